@@ -0,0 +1,106 @@
+#ifndef DAKE__BENCH__BENCH_HPP
+#define DAKE__BENCH__BENCH_HPP
+
+// Helpers shared by the benchmarks
+
+#include <epoxy/egl.h>
+#include <epoxy/gl.h>
+
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+
+// Makes a surfaceless OpenGL 3.3 core context current, or exits
+inline void create_context(void)
+{
+    EGLDisplay dpy = eglGetPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+    if (dpy == EGL_NO_DISPLAY) {
+        dpy = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+    }
+
+    EGLint config_attribs[] = { EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT, EGL_NONE };
+    EGLint context_attribs[] = {
+        EGL_CONTEXT_MAJOR_VERSION, 3,
+        EGL_CONTEXT_MINOR_VERSION, 3,
+        EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+        EGL_NONE
+    };
+
+    // Surfaceless displays may have no configs at all
+    EGLConfig config = EGL_NO_CONFIG_KHR;
+    EGLint configs;
+    EGLContext ctx = EGL_NO_CONTEXT;
+    if (eglInitialize(dpy, nullptr, nullptr) && eglBindAPI(EGL_OPENGL_API) &&
+        eglChooseConfig(dpy, config_attribs, &config, 1, &configs))
+    {
+        ctx = eglCreateContext(dpy, configs ? config : EGL_NO_CONFIG_KHR, EGL_NO_CONTEXT, context_attribs);
+    }
+
+    if ((ctx == EGL_NO_CONTEXT) || !eglMakeCurrent(dpy, EGL_NO_SURFACE, EGL_NO_SURFACE, ctx)) {
+        fprintf(stderr, "Could not create a surfaceless OpenGL 3.3 context\n");
+        exit(1);
+    }
+}
+
+
+// Lets the GL decode a w x h texture of compressed blocks and reads the
+// texels back as tightly packed RGBA of the given type
+inline void gl_decode(GLenum internal_format, const std::vector<uint8_t> &blocks, int w, int h,
+                      GLenum type, void *dst)
+{
+    GLuint tex;
+    glGenTextures(1, &tex);
+    glBindTexture(GL_TEXTURE_2D, tex);
+    glCompressedTexImage2D(GL_TEXTURE_2D, 0, internal_format, w, h, 0, blocks.size(), blocks.data());
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, type, dst);
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    glDeleteTextures(1, &tex);
+}
+
+
+// Compares the first channels of every RGBA texel of mine and ref, printing
+// the first difference of more than tolerance and the number of them;
+// returns that number
+template<typename T> int compare(const char *name, const std::vector<T> &mine, const std::vector<T> &ref,
+                                 int w, int channels = 4, int tolerance = 0)
+{
+    int mismatches = 0;
+    for (size_t i = 0; i < mine.size(); i++) {
+        int diff = static_cast<int>(mine[i]) - static_cast<int>(ref[i]);
+        if ((i % 4 < static_cast<size_t>(channels)) && (diff < -tolerance || diff > tolerance)) {
+            if (!mismatches) {
+                int texel = i / 4;
+                printf("%s: first mismatch at (%d, %d) channel %d: %u, GL %u\n", name,
+                       texel % w, texel / w, static_cast<int>(i % 4),
+                       static_cast<unsigned>(mine[i]), static_cast<unsigned>(ref[i]));
+            }
+            mismatches++;
+        }
+    }
+
+    printf("%s: %d of %zu values differ\n", name, mismatches, mine.size() / 4 * channels);
+    return mismatches;
+}
+
+
+// Shortest of the given number of runs of fn, in seconds
+template<typename F> double best_time(int runs, F fn)
+{
+    double best = HUGE_VAL;
+
+    for (int run = 0; run < runs; run++) {
+        auto start = std::chrono::steady_clock::now();
+        fn();
+        std::chrono::duration<double> t = std::chrono::steady_clock::now() - start;
+        best = t.count() < best ? t.count() : best;
+    }
+
+    return best;
+}
+
+#endif
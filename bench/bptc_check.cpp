@@ -0,0 +1,55 @@
+// Decodes random BC7 and BC6H blocks (so that all modes and partitions
+// occur, including the reserved ones) with dake::gl::bptc and with the GL,
+// and reports every texel on which they differ.  BC7 is compared as 8-bit
+// RGBA, BC6H as half floats.
+// Needs EGL with surfaceless contexts and a GL with BPTC support; for Mesa,
+// run with LIBGL_ALWAYS_SOFTWARE=1.
+//
+// Usage: bptc_check [seed]
+
+#include <dake/gl/bptc.hpp>
+#include <dake/gl/gl.hpp>
+#include <dake/gl/texture.hpp>
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include "bench.hpp"
+
+
+using namespace dake::gl;
+
+
+int main(int argc, char *argv[])
+{
+    srand(argc > 1 ? atoi(argv[1]) : 1);
+
+    create_context();
+    glext_init();
+
+    int w = 256, h = 256;
+    std::vector<uint8_t> blocks(w / 4 * h / 4 * 16);
+    for (uint8_t &b: blocks) {
+        b = rand();
+    }
+
+    std::vector<uint8_t> bc7(w * h * 4), bc7_ref(w * h * 4);
+    bptc::decompress(image::COMPRESSED_BPTC_RGBA, bc7.data(), blocks.data(), w, h, 4, w * 4);
+    gl_decode(GL_COMPRESSED_RGBA_BPTC_UNORM, blocks, w, h, GL_UNSIGNED_BYTE, bc7_ref.data());
+
+    std::vector<uint16_t> bc6h(w * h * 4), bc6h_ref(w * h * 4);
+    bptc::decompress_half(image::COMPRESSED_BPTC_RGB_UFLOAT, bc6h.data(), blocks.data(), w, h, 4, w * 8);
+    gl_decode(GL_COMPRESSED_RGB_BPTC_UNSIGNED_FLOAT, blocks, w, h, GL_HALF_FLOAT, bc6h_ref.data());
+
+    if (glGetError() != GL_NO_ERROR) {
+        fprintf(stderr, "The GL could not decode BPTC textures\n");
+        return 1;
+    }
+
+    int mismatches = compare("BC7", bc7, bc7_ref, w);
+    mismatches += compare("BC6H", bc6h, bc6h_ref, w);
+
+    return mismatches ? 1 : 0;
+}
@@ -0,0 +1,168 @@
+// Compares quality (PSNR) and throughput of the BC7 and BC6H compressor
+// presets, with DXT5 as a point of reference.
+//
+// BC6H is meant for HDR data and minimizes the error of half floats' bit
+// patterns, so its PSNR on 8-bit input is not directly comparable.
+//
+// Usage: bptc_compress [image file]
+// Without a file, a synthetic 2048x2048 RGBA image is used.
+
+#include <dake/gl/bptc.hpp>
+#include <dake/gl/s3tc.hpp>
+#include <dake/gl/texture.hpp>
+
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include "bench.hpp"
+
+
+using namespace dake::gl;
+
+
+struct source {
+    int w, h, cc;
+    size_t stride;
+    const uint8_t *data;
+};
+
+
+static std::vector<uint8_t> synthesize(int w, int h)
+{
+    std::vector<uint8_t> pixels(w * h * 4);
+
+    srand(42);
+    for (int y = 0; y < h; y++) {
+        for (int x = 0; x < w; x++) {
+            uint8_t *p = &pixels[(y * w + x) * 4];
+
+            // Smooth gradients, some hard edges and a bit of noise
+            float fx = static_cast<float>(x) / w, fy = static_cast<float>(y) / h;
+            bool edge = ((x / 37) ^ (y / 53)) & 1;
+
+            p[0] = static_cast<uint8_t>(fx * 255.f);
+            p[1] = static_cast<uint8_t>((0.5f + 0.5f * sinf(fx * 20.f + fy * 7.f)) * 255.f);
+            p[2] = edge ? 200 : static_cast<uint8_t>(fy * 128.f);
+            p[3] = static_cast<uint8_t>((0.5f + 0.5f * cosf(fy * 13.f)) * 255.f);
+
+            for (int c = 0; c < 3; c++) {
+                int v = p[c] + rand() % 9 - 4;
+                p[c] = v < 0 ? 0 : v > 255 ? 255 : v;
+            }
+        }
+    }
+
+    return pixels;
+}
+
+
+static double psnr(const source &src, const uint8_t *decoded, int channels)
+{
+    double sq_err = 0.;
+    long samples = 0;
+
+    for (int y = 0; y < src.h; y++) {
+        for (int x = 0; x < src.w; x++) {
+            const uint8_t *p = src.data + y * src.stride + x * src.cc;
+            const uint8_t *q = decoded + (static_cast<size_t>(y) * src.w + x) * 4;
+
+            for (int c = 0; c < channels; c++) {
+                int ref = c < src.cc ? p[c] : c == 3 ? 255 : 0;
+                double d = ref - q[c];
+                sq_err += d * d;
+                samples++;
+            }
+        }
+    }
+
+    if (!sq_err) {
+        return INFINITY;
+    }
+    return 10. * log10(255. * 255. / (sq_err / samples));
+}
+
+
+int main(int argc, char *argv[])
+{
+    static const struct {
+        const char *name;
+        image::channel_format fmt;
+        int channels;
+    } formats[] = {
+        { "BC7",  image::COMPRESSED_BPTC_RGBA,       4 },
+        { "BC6H", image::COMPRESSED_BPTC_RGB_UFLOAT, 3 },
+        { "DXT5", image::COMPRESSED_S3TC_DXT5,       4 },
+    };
+
+    static const struct {
+        const char *name;
+        image::compression_quality q;
+    } presets[] = {
+        { "fast",   image::COMPRESS_FAST   },
+        { "normal", image::COMPRESS_NORMAL },
+        { "best",   image::COMPRESS_BEST   },
+    };
+
+    image *img = nullptr;
+    std::vector<uint8_t> synthetic;
+    source src;
+
+    if (argc > 1) {
+        img = new image(argv[1]);
+        if (img->compressed()) {
+            fprintf(stderr, "%s is already compressed\n", argv[1]);
+            return 1;
+        }
+
+        src = { img->width(), img->height(), img->channels(),
+                static_cast<size_t>((img->width() * img->channels() + 3) & ~3),
+                static_cast<const uint8_t *>(img->data()) };
+    } else {
+        synthetic = synthesize(2048, 2048);
+        src = { 2048, 2048, 4, 2048 * 4, synthetic.data() };
+    }
+
+    double mpix = src.w * src.h / 1e6;
+    printf("%dx%d, %d channels\n\n", src.w, src.h, src.cc);
+    printf("%-6s %-8s %10s %10s %10s\n", "format", "encoder", "MPix/s", "PSNR/dB", "dec MPix/s");
+
+    std::vector<uint8_t> out(((src.w + 3) / 4) * ((src.h + 3) / 4) * 16);
+    std::vector<uint8_t> decoded(static_cast<size_t>(src.w) * src.h * 4);
+
+    for (const auto &f: formats) {
+        bool bptc = f.fmt != image::COMPRESSED_S3TC_DXT5;
+
+        for (const auto &p: presets) {
+            double t = best_time(3, [&]() {
+                    if (bptc) {
+                        bptc::compress(f.fmt, out.data(), src.data, src.w, src.h,
+                                       src.cc, src.stride, p.q);
+                    } else {
+                        s3tc::compress(f.fmt, out.data(), src.data, src.w, src.h,
+                                       src.cc, src.stride, p.q);
+                    }
+                });
+
+            double dt = best_time(3, [&]() {
+                    if (bptc) {
+                        bptc::decompress(f.fmt, decoded.data(), out.data(), src.w, src.h, 4, src.w * 4);
+                    } else {
+                        s3tc::decompress(f.fmt, decoded.data(), out.data(), src.w, src.h, 4, src.w * 4);
+                    }
+                });
+
+            printf("%-6s %-8s %10.1f %10.2f %10.1f\n", f.name, p.name, mpix / t,
+                   psnr(src, decoded.data(), f.channels), mpix / dt);
+        }
+
+        putchar('\n');
+    }
+
+    delete img;
+
+    return 0;
+}
@@ -0,0 +1,231 @@
+// GL calls made by the texture, buffer and framebuffer wrappers to create
+// and edit objects, once binding them to edit them and once through
+// ARB_direct_state_access.  No GL context is needed: the libepoxy entry
+// points are replaced by stubs that only count, so the times show nothing
+// but the wrappers' own overhead.
+//
+// Usage: dsa [iterations]
+
+#include <dake/gl/framebuffer.hpp>
+#include <dake/gl/gl.hpp>
+#include <dake/gl/texture.hpp>
+#include <dake/gl/vertex_array.hpp>
+#include <dake/gl/vertex_attrib.hpp>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+
+using namespace dake::gl;
+
+
+static long calls, binds;
+static bool offer_dsa;
+
+
+template<typename R, typename... A> static R APIENTRY counted(A...)
+{
+    calls++;
+    return R();
+}
+
+
+template<typename R, typename... A> static R APIENTRY counted_bind(A...)
+{
+    calls++;
+    binds++;
+    return R();
+}
+
+
+static void APIENTRY gen_names(GLsizei n, GLuint *names)
+{
+    static GLuint next;
+
+    calls++;
+    for (int i = 0; i < n; i++) {
+        names[i] = ++next;
+    }
+}
+
+
+static void APIENTRY create_names(GLenum, GLsizei n, GLuint *names)
+{
+    gen_names(n, names);
+}
+
+
+static void APIENTRY get_integerv(GLenum, GLint *value)
+{
+    *value = offer_dsa ? 1 : 0;
+}
+
+
+static const GLubyte *APIENTRY get_stringi(GLenum, GLuint)
+{
+    return reinterpret_cast<const GLubyte *>("GL_ARB_direct_state_access");
+}
+
+
+static GLenum APIENTRY framebuffer_status(GLenum)
+{
+    calls++;
+    return GL_FRAMEBUFFER_COMPLETE;
+}
+
+
+static GLenum APIENTRY named_framebuffer_status(GLuint, GLenum)
+{
+    calls++;
+    return GL_FRAMEBUFFER_COMPLETE;
+}
+
+
+static void stub_gl(void)
+{
+    glGetIntegerv = get_integerv;
+    glGetStringi = get_stringi;
+
+    glGenTextures = gen_names;
+    glGenBuffers = gen_names;
+    glGenFramebuffers = gen_names;
+    glGenVertexArrays = gen_names;
+    glCreateTextures = create_names;
+    glCreateBuffers = gen_names;
+    glCreateFramebuffers = gen_names;
+    glCheckFramebufferStatus = framebuffer_status;
+    glCheckNamedFramebufferStatus = named_framebuffer_status;
+
+    glActiveTexture = counted_bind;
+    glBindTexture = counted_bind;
+    glBindBuffer = counted_bind;
+    glBindFramebuffer = counted_bind;
+    glBindVertexArray = counted_bind;
+
+    glDeleteTextures = counted;
+    glDeleteBuffers = counted;
+    glDeleteFramebuffers = counted;
+    glDeleteVertexArrays = counted;
+    glTexParameteri = counted;
+    glTexParameterfv = counted;
+    glTextureParameteri = counted;
+    glTextureParameterfv = counted;
+    glTexImage2D = counted;
+    glTexImage2DMultisample = counted;
+    glBufferData = counted;
+    glNamedBufferData = counted;
+    glEnableVertexAttribArray = counted;
+    glVertexAttribPointer = counted;
+    glFramebufferTexture2D = counted;
+    glNamedFramebufferTexture = counted;
+    glDrawBuffers = counted;
+}
+
+
+struct result {
+    double calls, binds, ns;
+};
+
+
+template<typename F> static result run(int iterations, F fn)
+{
+    calls = binds = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++) {
+        fn(i);
+    }
+    std::chrono::duration<double, std::nano> t = std::chrono::steady_clock::now() - start;
+
+    return result{ static_cast<double>(calls) / iterations, static_cast<double>(binds) / iterations, t.count() / iterations };
+}
+
+
+// Each returns the per-operation numbers for the current glext state
+static std::vector<result> workloads(int iterations)
+{
+    std::vector<result> r;
+
+    // Create a texture and set it up
+    r.push_back(run(iterations, [](int) {
+            texture t;
+            t.filter(GL_LINEAR_MIPMAP_LINEAR, GL_LINEAR);
+            t.wrap(GL_REPEAT);
+            t.set_border_color(dake::math::vec4(0.f, 0.f, 0.f, 1.f));
+            t.format(GL_RGBA8, 256, 256, GL_RGBA, GL_UNSIGNED_BYTE);
+        }));
+
+    // Change the sampling state of many textures
+    std::vector<texture *> textures;
+    for (int i = 0; i < 64; i++) {
+        textures.push_back(new texture);
+    }
+    r.push_back(run(iterations, [&](int i) {
+            texture *t = textures[i % textures.size()];
+            t->filter(i & 1 ? GL_NEAREST : GL_LINEAR);
+            t->wrap(i & 2 ? GL_REPEAT : GL_CLAMP_TO_EDGE);
+        }));
+    for (texture *t: textures) {
+        delete t;
+    }
+
+    // Update the vertex data of two meshes in turn
+    static float vertices[3 * 64];
+    vertex_array va0, va1;
+    va0.set_elements(64);
+    va1.set_elements(64);
+    vertex_attrib *a0 = va0.attrib(0), *a1 = va1.attrib(0);
+    a0->format(3);
+    a1->format(3);
+    r.push_back(run(iterations, [&](int i) {
+            (i & 1 ? a1 : a0)->data(vertices, sizeof(vertices), GL_DYNAMIC_DRAW, false);
+        }));
+
+    // Create a framebuffer with two color attachments and depth
+    r.push_back(run(iterations / 16 + 1, [](int) {
+            framebuffer fb(2);
+            fb.resize(640, 480);
+        }));
+
+    return r;
+}
+
+
+int main(int argc, char *argv[])
+{
+    int iterations = argc > 1 ? atoi(argv[1]) : 100000;
+
+    static const char *names[] = {
+        "create texture",
+        "texture sampling",
+        "vertex data",
+        "create framebuffer",
+    };
+
+    stub_gl();
+
+    offer_dsa = false;
+    glext = glext_info();
+    glext_init();
+    std::vector<result> bound = workloads(iterations);
+
+    offer_dsa = true;
+    glext = glext_info();
+    glext_init();
+    if (!glext.has_direct_state_access()) {
+        abort();
+    }
+    std::vector<result> dsa = workloads(iterations);
+
+    printf("%-20s %22s %22s\n", "", "bind to edit", "DSA");
+    printf("%-20s %7s %7s %6s %7s %7s %6s\n", "per operation", "calls", "binds", "ns", "calls", "binds", "ns");
+    for (size_t i = 0; i < bound.size(); i++) {
+        printf("%-20s %7.1f %7.1f %6.0f %7.1f %7.1f %6.0f\n", names[i],
+               bound[i].calls, bound[i].binds, bound[i].ns,
+               dsa[i].calls, dsa[i].binds, dsa[i].ns);
+    }
+
+    return 0;
+}
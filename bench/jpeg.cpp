@@ -0,0 +1,49 @@
+// Time to load a JPEG file at full size and reduced to fit into a range of
+// limits, as done by image(file, max_width, max_height): decoding at 1/2,
+// 1/4 or 1/8 scale where that reaches the limit, then filtering the rest.
+//
+// Usage: jpeg <file.jpg>
+
+#include <dake/gl/texture.hpp>
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+
+#include "bench.hpp"
+
+
+using namespace dake::gl;
+
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <file.jpg>\n", argv[0]);
+        return 1;
+    }
+
+    static const int limits[] = { 0, 2048, 1024, 512, 256, 128 };
+
+    printf("%-8s %12s %10s %9s\n", "limit", "size", "ms", "speedup");
+
+    double full = 0.;
+    for (int limit: limits) {
+        int w = 0, h = 0;
+        double t = best_time(5, [&]() {
+                image img(argv[1], limit, limit);
+                w = img.width();
+                h = img.height();
+            });
+
+        if (!limit) {
+            full = t;
+        }
+
+        char size[32];
+        snprintf(size, sizeof(size), "%dx%d", w, h);
+        printf("%-8d %12s %10.2f %8.1fx\n", limit, size, t * 1e3, full / t);
+    }
+
+    return 0;
+}
@@ -0,0 +1,143 @@
+// Time to build a set of programs from source, once one after another
+// without the program binary cache, once submitted as a program_batch (which
+// only helps with KHR_parallel_shader_compile), once filling the cache and
+// once loading everything from it, as at the first and every later start of
+// an application.  The first three sets of programs differ, so that shader
+// caches inside of the driver do not help the later ones.
+// Needs EGL with surfaceless contexts; for Mesa llvmpipe, run with
+// LIBGL_ALWAYS_SOFTWARE=1 and MESA_SHADER_CACHE_DIR set to an empty directory
+// (Mesa offers no binary formats with its cache disabled).
+//
+// Usage: program_cache [programs [cache directory]]
+
+#include <dake/gl/gl.hpp>
+#include <dake/gl/shader.hpp>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "bench.hpp"
+
+
+using namespace dake::gl;
+
+
+// Distinct programs with some work for the compiler
+static std::string vertex_source(int i)
+{
+    return "#version 330 core\n"
+           "layout(location = 0) in vec4 in_pos;\n"
+           "uniform mat4 mvp;\n"
+           "out vec2 uv;\n"
+           "void main() {\n"
+           "    uv = in_pos.xy * " + std::to_string(i + 1) + ".0;\n"
+           "    gl_Position = mvp * in_pos;\n"
+           "}\n";
+}
+
+
+static std::string fragment_source(int i)
+{
+    return "#version 330 core\n"
+           "in vec2 uv;\n"
+           "uniform sampler2D tex;\n"
+           "uniform vec4 weights[16];\n"
+           "out vec4 out_col;\n"
+           "void main() {\n"
+           "    vec4 sum = vec4(0.0);\n"
+           "    for (int j = 0; j < 16; j++) {\n"
+           "        vec2 o = vec2(float(j % 4), float(j / 4)) * " + std::to_string(0.001 * (i + 1)) + ";\n"
+           "        vec4 c = texture(tex, uv + o);\n"
+           "        sum += c * weights[j] + pow(abs(c), vec4(2.2)) * sin(c.a * float(j));\n"
+           "    }\n"
+           "    out_col = sum / 16.0;\n"
+           "}\n";
+}
+
+
+static double build(int first, int count, std::vector<program *> &programs, bool batched = false)
+{
+    auto start = std::chrono::steady_clock::now();
+
+    program_batch batch;
+
+    for (int i = first; i < first + count; i++) {
+        shader vsh(shader::VERTEX), fsh(shader::FRAGMENT);
+        vsh.source(vertex_source(i).c_str());
+        fsh.source(fragment_source(i).c_str());
+
+        program *prg = new program;
+        *prg << vsh;
+        *prg << fsh;
+        prg->bind_attrib("in_pos", 0);
+        if (batched) {
+            batch << *prg;
+        } else {
+            prg->link();
+        }
+        programs.push_back(prg);
+    }
+    if (batched) {
+        batch.finish();
+    }
+    // Drivers may compile in the background
+    glFinish();
+
+    std::chrono::duration<double> t = std::chrono::steady_clock::now() - start;
+
+    for (program *prg: programs) {
+        delete prg;
+    }
+    programs.clear();
+
+    return t.count();
+}
+
+
+int main(int argc, char *argv[])
+{
+    int count = argc > 1 ? atoi(argv[1]) : 50;
+    std::string cache_dir = argc > 2 ? argv[2] : "program_cache.tmp";
+
+    create_context();
+    glext_init();
+
+    printf("%s, %s%s\n", glGetString(GL_RENDERER), glGetString(GL_VERSION),
+           glext.has_extension(PARALLEL_SHADER_COMPILE) ? ", parallel compile" : "");
+
+    GLint formats = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+    if (!formats) {
+        fprintf(stderr, "The driver supports no program binary formats\n");
+        return 1;
+    }
+
+    std::vector<program *> programs;
+
+    // Start with an empty cache
+    if (system(("rm -rf '" + cache_dir + "' && mkdir -p '" + cache_dir + "'").c_str())) {
+        fprintf(stderr, "Could not create %s\n", cache_dir.c_str());
+        return 1;
+    }
+
+    double uncached = build(count, count, programs);
+    double batched = build(2 * count, count, programs, true);
+
+    program::set_binary_cache(cache_dir);
+    double cold = build(0, count, programs);
+    double warm = build(0, count, programs);
+
+    const program::binary_cache_statistics &stats = program::binary_cache_stats();
+
+    printf("%d programs:\n", count);
+    printf("  no cache     %8.1f ms\n", uncached * 1e3);
+    printf("  batched      %8.1f ms\n", batched * 1e3);
+    printf("  cold cache   %8.1f ms\n", cold * 1e3);
+    printf("  warm cache   %8.1f ms  (%.1fx)\n", warm * 1e3, uncached / warm);
+    printf("hits %zu, misses %zu, rejected %zu\n", stats.hits, stats.misses, stats.rejected);
+
+    return 0;
+}
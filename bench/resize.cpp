@@ -0,0 +1,101 @@
+// Throughput of image rescaling with each filter, downscaling to a quarter
+// and a half of the size and upscaling by 1.5: 8-bit to 8-bit as done by
+// image(input, width, height, filter), and on float planes as done for every
+// mipmap level.  MPix/s refers to source pixels.
+//
+// Usage: resize [image file]
+// Without a file, a synthetic 4096x4096 RGBA image is used.
+
+#include <dake/gl/resample.hpp>
+#include <dake/gl/texture.hpp>
+
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include "bench.hpp"
+
+
+using namespace dake::gl;
+
+
+int main(int argc, char *argv[])
+{
+    static const struct {
+        const char *name;
+        image::resample_filter filter;
+    } filters[] = {
+        { "box",      image::RESAMPLE_BOX      },
+        { "bilinear", image::RESAMPLE_BILINEAR },
+        { "bicubic",  image::RESAMPLE_BICUBIC  },
+        { "lanczos",  image::RESAMPLE_LANCZOS  },
+        { "kaiser",   image::RESAMPLE_KAISER   },
+    };
+
+    static const struct {
+        const char *name;
+        float factor;
+    } scales[] = {
+        { "1/4", .25f },
+        { "1/2", .5f  },
+        { "3/2", 1.5f },
+    };
+
+    int w = 4096, h = 4096, cc = 4;
+    std::vector<uint8_t> pixels;
+    image *img = nullptr;
+    const void *data;
+    size_t stride;
+
+    if (argc > 1) {
+        img = new image(argv[1]);
+        if (img->compressed()) {
+            fprintf(stderr, "%s is compressed\n", argv[1]);
+            return 1;
+        }
+
+        w = img->width();
+        h = img->height();
+        cc = img->channels();
+        data = img->data();
+        stride = img->level_byte_size(0) / h;
+    } else {
+        pixels.resize(static_cast<size_t>(w) * h * cc);
+        srand(42);
+        for (size_t i = 0; i < pixels.size(); i++) {
+            pixels[i] = (i / 4 % w + i / 4 / w + rand() % 16) & 0xff;
+        }
+        data = pixels.data();
+        stride = w * cc;
+    }
+
+    double mpix = static_cast<double>(w) * h / 1e6;
+    printf("%dx%d, %d channels\n\n", w, h, cc);
+    printf("%-9s %-6s %16s %16s\n", "filter", "scale", "8-bit MPix/s", "float MPix/s");
+
+    resample::plane src(w, h);
+    resample::unpack(&src, data, cc, stride, false);
+
+    for (const auto &s: scales) {
+        int dw = static_cast<int>(w * s.factor), dh = static_cast<int>(h * s.factor);
+        size_t out_stride = (dw * cc + 3) & ~3;
+        std::vector<uint8_t> out(out_stride * dh);
+        resample::plane dst(dw, dh);
+
+        for (const auto &f: filters) {
+            double tb = best_time(3, [&]() {
+                    resample::scale(out.data(), dw, dh, out_stride, data, w, h, stride, cc, f.filter, false);
+                });
+            double tf = best_time(3, [&]() { resample::scale(&dst, src, f.filter); });
+
+            printf("%-9s %-6s %16.1f %16.1f\n", f.name, s.name, mpix / tb, mpix / tf);
+        }
+    }
+
+    delete img;
+
+    return 0;
+}
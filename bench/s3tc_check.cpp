@@ -0,0 +1,73 @@
+// Decodes random S3TC and RGTC blocks (so that all palette modes occur) with
+// dake::gl::s3tc and with the GL, and reports every texel on which they
+// differ by more than rounding.  The specifications leave the rounding of
+// interpolated values to the implementation (Mesa's llvmpipe, for one, is
+// off by up to 2), so this catches wrong palettes, not rounding; the latter
+// is left to s3tc_decompress, which compares against the scalar reference
+// decoder bit by bit.
+// Needs EGL with surfaceless contexts and a GL with S3TC and RGTC support;
+// for Mesa, run with LIBGL_ALWAYS_SOFTWARE=1.
+//
+// Usage: s3tc_check [seed]
+
+#include <dake/gl/gl.hpp>
+#include <dake/gl/s3tc.hpp>
+#include <dake/gl/texture.hpp>
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include "bench.hpp"
+
+
+using namespace dake::gl;
+
+
+int main(int argc, char *argv[])
+{
+    static const struct {
+        const char *name;
+        image::channel_format fmt;
+        GLenum gl_format;
+        // Channels the format stores
+        int channels;
+    } formats[] = {
+        { "DXT1",  image::COMPRESSED_S3TC_DXT1,       GL_COMPRESSED_RGB_S3TC_DXT1_EXT,  4 },
+        { "DXT1A", image::COMPRESSED_S3TC_DXT1_ALPHA, GL_COMPRESSED_RGBA_S3TC_DXT1_EXT, 4 },
+        { "DXT3",  image::COMPRESSED_S3TC_DXT3,       GL_COMPRESSED_RGBA_S3TC_DXT3_EXT, 4 },
+        { "DXT5",  image::COMPRESSED_S3TC_DXT5,       GL_COMPRESSED_RGBA_S3TC_DXT5_EXT, 4 },
+        { "RGTC1", image::COMPRESSED_RGTC_RED,        GL_COMPRESSED_RED_RGTC1,          1 },
+        { "RGTC2", image::COMPRESSED_RGTC_RG,         GL_COMPRESSED_RG_RGTC2,           2 },
+    };
+
+    srand(argc > 1 ? atoi(argv[1]) : 1);
+
+    create_context();
+    glext_init();
+
+    int w = 256, h = 256;
+    std::vector<uint8_t> random(w / 4 * h / 4 * 16);
+    for (uint8_t &b: random) {
+        b = rand();
+    }
+
+    int mismatches = 0;
+    for (const auto &f: formats) {
+        std::vector<uint8_t> blocks(random.begin(), random.begin() + w / 4 * h / 4 * s3tc::block_size(f.fmt));
+
+        std::vector<uint8_t> mine(w * h * 4), ref(w * h * 4);
+        s3tc::decompress(f.fmt, mine.data(), blocks.data(), w, h, 4, w * 4);
+        gl_decode(f.gl_format, blocks, w, h, GL_UNSIGNED_BYTE, ref.data());
+
+        if (glGetError() != GL_NO_ERROR) {
+            fprintf(stderr, "The GL could not decode %s textures\n", f.name);
+            return 1;
+        }
+
+        mismatches += compare(f.name, mine, ref, w, f.channels, 2);
+    }
+
+    return mismatches ? 1 : 0;
+}
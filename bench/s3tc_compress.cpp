@@ -0,0 +1,202 @@
+// Compares quality (PSNR) and throughput of the S3TC/RGTC compressor presets
+// and, unless built with -DWITHOUT_LIBTXC, of libtxc_dxtn.
+//
+// Usage: s3tc_compress [image file]
+// Without a file, a synthetic 2048x2048 RGBA image is used.
+
+#include <dake/gl/s3tc.hpp>
+#include <dake/gl/texture.hpp>
+
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include "bench.hpp"
+
+extern "C" {
+#ifndef WITHOUT_LIBTXC
+#include <txc_dxtn.h>
+#endif
+}
+
+
+using namespace dake::gl;
+
+
+struct source {
+    int w, h, cc;
+    size_t stride;
+    const uint8_t *data;
+};
+
+
+static std::vector<uint8_t> synthesize(int w, int h)
+{
+    std::vector<uint8_t> pixels(w * h * 4);
+
+    srand(42);
+    for (int y = 0; y < h; y++) {
+        for (int x = 0; x < w; x++) {
+            uint8_t *p = &pixels[(y * w + x) * 4];
+
+            // Smooth gradients, some hard edges and a bit of noise
+            float fx = static_cast<float>(x) / w, fy = static_cast<float>(y) / h;
+            bool edge = ((x / 37) ^ (y / 53)) & 1;
+
+            p[0] = static_cast<uint8_t>(fx * 255.f);
+            p[1] = static_cast<uint8_t>((0.5f + 0.5f * sinf(fx * 20.f + fy * 7.f)) * 255.f);
+            p[2] = edge ? 200 : static_cast<uint8_t>(fy * 128.f);
+            p[3] = static_cast<uint8_t>((0.5f + 0.5f * cosf(fy * 13.f)) * 255.f);
+
+            for (int c = 0; c < 3; c++) {
+                int v = p[c] + rand() % 9 - 4;
+                p[c] = v < 0 ? 0 : v > 255 ? 255 : v;
+            }
+        }
+    }
+
+    return pixels;
+}
+
+
+static double psnr(const source &src, image::channel_format fmt, const uint8_t *compressed, int first_channel, int channels)
+{
+    size_t bsz = s3tc::block_size(fmt);
+    int bw = (src.w + 3) / 4, bh = (src.h + 3) / 4;
+    double sq_err = 0.;
+    long samples = 0;
+
+    for (int by = 0; by < bh; by++) {
+        for (int bx = 0; bx < bw; bx++) {
+            uint8_t rgba[16][4];
+            s3tc::decode_block_reference(fmt, compressed + (by * bw + bx) * bsz, rgba);
+
+            for (int i = 0; i < 16; i++) {
+                int x = bx * 4 + (i & 3), y = by * 4 + (i >> 2);
+                if (x >= src.w || y >= src.h) {
+                    continue;
+                }
+
+                const uint8_t *p = src.data + y * src.stride + x * src.cc;
+                int ref_alpha = src.cc > 3 ? p[3] : 255;
+
+                // DXT1A can only represent 1-bit alpha, and the color of
+                // transparent pixels is irrelevant
+                bool punch_through = fmt == image::COMPRESSED_S3TC_DXT1_ALPHA;
+                if (punch_through) {
+                    ref_alpha = ref_alpha >= 128 ? 255 : 0;
+                }
+
+                for (int c = first_channel; c < first_channel + channels; c++) {
+                    if (punch_through && !ref_alpha && c < 3) {
+                        continue;
+                    }
+
+                    int ref = c == 3 ? ref_alpha : c < src.cc ? p[c] : 0;
+                    double d = ref - rgba[i][c];
+                    sq_err += d * d;
+                    samples++;
+                }
+            }
+        }
+    }
+
+    if (!sq_err) {
+        return INFINITY;
+    }
+    return 10. * log10(255. * 255. / (sq_err / samples));
+}
+
+
+int main(int argc, char *argv[])
+{
+    static const struct {
+        const char *name;
+        image::channel_format fmt;
+        int first_channel, channels;
+    } formats[] = {
+        { "DXT1",  image::COMPRESSED_S3TC_DXT1,       0, 3 },
+        { "DXT1A", image::COMPRESSED_S3TC_DXT1_ALPHA, 0, 4 },
+        { "DXT3",  image::COMPRESSED_S3TC_DXT3,       0, 4 },
+        { "DXT5",  image::COMPRESSED_S3TC_DXT5,       0, 4 },
+        { "RGTC1", image::COMPRESSED_RGTC_RED,        0, 1 },
+        { "RGTC2", image::COMPRESSED_RGTC_RG,         0, 2 },
+    };
+
+    static const struct {
+        const char *name;
+        image::compression_quality q;
+    } presets[] = {
+        { "fast",   image::COMPRESS_FAST   },
+        { "normal", image::COMPRESS_NORMAL },
+        { "best",   image::COMPRESS_BEST   },
+    };
+
+    image *img = nullptr;
+    std::vector<uint8_t> synthetic;
+    source src;
+
+    if (argc > 1) {
+        img = new image(argv[1]);
+        if (img->compressed()) {
+            fprintf(stderr, "%s is already compressed\n", argv[1]);
+            return 1;
+        }
+
+        src = { img->width(), img->height(), img->channels(),
+                static_cast<size_t>((img->width() * img->channels() + 3) & ~3),
+                static_cast<const uint8_t *>(img->data()) };
+    } else {
+        synthetic = synthesize(2048, 2048);
+        src = { 2048, 2048, 4, 2048 * 4, synthetic.data() };
+    }
+
+    double mpix = src.w * src.h / 1e6;
+    printf("%dx%d, %d channels\n\n", src.w, src.h, src.cc);
+    printf("%-6s %-8s %10s %10s\n", "format", "encoder", "MPix/s", "PSNR/dB");
+
+    for (const auto &f: formats) {
+        size_t bsz = s3tc::block_size(f.fmt);
+        std::vector<uint8_t> out(((src.w + 3) / 4) * ((src.h + 3) / 4) * bsz);
+
+        for (const auto &p: presets) {
+            double t = best_time(3, [&]() {
+                    s3tc::compress(f.fmt, out.data(), src.data, src.w, src.h,
+                                   src.cc, src.stride, p.q);
+                });
+
+            printf("%-6s %-8s %10.1f %10.2f\n", f.name, p.name, mpix / t,
+                   psnr(src, f.fmt, out.data(), f.first_channel, f.channels));
+        }
+
+#ifndef WITHOUT_LIBTXC
+        // libtxc_dxtn only knows about DXTn and 3 or 4 channel input
+        if (f.fmt <= image::COMPRESSED_S3TC_DXT5 && src.cc >= 3) {
+            static const GLenum txc_formats[] = {
+                GL_COMPRESSED_RGB_S3TC_DXT1_EXT,
+                GL_COMPRESSED_RGBA_S3TC_DXT1_EXT,
+                GL_COMPRESSED_RGBA_S3TC_DXT3_EXT,
+                GL_COMPRESSED_RGBA_S3TC_DXT5_EXT,
+            };
+
+            double t = best_time(3, [&]() {
+                    tx_compress_dxtn(src.cc, src.w, src.h, src.data,
+                                     txc_formats[f.fmt - image::COMPRESSED_S3TC_DXT1],
+                                     out.data(), ((src.w + 3) / 4) * bsz);
+                });
+
+            printf("%-6s %-8s %10.1f %10.2f\n", f.name, "libtxc", mpix / t,
+                   psnr(src, f.fmt, out.data(), f.first_channel, f.channels));
+        }
+#endif
+
+        putchar('\n');
+    }
+
+    delete img;
+
+    return 0;
+}
@@ -0,0 +1,104 @@
+// Checks that the S3TC/RGTC decompressor is bit-exact against the reference
+// block decoder (which shares no palette code with it) and measures its
+// throughput.  s3tc_check compares the decompressor with the GL.
+//
+// Random block data is used so that all palette modes get exercised.
+
+#include <dake/gl/s3tc.hpp>
+#include <dake/gl/texture.hpp>
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include "bench.hpp"
+
+
+using namespace dake::gl;
+
+
+static long verify(image::channel_format fmt, const std::vector<uint8_t> &blocks, int w, int h, int cc)
+{
+    size_t bsz = s3tc::block_size(fmt);
+    size_t stride = (w * cc + 3) & ~3;
+    int bw = (w + 3) / 4;
+
+    std::vector<uint8_t> out(h * stride);
+    s3tc::decompress(fmt, out.data(), blocks.data(), w, h, cc, stride);
+
+    long mismatches = 0;
+    for (int by = 0; by < (h + 3) / 4; by++) {
+        for (int bx = 0; bx < bw; bx++) {
+            uint8_t rgba[16][4];
+            s3tc::decode_block_reference(fmt, &blocks[(by * bw + bx) * bsz], rgba);
+
+            for (int i = 0; i < 16; i++) {
+                int x = bx * 4 + (i & 3), y = by * 4 + (i >> 2);
+                if (x >= w || y >= h) {
+                    continue;
+                }
+
+                for (int c = 0; c < cc; c++) {
+                    mismatches += out[y * stride + x * cc + c] != rgba[i][c];
+                }
+            }
+        }
+    }
+
+    return mismatches;
+}
+
+
+int main(void)
+{
+    static const struct {
+        const char *name;
+        image::channel_format fmt;
+    } formats[] = {
+        { "DXT1",  image::COMPRESSED_S3TC_DXT1       },
+        { "DXT1A", image::COMPRESSED_S3TC_DXT1_ALPHA },
+        { "DXT3",  image::COMPRESSED_S3TC_DXT3       },
+        { "DXT5",  image::COMPRESSED_S3TC_DXT5       },
+        { "RGTC1", image::COMPRESSED_RGTC_RED        },
+        { "RGTC2", image::COMPRESSED_RGTC_RG         },
+    };
+
+    // Odd size for checking the edges, large one for timing
+    const int vw = 1021, vh = 767;
+    const int tw = 4096, th = 4096;
+
+    bool failed = false;
+
+    srand(42);
+    std::vector<uint8_t> blocks(((tw + 3) / 4) * ((th + 3) / 4) * 16);
+    for (uint8_t &b: blocks) {
+        b = rand();
+    }
+
+    printf("%-6s %-8s %10s %10s\n", "format", "channels", "MPix/s", "mismatch");
+
+    for (const auto &f: formats) {
+        size_t bsz = s3tc::block_size(f.fmt);
+        std::vector<uint8_t> vblocks(blocks.begin(), blocks.begin() + ((vw + 3) / 4) * ((vh + 3) / 4) * bsz);
+
+        for (int cc = 1; cc <= 4; cc++) {
+            long mismatches = verify(f.fmt, vblocks, vw, vh, cc);
+            failed |= mismatches != 0;
+
+            std::vector<uint8_t> out(th * ((tw * cc + 3) & ~3));
+            double best = best_time(3, [&]() {
+                    s3tc::decompress(f.fmt, out.data(), blocks.data(), tw, th, cc, (tw * cc + 3) & ~3);
+                });
+
+            printf("%-6s %-8d %10.1f %10ld\n", f.name, cc, tw * th / 1e6 / best, mismatches);
+        }
+    }
+
+    if (failed) {
+        fprintf(stderr, "Decompressor output differs from the reference decoder\n");
+        return 1;
+    }
+
+    return 0;
+}
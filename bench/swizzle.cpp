@@ -0,0 +1,137 @@
+// Throughput of the channel repacking kernels image uses for swap_channels(),
+// changing the channel count and merging images, next to a plain byte loop.
+// GB/s counts the bytes read plus the bytes written.
+//
+// Usage: swizzle [width height]
+// Defaults to 4096x4096.
+
+#include <dake/gl/swizzle.hpp>
+
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include "bench.hpp"
+
+
+using namespace dake::gl;
+
+
+static size_t stride_of(int w, int channels)
+{
+    return (static_cast<size_t>(w) * channels + 3) & ~static_cast<size_t>(3);
+}
+
+
+// What image did before, minus the pointer arithmetic
+static void reference_remap(uint8_t *dst, int dc, size_t ds, const uint8_t *src, int sc, size_t ss,
+                            const int *map, int w, int h)
+{
+    for (int y = 0; y < h; y++) {
+        for (int x = 0; x < w; x++) {
+            uint8_t px[4];
+            for (int c = 0; c < dc; c++) {
+                px[c] = map[c] < 0 ? 0 : src[y * ss + x * sc + map[c]];
+            }
+            for (int c = 0; c < dc; c++) {
+                dst[y * ds + x * dc + c] = px[c];
+            }
+        }
+    }
+}
+
+
+static void reference_merge(uint8_t *dst, size_t ds, const uint8_t *s1, int c1, size_t ss1,
+                            const uint8_t *s2, int c2, size_t ss2, int w, int h)
+{
+    for (int y = 0; y < h; y++) {
+        uint8_t *out = dst + y * ds;
+        for (int x = 0; x < w; x++) {
+            for (int c = 0; c < c1; c++) {
+                *(out++) = s1[y * ss1 + x * c1 + c];
+            }
+            for (int c = 0; c < c2; c++) {
+                *(out++) = s2[y * ss2 + x * c2 + c];
+            }
+        }
+    }
+}
+
+
+int main(int argc, char *argv[])
+{
+    int w = 4096, h = 4096;
+    if (argc > 2) {
+        w = atoi(argv[1]);
+        h = atoi(argv[2]);
+    }
+
+    static const struct {
+        const char *name;
+        int src_channels, dst_channels;
+        int map[4];
+        bool in_place;
+    } remaps[] = {
+        { "RGBA -> BGRA (in place)", 4, 4, { 2, 1, 0, 3 }, true },
+        { "RGB -> BGR (in place)",   3, 3, { 2, 1, 0 },    true },
+        { "RG -> GR (in place)",     2, 2, { 1, 0 },       true },
+        { "RGB -> RGBA",             3, 4, { 0, 1, 2, -1 }, false },
+        { "R -> RGBA",               1, 4, { 0, -1, -1, -1 }, false },
+        { "RGBA -> RGB",             4, 3, { 0, 1, 2 },    false },
+        { "RGBA -> R",               4, 1, { 0 },          false },
+    };
+
+    static const struct {
+        const char *name;
+        int channels1, channels2;
+    } merges[] = {
+        { "RGB + A",  3, 1 },
+        { "RG + BA",  2, 2 },
+        { "R + G",    1, 1 },
+    };
+
+    std::vector<uint8_t> src(stride_of(w, 4) * h), src2(stride_of(w, 4) * h), dst(stride_of(w, 4) * h);
+    srand(42);
+    for (size_t i = 0; i < src.size(); i++) {
+        src[i] = rand();
+        src2[i] = rand();
+    }
+
+    printf("%dx%d\n\n", w, h);
+    printf("%-26s %12s %12s\n", "", "loop GB/s", "SIMD GB/s");
+
+    for (const auto &r: remaps) {
+        size_t ss = stride_of(w, r.src_channels), ds = stride_of(w, r.dst_channels);
+        double gb = (ss + ds) * h / 1e9;
+        uint8_t *out = r.in_place ? src.data() : dst.data();
+
+        double tr = best_time(5, [&]() {
+                reference_remap(out, r.dst_channels, ds, src.data(), r.src_channels, ss, r.map, w, h);
+            });
+        double ts = best_time(5, [&]() {
+                swizzle::remap(out, r.dst_channels, ds, src.data(), r.src_channels, ss, r.map, w, h);
+            });
+
+        printf("%-26s %12.2f %12.2f\n", r.name, gb / tr, gb / ts);
+    }
+
+    for (const auto &m: merges) {
+        size_t s1 = stride_of(w, m.channels1), s2 = stride_of(w, m.channels2);
+        size_t ds = stride_of(w, m.channels1 + m.channels2);
+        double gb = (s1 + s2 + ds) * h / 1e9;
+
+        double tr = best_time(5, [&]() {
+                reference_merge(dst.data(), ds, src.data(), m.channels1, s1, src2.data(), m.channels2, s2, w, h);
+            });
+        double ts = best_time(5, [&]() {
+                swizzle::merge(dst.data(), ds, src.data(), m.channels1, s1, src2.data(), m.channels2, s2, w, h);
+            });
+
+        printf("%-26s %12.2f %12.2f\n", m.name, gb / tr, gb / ts);
+    }
+
+    return 0;
+}
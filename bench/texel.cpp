@@ -0,0 +1,117 @@
+// Throughput of converting between the uncompressed channel formats as done
+// by image(input, format), next to a plain per-value loop.  GB/s counts the
+// bytes read plus the bytes written.
+//
+// Usage: texel [width height]
+// Defaults to 4096x4096 RGBA.
+
+#include <dake/gl/texel.hpp>
+#include <dake/gl/texture.hpp>
+
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include "bench.hpp"
+
+
+using namespace dake::gl;
+
+
+static float reference_load(const uint8_t *p, image::channel_format fmt)
+{
+    switch (fmt) {
+        case image::LINEAR_UINT8:  return *p / 255.f;
+        case image::LINEAR_UINT16: return *reinterpret_cast<const uint16_t *>(p) / 65535.f;
+        case image::LINEAR_HALF:   return texel::half_to_float(*reinterpret_cast<const uint16_t *>(p));
+        default:                   return *reinterpret_cast<const float *>(p);
+    }
+}
+
+
+static void reference_store(uint8_t *p, image::channel_format fmt, float v)
+{
+    switch (fmt) {
+        case image::LINEAR_UINT8:
+            *p = static_cast<uint8_t>(fminf(fmaxf(v, 0.f), 1.f) * 255.f + .5f);
+            break;
+        case image::LINEAR_UINT16:
+            *reinterpret_cast<uint16_t *>(p) = static_cast<uint16_t>(fminf(fmaxf(v, 0.f), 1.f) * 65535.f + .5f);
+            break;
+        case image::LINEAR_HALF:
+            *reinterpret_cast<uint16_t *>(p) = texel::float_to_half(v);
+            break;
+        default:
+            *reinterpret_cast<float *>(p) = v;
+    }
+}
+
+
+// What a straightforward implementation would do
+static void reference_convert(uint8_t *dst, image::channel_format df, const uint8_t *src, image::channel_format sf, size_t count)
+{
+    size_t ds = texel::value_size(df), ss = texel::value_size(sf);
+
+    for (size_t i = 0; i < count; i++) {
+        reference_store(dst + i * ds, df, reference_load(src + i * ss, sf));
+    }
+}
+
+
+int main(int argc, char *argv[])
+{
+    int w = 4096, h = 4096;
+    if (argc > 2) {
+        w = atoi(argv[1]);
+        h = atoi(argv[2]);
+    }
+
+    static const struct {
+        const char *name;
+        image::channel_format src, dst;
+    } conversions[] = {
+        { "uint8 -> float",  image::LINEAR_UINT8,  image::LINEAR_FLOAT  },
+        { "float -> uint8",  image::LINEAR_FLOAT,  image::LINEAR_UINT8  },
+        { "uint16 -> float", image::LINEAR_UINT16, image::LINEAR_FLOAT  },
+        { "float -> uint16", image::LINEAR_FLOAT,  image::LINEAR_UINT16 },
+        { "half -> float",   image::LINEAR_HALF,   image::LINEAR_FLOAT  },
+        { "float -> half",   image::LINEAR_FLOAT,  image::LINEAR_HALF   },
+        { "uint8 -> half",   image::LINEAR_UINT8,  image::LINEAR_HALF   },
+        { "uint16 -> uint8", image::LINEAR_UINT16, image::LINEAR_UINT8  },
+    };
+
+    size_t count = static_cast<size_t>(w) * h * 4;
+
+    // Values in [0, 1] in every format
+    std::vector<float> values(count);
+    srand(42);
+    for (size_t i = 0; i < count; i++) {
+        values[i] = rand() / static_cast<float>(RAND_MAX);
+    }
+
+    std::vector<uint8_t> src(count * 4), dst(count * 4);
+
+    printf("%dx%d RGBA\n\n", w, h);
+    printf("%-18s %12s %12s\n", "", "loop GB/s", "SIMD GB/s");
+
+    for (const auto &c: conversions) {
+        size_t ss = texel::value_size(c.src), ds = texel::value_size(c.dst);
+        double gb = count * (ss + ds) / 1e9;
+
+        texel::convert(src.data(), c.src, count * ss, values.data(), image::LINEAR_FLOAT, count * 4, count, 1);
+
+        double tr = best_time(5, [&]() {
+                reference_convert(dst.data(), c.dst, src.data(), c.src, count);
+            });
+        double ts = best_time(5, [&]() {
+                texel::convert(dst.data(), c.dst, w * 4 * ds, src.data(), c.src, w * 4 * ss, w * 4, h);
+            });
+
+        printf("%-18s %12.2f %12.2f\n", c.name, gb / tr, gb / ts);
+    }
+
+    return 0;
+}
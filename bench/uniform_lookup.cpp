@@ -0,0 +1,94 @@
+// Time to look up uniforms of a linked program, by std::string (hashing the
+// name and searching the location map every time) and by "name"_uniform
+// handles (hashed at compile time, probing the table built at link time).
+// Needs EGL with surfaceless contexts; for Mesa, run with
+// LIBGL_ALWAYS_SOFTWARE=1.
+//
+// Usage: uniform_lookup [lookups]
+
+#include <dake/gl/gl.hpp>
+#include <dake/gl/shader.hpp>
+#include <dake/math/matrix.hpp>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+#include "bench.hpp"
+
+
+using namespace dake::gl;
+using namespace dake::math;
+
+
+// Keeps the lookups from being optimized away
+static uniform<vec4> sink[8];
+
+
+int main(int argc, char *argv[])
+{
+    int lookups = argc > 1 ? atoi(argv[1]) : 10000000;
+
+    create_context();
+    glext_init();
+
+    shader vsh(shader::VERTEX), fsh(shader::FRAGMENT);
+    vsh.source("#version 330 core\n"
+               "layout(location = 0) in vec4 in_pos;\n"
+               "uniform mat4 mvp, model_view, projection, normal_matrix;\n"
+               "out vec4 pos;\n"
+               "void main() {\n"
+               "    pos = model_view * normal_matrix * in_pos;\n"
+               "    gl_Position = mvp * projection * in_pos;\n"
+               "}\n");
+    fsh.source("#version 330 core\n"
+               "in vec4 pos;\n"
+               "uniform vec4 light_pos, light_color, ambient, diffuse, specular, fog_color;\n"
+               "uniform float shininess, fog_density;\n"
+               "uniform vec4 weights[8];\n"
+               "out vec4 out_col;\n"
+               "void main() {\n"
+               "    vec4 c = ambient + diffuse * dot(pos, light_pos) * light_color + specular * shininess;\n"
+               "    for (int i = 0; i < 8; i++) c += weights[i];\n"
+               "    out_col = mix(c, fog_color, fog_density);\n"
+               "}\n");
+
+    program prg;
+    prg << vsh;
+    prg << fsh;
+    prg.link();
+
+    // Names as a render loop would pass them
+    static const char *const names[8] = {
+        "mvp", "light_pos", "light_color", "diffuse", "specular", "fog_color", "ambient", "weights"
+    };
+
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < lookups; i += 8) {
+        for (int j = 0; j < 8; j++) {
+            sink[j] = prg.uniform<vec4>(names[j]);
+        }
+    }
+    std::chrono::duration<double> by_string = std::chrono::steady_clock::now() - start;
+
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < lookups; i += 8) {
+        sink[0] = prg.uniform<vec4>("mvp"_uniform);
+        sink[1] = prg.uniform<vec4>("light_pos"_uniform);
+        sink[2] = prg.uniform<vec4>("light_color"_uniform);
+        sink[3] = prg.uniform<vec4>("diffuse"_uniform);
+        sink[4] = prg.uniform<vec4>("specular"_uniform);
+        sink[5] = prg.uniform<vec4>("fog_color"_uniform);
+        sink[6] = prg.uniform<vec4>("ambient"_uniform);
+        sink[7] = prg.uniform<vec4>("weights"_uniform);
+    }
+    std::chrono::duration<double> by_handle = std::chrono::steady_clock::now() - start;
+
+    printf("%d lookups:\n", lookups);
+    printf("  std::string  %8.1f ms  %6.1f ns each\n", by_string.count() * 1e3, by_string.count() * 1e9 / lookups);
+    printf("  _uniform     %8.1f ms  %6.1f ns each  (%.1fx)\n", by_handle.count() * 1e3, by_handle.count() * 1e9 / lookups,
+           by_string.count() / by_handle.count());
+
+    return 0;
+}
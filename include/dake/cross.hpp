@@ -36,6 +36,13 @@ static inline void aligned_free(void *ptr)
 { return ::free(ptr); }
 #endif
 
+// Maps a whole file into memory (copy-on-write, so writing to the mapping is
+// allowed but never reaches the file).  Where mmap() is not available, the
+// file is read into a buffer instead.  Returns nullptr and sets errno on
+// failure.
+void *map_file(const char *path, size_t *length);
+void unmap_file(void *base, size_t length);
+
 }
 }
 
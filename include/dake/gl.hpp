@@ -1,13 +1,24 @@
 #ifndef DAKE__GL_HPP
 #define DAKE__GL_HPP
 
+#include "dake/gl/atlas.hpp"
+#include "dake/gl/bptc.hpp"
+#include "dake/gl/draw_batch.hpp"
 #include "dake/gl/elements_array.hpp"
 #include "dake/gl/find_resource.hpp"
 #include "dake/gl/framebuffer.hpp"
 #include "dake/gl/gl.hpp"
 #include "dake/gl/obj.hpp"
+#include "dake/gl/pixel_buffer.hpp"
+#include "dake/gl/resample.hpp"
+#include "dake/gl/residency.hpp"
+#include "dake/gl/s3tc.hpp"
 #include "dake/gl/shader.hpp"
+#include "dake/gl/swizzle.hpp"
+#include "dake/gl/texel.hpp"
 #include "dake/gl/texture.hpp"
+#include "dake/gl/uniform_buffer.hpp"
+#include "dake/gl/upload_pool.hpp"
 #include "dake/gl/vertex_array.hpp"
 #include "dake/gl/vertex_attrib.hpp"
 
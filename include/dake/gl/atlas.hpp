@@ -0,0 +1,80 @@
+#ifndef DAKE__GL__ATLAS_HPP
+#define DAKE__GL__ATLAS_HPP
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "dake/gl/obj.hpp"
+#include "dake/gl/texture.hpp"
+#include "dake/math/matrix.hpp"
+
+
+namespace dake
+{
+
+namespace gl
+{
+
+// Packs many small images into few RGBA8 pages of a fixed size (skyline,
+// bottom-left), which can become separate textures or the layers of an
+// array texture.  Every image gets a border of padding texels repeating its
+// edge, and the padded images cover whole 4x4 blocks, so that neither block
+// compression nor filtering on the first mipmap levels mixes neighbors.
+//
+// Texture coordinates are only remapped correctly inside of [0, 1]; images
+// that are supposed to repeat cannot be put into an atlas.
+class atlas {
+    public:
+        struct placement {
+            int page;
+            // Position of the image (without padding) in its page
+            int x, y, width, height;
+            // page coordinate = offset + image coordinate * scale
+            math::vec2 offset, scale;
+        };
+
+    private:
+        int pw, ph, pad;
+
+        std::vector<image *> images;
+        std::vector<placement> places;
+        std::vector<image *> pgs;
+        std::unordered_map<std::string, int> files;
+
+    public:
+        atlas(int page_width, int page_height, int padding = 4);
+        atlas(const atlas &) = delete;
+        ~atlas(void);
+
+        atlas &operator=(const atlas &) = delete;
+
+        // Returns the index of the image; only level 0 is used
+        int add(const image &img);
+        // Adds each file only once
+        int add(const std::string &file);
+        // Adds the diffuse textures of all sections of o
+        void add(const obj &o);
+
+        // Places all images added so far, replacing the previous pages
+        void pack(void);
+
+        const placement &operator[](int index) const { return places[index]; }
+        int pages(void) const { return pgs.size(); }
+        const image &page(int index) const { return *pgs[index]; }
+
+        // Sets up tex with one layer per page and loads them
+        void upload(array_texture &tex) const;
+
+        // Maps the texture coordinates of s from image index into its page
+        void remap(obj_section &s, int index) const;
+        // Remaps all sections of o whose textures were added with add(o);
+        // returns the page of each section (-1 for those without texture)
+        std::vector<int> remap(obj &o) const;
+};
+
+}
+
+}
+
+#endif
@@ -0,0 +1,55 @@
+#ifndef DAKE__GL__BPTC_HPP
+#define DAKE__GL__BPTC_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+#include "dake/gl/texture.hpp"
+
+
+namespace dake
+{
+
+namespace gl
+{
+
+namespace bptc
+{
+
+// Compresses a width x height image with 8-bit channels (rows are stride
+// bytes apart) into BC7 (COMPRESSED_BPTC_RGBA) or BC6H
+// (COMPRESSED_BPTC_RGB_UFLOAT).  Missing color channels are read as 0,
+// missing alpha as 255.  The rows of blocks are distributed over all hardware
+// threads.
+//
+// BC7 uses mode 6 only with COMPRESS_FAST, adds mode 5 for blocks with
+// varying alpha with COMPRESS_NORMAL and the two-subset mode 1 for opaque
+// blocks with COMPRESS_BEST.  BC6H uses the single-region modes, i.e. only
+// mode 11 with COMPRESS_FAST and modes 11 to 14 otherwise.
+void compress(image::channel_format fmt, void *dst, const void *src,
+              int width, int height, int channels, size_t stride,
+              image::compression_quality quality);
+
+// Decompresses BC7 or BC6H into an image with 8-bit channels (1 to 4 of RGBA,
+// rows are stride bytes apart).  BC6H values are clamped to [0, 1].  All
+// modes of both formats are supported.
+void decompress(image::channel_format fmt, void *dst, const void *src,
+                int width, int height, int channels, size_t stride);
+
+// Same for BC6H with 16-bit half float channels (LINEAR_HALF; stride still in
+// bytes), keeping the whole range instead of going through 8 bits.  Negative
+// input values are compressed as 0.
+void compress_half(image::channel_format fmt, void *dst, const void *src,
+                   int width, int height, int channels, size_t stride,
+                   image::compression_quality quality);
+
+void decompress_half(image::channel_format fmt, void *dst, const void *src,
+                     int width, int height, int channels, size_t stride);
+
+}
+
+}
+
+}
+
+#endif
@@ -0,0 +1,97 @@
+#ifndef DAKE__GL__DRAW_BATCH_HPP
+#define DAKE__GL__DRAW_BATCH_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "dake/gl/gl.hpp"
+#include "dake/gl/obj.hpp"
+#include "dake/gl/vertex_array.hpp"
+#include "dake/math/matrix.hpp"
+
+
+namespace dake
+{
+
+namespace gl
+{
+
+// Many meshes in one vertex array (one buffer per attribute, plus one index
+// buffer shared by all), drawn with a single glMulti*DrawIndirect() call from
+// a buffer of draw commands.  Draw i has base instance i, so shaders can
+// find per-draw data through gl_DrawID (ARB_shader_draw_parameters) or
+// through an attribute with divisor 1 indexed by the base instance, e.g. the
+// draw index attribute given to the constructor.
+//
+// Without ARB_multi_draw_indirect, the commands are drawn one by one (which
+// needs ARB_base_instance).
+class draw_batch {
+    public:
+        // Layouts defined by the GL for indirect draw buffers
+        struct arrays_command {
+            GLuint count, instance_count, first, base_instance;
+        };
+
+        struct elements_command {
+            GLuint count, instance_count, first_index;
+            GLint base_vertex;
+            GLuint base_instance;
+        };
+
+
+    private:
+        struct mesh {
+            size_t first_vertex, vertices;
+            // index_count is 0 for meshes without indices
+            size_t first_index, index_count;
+        };
+
+        int pos_attr, txc_attr, nrm_attr, draw_attr;
+
+        std::vector<math::vec3> positions, normals;
+        std::vector<math::vec2> tex_coords;
+        std::vector<uint32_t> indices;
+        std::vector<mesh> meshes;
+
+        vertex_array *va = nullptr;
+        GLuint indirect_buffer;
+        // Only meshes with indices: all are drawn as elements then
+        bool indexed = false;
+        bool dirty = true;
+
+        std::vector<arrays_command> arrays_commands;
+        std::vector<elements_command> elements_commands;
+
+        void upload(void);
+
+
+    public:
+        // Attribute locations; txc_idx and nrm_idx may be -1.  If
+        // draw_idx is not -1, that attribute receives the draw index (as an
+        // unsigned integer).
+        draw_batch(int pos_idx, int txc_idx = -1, int nrm_idx = -1, int draw_idx = -1);
+        draw_batch(const draw_batch &) = delete;
+        ~draw_batch(void);
+
+        draw_batch &operator=(const draw_batch &) = delete;
+
+        // Both return the index of the new draw.  Texture coordinates and
+        // normals are needed if the batch has the respective attributes.  Meshes
+        // without indices are drawn as if they had 0 .. vertices - 1.
+        size_t add(const obj_section &section);
+        size_t add(const math::vec3 *pos, const math::vec2 *txc, const math::vec3 *nrm, size_t vertices,
+                   const uint32_t *idx = nullptr, size_t index_count = 0);
+
+        // Draws count meshes starting from first (all if count is 0)
+        void draw(GLenum type = GL_TRIANGLES, size_t first = 0, size_t count = 0);
+
+        size_t size(void) const { return meshes.size(); }
+        vertex_array *get_vertex_array(void);
+};
+
+}
+
+}
+
+#endif
@@ -1,7 +1,11 @@
 #ifndef DAKE__GL__FRAMEBUFFER_H
 #define DAKE__GL__FRAMEBUFFER_H
 
+#include <future>
+#include <vector>
+
 #include "dake/gl/gl.hpp"
+#include "dake/gl/pixel_buffer.hpp"
 #include "dake/gl/texture.hpp"
 
 
@@ -35,6 +39,14 @@ class framebuffer {
 
 
     private:
+        // A readback in flight
+        struct readback {
+            pixel_buffer *buffer = nullptr;
+            GLsync fence = nullptr;
+            image *img = nullptr;
+            std::promise<image> result;
+        };
+
         int ca_count;
         GLuint id;
         texture *textures;
@@ -46,6 +58,12 @@ class framebuffer {
         bool depth_buffer_in_stencil_mode = false;
         int spp = 1;
 
+        // Ring of readbacks, next_readback is the oldest
+        std::vector<readback> readbacks;
+        int next_readback = 0;
+
+        bool complete_read(readback &rb, bool wait);
+
 
     public:
         framebuffer(int color_attachments, GLenum format = GL_RGBA, depth_stencil_mode depth_stencil = DEPTH_ONLY, int multisample = 0);
@@ -62,6 +80,24 @@ class framebuffer {
         void bind(void);
         void blit(int sx = 0, int sy = 0, int sw = -1, int sh = -1, int dx = 0, int dy = 0, int dw = -1, int dh = -1, GLenum mask = GL_COLOR_BUFFER_BIT, GLenum filter = GL_NEAREST);
 
+        // Reads a region (origin at the top left) of color attachment i,
+        // all of it by default, into an image whose row 0 is the top row.
+        // Rendering is not waited for: the pixels go into one of a ring of
+        // pixel pack buffers, and the image is only passed to the future
+        // once poll_reads() finds the copy done.  If as many readbacks as
+        // set by set_read_latency() are pending, the oldest is waited for.
+        // Multisampled framebuffers have to be resolved with blit() first.
+        // The read framebuffer binding, its read buffer and the pack
+        // alignment are left as they were.
+        std::future<image> read_async(int i, int channels = 4, image::channel_format format = image::LINEAR_UINT8);
+        std::future<image> read_async(int i, const image::region &area, int channels = 4, image::channel_format format = image::LINEAR_UINT8);
+        // Completes the finished readbacks, or all of them with wait.  Has to
+        // be called regularly on the GL thread, e.g. once a frame.
+        void poll_reads(bool wait = false);
+        // Maximum number of pending readbacks (3 by default); completes all
+        // pending ones
+        void set_read_latency(int readbacks);
+
         static framebuffer *current(void) { return current_fb; }
 
         void mask(int i);
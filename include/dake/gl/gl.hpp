@@ -16,8 +16,14 @@ namespace gl
 
 enum extension {
     BINDLESS_TEXTURE,
+    BUFFER_STORAGE,
+    DIRECT_STATE_ACCESS,
     STENCIL_TEXTURING,
+    TEXTURE_STORAGE,
     TEXTURE_VIEW,
+    PARALLEL_SHADER_COMPILE,
+    SEPARATE_SHADER_OBJECTS,
+    MULTI_DRAW_INDIRECT,
 };
 
 extern const char *extension_names[];
@@ -38,10 +44,14 @@ class glext_info {
         bool has_extension(const char *name) const;
         bool has_extension(const std::string &name) const;
         bool has_extension(extension ext) const
-        { return exts_map[static_cast<int>(ext)]; }
+        { return initialized && exts_map[static_cast<int>(ext)]; }
 
         bool has_bindless_textures(void) const
         { return has_extension(BINDLESS_TEXTURE); }
+
+        // Objects are then edited without being bound
+        bool has_direct_state_access(void) const
+        { return has_extension(DIRECT_STATE_ACCESS); }
 };
 
 extern glext_info glext;
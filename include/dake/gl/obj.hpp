@@ -20,7 +20,8 @@ struct obj_material {
     math::vec4 ambient, diffuse, specular;
     float specular_coefficient;
     int illumination;
-    const texture *tex;
+    texture_manager::handle tex;
+    std::string tex_file;
 };
 
 
@@ -0,0 +1,54 @@
+#ifndef DAKE__GL__PIXEL_BUFFER_HPP
+#define DAKE__GL__PIXEL_BUFFER_HPP
+
+#include <cstddef>
+
+#include "dake/gl/gl.hpp"
+
+
+namespace dake
+{
+
+namespace gl
+{
+
+// Buffer object for pixel transfers: GL_PIXEL_UNPACK_BUFFER is a source for
+// texture uploads, GL_PIXEL_PACK_BUFFER a destination for readback.
+class pixel_buffer {
+    private:
+        GLuint id;
+        GLenum tgt;
+        size_t sz;
+        void *persistent_map = nullptr;
+
+    public:
+        // With persistent set and ARB_buffer_storage available, the buffer
+        // stays mapped coherently (for writing if it is an unpack buffer, for
+        // reading if it is a pack buffer) for its whole lifetime.  map() then
+        // only returns a pointer into that mapping and unmap() does nothing.
+        pixel_buffer(size_t size, GLenum target = GL_PIXEL_UNPACK_BUFFER, GLenum usage = GL_STREAM_DRAW, bool persistent = false);
+        pixel_buffer(const pixel_buffer &) = delete;
+        ~pixel_buffer(void);
+
+        pixel_buffer &operator=(const pixel_buffer &) = delete;
+
+        void data(const void *ptr, size_t size, size_t offset = 0);
+
+        void *map(GLbitfield access = GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+        void *map(size_t offset, size_t length, GLbitfield access);
+        void unmap(void);
+
+        void bind(void) const;
+        void unbind(void) const;
+
+        size_t size(void) const { return sz; }
+        GLenum target(void) const { return tgt; }
+        bool persistent(void) const { return persistent_map; }
+        GLuint glid(void) const { return id; }
+};
+
+}
+
+}
+
+#endif
@@ -0,0 +1,69 @@
+#ifndef DAKE__GL__RESAMPLE_HPP
+#define DAKE__GL__RESAMPLE_HPP
+
+#include <cstddef>
+
+#include "dake/gl/texture.hpp"
+
+
+namespace dake
+{
+
+namespace gl
+{
+
+namespace resample
+{
+
+// RGBA image with one float per channel, tightly packed and aligned for SIMD
+// access.  This is what all filtering is done on.
+class plane {
+    private:
+        float *px = nullptr;
+        int w, h;
+
+    public:
+        plane(int width, int height);
+        plane(const plane &orig) = delete;
+        plane(plane &&orig);
+        ~plane(void);
+
+        plane &operator=(plane &&orig);
+
+        int width(void) const { return w; }
+        int height(void) const { return h; }
+
+        float *row(int y) { return px + static_cast<size_t>(y) * w * 4; }
+        const float *row(int y) const { return px + static_cast<size_t>(y) * w * 4; }
+};
+
+// Expands an image of dst's size with 8-bit channels (rows are stride bytes
+// apart) into dst.  Missing color channels read as 0, missing alpha as 1.  If
+// srgb is set, the color channels are converted to linear light.
+void unpack(plane *dst, const void *src, int channels, size_t stride, bool srgb);
+
+// Inverse of unpack(), with alpha multiplied by alpha_scale.  Values are
+// clamped to [0, 1] and rounded.
+void pack(void *dst, int channels, size_t stride, const plane &src, bool srgb, float alpha_scale = 1.f);
+
+// Resamples src to the size of dst, using separable passes.  The output rows
+// are distributed over all hardware threads in bands.  When minifying, the
+// filter is widened accordingly.
+void scale(plane *dst, const plane &src, image::resample_filter filter);
+
+// Same as unpack(), scale() and pack() one after another, but without ever
+// holding more than a few rows in floating point
+void scale(void *dst, int dst_width, int dst_height, size_t dst_stride,
+           const void *src, int src_width, int src_height, size_t src_stride,
+           int channels, image::resample_filter filter, bool srgb);
+
+// Fraction of pixels whose alpha multiplied by alpha_scale is at least ref
+float alpha_coverage(const plane &p, float ref, float alpha_scale = 1.f);
+
+}
+
+}
+
+}
+
+#endif
@@ -0,0 +1,104 @@
+#ifndef DAKE__GL__RESIDENCY_HPP
+#define DAKE__GL__RESIDENCY_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "dake/gl/gl.hpp"
+#include "dake/gl/texture.hpp"
+
+
+namespace dake
+{
+
+namespace gl
+{
+
+// Keeps the bindless textures used in recent frames resident and all of
+// their handles in a shader storage buffer, so that shaders can select
+// textures by index instead of by texture unit:
+//
+//   layout(std430, binding = N) buffer textures { uvec2 handles[]; };
+//   ... texture(sampler2D(handles[i]), uv) ...
+//
+// Each frame, call use() for every texture that is going to be sampled, then
+// commit() before drawing; all residency changes are applied there at once.
+// Textures are made non-resident when they have not been used for
+// keep_frames frames, or earlier (least recently used first) when the
+// resident ones exceed the budget.  Textures used in the current frame are
+// always resident.
+//
+// Textures have to be removed before they are destroyed.
+class residency_manager {
+    public:
+        struct statistics {
+            int resident;
+            size_t resident_bytes;
+            // Residency changes made by the last commit()
+            int made_resident, made_non_resident;
+        };
+
+    private:
+        struct slot {
+            void *object = nullptr;
+            void (*set_resident)(void *object, bool state);
+            size_t bytes;
+            // Frame this slot was last used in, or -1 if never
+            long last_used;
+            bool resident;
+        };
+
+        std::vector<slot> slots;
+        std::vector<int> free_slots;
+        std::vector<uint64_t> table;
+        // Range of table not yet written to the buffer
+        int dirty_first = 0, dirty_last = 0;
+        // Used in this frame, but not resident
+        std::vector<int> pending;
+
+        GLuint buffer = 0;
+        size_t buffer_capacity = 0;
+
+        size_t budget;
+        int keep_frames;
+        long frame = 0;
+        statistics stats_ = {};
+
+        int add(void *object, uint64_t handle, void (*set_resident)(void *object, bool state), size_t bytes);
+        void mark_dirty(int index);
+        void upload_table(void);
+
+    public:
+        // The budget is in bytes, as given to add()
+        residency_manager(size_t budget = SIZE_MAX, int keep_frames = 3);
+        residency_manager(const residency_manager &) = delete;
+        ~residency_manager(void);
+
+        residency_manager &operator=(const residency_manager &) = delete;
+
+        // Makes the texture bindless (if it is not yet) and returns its index
+        // in the handle table.  bytes is what it counts against the budget.
+        int add(texture &t, size_t bytes);
+        int add(array_texture &t, size_t bytes);
+        int add(cubemap &t, size_t bytes);
+        // Makes the texture non-resident and frees its index
+        void remove(int index);
+
+        void use(int index);
+        void commit(void);
+        void next_frame(void);
+
+        // Binds the handle table to the given shader storage buffer binding
+        // point (after commit())
+        void bind(GLuint binding);
+
+        void set_budget(size_t bytes) { budget = bytes; }
+        const statistics &stats(void) const { return stats_; }
+};
+
+}
+
+}
+
+#endif
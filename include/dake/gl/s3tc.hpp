@@ -0,0 +1,48 @@
+#ifndef DAKE__GL__S3TC_HPP
+#define DAKE__GL__S3TC_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+#include "dake/gl/texture.hpp"
+
+
+namespace dake
+{
+
+namespace gl
+{
+
+namespace s3tc
+{
+
+// Size of a single 4x4 block of the given S3TC/RGTC format in bytes
+size_t block_size(image::channel_format fmt);
+
+// Compresses a width x height image with 8-bit channels (rows are stride
+// bytes apart) into fmt, which must be one of the S3TC or RGTC formats.
+// Missing color channels are read as 0, missing alpha as 255.  The rows of
+// blocks are distributed over all hardware threads.
+void compress(image::channel_format fmt, void *dst, const void *src,
+              int width, int height, int channels, size_t stride,
+              image::compression_quality quality);
+
+// Decompresses fmt into an image with 8-bit channels (1 to 4 of RGBA, rows
+// are stride bytes apart), distributing the rows of blocks over all hardware
+// threads.  The result is bit-identical to decode_block_reference().
+void decompress(image::channel_format fmt, void *dst, const void *src,
+                int width, int height, int channels, size_t stride);
+
+// Plain scalar decoder for a single block, writing 16 RGBA pixels.  This is
+// the reference against which the compressor's quality is measured; it
+// shares no palette code with compress() and decompress().
+void decode_block_reference(image::channel_format fmt, const void *block,
+                            uint8_t rgba[16][4]);
+
+}
+
+}
+
+}
+
+#endif
@@ -2,10 +2,15 @@
 #define DAKE__GL__SHADER_HPP
 
 #include <cassert>
+#include <cstddef>
+#include <cstdint>
 #include <initializer_list>
+#include <memory>
 #include <stdexcept>
 #include <string>
 #include <unordered_map>
+#include <utility>
+#include <vector>
 
 #include "dake/gl/gl.hpp"
 
@@ -16,20 +21,38 @@ namespace dake
 namespace gl
 {
 
+// Returns the contents of a shader file with every #include "file" replaced
+// by that file (looked up relative to the including one first, then through
+// find_resource_filename()), each file with #pragma once only included once.
+// #line directives keep line numbers in compiler messages; source string 0 is
+// the given file, the others are numbered in include order.
+std::string preprocess_shader(const std::string &file);
+// Inserts "#define name" for each of defines (which may be "NAME" or
+// "NAME value") after the #version line of src
+std::string inject_defines(const std::string &src, const std::vector<std::string> &defines);
+
+
 class shader
 {
     private:
         GLuint id;
         GLint t;
 
-        bool compiled = false;
+        // Shared with copies and with the programs the shader is attached
+        // to, so that it is only compiled once
+        std::shared_ptr<bool> compiled = std::make_shared<bool>(false);
         std::string name = std::string("(unnamed)");
         bool is_copy = false;
+        // Kept for the program binary cache key
+        std::string code;
 
         shader(GLint t, GLuint id);
         void check_valid(void) const;
+        // Throws if compiling has failed
+        void check_compiled(void);
 
         friend class program;
+        friend class program_permutations;
 
 
     public:
@@ -48,7 +71,8 @@ class shader
         static shader geom(const char *src_file = nullptr);
         static shader frag(const char *src_file = nullptr);
 
-        void load(const char *file);
+        // Includes are resolved with preprocess_shader()
+        void load(const char *file, const std::vector<std::string> &defines = std::vector<std::string>());
         void source(const char *src);
 
         // Always returns true
@@ -61,18 +85,139 @@ class program;
 extern program *active_program;
 
 
+// Name of a uniform, hashed (64-bit FNV-1a) at compile time when written as
+// a literal: prg.uniform<mat4>("mvp"_uniform) then only probes an integer
+// table built at link time instead of hashing a std::string.
+class uniform_name
+{
+    private:
+        uint64_t h;
+        const char *str;
+
+    public:
+        static constexpr uint64_t hash(const char *s, size_t length)
+        {
+            uint64_t result = 14695981039346656037ull;
+            for (size_t i = 0; i < length; i++) {
+                result = (result ^ static_cast<uint8_t>(s[i])) * 1099511628211ull;
+            }
+            // 0 marks empty table slots
+            return result ? result : 1;
+        }
+
+        constexpr uniform_name(const char *s, size_t length):
+            h(hash(s, length)), str(s)
+        {}
+
+        constexpr uint64_t value(void) const { return h; }
+        constexpr const char *c_str(void) const { return str; }
+};
+
+constexpr uniform_name operator""_uniform(const char *s, size_t length)
+{ return uniform_name(s, length); }
+
+
 template<typename T> class uniform;
 
 class program
 {
+    public:
+        struct binary_cache_statistics {
+            // Programs loaded from the cache, and those compiled instead
+            size_t hits, misses;
+            // Cached binaries that existed, but were not accepted
+            size_t rejected;
+        };
+
+        // Active uniforms as reported at link time; location is -1 for
+        // those in blocks, block is -1 for the others
+        struct uniform_info {
+            std::string name;
+            GLenum type;
+            GLint size, location;
+            GLint block, offset, array_stride, matrix_stride;
+        };
+
+        // Indexed by the block index
+        struct block_info {
+            std::string name;
+            GLint size, binding;
+        };
+
+        struct attrib_info {
+            std::string name;
+            GLenum type;
+            GLint size, location;
+        };
+
+
     private:
+        // Attached, but (with a binary cache) only compiled if needed
+        struct stage {
+            GLint type;
+            GLuint id;
+            std::string name, source;
+            std::shared_ptr<bool> compiled;
+        };
+
+        // A uniform value in the form it is passed to the GL; type is
+        // GL_UNSIGNED_INT64_ARB for bindless texture handles
+        struct pending_uniform {
+            GLint location;
+            GLenum type;
+            union {
+                GLfloat f[16];
+                GLint i;
+                GLuint u;
+                GLuint64 h;
+            } value;
+        };
+
+        // Open addressing with linear probing, the size a power of two
+        struct uniform_slot {
+            uint64_t hash;
+            GLint location;
+        };
+
         GLuint id;
         std::unordered_map<std::string, GLint> uniform_locations;
+        // Every name in uniform_locations after linking, by uniform_name hash
+        std::vector<uniform_slot> uniform_slots;
         std::string name = std::string("");
 
         bool linked = false;
+        // glLinkProgram() has been called, the result not yet checked
+        bool link_pending = false;
+
+        std::vector<stage> stages;
+        // Locations bound before linking; part of the cache key
+        std::string bindings;
+        // False if the source of a shader is unknown
+        bool cacheable = true;
+        // Set by submit_compile() if the result is to be cached
+        bool cache_result = false;
+        uint64_t binary_key = 0;
+
+        // Written while another program was in use, set by use()
+        std::vector<pending_uniform> pending_uniforms;
+
+        std::vector<uniform_info> uniform_table;
+        std::vector<block_info> block_table;
+        std::vector<attrib_info> attrib_table;
 
         void check_valid(void) const;
+        void submit_compile(void);
+        void submit_link(void);
+        bool link_complete(void) const;
+        void check_linked(void);
+        void reflect(void);
+        uint64_t cache_key(void) const;
+        bool load_binary(uint64_t key);
+        void save_binary(uint64_t key);
+        void write_uniform(GLint location, GLenum type, const void *value);
+
+        friend class program_batch;
+        template<typename T> friend class dake::gl::uniform;
 
 
     public:
@@ -87,20 +232,40 @@ class program
 
         ~program(void);
 
+        // The shader is compiled when linking unless it has been compiled
+        // before, by itself or by another program it is attached to
         void operator<<(shader &sh);
         void operator<<(shader &&sh);
 
-        // Always returns true
+        // Always returns true.  Links again if already linked, so that
+        // bind_attrib() and bind_frag() take effect.
         bool link(void);
+        // Also sets all uniforms written since the program was last in use
         void use(void);
 
         static void unuse(void) { glUseProgram(0); active_program = nullptr; }
 
+        // Stores linked program binaries in the given directory (which must
+        // exist; empty disables the cache).  link() only compiles the
+        // attached shaders if it finds no valid binary for them; the key
+        // covers their sources, the bound attribute and fragment data
+        // locations and the GL vendor, renderer and version.
+        static void set_binary_cache(const std::string &directory);
+        static const binary_cache_statistics &binary_cache_stats(void);
+
         GLuint attrib(const char *identifier);
         void bind_attrib(const char *identifier, int location);
         GLuint frag(const char *identifier);
         void bind_frag(const char *identifier, int location);
 
+        // Everything active in the program (linking it if necessary)
+        const std::vector<uniform_info> &active_uniforms(void);
+        const std::vector<block_info> &active_blocks(void);
+        const std::vector<attrib_info> &active_attribs(void);
+        // Index of a uniform block, or -1 if it is not active
+        int block_index(const std::string &block);
+        void bind_block(const std::string &block, GLuint binding);
+
         template<typename T> dake::gl::uniform<T> uniform(const std::string &identifier)
         {
             check_valid();
@@ -121,6 +286,102 @@ class program
             uniform_locations.emplace(identifier, uni_id);
             return dake::gl::uniform<T>(uni_id, this);
         }
+
+        // Names not found among the active uniforms (e.g. "array[3]") fall
+        // back to the lookup by string
+        template<typename T> dake::gl::uniform<T> uniform(const uniform_name &identifier)
+        {
+            check_valid();
+
+            if (!linked) {
+                link();
+            }
+
+            if (!uniform_slots.empty()) {
+                size_t mask = uniform_slots.size() - 1;
+                for (size_t i = identifier.value() & mask; uniform_slots[i].hash; i = (i + 1) & mask) {
+                    if (uniform_slots[i].hash == identifier.value()) {
+                        return dake::gl::uniform<T>(uniform_slots[i].location, this);
+                    }
+                }
+            }
+
+            return uniform<T>(std::string(identifier.c_str()));
+        }
+};
+
+
+// Compiles and links many programs at once: all shaders and programs are
+// submitted before any status is queried, so that with
+// KHR_parallel_shader_compile the driver can work on them in its own threads
+// while the application goes on.  Info logs are only fetched for what failed.
+class program_batch
+{
+    private:
+        std::vector<program *> programs;
+        bool submitted = false;
+
+    public:
+        // The program must stay alive until finish() (or its own link())
+        program_batch &operator<<(program &prg);
+
+        // Starts compiling and linking all programs added, without waiting
+        void submit(void);
+        // Whether all programs are done (submits them first if necessary);
+        // without KHR_parallel_shader_compile, this is always true
+        bool ready(void);
+        // Waits for all programs, then throws an exception listing every
+        // one that failed.  The others can be used either way.
+        void finish(void);
+};
+
+
+// Variants of a program built from the same files, selected by a bit mask
+// of features: bit i set means "#define features[i]" in every stage.  Each
+// variant is built on first use, but not linked (so it can be linked in a
+// program_batch).  Features a stage never mentions are not defined in it, so
+// that variants whose sources come out the same share one program.
+class program_permutations
+{
+    public:
+        struct statistics {
+            // Programs built, and variants that could use one of them
+            size_t programs, shared;
+        };
+
+    private:
+        struct stage {
+            shader::type type;
+            std::string file, source;
+            // Bits of the features the source mentions
+            uint32_t used;
+        };
+
+        // A program and the sources of its stages
+        struct variant {
+            std::vector<std::string> sources;
+            program *prg;
+        };
+
+        std::vector<stage> stages;
+        std::vector<std::string> features;
+        std::unordered_map<uint32_t, program *> by_mask;
+        // By a hash of the sources
+        std::unordered_multimap<uint64_t, variant> by_source;
+        statistics stats_ = {};
+
+    public:
+        // Reads and preprocesses the files right away; at most 32 features
+        program_permutations(const std::vector<std::pair<shader::type, std::string>> &files,
+                             const std::vector<std::string> &features);
+        program_permutations(const program_permutations &) = delete;
+        ~program_permutations(void);
+
+        program_permutations &operator=(const program_permutations &) = delete;
+
+        program &operator[](uint32_t mask);
+
+        const statistics &stats(void) const { return stats_; }
 };
 
 
@@ -142,12 +403,14 @@ template<typename T> class uniform
             prg = uprg;
         }
 
+        // Does not switch programs: with ARB_separate_shader_objects, the
+        // value is written with glProgramUniform*(), otherwise it is only
+        // recorded if the program is not in use, to be set by its next use()
         uniform<T> &operator=(const T &value)
         {
             if ((id < 0) || !prg) {
                 throw std::invalid_argument("Uniform has not been looked up yet");
             }
-            prg->use();
             assign(value);
             return *this;
         }
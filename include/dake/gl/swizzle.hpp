@@ -0,0 +1,43 @@
+#ifndef DAKE__GL__SWIZZLE_HPP
+#define DAKE__GL__SWIZZLE_HPP
+
+#include <cstddef>
+
+
+namespace dake
+{
+
+namespace gl
+{
+
+namespace swizzle
+{
+
+// Repacks a width x height image with src_channels channels per pixel into
+// one with dst_channels (both 1 to 4), channels being channel_size (1, 2 or
+// 4) bytes each.  Output channel c is input
+// channel map[c], or 0 if map[c] is negative; this covers reordering,
+// expanding and stripping channels.  Rows are src_stride and dst_stride bytes
+// apart.  src and dst may be the same if channel count and stride are, too.
+//
+// Groups of pixels are moved with pshufb (both 128-bit lanes of an AVX2
+// register at once where available), the rows are distributed over all
+// hardware threads.
+void remap(void *dst, int dst_channels, size_t dst_stride,
+           const void *src, int src_channels, size_t src_stride,
+           const int *map, int width, int height, int channel_size = 1);
+
+// Interleaves two images of the same size into one with channels1 + channels2
+// (at most 4) channels: first those of src1, then those of src2.
+void merge(void *dst, size_t dst_stride,
+           const void *src1, int channels1, size_t stride1,
+           const void *src2, int channels2, size_t stride2,
+           int width, int height);
+
+}
+
+}
+
+}
+
+#endif
@@ -0,0 +1,40 @@
+#ifndef DAKE__GL__TEXEL_HPP
+#define DAKE__GL__TEXEL_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+#include "dake/gl/texture.hpp"
+
+
+namespace dake
+{
+
+namespace gl
+{
+
+namespace texel
+{
+
+// IEEE 754 binary16, rounding to nearest even
+uint16_t float_to_half(float f);
+float half_to_float(uint16_t h);
+
+// Size of one channel value of an uncompressed (LINEAR_*) format
+size_t value_size(image::channel_format fmt);
+
+// Converts rows of row_values channel values each between two uncompressed
+// formats.  The integer formats represent [0, 1]; values outside of that are
+// clamped when converting to them.  Uses F16C for half floats where
+// available; the rows are distributed over all hardware threads.
+void convert(void *dst, image::channel_format dst_format, size_t dst_stride,
+             const void *src, image::channel_format src_format, size_t src_stride,
+             size_t row_values, int rows);
+
+}
+
+}
+
+}
+
+#endif
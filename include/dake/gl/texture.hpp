@@ -1,8 +1,12 @@
 #ifndef DAKE__GL__TEXTURE_HPP
 #define DAKE__GL__TEXTURE_HPP
 
+#include <cstddef>
+#include <cstdint>
+#include <list>
 #include <vector>
 #include <string>
+#include <unordered_map>
 
 #include "dake/gl/gl.hpp"
 #include "dake/math/matrix.hpp"
@@ -14,32 +18,120 @@ namespace dake
 namespace gl
 {
 
+class image_reader;
+class pixel_buffer;
+class upload_pool;
+struct image_row_decoder;
+
+
 class image {
     public:
         enum channel_format {
             LINEAR_UINT8,
+            // Normalized to [0, 1] like LINEAR_UINT8
+            LINEAR_UINT16,
+            LINEAR_HALF,
+            LINEAR_FLOAT,
             COMPRESSED_S3TC_DXT1,
             COMPRESSED_S3TC_DXT1_ALPHA,
             COMPRESSED_S3TC_DXT3,
             COMPRESSED_S3TC_DXT5,
             COMPRESSED_RGTC_RED,
             COMPRESSED_RGTC_RG,
+            COMPRESSED_BPTC_RGBA,
+            COMPRESSED_BPTC_RGB_UFLOAT,
+        };
+
+        enum compression_quality {
+            // Bounding box endpoints
+            COMPRESS_FAST,
+            // Principal axis endpoints
+            COMPRESS_NORMAL,
+            // Tries several endpoint candidates and refines them
+            COMPRESS_BEST,
+        };
+
+        enum resample_filter {
+            // Average over the covered source pixels
+            RESAMPLE_BOX,
+            // Triangle, radius 1
+            RESAMPLE_BILINEAR,
+            // Catmull-Rom spline, radius 2
+            RESAMPLE_BICUBIC,
+            // Kaiser-windowed sinc, radius 3
+            RESAMPLE_KAISER,
+            // Lanczos-windowed sinc, radius 3
+            RESAMPLE_LANCZOS,
+        };
+
+        struct mipmap_options {
+            resample_filter filter;
+            // Treat the color channels as sRGB and filter in linear light
+            bool srgb;
+            // If not negative, alpha is scaled on every level so the fraction
+            // of pixels with alpha >= alpha_coverage_ref stays as on level 0
+            float alpha_coverage_ref;
+            // Compress all levels into this format unless LINEAR_UINT8
+            channel_format compress_to;
+            compression_quality quality;
+
+            mipmap_options(resample_filter f = RESAMPLE_KAISER):
+                filter(f), srgb(false), alpha_coverage_ref(-1.f),
+                compress_to(LINEAR_UINT8), quality(COMPRESS_NORMAL)
+            {}
+        };
+
+        struct region {
+            int x, y, width, height;
         };
 
     private:
+        // All mipmap levels, one after another
         void *d = nullptr;
         channel_format fmt;
         int w, h, cc;
+        int lvls = 1;
         size_t bsz;
 
-        void load(const void *buffer, size_t length, const std::string &name);
+        // Set if d points into a mapped file
+        void *mapping = nullptr;
+        size_t mapping_size = 0;
+
+        void load(const void *buffer, size_t length, const std::string &name, int max_width, int max_height);
+        void reduce(int max_width, int max_height, const void *buffer, size_t length);
+        void read(image_reader &reader, int rows);
+        void convert(const image &input, channel_format new_format, int new_channels, compression_quality quality);
+        size_t level_offset(int level) const;
 
     public:
         image(const image &copy);
+        image(image &&other);
+        // All values zero
+        image(int width, int height, int channels, channel_format format = LINEAR_UINT8);
         image(const std::string &file);
         image(const void *buffer, size_t length);
+        // Reduces the image to fit into max_width x max_height (0 means no
+        // limit), keeping the aspect ratio: JPEG is decoded at a smaller
+        // scale right away, mipmapped images lose the levels that are too
+        // large and other 8-bit images are box-filtered down.  Images that
+        // allow for none of this are loaded at full size.
+        image(const std::string &file, int max_width, int max_height);
+        image(const void *buffer, size_t length, int max_width, int max_height);
+        // Decodes only the given area, which must lie within the image (see
+        // image_reader)
+        image(const std::string &file, const region &area);
+        image(const void *buffer, size_t length, const region &area);
+        // Decodes the next rows of reader (at most as many as are left)
+        image(image_reader &reader, int rows);
         image(const image &i1, const image &i2);
-        image(const image &input, channel_format new_format, int new_channels = 0);
+        // Converts all levels; recompression is not supported
+        image(const image &input, channel_format new_format, int new_channels = 0, compression_quality quality = COMPRESS_NORMAL);
+        // Builds a full mipmap chain from level 0 of an uncompressed image
+        image(const image &input, const mipmap_options &options);
+        // Scales level 0 of an uncompressed image to the given size; with
+        // srgb, the color channels are filtered in linear light
+        image(const image &input, int new_width, int new_height,
+              resample_filter filter = RESAMPLE_LANCZOS, bool srgb = false);
         ~image(void);
 
         int width(void) const { return w; }
@@ -47,17 +139,87 @@ class image {
         int channels(void) const { return cc; }
         channel_format format(void) const { return fmt; }
         const void *data(void) const { return d; }
+        void *data(void) { return d; }
+        // Size of all levels together
         size_t byte_size(void) const { return bsz; }
 
+        int levels(void) const { return lvls; }
+        int level_width(int level) const { return w >> level ? w >> level : 1; }
+        int level_height(int level) const { return h >> level ? h >> level : 1; }
+        const void *level_data(int level) const;
+        size_t level_byte_size(int level) const;
+
         void swap_channels(int r, int g = -1, int b = -1, int a = -1);
 
+        // Writes all levels into a DDS file, which loads as the same format
+        // with the same channels and values.  Exceptions: 3-channel
+        // LINEAR_UINT8 is stored as 24-bit RGB and repacked on load, like
+        // every layout with less than four bytes per pixel.  DDS has no
+        // 3-channel LINEAR_UINT16 or LINEAR_HALF format, so for those save()
+        // throws.
+        void save(const std::string &file) const;
+
         GLenum gl_format(void) const;
         GLenum gl_type(void) const;
+        // Sized internal format to upload the data as (e.g. GL_RGBA16F)
+        GLenum gl_internal_format(void) const;
 
         bool compressed(void) const;
 };
 
 
+// Decodes an image from top to bottom, some rows at a time, so that only
+// those have to be in memory.  PNG (unless interlaced), JPEG and BMP are
+// decoded incrementally, JPEG also skips rows and crops columns without
+// decoding all of them.  Other formats are loaded completely first; either
+// way, only uncompressed images can be read.
+class image_reader {
+    private:
+        const image_row_decoder *decoder = nullptr;
+        void *state = nullptr;
+        // Formats without a row decoder
+        image *whole = nullptr;
+
+        void *mapping = nullptr;
+        size_t mapping_size = 0;
+
+        int w, h, cc, x0, cols;
+        int next = 0;
+        image::channel_format fmt;
+
+        void open(const void *buffer, size_t length, const std::string &name, int x, int width);
+
+    public:
+        image_reader(const std::string &file);
+        image_reader(const void *buffer, size_t length);
+        // Only decodes columns [x, x + width); width 0 means up to the right
+        // edge
+        image_reader(const std::string &file, int x, int width);
+        image_reader(const void *buffer, size_t length, int x, int width);
+        image_reader(const image_reader &) = delete;
+        ~image_reader(void);
+
+        image_reader &operator=(const image_reader &) = delete;
+
+        // Size of the whole image
+        int image_width(void) const { return w; }
+        int image_height(void) const { return h; }
+
+        // Size of what is decoded
+        int width(void) const { return cols; }
+        int channels(void) const { return cc; }
+        image::channel_format format(void) const { return fmt; }
+
+        // Next row to be decoded
+        int row(void) const { return next; }
+        int rows_left(void) const { return h - next; }
+
+        void skip(int rows);
+        // Decodes the next rows into dst, rows being stride bytes apart
+        void read(void *dst, size_t stride, int rows);
+};
+
+
 class texture {
     private:
         GLuint tex_id;
@@ -66,16 +228,39 @@ class texture {
         bool bl = false, is_resident = false;
         uint64_t bl_handle;
         bool multisampled = false;
+        bool immutable = false;
         GLenum target = GL_TEXTURE_2D;
 
         void raw_init(void);
+        void replace_immutable(void);
+        void upload(const image &img, upload_pool *pool = nullptr);
+        void allocate(const image &img);
+        void upload_mutable(const image &img);
+        void upload_level(int level, int x, int y, const image &img, int img_level);
+        // data (bytes long) is in the format of img
+        void upload_region(int level, int x, int y, int w, int h, const image &img, size_t bytes, const void *data);
+
+        friend class texture_manager;
+        friend class upload_pool;
 
     public:
         texture(bool multisample = false);
         texture(const std::string &name);
         texture(const char *name); // so this isn't converted to bool
+        // Uploads all levels of img, limiting GL_TEXTURE_MAX_LEVEL to them if
+        // there is more than one.  Filtering is left as it is (GL_LINEAR), so
+        // a mip chain is only used after e.g.
+        // filter(GL_LINEAR_MIPMAP_LINEAR, GL_LINEAR).
         texture(const image &img);
-        texture(const texture &orig, GLenum format); // creates a texture view
+        // Uploads img through the staging buffers of pool
+        texture(const image &img, upload_pool &pool);
+        // Uploads the remaining rows of reader as level 0, band_rows at a
+        // time, so that the image is never in memory as a whole
+        texture(image_reader &reader, int band_rows = 256);
+        // Creates a texture view of level 0 of orig, which needs immutable
+        // storage (from storage(), or from an image if ARB_texture_storage
+        // is available)
+        texture(const texture &orig, GLenum format);
         ~texture(void);
 
         void bind(bool force = false) const;
@@ -87,7 +272,24 @@ class texture {
         bool resident(void) const { return is_resident; }
         void make_resident(bool state);
 
+        // Allocates mutable storage for level 0.  On a texture with immutable
+        // storage, this replaces the GL texture object (glid() changes;
+        // filtering, wrapping and border color are kept).
         void format(GLenum format, int w, int h, GLenum read_format = GL_RGB, GLenum read_data_format = GL_UNSIGNED_BYTE, int spp = 1);
+        // Allocates immutable storage for the given number of mipmap levels
+        // (0 for all down to 1x1); updating it with sub_image() then needs
+        // no reallocation.  Textures loaded from images (or image_readers)
+        // get immutable storage with the full mip chain if
+        // ARB_texture_storage is available, so glGenerateMipmap() still
+        // works on them.  Like format(), calling this again replaces the
+        // GL texture object.
+        void storage(GLenum format, int w, int h, int levels = 1);
+        // Replaces the region (x, y) to (x + w, y + h) of a level with rows
+        // aligned to four bytes, from client memory or from offset in a
+        // GL_PIXEL_UNPACK_BUFFER.  The image variant uses level 0 of img.
+        void sub_image(int level, int x, int y, const image &img);
+        void sub_image(int level, int x, int y, int w, int h, GLenum read_format, GLenum read_data_format, const void *data);
+        void sub_image(int level, int x, int y, int w, int h, GLenum read_format, GLenum read_data_format, const pixel_buffer &buffer, size_t offset = 0);
         void filter(GLenum filter);
         void filter(GLenum min_filter, GLenum mag_filter);
         void wrap(GLenum wrap);
@@ -135,6 +337,9 @@ class array_texture {
 
         void load_layer(int layer, const image &img);
         void load_layer(int layer, const void *data, GLenum format = GL_RGB, GLenum data_format = GL_UNSIGNED_BYTE);
+        // Streams the remaining rows of reader into the layer like
+        // texture(reader, band_rows) does
+        void load_layer(int layer, image_reader &reader, int band_rows = 256);
 
         int &tmu(void) { return tmu_index; }
         int tmu(void) const { return tmu_index; }
@@ -188,15 +393,102 @@ class cubemap {
 };
 
 
+// Caches textures loaded from files.  Files are looked up by name and, the
+// first time a name is loaded, by their contents (hashed, and compared byte
+// by byte on a match), so that the same file under different names is
+// uploaded only once.  Textures no handle refers to anymore stay cached until
+// the total size of all textures exceeds the budget; then the least recently
+// used of them are deleted.
 class texture_manager
 {
+    public:
+        struct statistics {
+            // find_texture() calls for names already uploaded
+            size_t hits;
+            // Loads that found the same file under another name, and those
+            // that had to upload it
+            size_t content_hits, misses;
+            size_t evictions;
+            // Textures currently on the GPU and their total size
+            size_t textures, bytes;
+        };
+
     private:
-        std::vector<texture *> textures;
+        struct entry;
+
+        // One texture on the GPU
+        struct resource {
+            texture *tex;
+            // File the texture was loaded from, to compare contents with
+            std::string file;
+            uint64_t hash;
+            size_t length, bytes;
+            // Handles referring to this resource through any name
+            int refs = 0;
+            std::vector<entry *> names;
+            std::list<resource *>::iterator lru_position;
+        };
+
+        // A name textures are looked up by; loads lazily
+        struct entry {
+            std::string name;
+            resource *res = nullptr;
+            int refs = 0;
+        };
+
+        std::unordered_map<std::string, entry> by_name;
+        std::unordered_multimap<uint64_t, resource *> by_content;
+        // Most recently used first
+        std::list<resource *> lru;
+        size_t budget = SIZE_MAX;
+        statistics stats_ = {};
+
+        void load(entry *e);
+        void touch(resource *res);
+        void reference(entry *e);
+        void release(entry *e);
+        void evict(void);
 
     public:
+        // Counted reference to a cached texture, which is only loaded when
+        // the handle is first dereferenced.  There is no implicit conversion
+        // to a texture pointer: the texture may be evicted once the last
+        // handle is gone, so callers have to keep one.
+        class handle {
+            private:
+                texture_manager *tm = nullptr;
+                entry *e = nullptr;
+
+                friend class texture_manager;
+                handle(texture_manager *manager, entry *ent);
+
+            public:
+                handle(void) {}
+                handle(std::nullptr_t) {}
+                handle(const handle &other);
+                ~handle(void);
+
+                handle &operator=(const handle &other);
+
+                // Loads the texture if necessary
+                const texture *get(void) const;
+                const texture *operator->(void) const { return get(); }
+                const texture &operator*(void) const { return *get(); }
+                explicit operator bool(void) const { return e; }
+        };
+
         ~texture_manager(void);
 
-        const texture *find_texture(const std::string &name);
+        // Never evicts the texture as long as the handle (or a copy) exists
+        handle find_texture(const std::string &name);
+
+        // Limits the total size of all cached textures (unlimited by
+        // default).  Referenced textures are never evicted, so they alone may
+        // exceed it.
+        void set_budget(size_t bytes);
+        size_t get_budget(void) const { return budget; }
+
+        const statistics &stats(void) const { return stats_; }
 
         static texture_manager &instance(void)
         {
@@ -0,0 +1,106 @@
+#ifndef DAKE__GL__UNIFORM_BUFFER_HPP
+#define DAKE__GL__UNIFORM_BUFFER_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "dake/gl/gl.hpp"
+#include "dake/gl/shader.hpp"
+#include "dake/math/matrix.hpp"
+
+
+namespace dake
+{
+
+namespace gl
+{
+
+// Buffer backing a uniform block (or, bound to GL_SHADER_STORAGE_BUFFER, a
+// storage block), with a copy of its contents in client memory.  set() only
+// writes that copy and remembers the range written; the next flush() or
+// bind() uploads everything between the first and last byte touched since
+// the last upload with a single call.
+//
+// Constructed from a program, member offsets and strides come from the
+// program's reflection tables, so they match whatever layout (std140 or
+// otherwise) the block has been declared with.  Without a program, there
+// are no names and write() has to be given offsets directly (e.g. following
+// the std430 rules for storage blocks).
+class uniform_buffer {
+    private:
+        struct member {
+            size_t offset;
+            size_t array_stride, matrix_stride;
+            // Bytes of one element (up to the end of its last column) and of
+            // one matrix column (or of the whole element for others); 0 for
+            // unknown types, for which set() writes all of the value
+            size_t size, column_size;
+        };
+
+        GLuint id;
+        std::vector<uint8_t> shadow;
+        std::unordered_map<std::string, member> members;
+
+        // Nothing is dirty if dirty_first >= dirty_last
+        size_t dirty_first = 0, dirty_last = 0;
+
+        void create(void);
+        const member &find(const std::string &name) const;
+
+    public:
+        uniform_buffer(program &prg, const std::string &block);
+        uniform_buffer(size_t size);
+        uniform_buffer(const uniform_buffer &) = delete;
+        ~uniform_buffer(void);
+
+        uniform_buffer &operator=(const uniform_buffer &) = delete;
+
+        // Element index of the member name, which may omit the block name
+        // prefix for blocks without an instance name.  No more than the
+        // member's size is written, so that padding in value (e.g. of SIMD
+        // vectors with three components) does not overwrite the next member.
+        template<typename T> void set(const std::string &name, const T &value, int index = 0)
+        {
+            const member &m = find(name);
+            size_t length = (m.size && m.size < sizeof(value)) ? m.size : sizeof(value);
+            write(m.offset + index * m.array_stride, &value, length);
+        }
+
+        // Matrices are written column by column, as the matrix stride of a
+        // block is usually larger than a column (e.g. 16 bytes for mat3)
+        template<int R, int C, typename T> void set(const std::string &name, const dake::math::mat<R, C, T> &value, int index = 0)
+        {
+            const member &m = find(name);
+            size_t base = m.offset + index * m.array_stride;
+            size_t stride = (C > 1 && m.matrix_stride) ? m.matrix_stride : R * sizeof(T);
+            size_t length = (m.column_size && m.column_size < R * sizeof(T)) ? m.column_size : R * sizeof(T);
+
+            for (int i = 0; i < C; i++) {
+                write(base + i * stride, &value.d[i * R], length);
+            }
+        }
+
+        void write(size_t offset, const void *ptr, size_t length);
+        void mark_dirty(size_t offset, size_t length);
+
+        // Uploads the dirty range, if any
+        void flush(void);
+        // Flushes and binds the buffer to the given indexed binding point
+        void bind(GLuint binding, GLenum target = GL_UNIFORM_BUFFER);
+
+        void *data(void) { return shadow.data(); }
+        const void *data(void) const { return shadow.data(); }
+        size_t size(void) const { return shadow.size(); }
+        GLuint glid(void) const { return id; }
+};
+
+}
+
+}
+
+#endif
@@ -0,0 +1,100 @@
+#ifndef DAKE__GL__UPLOAD_POOL_HPP
+#define DAKE__GL__UPLOAD_POOL_HPP
+
+#include <cstddef>
+#include <vector>
+
+#include "dake/gl/gl.hpp"
+#include "dake/gl/pixel_buffer.hpp"
+#include "dake/gl/texture.hpp"
+
+
+namespace dake
+{
+
+namespace gl
+{
+
+// Uploads textures through a ring of pixel unpack buffers instead of from
+// client memory, so that the driver can copy the data into the texture
+// asynchronously.  Buffers are mapped persistently if ARB_buffer_storage is
+// available; each is reused only after a fence shows that the GL is done
+// reading it.
+//
+// acquire() and upload() have to be called on the GL thread, but the staging
+// memory in between can be written by any thread, e.g. by one decoding an
+// image directly into it:
+//
+//   upload_pool::staging s = pool.acquire(stride * rows);
+//   (decode thread) reader.read(s.data(), stride, rows);
+//   pool.upload(s, tex, 0, 0, y, width, rows, GL_RGB, GL_UNSIGNED_BYTE);
+class upload_pool {
+    public:
+        // Staging memory for a single upload, valid until it is passed to
+        // upload() or release()
+        class staging {
+            private:
+                int slot = -1;
+                void *ptr = nullptr;
+                size_t sz = 0;
+
+                friend class upload_pool;
+
+            public:
+                void *data(void) const { return ptr; }
+                size_t size(void) const { return sz; }
+        };
+
+        struct statistics {
+            size_t uploads, bytes;
+            // acquire() calls that had to wait for the GL to finish reading
+            // a buffer; if this grows, the pool needs more buffers
+            size_t waits;
+        };
+
+    private:
+        struct slot {
+            pixel_buffer *buffer;
+            GLsync fence = nullptr;
+            bool acquired = false;
+        };
+
+        std::vector<slot> slots;
+        size_t buffer_size;
+        int next = 0;
+        statistics stats_ = {};
+
+        void wait(slot &s);
+        pixel_buffer &begin(staging &s);
+        void submit(staging &s);
+
+    public:
+        upload_pool(size_t buffer_size = 16 << 20, int buffers = 4);
+        upload_pool(const upload_pool &) = delete;
+        ~upload_pool(void);
+
+        upload_pool &operator=(const upload_pool &) = delete;
+
+        // Waits for the oldest buffer if all have been used recently; bytes
+        // must not exceed the buffer size
+        staging acquire(size_t bytes);
+        // Uploads the region (x, y) to (x + w, y + h) of a level of tex (which
+        // needs storage already) from offset in s, with rows aligned to four
+        // bytes; s becomes invalid
+        void upload(staging &s, texture &tex, int level, int x, int y, int w, int h,
+                    GLenum read_format, GLenum read_data_format, size_t offset = 0);
+        // Copies a level of img into staging memory and uploads it into tex
+        // at (x, y), in bands of rows if it does not fit into a single buffer
+        void upload(texture &tex, int level, int x, int y, const image &img, int img_level);
+        // Returns s unused
+        void release(staging &s);
+
+        size_t get_buffer_size(void) const { return buffer_size; }
+        const statistics &stats(void) const { return stats_; }
+};
+
+}
+
+}
+
+#endif
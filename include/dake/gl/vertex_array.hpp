@@ -42,10 +42,18 @@ class vertex_array
         vertex_attrib *attrib(GLuint id);
         elements_array *indices(void);
 
+        // Sets up attributes first_id to first_id + 3 to read the columns
+        // of one 4x4 float matrix (e.g. a math::fmat4) per instance from a
+        // shared buffer; returns the first one, whose stream() fills it
+        vertex_attrib *instance_transforms(GLuint first_id);
+
         void bind(void);
         static void unbind(void) { if (!cur_va) return; cur_va->unbind_single(); glBindVertexArray(0); cur_va = nullptr; }
 
         void draw(GLenum type, int start_index = 0);
+        // base_instance offsets instanced attributes (needs
+        // ARB_base_instance if not 0)
+        void draw_instanced(GLenum type, int instances, GLuint base_instance = 0, int start_index = 0);
 };
 
 }
@@ -23,6 +23,8 @@ class vertex_attrib {
         size_t bpv;
         GLenum t;
         vertex_array *va;
+        // Size of the store allocated by stream()
+        size_t stream_capacity = 0;
 
         friend class vertex_array;
 
@@ -40,6 +42,13 @@ class vertex_attrib {
         void load(size_t stride = 0, uintptr_t offset = 0);
 
         void data(const void *ptr, size_t size = static_cast<size_t>(-1), GLenum usage = GL_STATIC_DRAW, bool autoload = true);
+        // For data replaced every frame: orphans the old store (so drawing
+        // from it does not stall the upload) and keeps the largest size
+        // seen, so that the store is not reallocated when size varies
+        void stream(const void *ptr, size_t size);
+
+        // 0 advances once per vertex, n once every n instances
+        void divisor(GLuint instances);
 
         void *map(bool readable = false);
         void unmap(void);
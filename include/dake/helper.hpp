@@ -2,6 +2,7 @@
 #define DAKE__HELPER_HPP
 
 #include "dake/helper/function.hpp"
+#include "dake/helper/parallel.hpp"
 #include "dake/helper/traits.hpp"
 
 #endif
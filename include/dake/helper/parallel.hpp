@@ -0,0 +1,63 @@
+#ifndef DAKE__HELPER__PARALLEL_HPP
+#define DAKE__HELPER__PARALLEL_HPP
+
+#include <thread>
+#include <vector>
+
+
+namespace dake
+{
+namespace helper
+{
+
+// Splits [first, last) into contiguous chunks of at least min_chunk elements
+// and calls fn(chunk_first, chunk_last) for each of them, one chunk per
+// hardware thread.  The calling thread processes the last chunk itself.
+// fn must not throw.
+template<typename F> void parallel_for(int first, int last, F fn, int min_chunk = 1)
+{
+    int count = last - first;
+    if (count <= 0) {
+        return;
+    }
+
+    int threads = static_cast<int>(std::thread::hardware_concurrency());
+    int max_threads = (count + min_chunk - 1) / min_chunk;
+    if (threads > max_threads) {
+        threads = max_threads;
+    }
+
+    if (threads <= 1) {
+        fn(first, last);
+        return;
+    }
+
+    std::vector<std::thread> workers;
+    workers.reserve(threads - 1);
+
+    int chunk_first = first;
+    try {
+        for (int i = 0; i < threads - 1; i++) {
+            int chunk_last = first + static_cast<int>(static_cast<long>(count) * (i + 1) / threads);
+            workers.emplace_back(fn, chunk_first, chunk_last);
+            chunk_first = chunk_last;
+        }
+    } catch (...) {
+        // Destroying joinable threads would terminate the program
+        for (std::thread &t: workers) {
+            t.join();
+        }
+        throw;
+    }
+
+    fn(chunk_first, last);
+
+    for (std::thread &t: workers) {
+        t.join();
+    }
+}
+
+}
+}
+
+#endif
@@ -0,0 +1,120 @@
+#include <cerrno>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+
+#include <dake/cross.hpp>
+
+#ifndef __MINGW32__
+extern "C"
+{
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+}
+#endif
+
+
+namespace dake
+{
+namespace cross
+{
+
+// Zero-length mappings are not possible, so empty files all share this
+static char empty_file;
+
+
+#ifdef __MINGW32__
+
+void *map_file(const char *path, size_t *length)
+{
+    FILE *fp = fopen(path, "rb");
+    if (!fp) {
+        return nullptr;
+    }
+
+    fseek(fp, 0, SEEK_END);
+    *length = ftell(fp);
+    rewind(fp);
+
+    if (!*length) {
+        fclose(fp);
+        return &empty_file;
+    }
+
+    void *buffer = malloc(*length);
+    if (!buffer) {
+        fclose(fp);
+        errno = ENOMEM;
+        return nullptr;
+    }
+
+    if (fread(buffer, 1, *length, fp) < *length) {
+        int err = errno;
+        fclose(fp);
+        free(buffer);
+        errno = err;
+        return nullptr;
+    }
+
+    fclose(fp);
+
+    return buffer;
+}
+
+
+void unmap_file(void *base, size_t length)
+{
+    if (length) {
+        free(base);
+    }
+}
+
+#else
+
+void *map_file(const char *path, size_t *length)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return nullptr;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        int err = errno;
+        close(fd);
+        errno = err;
+        return nullptr;
+    }
+
+    *length = st.st_size;
+    if (!*length) {
+        close(fd);
+        return &empty_file;
+    }
+
+    void *base = mmap(nullptr, *length, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    int err = errno;
+    close(fd);
+
+    if (base == MAP_FAILED) {
+        errno = err;
+        return nullptr;
+    }
+
+    return base;
+}
+
+
+void unmap_file(void *base, size_t length)
+{
+    if (length) {
+        munmap(base, length);
+    }
+}
+
+#endif
+
+}
+}
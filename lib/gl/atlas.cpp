@@ -0,0 +1,263 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <dake/gl/atlas.hpp>
+#include <dake/gl/obj.hpp>
+#include <dake/gl/texture.hpp>
+
+
+struct skyline_segment {
+    int x, y, width;
+};
+
+
+// Bottom-left position for a w x h rectangle; returns the segment it starts
+// at or -1
+static int skyline_fit(const std::vector<skyline_segment> &sky, int page_width, int page_height, int w, int h, int *x, int *y)
+{
+    int best = -1;
+
+    for (int i = 0; i < static_cast<int>(sky.size()); i++) {
+        if (sky[i].x + w > page_width) {
+            break;
+        }
+
+        int top = 0;
+        for (int j = i, left = w; left > 0; j++) {
+            top = std::max(top, sky[j].y);
+            left -= sky[j].width;
+        }
+
+        if (top + h <= page_height && (best < 0 || top < *y)) {
+            best = i;
+            *x = sky[i].x;
+            *y = top;
+        }
+    }
+
+    return best;
+}
+
+
+static void skyline_insert(std::vector<skyline_segment> &sky, int index, int w, int top)
+{
+    int x = sky[index].x, end = x + w;
+
+    int i = index;
+    while (i < static_cast<int>(sky.size()) && sky[i].x < end) {
+        int seg_end = sky[i].x + sky[i].width;
+        if (seg_end <= end) {
+            sky.erase(sky.begin() + i);
+        } else {
+            sky[i].width = seg_end - end;
+            sky[i].x = end;
+            break;
+        }
+    }
+
+    sky.insert(sky.begin() + index, skyline_segment{x, top, w});
+
+    for (i = 0; i + 1 < static_cast<int>(sky.size()); ) {
+        if (sky[i].y == sky[i + 1].y) {
+            sky[i].width += sky[i + 1].width;
+            sky.erase(sky.begin() + i + 1);
+        } else {
+            i++;
+        }
+    }
+}
+
+
+// Copies src to (x, y) in the RGBA8 page and repeats its edges pad texels
+// outwards
+static void blit_padded(dake::gl::image *page, const dake::gl::image &src, int x, int y, int pad)
+{
+    int w = src.width(), h = src.height();
+    size_t page_stride = page->width() * 4, src_stride = w * 4;
+    const uint8_t *in = static_cast<const uint8_t *>(src.data());
+
+    for (int py = -pad; py < h + pad; py++) {
+        const uint8_t *row = in + std::min(std::max(py, 0), h - 1) * src_stride;
+        uint8_t *out = static_cast<uint8_t *>(page->data()) + (y + py) * page_stride + x * 4;
+
+        for (int px = -pad; px < 0; px++) {
+            memcpy(out + px * 4, row, 4);
+        }
+        memcpy(out, row, src_stride);
+        for (int px = w; px < w + pad; px++) {
+            memcpy(out + px * 4, row + (w - 1) * 4, 4);
+        }
+    }
+}
+
+
+dake::gl::atlas::atlas(int page_width, int page_height, int padding):
+    pw(page_width),
+    ph(page_height),
+    pad(padding)
+{
+    if (pw < 4 || ph < 4 || pad < 0) {
+        throw std::invalid_argument("Invalid atlas page size or padding");
+    }
+}
+
+
+dake::gl::atlas::~atlas(void)
+{
+    for (image *img: images) {
+        delete img;
+    }
+    for (image *pg: pgs) {
+        delete pg;
+    }
+}
+
+
+int dake::gl::atlas::add(const image &img)
+{
+    if (img.format() == image::LINEAR_UINT8 && img.channels() == 4) {
+        images.push_back(new image(img));
+    } else {
+        images.push_back(new image(img, image::LINEAR_UINT8, 4));
+    }
+
+    return images.size() - 1;
+}
+
+
+int dake::gl::atlas::add(const std::string &file)
+{
+    auto i = files.find(file);
+    if (i != files.end()) {
+        return i->second;
+    }
+
+    int index = add(image(file));
+    files.emplace(file, index);
+
+    return index;
+}
+
+
+void dake::gl::atlas::add(const obj &o)
+{
+    for (const obj_section &s: o.sections) {
+        if (!s.material.tex_file.empty()) {
+            add(s.material.tex_file);
+        }
+    }
+}
+
+
+void dake::gl::atlas::pack(void)
+{
+    for (image *pg: pgs) {
+        delete pg;
+    }
+    pgs.clear();
+
+    places.resize(images.size());
+
+    // Padded sizes, rounded up to whole blocks
+    auto padded_width  = [this](int i) { return (images[i]->width()  + 2 * pad + 3) & ~3; };
+    auto padded_height = [this](int i) { return (images[i]->height() + 2 * pad + 3) & ~3; };
+
+    std::vector<int> order(images.size());
+    for (int i = 0; i < static_cast<int>(order.size()); i++) {
+        order[i] = i;
+    }
+    std::sort(order.begin(), order.end(), [&](int a, int b) {
+            int ha = padded_height(a), hb = padded_height(b);
+            return ha != hb ? ha > hb : padded_width(a) > padded_width(b);
+        });
+
+    std::vector<std::vector<skyline_segment>> skylines;
+
+    for (int index: order) {
+        int w = padded_width(index), h = padded_height(index);
+        if (w > pw || h > ph) {
+            throw std::invalid_argument("Image does not fit into an atlas page");
+        }
+
+        int page, seg = -1, x, y;
+        for (page = 0; page < static_cast<int>(skylines.size()); page++) {
+            seg = skyline_fit(skylines[page], pw, ph, w, h, &x, &y);
+            if (seg >= 0) {
+                break;
+            }
+        }
+
+        if (seg < 0) {
+            skylines.push_back(std::vector<skyline_segment>{ { 0, 0, pw } });
+            seg = 0;
+            x = 0;
+            y = 0;
+        }
+
+        skyline_insert(skylines[page], seg, w, y + h);
+
+        placement &p = places[index];
+        p.page = page;
+        p.x = x + pad;
+        p.y = y + pad;
+        p.width = images[index]->width();
+        p.height = images[index]->height();
+        p.offset = math::vec2(static_cast<float>(p.x) / pw, static_cast<float>(p.y) / ph);
+        p.scale = math::vec2(static_cast<float>(p.width) / pw, static_cast<float>(p.height) / ph);
+    }
+
+    for (size_t i = 0; i < skylines.size(); i++) {
+        pgs.push_back(new image(pw, ph, 4));
+    }
+
+    for (size_t i = 0; i < images.size(); i++) {
+        blit_padded(pgs[places[i].page], *images[i], places[i].x, places[i].y, pad);
+    }
+}
+
+
+void dake::gl::atlas::upload(array_texture &tex) const
+{
+    if (pgs.empty()) {
+        throw std::runtime_error("Atlas has not been packed");
+    }
+
+    tex.format(GL_RGBA8, pw, ph, pgs.size(), GL_RGBA, GL_UNSIGNED_BYTE);
+    for (int i = 0; i < static_cast<int>(pgs.size()); i++) {
+        tex.load_layer(i, *pgs[i]);
+    }
+}
+
+
+void dake::gl::atlas::remap(obj_section &s, int index) const
+{
+    const placement &p = places[index];
+
+    for (math::vec2 &tc: s.tex_coords) {
+        tc.s() = p.offset.s() + tc.s() * p.scale.s();
+        tc.t() = p.offset.t() + tc.t() * p.scale.t();
+    }
+}
+
+
+std::vector<int> dake::gl::atlas::remap(obj &o) const
+{
+    std::vector<int> page_of;
+
+    for (obj_section &s: o.sections) {
+        auto i = files.find(s.material.tex_file);
+        if (s.material.tex_file.empty() || i == files.end()) {
+            page_of.push_back(-1);
+            continue;
+        }
+
+        remap(s, i->second);
+        page_of.push_back(places[i->second].page);
+    }
+
+    return page_of;
+}
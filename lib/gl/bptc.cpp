@@ -0,0 +1,1371 @@
+#include <climits>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <utility>
+
+#include <dake/gl/bptc.hpp>
+#include <dake/gl/texel.hpp>
+#include <dake/gl/texture.hpp>
+#include <dake/helper/parallel.hpp>
+
+
+using dake::gl::image;
+
+
+// One lane per pixel of a 4x4 block.  BC6H works on half float bit patterns,
+// which do not fit the squared errors into 32-bit integers, so everything is
+// float here.
+typedef float texel_vector __attribute__((vector_size(64)));
+typedef int32_t lane_mask __attribute__((vector_size(64)));
+
+struct bptc_block {
+    // BC7: R, G, B, A; BC6H: half float bit patterns of R, G, B
+    texel_vector c[4];
+};
+
+// Blocks are read and written as a single little-endian 128-bit integer
+__extension__ typedef unsigned __int128 block_bits;
+
+struct bptc_reader {
+    block_bits bits;
+    int pos;
+
+    bptc_reader(const uint8_t *blk, int start):
+        pos(start)
+    {
+        memcpy(&bits, blk, sizeof(bits));
+    }
+
+    unsigned read(int count)
+    {
+        unsigned v = static_cast<unsigned>(bits >> pos) & ((1u << count) - 1);
+        pos += count;
+        return v;
+    }
+};
+
+struct bptc_writer {
+    block_bits bits = 0;
+    int pos = 0;
+
+    void write(unsigned v, int count)
+    {
+        bits |= static_cast<block_bits>(v & ((1u << count) - 1)) << pos;
+        pos += count;
+    }
+
+    void store(uint8_t *blk) const
+    {
+        memcpy(blk, &bits, sizeof(bits));
+    }
+};
+
+
+static const lane_mask lane_index = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 };
+
+static const int weights2[4] = { 0, 21, 43, 64 };
+static const int weights3[8] = { 0, 9, 18, 27, 37, 46, 55, 64 };
+static const int weights4[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+// Bit i is set for all pixels i in the second subset
+static const uint16_t partitions2[64] = {
+    0xcccc, 0x8888, 0xeeee, 0xecc8, 0xc880, 0xfeec, 0xfec8, 0xec80,
+    0xc800, 0xffec, 0xfe80, 0xe800, 0xffe8, 0xff00, 0xfff0, 0xf000,
+    0xf710, 0x008e, 0x7100, 0x08ce, 0x008c, 0x7310, 0x3100, 0x8cce,
+    0x088c, 0x3110, 0x6666, 0x366c, 0x17e8, 0x0ff0, 0x718e, 0x399c,
+    0xaaaa, 0xf0f0, 0x5a5a, 0x33cc, 0x3c3c, 0x55aa, 0x9696, 0xa55a,
+    0x73ce, 0x13c8, 0x324c, 0x3bdc, 0x6996, 0xc33c, 0x9966, 0x0660,
+    0x0272, 0x04e4, 0x4e40, 0x2720, 0xc936, 0x936c, 0x39c6, 0x639c,
+    0x9336, 0x9cc6, 0x817e, 0xe718, 0xccf0, 0x0fcc, 0x7744, 0xee22,
+};
+
+// Bits 2i and 2i + 1 give the subset of pixel i
+static const uint32_t partitions3[64] = {
+    0xaa685050, 0x6a5a5040, 0x5a5a4200, 0x5450a0a8, 0xa5a50000, 0xa0a05050, 0x5555a0a0, 0x5a5a5050,
+    0xaa550000, 0xaa555500, 0xaaaa5500, 0x90909090, 0x94949494, 0xa4a4a4a4, 0xa9a59450, 0x2a0a4250,
+    0xa5945040, 0x0a425054, 0xa5a5a500, 0x55a0a0a0, 0xa8a85454, 0x6a6a4040, 0xa4a45000, 0x1a1a0500,
+    0x0050a4a4, 0xaaa59090, 0x14696914, 0x69691400, 0xa08585a0, 0xaa821414, 0x50a4a450, 0x6a5a0200,
+    0xa9a58000, 0x5090a0a8, 0xa8a09050, 0x24242424, 0x00aa5500, 0x24924924, 0x24499224, 0x50a50a50,
+    0x500aa550, 0xaaaa4444, 0x66660000, 0xa5a0a5a0, 0x50a050a0, 0x69286928, 0x44aaaa44, 0x66666600,
+    0xaa444444, 0x54a854a8, 0x95809580, 0x96969600, 0xa85454a8, 0x80959580, 0xaa141414, 0x96960000,
+    0xaaaa1414, 0xa05050a0, 0xa0a5a5a0, 0x96000000, 0x40804080, 0xa9a8a9a8, 0xaaaaaa44, 0x2a4a5254,
+};
+
+// Anchor pixels (whose index's most significant bit is implicitly 0) of all
+// subsets but the first one, whose anchor is always pixel 0
+static const uint8_t anchors2[64] = {
+    15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15,
+    15,  2,  8,  2,  2,  8,  8, 15,  2,  8,  2,  2,  8,  8,  2,  2,
+    15, 15,  6,  8,  2,  8, 15, 15,  2,  8,  2,  2,  2, 15, 15,  6,
+     6,  2,  6,  8, 15, 15,  2,  2, 15, 15, 15, 15, 15,  2,  2, 15,
+};
+
+static const uint8_t anchors3_second[64] = {
+     3,  3, 15, 15,  8,  3, 15, 15,  8,  8,  6,  6,  6,  5,  3,  3,
+     3,  3,  8, 15,  3,  3,  6, 10,  5,  8,  8,  6,  8,  5, 15, 15,
+     8, 15,  3,  5,  6, 10,  8, 15, 15,  3, 15,  5, 15, 15, 15, 15,
+     3, 15,  5,  5,  5,  8,  5, 10,  5, 10,  8, 13, 15, 12,  3,  3,
+};
+
+static const uint8_t anchors3_third[64] = {
+    15,  8,  8,  3, 15, 15,  3,  8, 15, 15, 15, 15, 15, 15, 15,  8,
+    15,  8, 15,  3, 15,  8, 15,  8,  3, 15,  6, 10, 15, 15, 10,  8,
+    15,  3, 15, 10, 10,  8,  9, 10,  6, 15,  8, 15,  3,  6,  6,  8,
+    15,  3, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15,  3, 15, 15,  8,
+};
+
+
+static const int *weights(int index_bits)
+{
+    return index_bits == 2 ? weights2 : index_bits == 3 ? weights3 : weights4;
+}
+
+
+static int interpolate(int e0, int e1, int weight)
+{
+    return (e0 * (64 - weight) + e1 * weight + 32) >> 6;
+}
+
+
+static int subset_of(int subsets, int partition, int i)
+{
+    if (subsets == 2) {
+        return (partitions2[partition] >> i) & 1;
+    } else if (subsets == 3) {
+        return (partitions3[partition] >> (2 * i)) & 3;
+    } else {
+        return 0;
+    }
+}
+
+
+static bool is_anchor(int subsets, int partition, int i)
+{
+    return !i ||
+           (subsets == 2 && i == anchors2[partition]) ||
+           (subsets == 3 && (i == anchors3_second[partition] || i == anchors3_third[partition]));
+}
+
+
+// Picks the best palette entry for every pixel whose lane in valid is set,
+// comparing the given channels.  Other pixels get index 0.  Returns the total
+// squared error.
+static float select_indices(const bptc_block &bp, const lane_mask &valid, int first, int count, const int pal[16][4], int entries, uint8_t idx[16])
+{
+    texel_vector best_err = texel_vector{} + HUGE_VALF;
+    lane_mask best_idx = lane_mask{};
+
+    for (int e = 0; e < entries; e++) {
+        texel_vector err = texel_vector{};
+        for (int c = first; c < first + count; c++) {
+            texel_vector d = bp.c[c] - static_cast<float>(pal[e][c]);
+            err += d * d;
+        }
+
+        lane_mask better = err < best_err;
+        best_err = better ? err : best_err;
+        best_idx = better ? lane_mask{} + e : best_idx;
+    }
+
+    float total = 0.f;
+    for (int i = 0; i < 16; i++) {
+        idx[i] = valid[i] ? best_idx[i] : 0;
+        total += valid[i] ? best_err[i] : 0.f;
+    }
+
+    return total;
+}
+
+
+// Principal axis of the selected pixels in the given channels, clipped to the
+// range of the pixels' projections onto it and to [0, max]
+static void line_endpoints(const bptc_block &bp, const lane_mask &valid, int first, int count, float max, int iterations, float ep[2][4])
+{
+    int last = first + count;
+    float mean[4] = { 0.f, 0.f, 0.f, 0.f };
+    float mn[4] = { HUGE_VALF, HUGE_VALF, HUGE_VALF, HUGE_VALF };
+    float mx[4] = { -HUGE_VALF, -HUGE_VALF, -HUGE_VALF, -HUGE_VALF };
+    int n = 0;
+
+    for (int i = 0; i < 16; i++) {
+        if (valid[i]) {
+            for (int c = first; c < last; c++) {
+                float v = bp.c[c][i];
+                mean[c] += v;
+                mn[c] = v < mn[c] ? v : mn[c];
+                mx[c] = v > mx[c] ? v : mx[c];
+            }
+            n++;
+        }
+    }
+
+    float axis[4] = { 0.f, 0.f, 0.f, 0.f }, extent = 0.f;
+    for (int c = first; c < last; c++) {
+        mean[c] /= n;
+        axis[c] = mx[c] - mn[c];
+        extent += axis[c];
+    }
+
+    if (extent == 0.f) {
+        for (int c = first; c < last; c++) {
+            ep[0][c] = ep[1][c] = mean[c];
+        }
+        return;
+    }
+
+    float cov[4][4] = {};
+    for (int i = 0; i < 16; i++) {
+        if (valid[i]) {
+            for (int c = first; c < last; c++) {
+                for (int d = c; d < last; d++) {
+                    cov[c][d] += (bp.c[c][i] - mean[c]) * (bp.c[d][i] - mean[d]);
+                }
+            }
+        }
+    }
+    for (int c = first; c < last; c++) {
+        for (int d = first; d < c; d++) {
+            cov[c][d] = cov[d][c];
+        }
+    }
+
+    // Power iteration, starting from the bounding box diagonal
+    for (int iter = 0; iter < iterations; iter++) {
+        float v[4] = { 0.f, 0.f, 0.f, 0.f }, m = 0.f;
+        for (int c = first; c < last; c++) {
+            for (int d = first; d < last; d++) {
+                v[c] += cov[c][d] * axis[d];
+            }
+            m = fmaxf(m, fabsf(v[c]));
+        }
+
+        if (m < 1e-6f) {
+            break;
+        }
+        for (int c = first; c < last; c++) {
+            axis[c] = v[c] / m;
+        }
+    }
+
+    float len2 = 0.f;
+    for (int c = first; c < last; c++) {
+        len2 += axis[c] * axis[c];
+    }
+
+    float tmin = HUGE_VALF, tmax = -HUGE_VALF;
+    for (int i = 0; i < 16; i++) {
+        if (valid[i]) {
+            float t = 0.f;
+            for (int c = first; c < last; c++) {
+                t += (bp.c[c][i] - mean[c]) * axis[c];
+            }
+            t /= len2;
+            tmin = t < tmin ? t : tmin;
+            tmax = t > tmax ? t : tmax;
+        }
+    }
+
+    for (int c = first; c < last; c++) {
+        ep[0][c] = fminf(fmaxf(mean[c] + axis[c] * tmin, 0.f), max);
+        ep[1][c] = fminf(fmaxf(mean[c] + axis[c] * tmax, 0.f), max);
+    }
+}
+
+
+// Least-squares fit of both endpoints to the selected pixels, given their
+// current palette indices.  Returns false if the system is degenerate.
+static bool refine_endpoints(const bptc_block &bp, const lane_mask &valid, int first, int count, int index_bits, const uint8_t idx[16], float max, float ep[2][4])
+{
+    const int *w = weights(index_bits);
+    float aa = 0.f, ab = 0.f, bb = 0.f;
+    float ax[4] = { 0.f, 0.f, 0.f, 0.f }, bx[4] = { 0.f, 0.f, 0.f, 0.f };
+
+    for (int i = 0; i < 16; i++) {
+        if (valid[i]) {
+            float b = w[idx[i]] / 64.f, a = 1.f - b;
+            aa += a * a;
+            ab += a * b;
+            bb += b * b;
+            for (int c = first; c < first + count; c++) {
+                ax[c] += a * bp.c[c][i];
+                bx[c] += b * bp.c[c][i];
+            }
+        }
+    }
+
+    float det = aa * bb - ab * ab;
+    if (fabsf(det) < 1e-6f) {
+        return false;
+    }
+
+    for (int c = first; c < first + count; c++) {
+        ep[0][c] = fminf(fmaxf((ax[c] * bb - bx[c] * ab) / det, 0.f), max);
+        ep[1][c] = fminf(fmaxf((bx[c] * aa - ax[c] * ab) / det, 0.f), max);
+    }
+    return true;
+}
+
+
+// Squared distance of the selected pixels' colors from their principal axis
+// (an upper bound, as the axis is only approximated)
+static float line_residual(const bptc_block &bp, const lane_mask &valid)
+{
+    float mean[3] = { 0.f, 0.f, 0.f };
+    int n = 0;
+
+    for (int i = 0; i < 16; i++) {
+        if (valid[i]) {
+            for (int c = 0; c < 3; c++) {
+                mean[c] += bp.c[c][i];
+            }
+            n++;
+        }
+    }
+    for (int c = 0; c < 3; c++) {
+        mean[c] /= n;
+    }
+
+    // xx, xy, xz, yy, yz, zz
+    float cov[6] = { 0.f, 0.f, 0.f, 0.f, 0.f, 0.f };
+    for (int i = 0; i < 16; i++) {
+        if (valid[i]) {
+            float d[3] = {
+                bp.c[0][i] - mean[0],
+                bp.c[1][i] - mean[1],
+                bp.c[2][i] - mean[2]
+            };
+            cov[0] += d[0] * d[0];
+            cov[1] += d[0] * d[1];
+            cov[2] += d[0] * d[2];
+            cov[3] += d[1] * d[1];
+            cov[4] += d[1] * d[2];
+            cov[5] += d[2] * d[2];
+        }
+    }
+
+    float axis[3] = { 1.f, 1.f, 1.f };
+    float v[3] = { 0.f, 0.f, 0.f };
+    for (int iter = 0; iter < 4; iter++) {
+        v[0] = cov[0] * axis[0] + cov[1] * axis[1] + cov[2] * axis[2];
+        v[1] = cov[1] * axis[0] + cov[3] * axis[1] + cov[4] * axis[2];
+        v[2] = cov[2] * axis[0] + cov[4] * axis[1] + cov[5] * axis[2];
+
+        float m = fmaxf(fabsf(v[0]), fmaxf(fabsf(v[1]), fabsf(v[2])));
+        if (m < 1e-6f) {
+            return 0.f;
+        }
+        for (int c = 0; c < 3; c++) {
+            axis[c] = v[c] / m;
+        }
+    }
+
+    float len2 = axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2];
+    float lambda = (axis[0] * (cov[0] * axis[0] + cov[1] * axis[1] + cov[2] * axis[2]) +
+                    axis[1] * (cov[1] * axis[0] + cov[3] * axis[1] + cov[4] * axis[2]) +
+                    axis[2] * (cov[2] * axis[0] + cov[4] * axis[1] + cov[5] * axis[2])) / len2;
+
+    return cov[0] + cov[3] + cov[5] - lambda;
+}
+
+
+/* BC7 */
+
+struct bc7_mode_info {
+    int subsets;
+    int partition_bits, rotation_bits, index_selection_bits;
+    int color_bits, alpha_bits;
+    // Whether there is a p-bit per endpoint or one per subset shared by both
+    // of its endpoints
+    int endpoint_pbits, shared_pbits;
+    int index_bits, secondary_index_bits;
+};
+
+static const bc7_mode_info bc7_modes[8] = {
+    { 3, 4, 0, 0, 4, 0, 1, 0, 3, 0 },
+    { 2, 6, 0, 0, 6, 0, 0, 1, 3, 0 },
+    { 3, 6, 0, 0, 5, 0, 0, 0, 2, 0 },
+    { 2, 6, 0, 0, 7, 0, 1, 0, 2, 0 },
+    { 1, 0, 2, 1, 5, 6, 0, 0, 2, 3 },
+    { 1, 0, 2, 0, 7, 8, 0, 0, 2, 2 },
+    { 1, 0, 0, 0, 7, 7, 1, 0, 4, 0 },
+    { 2, 6, 0, 0, 5, 5, 1, 0, 2, 0 },
+};
+
+// Describes how the encoder fits a set of channels of one subset
+struct bc7_subset_params {
+    int first, count;
+    int bits;
+    // 0: none, 1: one per endpoint, 2: one shared by both endpoints
+    int pbits;
+    int index_bits;
+};
+
+struct bc7_fit {
+    // Quantized endpoints (without their p-bits) and p-bits
+    int q[2][4];
+    int p[2];
+    uint8_t idx[16];
+    float error;
+};
+
+
+static int bc7_expand(int v, int bits)
+{
+    v <<= 8 - bits;
+    return v | (v >> bits);
+}
+
+
+static void bc7_decode_block(const uint8_t *blk, uint8_t rgba[16][4])
+{
+    int mode = 0;
+    while (mode < 8 && !(blk[0] & (1 << mode))) {
+        mode++;
+    }
+
+    if (mode == 8) {
+        // Reserved
+        memset(rgba, 0, 16 * 4);
+        return;
+    }
+
+    const bc7_mode_info &m = bc7_modes[mode];
+    bptc_reader br(blk, mode + 1);
+
+    int partition = br.read(m.partition_bits);
+    int rotation = br.read(m.rotation_bits);
+    int index_selection = br.read(m.index_selection_bits);
+
+    int ep[3][2][4];
+    for (int c = 0; c < 3; c++) {
+        for (int s = 0; s < m.subsets; s++) {
+            for (int e = 0; e < 2; e++) {
+                ep[s][e][c] = br.read(m.color_bits);
+            }
+        }
+    }
+    for (int s = 0; s < m.subsets; s++) {
+        for (int e = 0; e < 2; e++) {
+            ep[s][e][3] = m.alpha_bits ? br.read(m.alpha_bits) : 255;
+        }
+    }
+
+    int pbits[3][2] = {};
+    for (int s = 0; s < m.subsets; s++) {
+        if (m.endpoint_pbits) {
+            pbits[s][0] = br.read(1);
+            pbits[s][1] = br.read(1);
+        } else if (m.shared_pbits) {
+            pbits[s][0] = pbits[s][1] = br.read(1);
+        }
+    }
+
+    int has_pbit = m.endpoint_pbits | m.shared_pbits;
+    for (int s = 0; s < m.subsets; s++) {
+        for (int e = 0; e < 2; e++) {
+            for (int c = 0; c < 3; c++) {
+                ep[s][e][c] = bc7_expand((ep[s][e][c] << has_pbit) | pbits[s][e], m.color_bits + has_pbit);
+            }
+            if (m.alpha_bits) {
+                ep[s][e][3] = bc7_expand((ep[s][e][3] << has_pbit) | pbits[s][e], m.alpha_bits + has_pbit);
+            }
+        }
+    }
+
+    int idx[16], idx2[16] = {};
+    for (int i = 0; i < 16; i++) {
+        idx[i] = br.read(m.index_bits - is_anchor(m.subsets, partition, i));
+    }
+    if (m.secondary_index_bits) {
+        for (int i = 0; i < 16; i++) {
+            idx2[i] = br.read(m.secondary_index_bits - !i);
+        }
+    }
+
+    for (int i = 0; i < 16; i++) {
+        int s = subset_of(m.subsets, partition, i);
+        int cw = weights(m.index_bits)[idx[i]], aw = cw;
+
+        if (m.secondary_index_bits) {
+            if (index_selection) {
+                cw = weights(m.secondary_index_bits)[idx2[i]];
+            } else {
+                aw = weights(m.secondary_index_bits)[idx2[i]];
+            }
+        }
+
+        for (int c = 0; c < 3; c++) {
+            rgba[i][c] = interpolate(ep[s][0][c], ep[s][1][c], cw);
+        }
+        rgba[i][3] = interpolate(ep[s][0][3], ep[s][1][3], aw);
+
+        if (rotation) {
+            std::swap(rgba[i][3], rgba[i][rotation - 1]);
+        }
+    }
+}
+
+
+static int bc7_dequantize(int q, int p, const bc7_subset_params &sp)
+{
+    int has_pbit = sp.pbits != 0;
+    return bc7_expand((q << has_pbit) | p, sp.bits + has_pbit);
+}
+
+
+static int bc7_quantize(float v, int p, const bc7_subset_params &sp)
+{
+    int has_pbit = sp.pbits != 0;
+    int max = (1 << sp.bits) - 1;
+    float full = v * ((1 << (sp.bits + has_pbit)) - 1) / 255.f;
+    int guess = static_cast<int>(lrintf(has_pbit ? (full - p) / 2.f : full));
+
+    int best = 0;
+    float best_err = HUGE_VALF;
+    for (int q = guess - 1; q <= guess + 1; q++) {
+        if (q < 0 || q > max) {
+            continue;
+        }
+
+        float err = fabsf(bc7_dequantize(q, p, sp) - v);
+        if (err < best_err) {
+            best = q;
+            best_err = err;
+        }
+    }
+
+    return best;
+}
+
+
+static float bc7_evaluate(const bptc_block &bp, const lane_mask &valid, const bc7_subset_params &sp, const float ep[2][4], const int p[2], bc7_fit *fit)
+{
+    int dq[2][4];
+    for (int e = 0; e < 2; e++) {
+        fit->p[e] = p[e];
+        for (int c = sp.first; c < sp.first + sp.count; c++) {
+            fit->q[e][c] = bc7_quantize(ep[e][c], p[e], sp);
+            dq[e][c] = bc7_dequantize(fit->q[e][c], p[e], sp);
+        }
+    }
+
+    const int *w = weights(sp.index_bits);
+    int entries = 1 << sp.index_bits;
+    int pal[16][4];
+    for (int i = 0; i < entries; i++) {
+        for (int c = sp.first; c < sp.first + sp.count; c++) {
+            pal[i][c] = interpolate(dq[0][c], dq[1][c], w[i]);
+        }
+    }
+
+    fit->error = select_indices(bp, valid, sp.first, sp.count, pal, entries, fit->idx);
+    return fit->error;
+}
+
+
+static float bc7_endpoint_error(const float ep[4], int p, const bc7_subset_params &sp)
+{
+    float err = 0.f;
+    for (int c = sp.first; c < sp.first + sp.count; c++) {
+        float d = bc7_dequantize(bc7_quantize(ep[c], p, sp), p, sp) - ep[c];
+        err += d * d;
+    }
+    return err;
+}
+
+
+// Quantizes the given endpoints, choosing the p-bits
+static void bc7_fit_endpoints(const bptc_block &bp, const lane_mask &valid, const bc7_subset_params &sp, const float ep[2][4], image::compression_quality q, bc7_fit *best)
+{
+    static const int combinations[4][2] = { { 0, 0 }, { 1, 1 }, { 0, 1 }, { 1, 0 } };
+
+    if (sp.pbits == 1 && q == image::COMPRESS_FAST) {
+        // Choose each endpoint's p-bit by its own quantization error only
+        int p[2];
+        for (int e = 0; e < 2; e++) {
+            p[e] = bc7_endpoint_error(ep[e], 1, sp) < bc7_endpoint_error(ep[e], 0, sp);
+        }
+        bc7_evaluate(bp, valid, sp, ep, p, best);
+        return;
+    }
+
+    int count = sp.pbits == 0 ? 1 : sp.pbits == 2 ? 2 : 4;
+    best->error = HUGE_VALF;
+
+    for (int i = 0; i < count; i++) {
+        bc7_fit fit;
+        if (bc7_evaluate(bp, valid, sp, ep, combinations[i], &fit) < best->error) {
+            *best = fit;
+        }
+    }
+}
+
+
+static void bc7_fit_subset(const bptc_block &bp, const lane_mask &valid, const bc7_subset_params &sp, image::compression_quality q, bc7_fit *fit)
+{
+    float ep[2][4];
+    line_endpoints(bp, valid, sp.first, sp.count, 255.f, q == image::COMPRESS_FAST ? 1 : 4, ep);
+    bc7_fit_endpoints(bp, valid, sp, ep, q, fit);
+
+    if (q == image::COMPRESS_BEST) {
+        for (int iter = 0; iter < 2 && fit->error > 0.f; iter++) {
+            if (!refine_endpoints(bp, valid, sp.first, sp.count, sp.index_bits, fit->idx, 255.f, ep)) {
+                break;
+            }
+
+            bc7_fit refined;
+            bc7_fit_endpoints(bp, valid, sp, ep, q, &refined);
+            if (refined.error >= fit->error) {
+                break;
+            }
+            *fit = refined;
+        }
+    }
+}
+
+
+// The most significant index bit of each subset's anchor pixel is not stored;
+// swap the endpoints if it is set
+static void bc7_fix_anchor(bc7_fit *fit, const bc7_subset_params &sp, const lane_mask &valid, int anchor)
+{
+    int top = 1 << (sp.index_bits - 1);
+    if (!(fit->idx[anchor] & top)) {
+        return;
+    }
+
+    for (int c = sp.first; c < sp.first + sp.count; c++) {
+        std::swap(fit->q[0][c], fit->q[1][c]);
+    }
+    std::swap(fit->p[0], fit->p[1]);
+
+    for (int i = 0; i < 16; i++) {
+        if (valid[i]) {
+            fit->idx[i] = 2 * top - 1 - fit->idx[i];
+        }
+    }
+}
+
+
+// Single subset, RGBA with 7 bits plus p-bit and 4-bit indices
+static float bc7_encode_mode6(const bptc_block &bp, image::compression_quality q, uint8_t out[16])
+{
+    static const bc7_subset_params sp = { 0, 4, 7, 1, 4 };
+    const lane_mask all = lane_mask{} - 1;
+
+    bc7_fit fit;
+    bc7_fit_subset(bp, all, sp, q, &fit);
+    bc7_fix_anchor(&fit, sp, all, 0);
+
+    bptc_writer bw;
+
+    bw.write(1 << 6, 7);
+    for (int c = 0; c < 4; c++) {
+        bw.write(fit.q[0][c], 7);
+        bw.write(fit.q[1][c], 7);
+    }
+    bw.write(fit.p[0], 1);
+    bw.write(fit.p[1], 1);
+    for (int i = 0; i < 16; i++) {
+        bw.write(fit.idx[i], i ? 4 : 3);
+    }
+    bw.store(out);
+
+    return fit.error;
+}
+
+
+// Single subset, separate RGB (7 bits) and alpha (8 bits) with 2-bit indices
+// each; the rotation swaps alpha with one of the color channels
+static float bc7_encode_mode5(const bptc_block &bp, int rotation, image::compression_quality q, uint8_t out[16])
+{
+    static const bc7_subset_params color = { 0, 3, 7, 0, 2 };
+    static const bc7_subset_params alpha = { 3, 1, 8, 0, 2 };
+    const lane_mask all = lane_mask{} - 1;
+
+    bptc_block rotated = bp;
+    if (rotation) {
+        std::swap(rotated.c[3], rotated.c[rotation - 1]);
+    }
+
+    bc7_fit cfit, afit;
+    bc7_fit_subset(rotated, all, color, q, &cfit);
+    bc7_fit_subset(rotated, all, alpha, q, &afit);
+    bc7_fix_anchor(&cfit, color, all, 0);
+    bc7_fix_anchor(&afit, alpha, all, 0);
+
+    bptc_writer bw;
+
+    bw.write(1 << 5, 6);
+    bw.write(rotation, 2);
+    for (int c = 0; c < 3; c++) {
+        bw.write(cfit.q[0][c], 7);
+        bw.write(cfit.q[1][c], 7);
+    }
+    bw.write(afit.q[0][3], 8);
+    bw.write(afit.q[1][3], 8);
+    for (int i = 0; i < 16; i++) {
+        bw.write(cfit.idx[i], i ? 2 : 1);
+    }
+    for (int i = 0; i < 16; i++) {
+        bw.write(afit.idx[i], i ? 2 : 1);
+    }
+    bw.store(out);
+
+    return cfit.error + afit.error;
+}
+
+
+// Two subsets, RGB with 6 bits plus shared p-bit and 3-bit indices, opaque.
+// Only the partitions whose subsets lie closest to a line are tried.
+static float bc7_encode_mode1(const bptc_block &bp, image::compression_quality q, uint8_t out[16])
+{
+    static const bc7_subset_params sp = { 0, 3, 6, 2, 3 };
+    const int max_candidates = 4;
+
+    int candidates[max_candidates];
+    float residuals[max_candidates];
+    int candidate_count = 0;
+
+    for (int p = 0; p < 64; p++) {
+        lane_mask second = ((lane_mask{} + partitions2[p]) >> lane_index & 1) != 0;
+        float res = line_residual(bp, ~second) + line_residual(bp, second);
+
+        int pos = candidate_count < max_candidates ? candidate_count++ : max_candidates;
+        while (pos > 0 && residuals[pos - 1] > res) {
+            if (pos < max_candidates) {
+                candidates[pos] = candidates[pos - 1];
+                residuals[pos] = residuals[pos - 1];
+            }
+            pos--;
+        }
+        if (pos < max_candidates) {
+            candidates[pos] = p;
+            residuals[pos] = res;
+        }
+    }
+
+    float best_err = HUGE_VALF;
+    int best_partition = 0;
+    bc7_fit best[2];
+
+    for (int i = 0; i < candidate_count; i++) {
+        int p = candidates[i];
+        lane_mask second = ((lane_mask{} + partitions2[p]) >> lane_index & 1) != 0;
+
+        bc7_fit fits[2];
+        bc7_fit_subset(bp, ~second, sp, q, &fits[0]);
+        bc7_fit_subset(bp, second, sp, q, &fits[1]);
+
+        if (fits[0].error + fits[1].error < best_err) {
+            best_err = fits[0].error + fits[1].error;
+            best_partition = p;
+            best[0] = fits[0];
+            best[1] = fits[1];
+        }
+    }
+
+    lane_mask second = ((lane_mask{} + partitions2[best_partition]) >> lane_index & 1) != 0;
+    bc7_fix_anchor(&best[0], sp, ~second, 0);
+    bc7_fix_anchor(&best[1], sp, second, anchors2[best_partition]);
+
+    bptc_writer bw;
+
+    bw.write(1 << 1, 2);
+    bw.write(best_partition, 6);
+    for (int c = 0; c < 3; c++) {
+        for (int s = 0; s < 2; s++) {
+            bw.write(best[s].q[0][c], 6);
+            bw.write(best[s].q[1][c], 6);
+        }
+    }
+    bw.write(best[0].p[0], 1);
+    bw.write(best[1].p[0], 1);
+    for (int i = 0; i < 16; i++) {
+        int s = subset_of(2, best_partition, i);
+        bw.write(best[s].idx[i], is_anchor(2, best_partition, i) ? 2 : 3);
+    }
+    bw.store(out);
+
+    return best_err;
+}
+
+
+static void bc7_encode_block(const bptc_block &bp, image::compression_quality q, uint8_t out[16])
+{
+    float err = bc7_encode_mode6(bp, q, out);
+    if (q == image::COMPRESS_FAST || !err) {
+        return;
+    }
+
+    bool opaque = true, constant_alpha = true;
+    for (int i = 0; i < 16; i++) {
+        opaque &= bp.c[3][i] == 255.f;
+        constant_alpha &= bp.c[3][i] == bp.c[3][0];
+    }
+
+    uint8_t candidate[16];
+
+    if (!constant_alpha || q == image::COMPRESS_BEST) {
+        for (int rotation = 0; rotation < (q == image::COMPRESS_BEST ? 4 : 1); rotation++) {
+            float e = bc7_encode_mode5(bp, rotation, q, candidate);
+            if (e < err) {
+                err = e;
+                memcpy(out, candidate, 16);
+            }
+        }
+    }
+
+    if (opaque && q == image::COMPRESS_BEST) {
+        float e = bc7_encode_mode1(bp, q, candidate);
+        if (e < err) {
+            memcpy(out, candidate, 16);
+        }
+    }
+}
+
+
+/* BC6H (unsigned only) */
+
+// Endpoint fields as named by the specification: channel * 4 + endpoint
+enum {
+    RW, RX, RY, RZ,
+    GW, GX, GY, GZ,
+    BW, BX, BY, BZ,
+    END
+};
+
+// Bits of a field, stored in order from first to last (which may be
+// descending)
+struct bc6h_segment {
+    uint8_t field, first, last;
+};
+
+struct bc6h_mode_info {
+    int mode, mode_bits;
+    bool transformed;
+    int regions;
+    int endpoint_bits, delta_bits[3];
+    bc6h_segment layout[24];
+};
+
+static const bc6h_mode_info bc6h_modes[14] = {
+    { 0x00, 2, true, 2, 10, { 5, 5, 5 }, {
+        { GY, 4, 4 }, { BY, 4, 4 }, { BZ, 4, 4 }, { RW, 0, 9 }, { GW, 0, 9 }, { BW, 0, 9 },
+        { RX, 0, 4 }, { GZ, 4, 4 }, { GY, 0, 3 }, { GX, 0, 4 }, { BZ, 0, 0 }, { GZ, 0, 3 },
+        { BX, 0, 4 }, { BZ, 1, 1 }, { BY, 0, 3 }, { RY, 0, 4 }, { BZ, 2, 2 }, { RZ, 0, 4 },
+        { BZ, 3, 3 }, { END, 0, 0 } } },
+    { 0x01, 2, true, 2, 7, { 6, 6, 6 }, {
+        { GY, 5, 5 }, { GZ, 4, 5 }, { RW, 0, 6 }, { BZ, 0, 1 }, { BY, 4, 4 }, { GW, 0, 6 },
+        { BY, 5, 5 }, { BZ, 2, 2 }, { GY, 4, 4 }, { BW, 0, 6 }, { BZ, 3, 3 }, { BZ, 5, 5 },
+        { BZ, 4, 4 }, { RX, 0, 5 }, { GY, 0, 3 }, { GX, 0, 5 }, { GZ, 0, 3 }, { BX, 0, 5 },
+        { BY, 0, 3 }, { RY, 0, 5 }, { RZ, 0, 5 }, { END, 0, 0 } } },
+    { 0x02, 5, true, 2, 11, { 5, 4, 4 }, {
+        { RW, 0, 9 }, { GW, 0, 9 }, { BW, 0, 9 }, { RX, 0, 4 }, { RW, 10, 10 }, { GY, 0, 3 },
+        { GX, 0, 3 }, { GW, 10, 10 }, { BZ, 0, 0 }, { GZ, 0, 3 }, { BX, 0, 3 }, { BW, 10, 10 },
+        { BZ, 1, 1 }, { BY, 0, 3 }, { RY, 0, 4 }, { BZ, 2, 2 }, { RZ, 0, 4 }, { BZ, 3, 3 },
+        { END, 0, 0 } } },
+    { 0x06, 5, true, 2, 11, { 4, 5, 4 }, {
+        { RW, 0, 9 }, { GW, 0, 9 }, { BW, 0, 9 }, { RX, 0, 3 }, { RW, 10, 10 }, { GZ, 4, 4 },
+        { GY, 0, 3 }, { GX, 0, 4 }, { GW, 10, 10 }, { GZ, 0, 3 }, { BX, 0, 3 }, { BW, 10, 10 },
+        { BZ, 1, 1 }, { BY, 0, 3 }, { RY, 0, 3 }, { BZ, 0, 0 }, { BZ, 2, 2 }, { RZ, 0, 3 },
+        { GY, 4, 4 }, { BZ, 3, 3 }, { END, 0, 0 } } },
+    { 0x0a, 5, true, 2, 11, { 4, 4, 5 }, {
+        { RW, 0, 9 }, { GW, 0, 9 }, { BW, 0, 9 }, { RX, 0, 3 }, { RW, 10, 10 }, { BY, 4, 4 },
+        { GY, 0, 3 }, { GX, 0, 3 }, { GW, 10, 10 }, { BZ, 0, 0 }, { GZ, 0, 3 }, { BX, 0, 4 },
+        { BW, 10, 10 }, { BY, 0, 3 }, { RY, 0, 3 }, { BZ, 1, 2 }, { RZ, 0, 3 }, { BZ, 4, 4 },
+        { BZ, 3, 3 }, { END, 0, 0 } } },
+    { 0x0e, 5, true, 2, 9, { 5, 5, 5 }, {
+        { RW, 0, 8 }, { BY, 4, 4 }, { GW, 0, 8 }, { GY, 4, 4 }, { BW, 0, 8 }, { BZ, 4, 4 },
+        { RX, 0, 4 }, { GZ, 4, 4 }, { GY, 0, 3 }, { GX, 0, 4 }, { BZ, 0, 0 }, { GZ, 0, 3 },
+        { BX, 0, 4 }, { BZ, 1, 1 }, { BY, 0, 3 }, { RY, 0, 4 }, { BZ, 2, 2 }, { RZ, 0, 4 },
+        { BZ, 3, 3 }, { END, 0, 0 } } },
+    { 0x12, 5, true, 2, 8, { 6, 5, 5 }, {
+        { RW, 0, 7 }, { GZ, 4, 4 }, { BY, 4, 4 }, { GW, 0, 7 }, { BZ, 2, 2 }, { GY, 4, 4 },
+        { BW, 0, 7 }, { BZ, 3, 4 }, { RX, 0, 5 }, { GY, 0, 3 }, { GX, 0, 4 }, { BZ, 0, 0 },
+        { GZ, 0, 3 }, { BX, 0, 4 }, { BZ, 1, 1 }, { BY, 0, 3 }, { RY, 0, 5 }, { RZ, 0, 5 },
+        { END, 0, 0 } } },
+    { 0x16, 5, true, 2, 8, { 5, 6, 5 }, {
+        { RW, 0, 7 }, { BZ, 0, 0 }, { BY, 4, 4 }, { GW, 0, 7 }, { GY, 5, 4 }, { BW, 0, 7 },
+        { GZ, 5, 5 }, { BZ, 4, 4 }, { RX, 0, 4 }, { GZ, 4, 4 }, { GY, 0, 3 }, { GX, 0, 5 },
+        { GZ, 0, 3 }, { BX, 0, 4 }, { BZ, 1, 1 }, { BY, 0, 3 }, { RY, 0, 4 }, { BZ, 2, 2 },
+        { RZ, 0, 4 }, { BZ, 3, 3 }, { END, 0, 0 } } },
+    { 0x1a, 5, true, 2, 8, { 5, 5, 6 }, {
+        { RW, 0, 7 }, { BZ, 1, 1 }, { BY, 4, 4 }, { GW, 0, 7 }, { BY, 5, 5 }, { GY, 4, 4 },
+        { BW, 0, 7 }, { BZ, 5, 4 }, { RX, 0, 4 }, { GZ, 4, 4 }, { GY, 0, 3 }, { GX, 0, 4 },
+        { BZ, 0, 0 }, { GZ, 0, 3 }, { BX, 0, 5 }, { BY, 0, 3 }, { RY, 0, 4 }, { BZ, 2, 2 },
+        { RZ, 0, 4 }, { BZ, 3, 3 }, { END, 0, 0 } } },
+    { 0x1e, 5, false, 2, 6, { 6, 6, 6 }, {
+        { RW, 0, 5 }, { GZ, 4, 4 }, { BZ, 0, 1 }, { BY, 4, 4 }, { GW, 0, 5 }, { GY, 5, 5 },
+        { BY, 5, 5 }, { BZ, 2, 2 }, { GY, 4, 4 }, { BW, 0, 5 }, { GZ, 5, 5 }, { BZ, 3, 3 },
+        { BZ, 5, 4 }, { RX, 0, 5 }, { GY, 0, 3 }, { GX, 0, 5 }, { GZ, 0, 3 }, { BX, 0, 5 },
+        { BY, 0, 3 }, { RY, 0, 5 }, { RZ, 0, 5 }, { END, 0, 0 } } },
+    { 0x03, 5, false, 1, 10, { 10, 10, 10 }, {
+        { RW, 0, 9 }, { GW, 0, 9 }, { BW, 0, 9 }, { RX, 0, 9 }, { GX, 0, 9 }, { BX, 0, 9 },
+        { END, 0, 0 } } },
+    { 0x07, 5, true, 1, 11, { 9, 9, 9 }, {
+        { RW, 0, 9 }, { GW, 0, 9 }, { BW, 0, 9 }, { RX, 0, 8 }, { RW, 10, 10 }, { GX, 0, 8 },
+        { GW, 10, 10 }, { BX, 0, 8 }, { BW, 10, 10 }, { END, 0, 0 } } },
+    { 0x0b, 5, true, 1, 12, { 8, 8, 8 }, {
+        { RW, 0, 9 }, { GW, 0, 9 }, { BW, 0, 9 }, { RX, 0, 7 }, { RW, 11, 10 }, { GX, 0, 7 },
+        { GW, 11, 10 }, { BX, 0, 7 }, { BW, 11, 10 }, { END, 0, 0 } } },
+    { 0x0f, 5, true, 1, 16, { 4, 4, 4 }, {
+        { RW, 0, 9 }, { GW, 0, 9 }, { BW, 0, 9 }, { RX, 0, 3 }, { RW, 15, 10 }, { GX, 0, 3 },
+        { GW, 15, 10 }, { BX, 0, 3 }, { BW, 15, 10 }, { END, 0, 0 } } },
+};
+
+
+static int bc6h_unquantize(int q, int bits)
+{
+    if (bits >= 15) {
+        return q;
+    } else if (!q) {
+        return 0;
+    } else if (q == (1 << bits) - 1) {
+        return 0xffff;
+    } else {
+        return ((q << 16) + 0x8000) >> bits;
+    }
+}
+
+
+// Scales an interpolated value to a (positive) half float bit pattern
+static int bc6h_finish(int v)
+{
+    return (v * 31) >> 6;
+}
+
+
+static int sign_extend(int v, int bits)
+{
+    return (v ^ (1 << (bits - 1))) - (1 << (bits - 1));
+}
+
+
+static void bc6h_decode_block(const uint8_t *blk, uint16_t rgb[16][3])
+{
+    bptc_reader br(blk, 0);
+
+    int mode = br.read(2);
+    int mode_bits = 2;
+    if (mode & 2) {
+        mode |= br.read(3) << 2;
+        mode_bits = 5;
+    }
+
+    const bc6h_mode_info *m = nullptr;
+    for (const bc6h_mode_info &mi: bc6h_modes) {
+        if (mi.mode == mode && mi.mode_bits == mode_bits) {
+            m = &mi;
+            break;
+        }
+    }
+
+    if (!m) {
+        // Reserved
+        memset(rgb, 0, 16 * 3 * sizeof(rgb[0][0]));
+        return;
+    }
+
+    int fields[END] = {};
+    for (const bc6h_segment *seg = m->layout; seg->field != END; seg++) {
+        int step = seg->first <= seg->last ? 1 : -1;
+        for (int b = seg->first; ; b += step) {
+            fields[seg->field] |= br.read(1) << b;
+            if (b == seg->last) {
+                break;
+            }
+        }
+    }
+
+    int partition = m->regions == 2 ? br.read(5) : 0;
+    int index_bits = m->regions == 2 ? 3 : 4;
+
+    // [region * 2 + endpoint][channel]
+    int ep[4][3];
+    int mask = (1 << m->endpoint_bits) - 1;
+    for (int c = 0; c < 3; c++) {
+        ep[0][c] = fields[c * 4];
+        for (int e = 1; e < m->regions * 2; e++) {
+            int v = fields[c * 4 + e];
+            if (m->transformed) {
+                v = (ep[0][c] + sign_extend(v, m->delta_bits[c])) & mask;
+            }
+            ep[e][c] = v;
+        }
+        for (int e = 0; e < m->regions * 2; e++) {
+            ep[e][c] = bc6h_unquantize(ep[e][c], m->endpoint_bits);
+        }
+    }
+
+    const int *w = weights(index_bits);
+    for (int i = 0; i < 16; i++) {
+        int s = subset_of(m->regions, partition, i);
+        int idx = br.read(index_bits - is_anchor(m->regions, partition, i));
+
+        for (int c = 0; c < 3; c++) {
+            rgb[i][c] = bc6h_finish(interpolate(ep[s * 2][c], ep[s * 2 + 1][c], w[idx]));
+        }
+    }
+}
+
+
+struct bc6h_fit {
+    const bc6h_mode_info *mode;
+    int q[2][3];
+    uint8_t idx[16];
+    float error;
+};
+
+
+static int bc6h_quantize(float h, int bits)
+{
+    // Invert bc6h_finish() and bc6h_unquantize(), then search around that
+    float u = h * 64.f / 31.f;
+    int max = (1 << bits) - 1;
+    int guess = static_cast<int>(lrintf(bits >= 15 ? u : u * (1 << bits) / 65536.f - .5f));
+
+    int best = 0;
+    float best_err = HUGE_VALF;
+    for (int q = guess - 1; q <= guess + 1; q++) {
+        if (q < 0 || q > max) {
+            continue;
+        }
+
+        float err = fabsf(bc6h_finish(bc6h_unquantize(q, bits)) - h);
+        if (err < best_err) {
+            best = q;
+            best_err = err;
+        }
+    }
+
+    return best;
+}
+
+
+static float bc6h_evaluate(const bptc_block &bp, const lane_mask &valid, const float ep[2][4], const bc6h_mode_info &m, bc6h_fit *fit)
+{
+    fit->mode = &m;
+
+    int uq[2][3];
+    for (int c = 0; c < 3; c++) {
+        fit->q[0][c] = bc6h_quantize(ep[0][c], m.endpoint_bits);
+        fit->q[1][c] = bc6h_quantize(ep[1][c], m.endpoint_bits);
+
+        if (m.transformed) {
+            // Clamp symmetrically, so the delta still fits when the endpoints
+            // get swapped for the anchor
+            int limit = (1 << (m.delta_bits[c] - 1)) - 1;
+            int delta = fit->q[1][c] - fit->q[0][c];
+            delta = delta < -limit ? -limit : delta > limit ? limit : delta;
+            fit->q[1][c] = fit->q[0][c] + delta;
+        }
+
+        uq[0][c] = bc6h_unquantize(fit->q[0][c], m.endpoint_bits);
+        uq[1][c] = bc6h_unquantize(fit->q[1][c], m.endpoint_bits);
+    }
+
+    int pal[16][4];
+    for (int i = 0; i < 16; i++) {
+        for (int c = 0; c < 3; c++) {
+            pal[i][c] = bc6h_finish(interpolate(uq[0][c], uq[1][c], weights4[i]));
+        }
+    }
+
+    fit->error = select_indices(bp, valid, 0, 3, pal, 16, fit->idx);
+    return fit->error;
+}
+
+
+// Writes a single-region block
+static void bc6h_pack(const bc6h_fit &fit, uint8_t *out)
+{
+    const bc6h_mode_info &m = *fit.mode;
+
+    int fields[END] = {};
+    for (int c = 0; c < 3; c++) {
+        fields[c * 4] = fit.q[0][c];
+        fields[c * 4 + 1] = m.transformed ? fit.q[1][c] - fit.q[0][c] : fit.q[1][c];
+    }
+
+    bptc_writer bw;
+    bw.write(m.mode, m.mode_bits);
+    for (const bc6h_segment *seg = m.layout; seg->field != END; seg++) {
+        int step = seg->first <= seg->last ? 1 : -1;
+        for (int b = seg->first; ; b += step) {
+            bw.write(fields[seg->field] >> b, 1);
+            if (b == seg->last) {
+                break;
+            }
+        }
+    }
+    for (int i = 0; i < 16; i++) {
+        bw.write(fit.idx[i], i ? 4 : 3);
+    }
+    bw.store(out);
+}
+
+
+// Uses the single-region modes: 11 (10-bit endpoints) only with
+// COMPRESS_FAST, otherwise also the transformed modes 12 to 14, which trade
+// delta range for endpoint precision.  Errors are measured on the half float
+// bit patterns, i.e. roughly logarithmically.
+static void bc6h_encode_block(const bptc_block &bp, image::compression_quality quality, uint8_t out[16])
+{
+    const lane_mask all = lane_mask{} - 1;
+    const bc6h_mode_info *single_region = &bc6h_modes[10];
+    int mode_count = quality == image::COMPRESS_FAST ? 1 : 4;
+
+    float ep[2][4];
+    line_endpoints(bp, all, 0, 3, 31743.f, quality == image::COMPRESS_FAST ? 1 : 4, ep);
+
+    bc6h_fit best;
+    best.error = HUGE_VALF;
+    for (int i = 0; i < mode_count; i++) {
+        bc6h_fit fit;
+        if (bc6h_evaluate(bp, all, ep, single_region[i], &fit) < best.error) {
+            best = fit;
+        }
+    }
+
+    if (quality == image::COMPRESS_BEST) {
+        for (int iter = 0; iter < 2 && best.error > 0.f; iter++) {
+            if (!refine_endpoints(bp, all, 0, 3, 4, best.idx, 31743.f, ep)) {
+                break;
+            }
+
+            bc6h_fit refined;
+            if (bc6h_evaluate(bp, all, ep, *best.mode, &refined) >= best.error) {
+                break;
+            }
+            best = refined;
+        }
+    }
+
+    if (best.idx[0] & 8) {
+        for (int c = 0; c < 3; c++) {
+            std::swap(best.q[0][c], best.q[1][c]);
+        }
+        for (int i = 0; i < 16; i++) {
+            best.idx[i] = 15 - best.idx[i];
+        }
+    }
+
+    bc6h_pack(best, out);
+}
+
+
+// Maps BC6H output (non-negative half floats) to [0, 255]
+struct bc6h_unorm8_table {
+    uint8_t v[0x7c00];
+
+    bc6h_unorm8_table(void)
+    {
+        for (int h = 0; h < 0x7c00; h++) {
+            v[h] = static_cast<uint8_t>(fminf(dake::gl::texel::half_to_float(h), 1.f) * 255.f + .5f);
+        }
+    }
+};
+
+
+static const bc6h_unorm8_table &get_bc6h_unorm8_table(void)
+{
+    static const bc6h_unorm8_table table;
+    return table;
+}
+
+
+static void check_format(image::channel_format fmt)
+{
+    if (fmt != image::COMPRESSED_BPTC_RGBA && fmt != image::COMPRESSED_BPTC_RGB_UFLOAT) {
+        throw std::invalid_argument("Not a BPTC format");
+    }
+}
+
+
+static void fetch_block(bptc_block *bp, const uint8_t *src, int w, int h, int cc, size_t stride, int bx, int by, const uint16_t *halfs)
+{
+    for (int i = 0; i < 16; i++) {
+        int x = bx * 4 + (i & 3), y = by * 4 + (i >> 2);
+        if (x >= w) {
+            x = w - 1;
+        }
+        if (y >= h) {
+            y = h - 1;
+        }
+
+        const uint8_t *p = src + y * stride + x * cc;
+        int v[4] = { p[0], cc > 1 ? p[1] : 0, cc > 2 ? p[2] : 0, cc > 3 ? p[3] : 255 };
+
+        for (int c = 0; c < 4; c++) {
+            bp->c[c][i] = halfs ? halfs[v[c]] : v[c];
+        }
+    }
+}
+
+
+// BC6H only: half float input, clamped to the representable unsigned range
+static void fetch_half_block(bptc_block *bp, const uint8_t *src, int w, int h, int cc, size_t stride, int bx, int by)
+{
+    for (int i = 0; i < 16; i++) {
+        int x = bx * 4 + (i & 3), y = by * 4 + (i >> 2);
+        if (x >= w) {
+            x = w - 1;
+        }
+        if (y >= h) {
+            y = h - 1;
+        }
+
+        const uint16_t *p = reinterpret_cast<const uint16_t *>(src + y * stride + x * cc * 2);
+        for (int c = 0; c < 3; c++) {
+            uint16_t v = c < cc ? p[c] : 0;
+            // Negative values and NaNs become 0, infinity the largest value
+            bp->c[c][i] = (v & 0x8000) || v > 0x7c00 ? 0 : v == 0x7c00 ? 0x7bff : v;
+        }
+        bp->c[3][i] = 0;
+    }
+}
+
+
+void dake::gl::bptc::compress(image::channel_format fmt, void *dst, const void *src, int width, int height, int channels, size_t stride, image::compression_quality quality)
+{
+    check_format(fmt);
+
+    int bw = (width + 3) / 4, bh = (height + 3) / 4;
+    const uint8_t *in = static_cast<const uint8_t *>(src);
+    uint8_t *out = static_cast<uint8_t *>(dst);
+
+    bool hdr = fmt == image::COMPRESSED_BPTC_RGB_UFLOAT;
+    uint16_t halfs[256];
+    for (int i = 0; i < 256; i++) {
+        halfs[i] = dake::gl::texel::float_to_half(i / 255.f);
+    }
+
+    dake::helper::parallel_for(0, bh, [=, &halfs](int first, int last) {
+            bptc_block bp;
+
+            for (int by = first; by < last; by++) {
+                uint8_t *row = out + static_cast<size_t>(by) * bw * 16;
+
+                for (int bx = 0; bx < bw; bx++) {
+                    fetch_block(&bp, in, width, height, channels, stride, bx, by, hdr ? halfs : nullptr);
+
+                    if (hdr) {
+                        bc6h_encode_block(bp, quality, row + bx * 16);
+                    } else {
+                        bc7_encode_block(bp, quality, row + bx * 16);
+                    }
+                }
+            }
+        }, 4);
+}
+
+
+void dake::gl::bptc::decompress(image::channel_format fmt, void *dst, const void *src, int width, int height, int channels, size_t stride)
+{
+    check_format(fmt);
+
+    if (channels < 1 || channels > 4) {
+        throw std::invalid_argument("Invalid channel count for decompression");
+    }
+
+    int bw = (width + 3) / 4, bh = (height + 3) / 4;
+    const uint8_t *in = static_cast<const uint8_t *>(src);
+    uint8_t *out = static_cast<uint8_t *>(dst);
+    bool hdr = fmt == image::COMPRESSED_BPTC_RGB_UFLOAT;
+    const bc6h_unorm8_table &unorm8 = get_bc6h_unorm8_table();
+
+    dake::helper::parallel_for(0, bh, [=, &unorm8](int first, int last) {
+            uint8_t rgba[16][4];
+            uint16_t rgb[16][3];
+
+            for (int by = first; by < last; by++) {
+                const uint8_t *blk = in + static_cast<size_t>(by) * bw * 16;
+
+                for (int bx = 0; bx < bw; bx++, blk += 16) {
+                    if (hdr) {
+                        bc6h_decode_block(blk, rgb);
+                        for (int i = 0; i < 16; i++) {
+                            for (int c = 0; c < 3; c++) {
+                                rgba[i][c] = unorm8.v[rgb[i][c]];
+                            }
+                            rgba[i][3] = 255;
+                        }
+                    } else {
+                        bc7_decode_block(blk, rgba);
+                    }
+
+                    for (int i = 0; i < 16; i++) {
+                        int x = bx * 4 + (i & 3), y = by * 4 + (i >> 2);
+                        if (x < width && y < height) {
+                            memcpy(out + y * stride + x * channels, rgba[i], channels);
+                        }
+                    }
+                }
+            }
+        }, 4);
+}
+
+
+void dake::gl::bptc::compress_half(image::channel_format fmt, void *dst, const void *src, int width, int height, int channels, size_t stride, image::compression_quality quality)
+{
+    if (fmt != image::COMPRESSED_BPTC_RGB_UFLOAT) {
+        throw std::invalid_argument("Only BC6H can be compressed from half floats");
+    }
+
+    int bw = (width + 3) / 4, bh = (height + 3) / 4;
+    const uint8_t *in = static_cast<const uint8_t *>(src);
+    uint8_t *out = static_cast<uint8_t *>(dst);
+
+    dake::helper::parallel_for(0, bh, [=](int first, int last) {
+            bptc_block bp;
+
+            for (int by = first; by < last; by++) {
+                uint8_t *row = out + static_cast<size_t>(by) * bw * 16;
+
+                for (int bx = 0; bx < bw; bx++) {
+                    fetch_half_block(&bp, in, width, height, channels, stride, bx, by);
+                    bc6h_encode_block(bp, quality, row + bx * 16);
+                }
+            }
+        }, 4);
+}
+
+
+void dake::gl::bptc::decompress_half(image::channel_format fmt, void *dst, const void *src, int width, int height, int channels, size_t stride)
+{
+    if (fmt != image::COMPRESSED_BPTC_RGB_UFLOAT) {
+        throw std::invalid_argument("Only BC6H can be decompressed to half floats");
+    }
+    if (channels < 1 || channels > 4) {
+        throw std::invalid_argument("Invalid channel count for decompression");
+    }
+
+    int bw = (width + 3) / 4, bh = (height + 3) / 4;
+    const uint8_t *in = static_cast<const uint8_t *>(src);
+    uint8_t *out = static_cast<uint8_t *>(dst);
+
+    dake::helper::parallel_for(0, bh, [=](int first, int last) {
+            uint16_t rgb[16][3];
+
+            for (int by = first; by < last; by++) {
+                const uint8_t *blk = in + static_cast<size_t>(by) * bw * 16;
+
+                for (int bx = 0; bx < bw; bx++, blk += 16) {
+                    bc6h_decode_block(blk, rgb);
+
+                    for (int i = 0; i < 16; i++) {
+                        int x = bx * 4 + (i & 3), y = by * 4 + (i >> 2);
+                        if (x < width && y < height) {
+                            // Alpha is 1.0
+                            uint16_t px[4] = { rgb[i][0], rgb[i][1], rgb[i][2], 0x3c00 };
+                            memcpy(out + y * stride + x * channels * 2, px, channels * 2);
+                        }
+                    }
+                }
+            }
+        }, 4);
+}
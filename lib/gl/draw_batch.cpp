@@ -0,0 +1,229 @@
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+
+#include <dake/gl/draw_batch.hpp>
+#include <dake/gl/elements_array.hpp>
+#include <dake/gl/gl.hpp>
+#include <dake/gl/obj.hpp>
+#include <dake/gl/vertex_array.hpp>
+#include <dake/gl/vertex_attrib.hpp>
+#include <dake/math/matrix.hpp>
+
+
+dake::gl::draw_batch::draw_batch(int pos_idx, int txc_idx, int nrm_idx, int draw_idx):
+    pos_attr(pos_idx),
+    txc_attr(txc_idx),
+    nrm_attr(nrm_idx),
+    draw_attr(draw_idx)
+{
+    if (pos_idx < 0) {
+        throw std::invalid_argument("dake::gl::draw_batch: pos_idx must be valid");
+    }
+
+    if (glext.has_direct_state_access()) {
+        glCreateBuffers(1, &indirect_buffer);
+    } else {
+        glGenBuffers(1, &indirect_buffer);
+    }
+}
+
+
+dake::gl::draw_batch::~draw_batch(void)
+{
+    glDeleteBuffers(1, &indirect_buffer);
+    delete va;
+}
+
+
+size_t dake::gl::draw_batch::add(const obj_section &section)
+{
+    return add(section.positions.data(),
+               section.tex_coords.empty() ? nullptr : section.tex_coords.data(),
+               section.normals.empty() ? nullptr : section.normals.data(),
+               section.positions.size());
+}
+
+
+size_t dake::gl::draw_batch::add(const math::vec3 *pos, const math::vec2 *txc, const math::vec3 *nrm, size_t vertices,
+                                 const uint32_t *idx, size_t index_count)
+{
+    if ((txc_attr >= 0) && !txc) {
+        throw std::invalid_argument("dake::gl::draw_batch::add: No texture coordinates given");
+    }
+    if ((nrm_attr >= 0) && !nrm) {
+        throw std::invalid_argument("dake::gl::draw_batch::add: No normals given");
+    }
+
+    mesh m = { positions.size(), vertices, indices.size(), idx ? index_count : 0 };
+    meshes.push_back(m);
+
+    positions.insert(positions.end(), pos, pos + vertices);
+    if (txc_attr >= 0) {
+        tex_coords.insert(tex_coords.end(), txc, txc + vertices);
+    }
+    if (nrm_attr >= 0) {
+        normals.insert(normals.end(), nrm, nrm + vertices);
+    }
+    if (idx) {
+        indices.insert(indices.end(), idx, idx + index_count);
+        indexed = true;
+    }
+
+    dirty = true;
+    return meshes.size() - 1;
+}
+
+
+// Recreates the vertex array and the command buffer from everything added
+void dake::gl::draw_batch::upload(void)
+{
+    delete va;
+    va = new vertex_array;
+    va->set_elements(positions.size());
+
+    vertex_attrib *va_pos = va->attrib(pos_attr);
+    va_pos->format(3);
+    va_pos->data(positions.data());
+
+    if (txc_attr >= 0) {
+        vertex_attrib *va_txc = va->attrib(txc_attr);
+        va_txc->format(2);
+        va_txc->data(tex_coords.data());
+    }
+
+    if (nrm_attr >= 0) {
+        vertex_attrib *va_nrm = va->attrib(nrm_attr);
+        va_nrm->format(3);
+        va_nrm->data(normals.data());
+    }
+
+    if (draw_attr >= 0) {
+        std::vector<uint32_t> draw_indices(meshes.size());
+        for (size_t i = 0; i < meshes.size(); i++) {
+            draw_indices[i] = i;
+        }
+
+        vertex_attrib *va_draw = va->attrib(draw_attr);
+        va_draw->format(1, GL_UNSIGNED_INT);
+        va_draw->data(draw_indices.data(), draw_indices.size() * sizeof(uint32_t));
+        // Advances once per instance, so the base instance selects the value
+        va_draw->divisor(1);
+    }
+
+    arrays_commands.clear();
+    elements_commands.clear();
+
+    std::vector<uint32_t> all_indices;
+    const void *commands;
+    size_t commands_size;
+
+    if (indexed) {
+        for (size_t i = 0; i < meshes.size(); i++) {
+            const mesh &m = meshes[i];
+            elements_command cmd = {
+                static_cast<GLuint>(m.index_count ? m.index_count : m.vertices), 1,
+                static_cast<GLuint>(all_indices.size()), static_cast<GLint>(m.first_vertex), static_cast<GLuint>(i)
+            };
+            elements_commands.push_back(cmd);
+
+            if (m.index_count) {
+                all_indices.insert(all_indices.end(), indices.begin() + m.first_index,
+                                   indices.begin() + m.first_index + m.index_count);
+            } else {
+                for (size_t j = 0; j < m.vertices; j++) {
+                    all_indices.push_back(j);
+                }
+            }
+        }
+
+        elements_array *ea = va->indices();
+        ea->format(1, GL_UNSIGNED_INT);
+        ea->data(all_indices.data(), all_indices.size() * sizeof(uint32_t));
+
+        commands = elements_commands.data();
+        commands_size = elements_commands.size() * sizeof(elements_command);
+    } else {
+        for (size_t i = 0; i < meshes.size(); i++) {
+            const mesh &m = meshes[i];
+            arrays_command cmd = {
+                static_cast<GLuint>(m.vertices), 1, static_cast<GLuint>(m.first_vertex), static_cast<GLuint>(i)
+            };
+            arrays_commands.push_back(cmd);
+        }
+
+        commands = arrays_commands.data();
+        commands_size = arrays_commands.size() * sizeof(arrays_command);
+    }
+
+    if (glext.has_direct_state_access()) {
+        glNamedBufferData(indirect_buffer, commands_size, commands, GL_STATIC_DRAW);
+    } else {
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirect_buffer);
+        glBufferData(GL_DRAW_INDIRECT_BUFFER, commands_size, commands, GL_STATIC_DRAW);
+    }
+
+    dirty = false;
+}
+
+
+void dake::gl::draw_batch::draw(GLenum type, size_t first, size_t count)
+{
+    if (!count) {
+        count = meshes.size() - first;
+    }
+    if (first > meshes.size() || count > meshes.size() - first) {
+        throw std::out_of_range("dake::gl::draw_batch::draw: Draws out of range");
+    }
+    if (!count) {
+        return;
+    }
+
+    if (dirty) {
+        upload();
+    }
+
+    va->bind();
+
+    if (glext.has_extension(MULTI_DRAW_INDIRECT)) {
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirect_buffer);
+
+        if (indexed) {
+            va->indices()->bind();
+            glMultiDrawElementsIndirect(type, GL_UNSIGNED_INT,
+                                        reinterpret_cast<const void *>(first * sizeof(elements_command)),
+                                        count, 0);
+        } else {
+            elements_array::unbind();
+            glMultiDrawArraysIndirect(type, reinterpret_cast<const void *>(first * sizeof(arrays_command)),
+                                      count, 0);
+        }
+        return;
+    }
+
+    if (indexed) {
+        va->indices()->bind();
+        for (size_t i = first; i < first + count; i++) {
+            const elements_command &cmd = elements_commands[i];
+            glDrawElementsInstancedBaseVertexBaseInstance(type, cmd.count, GL_UNSIGNED_INT,
+                                                          reinterpret_cast<const void *>(cmd.first_index * sizeof(uint32_t)),
+                                                          cmd.instance_count, cmd.base_vertex, cmd.base_instance);
+        }
+    } else {
+        elements_array::unbind();
+        for (size_t i = first; i < first + count; i++) {
+            const arrays_command &cmd = arrays_commands[i];
+            glDrawArraysInstancedBaseInstance(type, cmd.first, cmd.count, cmd.instance_count, cmd.base_instance);
+        }
+    }
+}
+
+
+dake::gl::vertex_array *dake::gl::draw_batch::get_vertex_array(void)
+{
+    if (dirty) {
+        upload();
+    }
+    return va;
+}
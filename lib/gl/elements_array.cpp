@@ -23,12 +23,20 @@ dake::gl::elements_array *cur_ea = nullptr;
 dake::gl::elements_array::elements_array(vertex_array *vxa):
     va(vxa)
 {
-    glGenBuffers(1, &buffer);
+    if (glext.has_direct_state_access()) {
+        glCreateBuffers(1, &buffer);
+    } else {
+        glGenBuffers(1, &buffer);
+    }
 }
 
 
 dake::gl::elements_array::~elements_array(void)
 {
+    if (dake::gl::cur_ea == this) {
+        dake::gl::cur_ea = nullptr;
+    }
+
     if (!buffer_reused) {
         glDeleteBuffers(1, &buffer);
     }
@@ -83,6 +91,10 @@ void dake::gl::elements_array::data(void *ptr, size_t size, GLenum usage)
         size = va->n * bpv;
     }
 
-    bind();
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, size, ptr, usage);
+    if (glext.has_direct_state_access()) {
+        glNamedBufferData(buffer, size, ptr, usage);
+    } else {
+        bind();
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, size, ptr, usage);
+    }
 }
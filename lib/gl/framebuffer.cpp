@@ -1,7 +1,12 @@
 #include <cstdlib>
+#include <cstring>
+#include <future>
 #include <stdexcept>
+#include <utility>
 
 #include <dake/gl/framebuffer.hpp>
+#include <dake/gl/pixel_buffer.hpp>
+#include <dake/gl/texture.hpp>
 
 
 namespace dake
@@ -20,7 +25,8 @@ dake::gl::framebuffer *current_fb = nullptr;
 dake::gl::framebuffer::framebuffer(int color_attachments, GLenum format, depth_stencil_mode ds_mode, int multisample):
     ca_count(color_attachments),
     dsm(ds_mode),
-    spp(multisample > 1 ? multisample : 1)
+    spp(multisample > 1 ? multisample : 1),
+    readbacks(3)
 {
     if ((dsm == STENCIL_XOR_DEPTH) && !glext.has_extension(STENCIL_TEXTURING)) {
         dsm = STENCIL_AND_DEPTH;
@@ -40,8 +46,13 @@ dake::gl::framebuffer::framebuffer(int color_attachments, GLenum format, depth_s
         formats[i] = format;
     }
 
-    glGenFramebuffers(1, &id);
-    bind();
+    bool dsa = glext.has_direct_state_access();
+    if (dsa) {
+        glCreateFramebuffers(1, &id);
+    } else {
+        glGenFramebuffers(1, &id);
+        bind();
+    }
 
     textures = static_cast<texture *>(malloc(ca_count * sizeof(textures[0])));
     for (int i = 0; i < ca_count; i++) {
@@ -71,24 +82,31 @@ dake::gl::framebuffer::framebuffer(int color_attachments, GLenum format, depth_s
 
     resize(1024, 1024);
 
+    // Without DSA, this relies on the framebuffer having been bound above
+    auto attach = [&](GLenum attachment, const texture &tex) {
+        if (dsa) {
+            glNamedFramebufferTexture(id, attachment, tex.get_glid(), 0);
+        } else {
+            glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, attachment, spp > 1 ? GL_TEXTURE_2D_MULTISAMPLE : GL_TEXTURE_2D, tex.get_glid(), 0);
+        }
+    };
+
     for (int i = 0; i < ca_count; i++) {
         textures[i].filter(GL_NEAREST);
-        glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + i, spp > 1 ? GL_TEXTURE_2D_MULTISAMPLE : GL_TEXTURE_2D, textures[i].get_glid(), 0);
+        attach(GL_COLOR_ATTACHMENT0 + i, textures[i]);
     }
 
     if (depth_buffer) {
         depth_buffer->filter(GL_NEAREST);
-        if (dsm == STENCIL_XOR_DEPTH) {
-            glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, spp > 1 ? GL_TEXTURE_2D_MULTISAMPLE : GL_TEXTURE_2D, depth_buffer->get_glid(), 0);
-        } else {
-            glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, spp > 1 ? GL_TEXTURE_2D_MULTISAMPLE : GL_TEXTURE_2D, depth_buffer->get_glid(), 0);
-        }
+        attach(dsm == STENCIL_XOR_DEPTH ? GL_DEPTH_STENCIL_ATTACHMENT : GL_DEPTH_ATTACHMENT, *depth_buffer);
     } else if (stencil_buffer) {
         stencil_buffer->filter(GL_NEAREST);
-        glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_STENCIL_ATTACHMENT, spp > 1 ? GL_TEXTURE_2D_MULTISAMPLE : GL_TEXTURE_2D, stencil_buffer->get_glid(), 0);
+        attach(GL_STENCIL_ATTACHMENT, *stencil_buffer);
     }
 
-    if (glCheckFramebufferStatus(GL_DRAW_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+    GLenum status = dsa ? glCheckNamedFramebufferStatus(id, GL_DRAW_FRAMEBUFFER)
+                        : glCheckFramebufferStatus(GL_DRAW_FRAMEBUFFER);
+    if (status != GL_FRAMEBUFFER_COMPLETE) {
         throw std::runtime_error("Framebuffer incomplete");
     }
 }
@@ -96,6 +114,15 @@ dake::gl::framebuffer::framebuffer(int color_attachments, GLenum format, depth_s
 
 dake::gl::framebuffer::~framebuffer(void)
 {
+    // Pending futures get a broken_promise error
+    for (readback &rb: readbacks) {
+        if (rb.fence) {
+            glDeleteSync(rb.fence);
+        }
+        delete rb.buffer;
+        delete rb.img;
+    }
+
     glDeleteFramebuffers(1, &id);
     delete depth_buffer;
     delete stencil_buffer;
@@ -189,8 +216,12 @@ dake::gl::texture &dake::gl::framebuffer::depth(void)
     }
 
     if ((dsm == STENCIL_XOR_DEPTH) && depth_buffer_in_stencil_mode) {
-        depth_buffer->bind();
-        glTexParameteri(spp > 1 ? GL_TEXTURE_2D_MULTISAMPLE : GL_TEXTURE_2D, GL_DEPTH_STENCIL_TEXTURE_MODE, GL_DEPTH_COMPONENT);
+        if (glext.has_direct_state_access()) {
+            glTextureParameteri(depth_buffer->get_glid(), GL_DEPTH_STENCIL_TEXTURE_MODE, GL_DEPTH_COMPONENT);
+        } else {
+            depth_buffer->bind();
+            glTexParameteri(spp > 1 ? GL_TEXTURE_2D_MULTISAMPLE : GL_TEXTURE_2D, GL_DEPTH_STENCIL_TEXTURE_MODE, GL_DEPTH_COMPONENT);
+        }
         depth_buffer_in_stencil_mode = false;
     }
 
@@ -205,8 +236,12 @@ dake::gl::texture &dake::gl::framebuffer::stencil(void)
     }
 
     if ((dsm == STENCIL_XOR_DEPTH) && !depth_buffer_in_stencil_mode) {
-        depth_buffer->bind();
-        glTexParameteri(spp > 1 ? GL_TEXTURE_2D_MULTISAMPLE : GL_TEXTURE_2D, GL_DEPTH_STENCIL_TEXTURE_MODE, GL_STENCIL_INDEX);
+        if (glext.has_direct_state_access()) {
+            glTextureParameteri(depth_buffer->get_glid(), GL_DEPTH_STENCIL_TEXTURE_MODE, GL_STENCIL_INDEX);
+        } else {
+            depth_buffer->bind();
+            glTexParameteri(spp > 1 ? GL_TEXTURE_2D_MULTISAMPLE : GL_TEXTURE_2D, GL_DEPTH_STENCIL_TEXTURE_MODE, GL_STENCIL_INDEX);
+        }
         depth_buffer_in_stencil_mode = true;
     }
 
@@ -228,3 +263,134 @@ void dake::gl::framebuffer::unmask(int i)
 {
     draw_buffers[i] = GL_COLOR_ATTACHMENT0 + i;
 }
+
+
+std::future<dake::gl::image> dake::gl::framebuffer::read_async(int i, int channels, image::channel_format format)
+{
+    return read_async(i, image::region{0, 0, width, height}, channels, format);
+}
+
+
+std::future<dake::gl::image> dake::gl::framebuffer::read_async(int i, const image::region &area, int channels, image::channel_format format)
+{
+    if (spp > 1) {
+        throw std::invalid_argument("Cannot read back a multisampled framebuffer");
+    }
+    if ((i < 0) || (i >= ca_count)) {
+        throw std::out_of_range("Invalid color attachment index");
+    }
+    if ((area.x < 0) || (area.y < 0) || (area.width < 1) || (area.height < 1) ||
+        (area.x + area.width > width) || (area.y + area.height > height))
+    {
+        throw std::out_of_range("Readback region exceeds the framebuffer");
+    }
+
+    image *img = new image(area.width, area.height, channels, format);
+    if (img->compressed()) {
+        delete img;
+        throw std::invalid_argument("Cannot read back into a compressed format");
+    }
+
+    readback &rb = readbacks[next_readback];
+    if (rb.fence) {
+        complete_read(rb, true);
+    }
+    next_readback = (next_readback + 1) % readbacks.size();
+
+    if (!rb.buffer || (rb.buffer->size() < img->byte_size())) {
+        delete rb.buffer;
+        rb.buffer = new pixel_buffer(img->byte_size(), GL_PIXEL_PACK_BUFFER, GL_STREAM_READ, true);
+    }
+
+    // Everything changed here is restored afterwards
+    GLint prev_fb, prev_read_buffer, prev_alignment;
+    glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &prev_fb);
+    glGetIntegerv(GL_PACK_ALIGNMENT, &prev_alignment);
+
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, id);
+    glGetIntegerv(GL_READ_BUFFER, &prev_read_buffer);
+    glReadBuffer(GL_COLOR_ATTACHMENT0 + i);
+
+    // Image rows are padded to 4 bytes
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    rb.buffer->bind();
+    glReadPixels(area.x, height - area.y - area.height, area.width, area.height,
+                 img->gl_format(), img->gl_type(), nullptr);
+    rb.buffer->unbind();
+
+    glPixelStorei(GL_PACK_ALIGNMENT, prev_alignment);
+    glReadBuffer(prev_read_buffer);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, prev_fb);
+
+    rb.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    rb.img = img;
+    rb.result = std::promise<image>();
+
+    return rb.result.get_future();
+}
+
+
+bool dake::gl::framebuffer::complete_read(readback &rb, bool wait)
+{
+    GLenum status = glClientWaitSync(rb.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+    while (wait && (status == GL_TIMEOUT_EXPIRED)) {
+        status = glClientWaitSync(rb.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+    }
+    if (status == GL_TIMEOUT_EXPIRED) {
+        return false;
+    }
+
+    glDeleteSync(rb.fence);
+    rb.fence = nullptr;
+
+    if (status == GL_WAIT_FAILED) {
+        rb.result.set_exception(std::make_exception_ptr(std::runtime_error("Waiting for readback failed")));
+    } else {
+        size_t bytes = rb.img->byte_size(), row = bytes / rb.img->height();
+        const char *src = static_cast<const char *>(rb.buffer->map(0, bytes, GL_MAP_READ_BIT));
+        char *dst = static_cast<char *>(rb.img->data());
+
+        // The GL returns the bottom row first
+        for (int y = 0; y < rb.img->height(); y++) {
+            memcpy(dst + y * row, src + (rb.img->height() - 1 - y) * row, row);
+        }
+
+        rb.buffer->unmap();
+        rb.result.set_value(std::move(*rb.img));
+    }
+
+    delete rb.img;
+    rb.img = nullptr;
+
+    return true;
+}
+
+
+void dake::gl::framebuffer::poll_reads(bool wait)
+{
+    // Fences signal in order, so nothing after an unfinished readback can
+    // be finished either
+    for (size_t j = 0; j < readbacks.size(); j++) {
+        readback &rb = readbacks[(next_readback + j) % readbacks.size()];
+        if (rb.fence && !complete_read(rb, wait)) {
+            break;
+        }
+    }
+}
+
+
+void dake::gl::framebuffer::set_read_latency(int count)
+{
+    if (count < 1) {
+        throw std::invalid_argument("Read latency must be at least one readback");
+    }
+
+    poll_reads(true);
+
+    for (readback &rb: readbacks) {
+        delete rb.buffer;
+    }
+    readbacks.clear();
+    readbacks.resize(count);
+    next_readback = 0;
+}
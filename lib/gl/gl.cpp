@@ -13,8 +13,14 @@ glext_info glext;
 
 const char *extension_names[] = {
     "GL_ARB_bindless_texture",
+    "GL_ARB_buffer_storage",
+    "GL_ARB_direct_state_access",
     "GL_ARB_stencil_texturing",
+    "GL_ARB_texture_storage",
     "GL_ARB_texture_view",
+    "GL_KHR_parallel_shader_compile",
+    "GL_ARB_separate_shader_objects",
+    "GL_ARB_multi_draw_indirect",
 };
 
 }
@@ -1,16 +1,25 @@
+#include <dake/cross.hpp>
 #include <dake/helper/function.hpp>
+#include <dake/gl/bptc.hpp>
 #include <dake/gl/find_resource.hpp>
 #include <dake/gl/gl.hpp>
+#include <dake/gl/resample.hpp>
+#include <dake/gl/s3tc.hpp>
+#include <dake/gl/swizzle.hpp>
+#include <dake/gl/texel.hpp>
 #include <dake/gl/texture.hpp>
 
 #include <cassert>
 #include <cerrno>
+#include <cmath>
 #include <cstdint>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
 #include <stdexcept>
 #include <string>
+#include <utility>
+#include <vector>
 
 extern "C" {
 #ifndef WITHOUT_LIBPNG
@@ -19,15 +28,59 @@ extern "C" {
 #ifndef WITHOUT_LIBJPEG
 #include <jpeglib.h>
 #endif
-#ifndef WITHOUT_LIBTXC
-#include <txc_dxtn.h>
-#endif
 }
 
 
 using namespace dake::helper;
 
 
+// Incremental decoding for image_reader; state is whatever open returns
+struct dake::gl::image_row_decoder {
+    // Only columns [x, x + *columns) are to be decoded, *columns being 0
+    // for all of them right of x; sets *columns to the actual count
+    void *(*open)(const void *buffer, size_t length, int x, int *columns, int *width, int *height, int *channels, dake::gl::image::channel_format *format);
+    void (*skip)(void *state, int rows);
+    void (*read)(void *state, uint8_t *dst, size_t stride, int rows);
+    void (*close)(void *state);
+};
+
+
+static void check_columns(int x, int *columns, int width)
+{
+    if (!*columns) {
+        *columns = width - x;
+    }
+
+    if (x < 0 || *columns < 1 || *columns > width - x) {
+        throw std::invalid_argument("Columns out of bounds");
+    }
+}
+
+
+// Decodes a whole image with a row decoder
+static void *load_rows(const dake::gl::image_row_decoder &dec, const void *buffer, size_t length, int *width, int *height, int *channels, int *levels, dake::gl::image::channel_format *format)
+{
+    int columns = 0;
+    void *state = dec.open(buffer, length, 0, &columns, width, height, channels, format);
+    *levels = 1;
+
+    size_t stride = (*width * *channels * dake::gl::texel::value_size(*format) + 3) & ~static_cast<size_t>(3);
+    uint8_t *output = nullptr;
+
+    try {
+        output = new uint8_t[stride * *height];
+        dec.read(state, output, stride, *height);
+    } catch (...) {
+        delete[] output;
+        dec.close(state);
+        throw;
+    }
+
+    dec.close(state);
+    return output;
+}
+
+
 #ifndef WITHOUT_LIBPNG
 bool test_png(const void *buffer, size_t length)
 {
@@ -56,84 +109,149 @@ static void buffer_load(png_structp png_ptr, png_bytep out, png_size_t length)
 }
 
 
-void *load_png(const void *buffer, size_t length, int *width, int *height, int *channels, dake::gl::image::channel_format *format)
+struct png_row_state {
+    png_structp png_ptr;
+    png_infop info_ptr;
+    PNGIOState io;
+
+    int x, columns, next;
+    size_t pixel_bytes, row_bytes;
+    bool interlaced;
+    // The current row, or all of them for interlaced images
+    std::vector<uint8_t> rows;
+};
+
+
+static void png_close(void *state)
+{
+    png_row_state *s = static_cast<png_row_state *>(state);
+
+    png_destroy_read_struct(&s->png_ptr, &s->info_ptr, nullptr);
+    delete s;
+}
+
+
+static void *png_open(const void *buffer, size_t length, int x, int *columns, int *width, int *height, int *channels, dake::gl::image::channel_format *format)
 {
     // lol longjmp
 
-    png_structp png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, nullptr, nullptr, nullptr);
-    if (!png_ptr) {
+    png_row_state *s = new png_row_state;
+
+    s->png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, nullptr, nullptr, nullptr);
+    if (!s->png_ptr) {
+        delete s;
         throw std::runtime_error("Could not create PNG read struct");
     }
 
-    png_infop info_ptr = png_create_info_struct(png_ptr);
-    if (!info_ptr) {
-        png_destroy_read_struct(&png_ptr, nullptr, nullptr);
+    s->info_ptr = png_create_info_struct(s->png_ptr);
+    if (!s->info_ptr) {
+        png_destroy_read_struct(&s->png_ptr, nullptr, nullptr);
+        delete s;
         throw std::runtime_error("Could not create PNG info struct");
     }
 
-    png_infop info_end = png_create_info_struct(png_ptr);
-    if (!info_end) {
-        png_destroy_read_struct(&png_ptr, &info_ptr, nullptr);
-        throw std::runtime_error("Could not create PNG end info struct");
-    }
-
-    struct PNGIOState pngios = {
-        static_cast<const uint8_t *>(buffer),
-        0,
-        length
-    };
-    png_set_read_fn(png_ptr, &pngios, buffer_load);
-    png_set_sig_bytes(png_ptr, 0);
+    s->io = { static_cast<const uint8_t *>(buffer), 0, length };
+    png_set_read_fn(s->png_ptr, &s->io, buffer_load);
+    png_set_sig_bytes(s->png_ptr, 0);
 
-    png_read_png(png_ptr, info_ptr, PNG_TRANSFORM_STRIP_16 | PNG_TRANSFORM_PACKING, nullptr);
+    png_read_info(s->png_ptr, s->info_ptr);
 
-    int depth, fmt;
+    int depth, color_type;
     uint32_t w, h;
-    png_get_IHDR(png_ptr, info_ptr, &w, &h, &depth, &fmt, nullptr, nullptr, nullptr);
+    png_get_IHDR(s->png_ptr, s->info_ptr, &w, &h, &depth, &color_type, nullptr, nullptr, nullptr);
+
+    // Everything becomes 8 or 16 bits per channel, 16-bit channels in host
+    // byte order.  png_set_palette_to_rgb() also turns tRNS transparency
+    // into an alpha channel, for any color type.
+    png_set_palette_to_rgb(s->png_ptr);
+    png_set_expand_gray_1_2_4_to_8(s->png_ptr);
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    if (depth == 16) {
+        png_set_swap(s->png_ptr);
+    }
+#endif
+    s->interlaced = png_set_interlace_handling(s->png_ptr) > 1;
+    png_read_update_info(s->png_ptr, s->info_ptr);
 
     *width = w;
     *height = h;
-    *format = dake::gl::image::LINEAR_UINT8;
+    *channels = png_get_channels(s->png_ptr, s->info_ptr);
+    *format = depth == 16 ? dake::gl::image::LINEAR_UINT16 : dake::gl::image::LINEAR_UINT8;
 
-    switch (fmt) {
-        case PNG_COLOR_TYPE_GRAY:       *channels = 1; break;
-        case PNG_COLOR_TYPE_GRAY_ALPHA: *channels = 2; break;
-        case PNG_COLOR_TYPE_PALETTE:
-        case PNG_COLOR_TYPE_RGB:        *channels = 3; break;
-        case PNG_COLOR_TYPE_RGB_ALPHA:  *channels = 4; break;
-        default:
-            png_destroy_read_struct(&png_ptr, &info_ptr, &info_end);
+    try {
+        if (*channels < 1 || *channels > 4) {
             throw std::runtime_error("Unknown PNG color format");
+        }
+        check_columns(x, columns, *width);
+    } catch (...) {
+        png_close(s);
+        throw;
     }
 
-    png_bytep *rows = png_get_rows(png_ptr, info_ptr);
+    s->x = x;
+    s->columns = *columns;
+    s->next = 0;
+    s->pixel_bytes = *channels * (depth == 16 ? 2 : 1);
+    s->row_bytes = png_get_rowbytes(s->png_ptr, s->info_ptr);
+
+    if (s->interlaced) {
+        // Every pass covers the whole image, so there is no way around
+        // decoding all of it
+        s->rows.resize(s->row_bytes * h);
 
-    png_colorp palette;
-    int palette_entries = 0;
-    if (fmt == PNG_COLOR_TYPE_PALETTE) {
-        png_get_PLTE(png_ptr, info_ptr, &palette, &palette_entries);
+        std::vector<png_bytep> row_ptrs(h);
+        for (uint32_t y = 0; y < h; y++) {
+            row_ptrs[y] = &s->rows[y * s->row_bytes];
+        }
+        png_read_image(s->png_ptr, row_ptrs.data());
+    } else {
+        s->rows.resize(s->row_bytes);
     }
 
-    uint8_t *output = new uint8_t[h * ((w * *channels + 3) & ~3u)];
-    uint32_t ofs = 0;
-    for (uint32_t y = 0; y < h; y++) {
-        if (fmt == PNG_COLOR_TYPE_PALETTE) {
-            uint32_t rofs = 0;
-            for (uint32_t x = 0; x < w; x++) {
-                output[ofs++] = palette[rows[y][rofs  ]].red;
-                output[ofs++] = palette[rows[y][rofs  ]].green;
-                output[ofs++] = palette[rows[y][rofs++]].blue;
-            }
+    return s;
+}
+
+
+static void png_skip(void *state, int rows)
+{
+    png_row_state *s = static_cast<png_row_state *>(state);
+
+    for (int r = 0; r < rows; r++, s->next++) {
+        if (!s->interlaced) {
+            png_read_row(s->png_ptr, s->rows.data(), nullptr);
+        }
+    }
+}
+
+
+static void png_read_rows(void *state, uint8_t *dst, size_t stride, int rows)
+{
+    png_row_state *s = static_cast<png_row_state *>(state);
+
+    for (int r = 0; r < rows; r++, s->next++) {
+        const uint8_t *row = s->rows.data();
+        if (s->interlaced) {
+            row += s->next * s->row_bytes;
         } else {
-            memcpy(&output[ofs], rows[y], w * *channels);
-            ofs += w * *channels;
+            png_read_row(s->png_ptr, s->rows.data(), nullptr);
         }
-        ofs = (ofs + 3) & ~3u;
+
+        memcpy(dst + r * stride, row + s->x * s->pixel_bytes, s->columns * s->pixel_bytes);
     }
+}
 
-    png_destroy_read_struct(&png_ptr, &info_ptr, &info_end);
 
-    return output;
+static const dake::gl::image_row_decoder png_rows = {
+    png_open,
+    png_skip,
+    png_read_rows,
+    png_close
+};
+
+
+void *load_png(const void *buffer, size_t length, int *width, int *height, int *channels, int *levels, dake::gl::image::channel_format *format)
+{
+    return load_rows(png_rows, buffer, length, width, height, channels, levels, format);
 }
 #endif
 
@@ -165,7 +283,17 @@ bool test_bmp(const void *buffer, size_t length)
 }
 
 
-void *load_bmp(const void *buffer, size_t length, int *width, int *height, int *channels, dake::gl::image::channel_format *format)
+struct bmp_row_state {
+    const uint8_t *pixels, *palette;
+    int pal_entries, bit_count;
+    size_t scanline;
+    bool top_down;
+
+    int height, channels, x, columns, next;
+};
+
+
+static void *bmp_open(const void *buffer, size_t length, int x, int *columns, int *width, int *height, int *channels, dake::gl::image::channel_format *format)
 {
     const bitmap_file_header *bfh = static_cast<const bitmap_file_header *>(buffer);
     const bitmap_info_header *bih = reinterpret_cast<const bitmap_info_header *>(bfh + 1);
@@ -182,95 +310,116 @@ void *load_bmp(const void *buffer, size_t length, int *width, int *height, int *
 
     *width  = bih->biWidth;
     *height = abs(bih->biHeight);
-    if (bih->biBitCount < 32) {
-        *channels = 3;
-    } else {
-        *channels = 4;
+    *channels = bih->biBitCount < 32 ? 3 : 4;
+    *format = dake::gl::image::LINEAR_UINT8;
+
+    if (*width < 1 || *height < 1) {
+        throw std::runtime_error("Invalid BMP size");
+    }
+    check_columns(x, columns, *width);
+
+    bmp_row_state s;
+    s.bit_count = bih->biBitCount;
+    s.scanline = ((static_cast<size_t>(*width) * bih->biBitCount + 7) / 8 + 3) & ~static_cast<size_t>(3);
+    s.top_down = bih->biHeight < 0;
+    s.height = *height;
+    s.channels = *channels;
+    s.x = x;
+    s.columns = *columns;
+    s.next = 0;
+
+    // Rows can be found without decoding anything, so make sure all of
+    // them are there
+    if (bfh->bfOffBits > length || (length - bfh->bfOffBits) / s.scanline < static_cast<size_t>(*height)) {
+        throw std::runtime_error("Unexpected end of BMP");
     }
+    s.pixels = static_cast<const uint8_t *>(buffer) + bfh->bfOffBits;
 
-    int pal_entries = -1;
+    // BGRX entries following the info header
+    s.palette = nullptr;
+    s.pal_entries = 0;
     if (bih->biBitCount <= 8) {
-        pal_entries = bih->biClrUsed ? bih->biClrUsed : 1 << bih->biBitCount;
-        if (pal_entries > 1 << bih->biBitCount) {
-            pal_entries = 1 << bih->biBitCount;
+        s.pal_entries = bih->biClrUsed ? bih->biClrUsed : 1 << bih->biBitCount;
+        if (s.pal_entries > 1 << bih->biBitCount) {
+            s.pal_entries = 1 << bih->biBitCount;
         }
-    }
 
-    const uint8_t *pal = nullptr;
-    if (pal_entries >= 0) {
-        pal = reinterpret_cast<const uint8_t *>(bih + 1);
+        size_t pal_offset = sizeof(*bfh) + bih->biSize;
+        if (pal_offset > length || (length - pal_offset) / 4 < static_cast<size_t>(s.pal_entries)) {
+            throw std::runtime_error("Unexpected end of BMP");
+        }
+        s.palette = static_cast<const uint8_t *>(buffer) + pal_offset;
     }
 
-    *format = dake::gl::image::channel_format::LINEAR_UINT8;
-    uint8_t *output = new uint8_t[*height * ((*width * *channels + 3) & ~3u)];
-    const uint8_t *input = static_cast<const uint8_t *>(buffer) + bfh->bfOffBits;
+    return new bmp_row_state(s);
+}
 
-    int total = *width * *height * *channels;
-    int i = 0, o = 0;
-    int scanline = ((*width * bih->biBitCount + 7) / 8 + 3) & ~3u;
 
-    for (int y = 0; y < *height; y++) {
-        if (bih->biHeight < 0) {
-            i = y * scanline;
-        } else {
-            i = (*height - y - 1) * scanline;
-        }
-        o = (o + 3) & ~3u;
+static void bmp_skip(void *state, int rows)
+{
+    static_cast<bmp_row_state *>(state)->next += rows;
+}
 
-        for (int x = 0; x < *width; x++) {
-            if (pal) {
-                if (length - i < 1) {
-                    throw std::runtime_error("Unexpected end of BMP");
-                }
-                int to_read = 8 / bih->biBitCount;
-                while (o < total && to_read--) {
-                    int pi = input[i];
-
-                    pi >>= to_read * bih->biBitCount;
-                    pi &= (1 << bih->biBitCount) - 1;
-                    if (pi >= pal_entries) {
-                        throw std::runtime_error("BMP palette index out of bounds");
-                    }
-
-                    const uint8_t *pe = &pal[pi];
-                    output[o++] = pe[2];
-                    output[o++] = pe[1];
-                    output[o++] = pe[0];
-
-                    if (to_read) {
-                        if (++x == *width) {
-                            --x;
-                            break;
-                        }
-                    }
+
+static void bmp_read_rows(void *state, uint8_t *dst, size_t stride, int rows)
+{
+    bmp_row_state *s = static_cast<bmp_row_state *>(state);
+    int bits = s->bit_count;
+
+    for (int r = 0; r < rows; r++, s->next++) {
+        const uint8_t *in = s->pixels + (s->top_down ? s->next : s->height - s->next - 1) * s->scanline;
+        uint8_t *out = dst + r * stride;
+
+        for (int px = s->x; px < s->x + s->columns; px++, out += s->channels) {
+            if (bits <= 8) {
+                int bit = px * bits;
+                int index = (in[bit / 8] >> (8 - bits - bit % 8)) & ((1 << bits) - 1);
+                if (index >= s->pal_entries) {
+                    throw std::runtime_error("BMP palette index out of bounds");
                 }
-            } else if (bih->biBitCount == 16) {
-                uint16_t val;
-                if (length - i < 2) {
-                    throw std::runtime_error("Unexpected end of BMP");
+
+                const uint8_t *pe = s->palette + index * 4;
+                out[0] = pe[2];
+                out[1] = pe[1];
+                out[2] = pe[0];
+            } else if (bits == 16) {
+                // X1R5G5B5
+                int val = in[px * 2] | in[px * 2 + 1] << 8;
+                for (int c = 0; c < 3; c++) {
+                    int v = (val >> (10 - c * 5)) & 0x1f;
+                    out[c] = v << 3 | v >> 2;
                 }
-                val = input[i++];
-                val |= input[i++] << 8;
-                output[o++] = (val >> 10) & 0x1f;
-                output[o++] = (val >>  5) & 0x1f;
-                output[o++] =  val        & 0x1f;
             } else {
-                assert(bih->biBitCount == 24 || bih->biBitCount == 32);
-                if (length - i < 4) {
-                    throw std::runtime_error("Unexpected end of BMP");
+                const uint8_t *p = in + px * (bits / 8);
+                out[0] = p[2];
+                out[1] = p[1];
+                out[2] = p[0];
+                if (bits == 32) {
+                    out[3] = p[3];
                 }
-                if (bih->biBitCount == 32) {
-                    output[o++] = input[i + 3];
-                }
-                output[o++] = input[i + 2];
-                output[o++] = input[i + 1];
-                output[o++] = input[i + 0];
-                i += bih->biBitCount / 8;
             }
         }
     }
+}
 
-    return output;
+
+static void bmp_close(void *state)
+{
+    delete static_cast<bmp_row_state *>(state);
+}
+
+
+static const dake::gl::image_row_decoder bmp_rows = {
+    bmp_open,
+    bmp_skip,
+    bmp_read_rows,
+    bmp_close
+};
+
+
+void *load_bmp(const void *buffer, size_t length, int *width, int *height, int *channels, int *levels, dake::gl::image::channel_format *format)
+{
+    return load_rows(bmp_rows, buffer, length, width, height, channels, levels, format);
 }
 
 
@@ -295,7 +444,11 @@ bool test_jpg(const void *buffer, size_t length)
 }
 
 
-void *load_jpg(const void *buffer, size_t length, int *width, int *height, int *channels, dake::gl::image::channel_format *format)
+// Uses libjpeg's DCT scaling to decode at the smallest of 1/8, 1/4 and 1/2
+// that still reaches max_width or max_height (0 for no limit), so that only
+// little remains to be filtered down.  Other scales are not supported
+// everywhere and are much slower where they are.
+void *load_jpg_reduced(const void *buffer, size_t length, int max_width, int max_height, int *width, int *height, int *channels, int *levels, dake::gl::image::channel_format *format)
 {
     jpeg_decompress_struct cinfo;
     jpeg_error_mgr jpg_err;
@@ -308,6 +461,20 @@ void *load_jpg(const void *buffer, size_t length, int *width, int *height, int *
     jpeg_mem_src(&cinfo, mutilated, length);
 
     jpeg_read_header(&cinfo, true);
+
+    if (max_width > 0 || max_height > 0) {
+        cinfo.scale_num = 1;
+        for (cinfo.scale_denom = 8; cinfo.scale_denom > 1; cinfo.scale_denom /= 2) {
+            jpeg_calc_output_dimensions(&cinfo);
+
+            if ((max_width > 0 && static_cast<int>(cinfo.output_width) >= max_width) ||
+                (max_height > 0 && static_cast<int>(cinfo.output_height) >= max_height))
+            {
+                break;
+            }
+        }
+    }
+
     jpeg_start_decompress(&cinfo);
 
     if ((cinfo.output_components < 1) || (cinfo.output_components > 4)) {
@@ -318,13 +485,20 @@ void *load_jpg(const void *buffer, size_t length, int *width, int *height, int *
     *width    = cinfo.output_width;
     *height   = cinfo.output_height;
     *channels = cinfo.output_components;
+    *levels   = 1;
     *format   = dake::gl::image::LINEAR_UINT8;
 
-    uint8_t *output = new uint8_t[*height * ((*width * *channels + 3) & ~3u)];
-    uint8_t *target = output;
+    size_t stride = (*width * *channels + 3) & ~3u;
+    uint8_t *output = new uint8_t[*height * stride];
+
+    // libjpeg returns as many rows per call as it decodes at once (up to
+    // rec_outbuf_height), so offer all of the remaining ones
+    std::vector<JSAMPROW> rows(*height);
+    for (int y = 0; y < *height; y++) {
+        rows[y] = output + y * stride;
+    }
     while (static_cast<int>(cinfo.output_scanline) < *height) {
-        jpeg_read_scanlines(&cinfo, &target, 1);
-        target += (*width * *channels + 3) & ~3u;
+        jpeg_read_scanlines(&cinfo, &rows[cinfo.output_scanline], *height - cinfo.output_scanline);
     }
 
     jpeg_finish_decompress(&cinfo);
@@ -332,344 +506,1272 @@ void *load_jpg(const void *buffer, size_t length, int *width, int *height, int *
 
     return output;
 }
-#endif
 
 
-struct image_format {
-    const char *name;
-
-    bool (*test)(const void *buffer, size_t length);
-    void *(*load)(const void *buffer, size_t length, int *width, int *height, int *channels, dake::gl::image::channel_format *fmt);
-};
+void *load_jpg(const void *buffer, size_t length, int *width, int *height, int *channels, int *levels, dake::gl::image::channel_format *format)
+{
+    return load_jpg_reduced(buffer, length, 0, 0, width, height, channels, levels, format);
+}
 
 
-static const image_format formats[] = {
-#ifndef WITHOUT_LIBPNG
-    {
-        "png",
-        test_png,
-        load_png
-    },
+// libjpeg-turbo can skip rows and crop columns with little decoding
+#if defined(LIBJPEG_TURBO_VERSION_NUMBER) && LIBJPEG_TURBO_VERSION_NUMBER >= 1005000
+#define HAVE_JPEG_CROP
 #endif
 
-    {
-        "bmp",
-        test_bmp,
-        load_bmp
-    },
+struct jpg_row_state {
+    jpeg_decompress_struct cinfo;
+    jpeg_error_mgr jpg_err;
 
-#ifndef WITHOUT_LIBJPEG
-    {
-        "jpg",
-        test_jpg,
-        load_jpg
-    },
-#endif
+    // Where the requested columns start in a decoded row
+    size_t offset, column_bytes, row_bytes;
+    // Decoded rows
+    std::vector<uint8_t> band;
+    std::vector<JSAMPROW> band_rows;
 };
 
 
-dake::gl::image::image(const std::string &file)
+static void jpg_close(void *state)
 {
-    FILE *fp = fopen(dake::gl::find_resource_filename(file).c_str(), "rb");
-    if (!fp) {
-        throw std::runtime_error("Could not load image from " + file + ": " + strerror(errno));
-    }
+    jpg_row_state *s = static_cast<jpg_row_state *>(state);
 
-    fseek(fp, 0, SEEK_END);
-    size_t lof = ftell(fp);
-    rewind(fp);
+    jpeg_destroy_decompress(&s->cinfo);
+    delete s;
+}
 
-    void *buffer = malloc(lof);
-    if (fread(buffer, 1, lof, fp) < lof) {
-        const char *err = strerror(errno);
-        fclose(fp);
-        free(buffer);
-        throw std::runtime_error("Failed to read image from " + file + ": "
-                                 + err);
-    }
 
-    fclose(fp);
+static void *jpg_open(const void *buffer, size_t length, int x, int *columns, int *width, int *height, int *channels, dake::gl::image::channel_format *format)
+{
+    jpg_row_state *s = new jpg_row_state;
 
-    try {
-        load(buffer, lof, file);
-    } catch (...) {
-        free(buffer);
-        throw;
-    }
+    s->cinfo.err = jpeg_std_error(&s->jpg_err);
+    jpeg_create_decompress(&s->cinfo);
 
-    free(buffer);
-}
+    uint8_t *mutilated = static_cast<uint8_t *>(const_cast<void *>(buffer));
+    jpeg_mem_src(&s->cinfo, mutilated, length);
 
+    jpeg_read_header(&s->cinfo, true);
+    jpeg_start_decompress(&s->cinfo);
 
-dake::gl::image::image(const void *buffer, size_t length)
-{
-    char *name = new char[2 + sizeof(buffer) * 2 + 1];
-    snprintf(name, 2 + sizeof(buffer) * 2 + 1, "%p", buffer);
+    *width    = s->cinfo.output_width;
+    *height   = s->cinfo.output_height;
+    *channels = s->cinfo.output_components;
+    *format   = dake::gl::image::LINEAR_UINT8;
 
     try {
-        load(buffer, length, name);
+        if ((*channels < 1) || (*channels > 4)) {
+            throw std::runtime_error("Invalid number of JPEG color channels");
+        }
+        check_columns(x, columns, *width);
     } catch (...) {
-        delete[] name;
+        jpg_close(s);
         throw;
     }
 
-    delete[] name;
-}
+    s->offset = x;
+#ifdef HAVE_JPEG_CROP
+    if (*columns < *width) {
+        // Only whole iMCUs can be decoded, so this may start further left
+        // and end further right
+        JDIMENSION crop_x = x, crop_width = *columns;
+        jpeg_crop_scanline(&s->cinfo, &crop_x, &crop_width);
+        s->offset = x - crop_x;
+    }
+#endif
 
+    s->offset *= *channels;
+    s->column_bytes = static_cast<size_t>(*columns) * *channels;
+    s->row_bytes = static_cast<size_t>(s->cinfo.output_width) * *channels;
 
-dake::gl::image::image(const dake::gl::image &copy)
-{
-    w = copy.width();
-    h = copy.height();
-    cc = copy.channels();
-    fmt = copy.format();
-    bsz = copy.byte_size();
+    // As many rows as libjpeg may return at once, and some more
+    int band_height = s->cinfo.rec_outbuf_height > 16 ? s->cinfo.rec_outbuf_height : 16;
+    s->band.resize(s->row_bytes * band_height);
+    s->band_rows.resize(band_height);
+    for (int y = 0; y < band_height; y++) {
+        s->band_rows[y] = &s->band[y * s->row_bytes];
+    }
 
-    d = new uint8_t[bsz];
-    memcpy(d, copy.data(), bsz);
+    return s;
 }
 
 
-dake::gl::image::image(const dake::gl::image &i1, const dake::gl::image &i2)
+// Decodes up to the band's height of rows, returns how many it did
+static int jpg_read_band(jpg_row_state *s, int rows)
 {
-    if (i1.channels() + i2.channels() > 4) {
-        throw std::invalid_argument("Images have too many channels");
-    }
+    int count = rows < static_cast<int>(s->band_rows.size()) ? rows : static_cast<int>(s->band_rows.size());
 
-    if ((i1.width() != i2.width()) || (i1.height() != i2.height())) {
-        throw std::invalid_argument("Images do not have the same size");
+    for (int done = 0; done < count;) {
+        done += jpeg_read_scanlines(&s->cinfo, &s->band_rows[done], count - done);
     }
 
-    if ((i1.format() != LINEAR_UINT8) || (i2.format() != LINEAR_UINT8)) {
-        throw std::invalid_argument("Images are not in linear uint8 format");
-    }
+    return count;
+}
 
-    w = i1.width();
-    h = i1.height();
-    cc = i1.channels() + i2.channels();
-    fmt = LINEAR_UINT8;
 
-    bsz = w * h * cc;
+static void jpg_skip(void *state, int rows)
+{
+    jpg_row_state *s = static_cast<jpg_row_state *>(state);
 
-    d = new uint8_t[bsz];
+#ifdef HAVE_JPEG_CROP
+    jpeg_skip_scanlines(&s->cinfo, rows);
+#else
+    while (rows > 0) {
+        rows -= jpg_read_band(s, rows);
+    }
+#endif
+}
 
-    const uint8_t *s1 = static_cast<const uint8_t *>(i1.data());
-    const uint8_t *s2 = static_cast<const uint8_t *>(i2.data());
 
-    uint8_t *dst = static_cast<uint8_t *>(d);
+static void jpg_read_rows(void *state, uint8_t *dst, size_t stride, int rows)
+{
+    jpg_row_state *s = static_cast<jpg_row_state *>(state);
 
-    for (int i = 0; i < w * h; i++) {
-        for (int c = 0; c < i1.channels(); c++) {
-            *(dst++) = *(s1++);
-        }
-        for (int c = 0; c < i2.channels(); c++) {
-            *(dst++) = *(s2++);
+    while (rows > 0) {
+        int count = jpg_read_band(s, rows);
+
+        for (int y = 0; y < count; y++) {
+            memcpy(dst + y * stride, s->band_rows[y] + s->offset, s->column_bytes);
         }
+
+        dst += count * stride;
+        rows -= count;
     }
 }
 
 
-static const GLenum gl_types[] = {
-    GL_UNSIGNED_BYTE,                 // LINEAR_UINT8
-    GL_COMPRESSED_RGB_S3TC_DXT1_EXT,  // COMPRESSED_S3TC_DXT1
-    GL_COMPRESSED_RGBA_S3TC_DXT1_EXT, // COMPRESSED_S3TC_DXT1_ALPHA
-    GL_COMPRESSED_RGBA_S3TC_DXT3_EXT, // COMPRESSED_S3TC_DXT3
-    GL_COMPRESSED_RGBA_S3TC_DXT5_EXT, // COMPRESSED_S3TC_DXT5
-    GL_COMPRESSED_RED_RGTC1,          // COMPRESSED_RGTC_RED
-    GL_COMPRESSED_RG_RGTC2,           // COMPRESSED_RGTC_RG
+static const dake::gl::image_row_decoder jpg_rows = {
+    jpg_open,
+    jpg_skip,
+    jpg_read_rows,
+    jpg_close
 };
+#endif
 
 
-dake::gl::image::image(const dake::gl::image &input, channel_format new_format, int new_channels)
+bool test_hdr(const void *buffer, size_t length)
 {
-    int stride;
-
-    if (!new_channels) {
-        new_channels = input.channels();
-    }
-
-    switch (new_format) {
-        case LINEAR_UINT8:
-            stride = (input.width() * new_channels + 3) & ~3u;
-            bsz = input.height() * stride;
-            break;
+    return (length >= 10 && !memcmp(buffer, "#?RADIANCE", 10)) ||
+           (length >= 6 && !memcmp(buffer, "#?RGBE", 6));
+}
 
-#ifndef WITHOUT_LIBTXC
-        case COMPRESSED_S3TC_DXT1:
-        case COMPRESSED_S3TC_DXT1_ALPHA:
-        case COMPRESSED_RGTC_RED:
-            stride = ((input.width() + 3) / 4) * 8;
-            bsz = ((input.height() + 3) / 4) * stride;
-            break;
 
-        case COMPRESSED_S3TC_DXT3:
-        case COMPRESSED_S3TC_DXT5:
-        case COMPRESSED_RGTC_RG:
-            stride = ((input.width() + 3) / 4) * 16;
-            bsz = ((input.height() + 3) / 4) * stride;
-            break;
-#else
-        case COMPRESSED_S3TC_DXT1:
-        case COMPRESSED_S3TC_DXT1_ALPHA:
-        case COMPRESSED_RGTC_RED:
-        case COMPRESSED_S3TC_DXT3:
-        case COMPRESSED_S3TC_DXT5:
-        case COMPRESSED_RGTC_RG:
-            throw std::invalid_argument("This version of dake has been "
-                                        "compiled without support for "
-                                        "compressed textures");
-#endif
+// Reads one scanline of RGBE pixels, advancing *inp past it
+static void read_hdr_scanline(uint8_t *out, int width, const uint8_t **inp, const uint8_t *end)
+{
+    const uint8_t *in = *inp;
 
-        default:
-            abort();
+    if (end - in < 4) {
+        throw std::runtime_error("Truncated Radiance HDR file");
     }
 
-    if (input.format() == new_format) {
-        if (new_format != LINEAR_UINT8) {
-            if (new_channels != input.channels()) {
-                throw std::invalid_argument("Cannot change channel count of compressed images");
-            }
+    if (width >= 8 && width < 32768 && in[0] == 2 && in[1] == 2 && !(in[2] & 0x80)) {
+        // New-style RLE: the components one after another, in runs
+        // (count > 128) or literal spans
+        if ((in[2] << 8 | in[3]) != width) {
+            throw std::runtime_error("Invalid Radiance HDR scanline");
         }
+        in += 4;
+
+        for (int c = 0; c < 4; c++) {
+            for (int x = 0; x < width;) {
+                int count = in < end ? *(in++) : 0;
+                bool run = count > 128;
+                if (run) {
+                    count -= 128;
+                }
 
-        fmt = input.format();
-        w = input.width();
-        h = input.height();
-        cc = new_channels;
-
-        d = new uint8_t[bsz];
-        if (new_channels == input.channels()) {
-            memcpy(d, input.data(), bsz);
-        } else {
-            assert(input.format() == LINEAR_UINT8);
-
-            const uint8_t *inp = static_cast<const uint8_t *>(input.data());
-            uint8_t *outp = static_cast<uint8_t *>(d);
-
-            const uint8_t *inp_start = inp;
-            uint8_t *outp_start = outp;
-
-            for (int y = 0; y < h; y++) {
-                inp = inp_start + ((inp - inp_start + 3) & ~3ul);
-                outp = outp_start + ((outp - outp_start + 3) & ~3ul);
+                if (!count || count > width - x || end - in < (run ? 1 : count)) {
+                    throw std::runtime_error("Invalid or truncated Radiance HDR scanline");
+                }
 
-                for (int x = 0; x < w; x++) {
-                    for (int c = 0; c < cc; c++) {
-                        *(outp++) = (c < input.channels() ? *(inp++) : 0);
-                    }
-                    for (int c = 0; c < input.channels() - cc; c++) {
-                        inp++;
-                    }
+                for (int i = 0; i < count; i++) {
+                    out[(x++) * 4 + c] = run ? *in : *(in++);
+                }
+                if (run) {
+                    in++;
                 }
             }
         }
-    } else if (new_format == LINEAR_UINT8) {
-        throw std::invalid_argument("Decompression is not yet supported");
-    } else if (input.format() == LINEAR_UINT8) {
-#ifndef WITHOUT_LIBTXC
-        fmt = new_format;
-        w = input.width();
-        h = input.height();
-
-        if (new_format == COMPRESSED_RGTC_RED) {
-            cc = 1;
-        } else if (new_format == COMPRESSED_RGTC_RG) {
-            cc = 2;
-        } else if (new_format == COMPRESSED_S3TC_DXT1) {
-            cc = 3;
-        } else {
-            cc = 4;
-        }
+    } else {
+        // Flat pixels, or old-style RLE where 1, 1, 1, n repeats the last
+        // pixel n times (consecutive repeats are more significant bytes)
+        int shift = 0;
 
-        d = new uint8_t[bsz];
-        if (new_format == COMPRESSED_S3TC_DXT1 ||
-            new_format == COMPRESSED_S3TC_DXT1_ALPHA ||
-            new_format == COMPRESSED_S3TC_DXT3 ||
-            new_format == COMPRESSED_S3TC_DXT5)
-        {
-            tx_compress_dxtn(input.channels(), w, h,
-                             static_cast<const uint8_t *>(input.data()),
-                             gl_types[fmt], static_cast<uint8_t *>(d), stride);
-        } else if (new_format == COMPRESSED_RGTC_RED) {
-            // FIXME
-            uint64_t *dest_ptr = static_cast<uint64_t *>(d);
-
-            image rgba_image(input, LINEAR_UINT8, 4);
-            rgba_image.swap_channels(0, 1, 2, 0);
-
-            image compressed_rgba(rgba_image, COMPRESSED_S3TC_DXT5);
-            const uint64_t *src_ptr =
-                static_cast<const uint64_t *>(compressed_rgba.data());
-
-            for (size_t i = 0; i < compressed_rgba.bsz / 16; i++) {
-                dest_ptr[i] = src_ptr[i * 2];
+        for (int x = 0; x < width; in += 4) {
+            if (end - in < 4) {
+                throw std::runtime_error("Truncated Radiance HDR file");
             }
-        } else if (new_format == COMPRESSED_RGTC_RG) {
-            // FIXME
-            uint64_t *dest_ptr = static_cast<uint64_t *>(d);
-
-            image rgba_image_r(input, LINEAR_UINT8, 4);
-            image rgba_image_g(rgba_image_r);
-
-            rgba_image_r.swap_channels(0, 1, 2, 0);
-            rgba_image_g.swap_channels(0, 1, 2, 1);
-
-            image compressed_rgba_r(rgba_image_r, COMPRESSED_S3TC_DXT5);
-            image compressed_rgba_g(rgba_image_g, COMPRESSED_S3TC_DXT5);
-            const uint64_t *src_ptr;
 
-            src_ptr = static_cast<const uint64_t *>(compressed_rgba_r.data());
-            for (size_t i = 0; i < compressed_rgba_r.bsz / 16; i++) {
-                dest_ptr[i * 2 + 0] = src_ptr[i * 2];
-            }
+            if (in[0] == 1 && in[1] == 1 && in[2] == 1) {
+                size_t count = static_cast<size_t>(in[3]) << shift;
+                if (!x || shift > 16 || count > static_cast<size_t>(width - x)) {
+                    throw std::runtime_error("Invalid Radiance HDR scanline");
+                }
 
-            src_ptr = static_cast<const uint64_t *>(compressed_rgba_g.data());
-            for (size_t i = 0; i < compressed_rgba_g.bsz / 16; i++) {
-                dest_ptr[i * 2 + 1] = src_ptr[i * 2];
+                for (size_t i = 0; i < count; i++, x++) {
+                    memcpy(out + x * 4, out + (x - 1) * 4, 4);
+                }
+                shift += 8;
+            } else {
+                memcpy(out + (x++) * 4, in, 4);
+                shift = 0;
             }
-        } else {
-            abort();
         }
-#else
-        abort();
-#endif
-    } else {
-        throw std::invalid_argument("Recompression is not supported");
     }
-}
 
-
-dake::gl::image::~image(void)
-{
-    // FIXME (should use the correct type)
-    delete[] static_cast<uint8_t *>(d);
+    *inp = in;
 }
 
 
-void dake::gl::image::load(const void *buffer, size_t length, const std::string &name)
+void *load_hdr(const void *buffer, size_t length, int *width, int *height, int *channels, int *levels, dake::gl::image::channel_format *format)
 {
-    for (const image_format &f: formats) {
-        if (f.test(buffer, length)) {
-            try {
-                d = f.load(buffer, length, &w, &h, &cc, &fmt);
-            } catch (const std::exception &e) {
-                throw std::runtime_error("Could not load image from " + name + ": " + e.what());
-            }
+    const char *p = static_cast<const char *>(buffer), *end = p + length;
+
+    // Header lines up to an empty one, then the resolution
+    std::string line;
+    do {
+        const char *eol = static_cast<const char *>(memchr(p, '\n', end - p));
+        if (!eol) {
+            throw std::runtime_error("Truncated Radiance HDR header");
+        }
 
-            assert(fmt == LINEAR_UINT8);
-            bsz = w * h * cc;
+        line.assign(p, eol);
+        p = eol + 1;
 
-            return;
+        if (!line.compare(0, 7, "FORMAT=") && line != "FORMAT=32-bit_rle_rgbe") {
+            throw std::runtime_error("Unsupported Radiance HDR format " + line.substr(7));
         }
+    } while (!line.empty());
+
+    const char *eol = static_cast<const char *>(memchr(p, '\n', end - p));
+    if (!eol) {
+        throw std::runtime_error("Truncated Radiance HDR header");
+    }
+    line.assign(p, eol);
+    p = eol + 1;
+
+    // Only the standard orientation (top to bottom, left to right)
+    int w, h;
+    char trailing;
+    if (sscanf(line.c_str(), "-Y %d +X %d %c", &h, &w, &trailing) != 2 || w < 1 || h < 1) {
+        throw std::runtime_error("Unsupported Radiance HDR resolution " + line);
     }
 
-    std::string format_list;
+    *width    = w;
+    *height   = h;
+    *channels = 3;
+    *levels   = 1;
+    *format   = dake::gl::image::LINEAR_FLOAT;
 
-    int format_count = static_cast<int>(sizeof(formats) / sizeof(formats[0]));
-    for (int i = 0; i < format_count; i++) {
-        format_list += formats[i].name;
+    // Rows of three floats per pixel need no padding
+    uint8_t *output = new uint8_t[static_cast<size_t>(w) * h * 3 * sizeof(float)];
+    std::vector<uint8_t> rgbe(static_cast<size_t>(w) * 4);
+    const uint8_t *in = reinterpret_cast<const uint8_t *>(p);
 
-        if (i < format_count - 1) {
-            format_list += ", ";
+    try {
+        for (int y = 0; y < h; y++) {
+            read_hdr_scanline(rgbe.data(), w, &in, reinterpret_cast<const uint8_t *>(end));
+
+            float *row = reinterpret_cast<float *>(output) + static_cast<size_t>(y) * w * 3;
+            for (int x = 0; x < w; x++) {
+                const uint8_t *px = &rgbe[x * 4];
+                // Shared exponent, biased by 128 plus 8 for the mantissa
+                float scale = px[3] ? ldexpf(1.f, px[3] - 136) : 0.f;
+
+                for (int c = 0; c < 3; c++) {
+                    row[x * 3 + c] = px[c] * scale;
+                }
+            }
+        }
+    } catch (...) {
+        delete[] output;
+        throw;
+    }
+
+    return output;
+}
+
+
+// Everything image needs to know about a channel format, indexed by
+// channel_format.  Supporting another block-compressed format (such as ASTC)
+// only takes another entry with its codec.
+struct channel_format_info {
+    GLenum gl_type;
+    bool compressed;
+
+    // Compressed formats have blocks of block_bytes each and always represent
+    // the given number of channels; uncompressed formats have 1x1 blocks of
+    // block_bytes per channel.
+    int block_width, block_height;
+    size_t block_bytes;
+    int channels;
+
+    // Sized internal format by channel count; compressed formats use gl_type
+    GLenum internal_formats[4];
+
+    // The uncompressed format the codec reads and writes; images in any other
+    // format are converted to that first
+    dake::gl::image::channel_format codec_format;
+    void (*compress)(dake::gl::image::channel_format fmt, void *dst, const void *src, int width, int height, int channels, size_t stride, dake::gl::image::compression_quality quality);
+    void (*decompress)(dake::gl::image::channel_format fmt, void *dst, const void *src, int width, int height, int channels, size_t stride);
+};
+
+static const channel_format_info channel_formats[] = {
+    // LINEAR_UINT8
+    { GL_UNSIGNED_BYTE, false, 1, 1, 1, 0, { GL_R8, GL_RG8, GL_RGB8, GL_RGBA8 },
+      dake::gl::image::LINEAR_UINT8, nullptr, nullptr },
+    // LINEAR_UINT16
+    { GL_UNSIGNED_SHORT, false, 1, 1, 2, 0, { GL_R16, GL_RG16, GL_RGB16, GL_RGBA16 },
+      dake::gl::image::LINEAR_UINT16, nullptr, nullptr },
+    // LINEAR_HALF
+    { GL_HALF_FLOAT, false, 1, 1, 2, 0, { GL_R16F, GL_RG16F, GL_RGB16F, GL_RGBA16F },
+      dake::gl::image::LINEAR_HALF, nullptr, nullptr },
+    // LINEAR_FLOAT
+    { GL_FLOAT, false, 1, 1, 4, 0, { GL_R32F, GL_RG32F, GL_RGB32F, GL_RGBA32F },
+      dake::gl::image::LINEAR_FLOAT, nullptr, nullptr },
+    // COMPRESSED_S3TC_DXT1
+    { GL_COMPRESSED_RGB_S3TC_DXT1_EXT, true, 4, 4, 8, 3, {},
+      dake::gl::image::LINEAR_UINT8, dake::gl::s3tc::compress, dake::gl::s3tc::decompress },
+    // COMPRESSED_S3TC_DXT1_ALPHA
+    { GL_COMPRESSED_RGBA_S3TC_DXT1_EXT, true, 4, 4, 8, 4, {},
+      dake::gl::image::LINEAR_UINT8, dake::gl::s3tc::compress, dake::gl::s3tc::decompress },
+    // COMPRESSED_S3TC_DXT3
+    { GL_COMPRESSED_RGBA_S3TC_DXT3_EXT, true, 4, 4, 16, 4, {},
+      dake::gl::image::LINEAR_UINT8, dake::gl::s3tc::compress, dake::gl::s3tc::decompress },
+    // COMPRESSED_S3TC_DXT5
+    { GL_COMPRESSED_RGBA_S3TC_DXT5_EXT, true, 4, 4, 16, 4, {},
+      dake::gl::image::LINEAR_UINT8, dake::gl::s3tc::compress, dake::gl::s3tc::decompress },
+    // COMPRESSED_RGTC_RED
+    { GL_COMPRESSED_RED_RGTC1, true, 4, 4, 8, 1, {},
+      dake::gl::image::LINEAR_UINT8, dake::gl::s3tc::compress, dake::gl::s3tc::decompress },
+    // COMPRESSED_RGTC_RG
+    { GL_COMPRESSED_RG_RGTC2, true, 4, 4, 16, 2, {},
+      dake::gl::image::LINEAR_UINT8, dake::gl::s3tc::compress, dake::gl::s3tc::decompress },
+    // COMPRESSED_BPTC_RGBA
+    { GL_COMPRESSED_RGBA_BPTC_UNORM, true, 4, 4, 16, 4, {},
+      dake::gl::image::LINEAR_UINT8, dake::gl::bptc::compress, dake::gl::bptc::decompress },
+    // COMPRESSED_BPTC_RGB_UFLOAT
+    { GL_COMPRESSED_RGB_BPTC_UNSIGNED_FLOAT, true, 4, 4, 16, 3, {},
+      dake::gl::image::LINEAR_HALF, dake::gl::bptc::compress_half, dake::gl::bptc::decompress_half },
+};
+
+
+static size_t level_size(dake::gl::image::channel_format fmt, int width, int height, int channels)
+{
+    const channel_format_info &fi = channel_formats[fmt];
+
+    if (fi.compressed) {
+        return ((width + fi.block_width - 1) / fi.block_width) * fi.block_bytes
+             * ((height + fi.block_height - 1) / fi.block_height);
+    } else {
+        return ((width * channels * fi.block_bytes + 3) & ~static_cast<size_t>(3)) * height;
+    }
+}
+
+
+static int mip_size(int size, int level)
+{
+    return size >> level ? size >> level : 1;
+}
+
+
+// DDS: a header describing the format, followed by all mipmap levels (largest
+// first) stored exactly as OpenGL expects them, except for the row alignment
+// of uncompressed data
+enum {
+    DDSD_CAPS        = 0x1,
+    DDSD_HEIGHT      = 0x2,
+    DDSD_WIDTH       = 0x4,
+    DDSD_PITCH       = 0x8,
+    DDSD_PIXELFORMAT = 0x1000,
+    DDSD_MIPMAPCOUNT = 0x20000,
+    DDSD_LINEARSIZE  = 0x80000,
+
+    DDPF_ALPHAPIXELS = 0x1,
+    DDPF_FOURCC      = 0x4,
+    DDPF_RGB         = 0x40,
+    DDPF_LUMINANCE   = 0x20000,
+
+    DDSCAPS_COMPLEX  = 0x8,
+    DDSCAPS_TEXTURE  = 0x1000,
+    DDSCAPS_MIPMAP   = 0x400000,
+
+    DDSCAPS2_CUBEMAP = 0x200,
+    DDSCAPS2_VOLUME  = 0x200000,
+
+    DDS_DIMENSION_TEXTURE2D = 3,
+    DDS_MISC_TEXTURECUBE    = 0x4,
+};
+
+struct dds_pixel_format {
+    uint32_t size;
+    uint32_t flags;
+    uint32_t fourcc;
+    uint32_t rgb_bit_count;
+    uint32_t masks[4];
+} __attribute__((packed));
+
+struct dds_header {
+    char magic[4];
+    uint32_t size;
+    uint32_t flags;
+    uint32_t height;
+    uint32_t width;
+    uint32_t pitch_or_linear_size;
+    uint32_t depth;
+    uint32_t mip_map_count;
+    uint32_t reserved1[11];
+    dds_pixel_format pf;
+    uint32_t caps, caps2, caps3, caps4;
+    uint32_t reserved2;
+} __attribute__((packed));
+
+struct dds_header_dx10 {
+    uint32_t dxgi_format;
+    uint32_t resource_dimension;
+    uint32_t misc_flag;
+    uint32_t array_size;
+    uint32_t misc_flags2;
+} __attribute__((packed));
+
+
+static constexpr uint32_t fourcc(const char *s)
+{
+    return static_cast<uint32_t>(s[0]) | static_cast<uint32_t>(s[1]) << 8 |
+           static_cast<uint32_t>(s[2]) << 16 | static_cast<uint32_t>(s[3]) << 24;
+}
+
+
+// Formats without a FourCC can only be stored with the DX10 header
+static const struct {
+    uint32_t fourcc;
+    uint32_t dxgi_format;
+    dake::gl::image::channel_format format;
+} dds_compressed_formats[] = {
+    { fourcc("DXT1"), 71, dake::gl::image::COMPRESSED_S3TC_DXT1 },
+    { fourcc("DXT1"), 71, dake::gl::image::COMPRESSED_S3TC_DXT1_ALPHA },
+    { fourcc("DXT3"), 74, dake::gl::image::COMPRESSED_S3TC_DXT3 },
+    { fourcc("DXT5"), 77, dake::gl::image::COMPRESSED_S3TC_DXT5 },
+    { fourcc("ATI1"), 80, dake::gl::image::COMPRESSED_RGTC_RED },
+    { fourcc("BC4U"), 80, dake::gl::image::COMPRESSED_RGTC_RED },
+    { fourcc("ATI2"), 83, dake::gl::image::COMPRESSED_RGTC_RG },
+    { fourcc("BC5U"), 83, dake::gl::image::COMPRESSED_RGTC_RG },
+    { 0,              98, dake::gl::image::COMPRESSED_BPTC_RGBA },
+    { 0,              95, dake::gl::image::COMPRESSED_BPTC_RGB_UFLOAT },
+};
+
+// Where to find each channel (of format, offsets in bytes) in a pixel of the
+// given size
+struct dds_pixel_layout {
+    dake::gl::image::channel_format format;
+    int bytes, channels;
+    int offset[4];
+};
+
+static const struct {
+    uint32_t dxgi_format;
+    dds_pixel_layout layout;
+} dds_uncompressed_formats[] = {
+    { 61, { dake::gl::image::LINEAR_UINT8,   1, 1, { 0 } } },             // R8_UNORM
+    { 49, { dake::gl::image::LINEAR_UINT8,   2, 2, { 0, 1 } } },          // R8G8_UNORM
+    { 28, { dake::gl::image::LINEAR_UINT8,   4, 4, { 0, 1, 2, 3 } } },    // R8G8B8A8_UNORM
+    { 87, { dake::gl::image::LINEAR_UINT8,   4, 4, { 2, 1, 0, 3 } } },    // B8G8R8A8_UNORM
+    { 56, { dake::gl::image::LINEAR_UINT16,  2, 1, { 0 } } },             // R16_UNORM
+    { 35, { dake::gl::image::LINEAR_UINT16,  4, 2, { 0, 2 } } },          // R16G16_UNORM
+    { 11, { dake::gl::image::LINEAR_UINT16,  8, 4, { 0, 2, 4, 6 } } },    // R16G16B16A16_UNORM
+    { 54, { dake::gl::image::LINEAR_HALF,    2, 1, { 0 } } },             // R16_FLOAT
+    { 34, { dake::gl::image::LINEAR_HALF,    4, 2, { 0, 2 } } },          // R16G16_FLOAT
+    { 10, { dake::gl::image::LINEAR_HALF,    8, 4, { 0, 2, 4, 6 } } },    // R16G16B16A16_FLOAT
+    { 41, { dake::gl::image::LINEAR_FLOAT,   4, 1, { 0 } } },             // R32_FLOAT
+    { 16, { dake::gl::image::LINEAR_FLOAT,   8, 2, { 0, 4 } } },          // R32G32_FLOAT
+    {  6, { dake::gl::image::LINEAR_FLOAT,  12, 3, { 0, 4, 8 } } },       // R32G32B32_FLOAT
+    {  2, { dake::gl::image::LINEAR_FLOAT,  16, 4, { 0, 4, 8, 12 } } },   // R32G32B32A32_FLOAT
+};
+
+
+// Whether pixels are stored just like image does, apart from row padding
+static bool dds_layout_is_identity(const dds_pixel_layout &layout)
+{
+    size_t cs = dake::gl::texel::value_size(layout.format);
+
+    if (static_cast<size_t>(layout.bytes) != layout.channels * cs) {
+        return false;
+    }
+    for (int c = 0; c < layout.channels; c++) {
+        if (static_cast<size_t>(layout.offset[c]) != c * cs) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+bool test_dds(const void *buffer, size_t length)
+{
+    return length >= sizeof(dds_header) && !strncmp(static_cast<const char *>(buffer), "DDS ", 4);
+}
+
+
+static bool dds_layout_from_masks(const dds_pixel_format &pf, dds_pixel_layout *layout)
+{
+    if (pf.rgb_bit_count % 8 || pf.rgb_bit_count < 8 || pf.rgb_bit_count > 32) {
+        return false;
+    }
+
+    layout->format = dake::gl::image::LINEAR_UINT8;
+    layout->bytes = pf.rgb_bit_count / 8;
+    layout->channels = pf.flags & DDPF_LUMINANCE ? 1 : 3;
+
+    uint32_t masks[4];
+    int mc = 0;
+    for (int c = 0; c < layout->channels; c++) {
+        masks[mc++] = pf.masks[c];
+    }
+    if (pf.flags & DDPF_ALPHAPIXELS) {
+        masks[mc++] = pf.masks[3];
+        layout->channels++;
+    }
+
+    // Some writers get the mask of 8-bit luminance wrong, but there is only
+    // one way to store that anyway
+    if (layout->bytes == 1 && layout->channels == 1) {
+        layout->offset[0] = 0;
+        return true;
+    }
+
+    for (int c = 0; c < layout->channels; c++) {
+        layout->offset[c] = -1;
+        for (int b = 0; b < layout->bytes; b++) {
+            if (masks[c] == 0xffu << (b * 8)) {
+                layout->offset[c] = b;
+            }
+        }
+
+        if (layout->offset[c] < 0) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+void *load_dds(const void *buffer, size_t length, int *width, int *height, int *channels, int *levels, dake::gl::image::channel_format *format)
+{
+    const dds_header *hdr = static_cast<const dds_header *>(buffer);
+    const uint8_t *data = reinterpret_cast<const uint8_t *>(hdr + 1);
+    const uint8_t *end = static_cast<const uint8_t *>(buffer) + length;
+
+    if (hdr->size != sizeof(dds_header) - 4 || hdr->pf.size != sizeof(dds_pixel_format)) {
+        throw std::runtime_error("Invalid DDS header");
+    }
+
+    if (hdr->caps2 & (DDSCAPS2_CUBEMAP | DDSCAPS2_VOLUME)) {
+        throw std::runtime_error("DDS cube maps and volume textures are not supported");
+    }
+
+    *width  = hdr->width;
+    *height = hdr->height;
+    *levels = (hdr->flags & DDSD_MIPMAPCOUNT) && hdr->mip_map_count ? hdr->mip_map_count : 1;
+
+    if (*width < 1 || *height < 1 || *levels > 32 ||
+        (*levels > 1 && !((*width | *height) >> (*levels - 1))))
+    {
+        throw std::runtime_error("Invalid DDS image size");
+    }
+
+    bool compressed = false;
+    dds_pixel_layout layout;
+
+    if (hdr->pf.flags & DDPF_FOURCC) {
+        const dds_header_dx10 *dx10 = nullptr;
+        if (hdr->pf.fourcc == fourcc("DX10")) {
+            dx10 = reinterpret_cast<const dds_header_dx10 *>(data);
+            data = reinterpret_cast<const uint8_t *>(dx10 + 1);
+
+            if (data > end) {
+                throw std::runtime_error("Truncated DDS header");
+            }
+            if (dx10->resource_dimension != DDS_DIMENSION_TEXTURE2D || dx10->array_size > 1 ||
+                (dx10->misc_flag & DDS_MISC_TEXTURECUBE))
+            {
+                throw std::runtime_error("Only single 2D DDS textures are supported");
+            }
+        }
+
+        for (const auto &f: dds_compressed_formats) {
+            if (dx10 ? f.dxgi_format == dx10->dxgi_format : f.fourcc == hdr->pf.fourcc) {
+                *format = f.format;
+                compressed = true;
+                break;
+            }
+        }
+
+        // D3D10 always decodes BC1 with punch-through alpha
+        if (compressed && *format == dake::gl::image::COMPRESSED_S3TC_DXT1 &&
+            (dx10 || (hdr->pf.flags & DDPF_ALPHAPIXELS)))
+        {
+            *format = dake::gl::image::COMPRESSED_S3TC_DXT1_ALPHA;
+        }
+
+        if (!compressed && dx10) {
+            bool found = false;
+            for (const auto &f: dds_uncompressed_formats) {
+                if (f.dxgi_format == dx10->dxgi_format) {
+                    layout = f.layout;
+                    found = true;
+                    break;
+                }
+            }
+
+            if (!found) {
+                throw std::runtime_error("Unsupported DXGI format " + std::to_string(dx10->dxgi_format));
+            }
+        } else if (!compressed) {
+            throw std::runtime_error("Unsupported DDS FourCC");
+        }
+    } else if (hdr->pf.flags & (DDPF_RGB | DDPF_LUMINANCE)) {
+        if (!dds_layout_from_masks(hdr->pf, &layout)) {
+            throw std::runtime_error("Unsupported DDS pixel layout");
+        }
+    } else {
+        throw std::runtime_error("Unsupported DDS pixel format");
+    }
+
+    if (compressed) {
+        *channels = channel_formats[*format].channels;
+
+        size_t size = 0;
+        for (int l = 0; l < *levels; l++) {
+            size += level_size(*format, mip_size(*width, l), mip_size(*height, l), *channels);
+        }
+        if (size > static_cast<size_t>(end - data)) {
+            throw std::runtime_error("Truncated DDS file");
+        }
+
+        // Use the data in place
+        return const_cast<uint8_t *>(data);
+    }
+
+    *format   = layout.format;
+    *channels = layout.channels;
+    size_t cs = dake::gl::texel::value_size(layout.format);
+
+    size_t src_size = 0, size = 0;
+    for (int l = 0; l < *levels; l++) {
+        int lw = mip_size(*width, l), lh = mip_size(*height, l);
+        src_size += static_cast<size_t>(lw) * lh * layout.bytes;
+        size += level_size(*format, lw, lh, *channels);
+    }
+    if (src_size > static_cast<size_t>(end - data)) {
+        throw std::runtime_error("Truncated DDS file");
+    }
+
+    // Rows of pixels that are a multiple of four bytes in size are always
+    // aligned, so they can be used in place
+    if (dds_layout_is_identity(layout) && !(layout.bytes % 4)) {
+        return const_cast<uint8_t *>(data);
+    }
+
+    uint8_t *output = new uint8_t[size];
+    uint8_t *out = output;
+    for (int l = 0; l < *levels; l++) {
+        int lw = mip_size(*width, l), lh = mip_size(*height, l);
+
+        for (int y = 0; y < lh; y++) {
+            for (int x = 0; x < lw; x++) {
+                for (int c = 0; c < *channels; c++) {
+                    memcpy(out + (x * *channels + c) * cs, data + layout.offset[c], cs);
+                }
+                data += layout.bytes;
+            }
+            out += (lw * *channels * cs + 3) & ~static_cast<size_t>(3);
+        }
+    }
+
+    return output;
+}
+
+
+static void save_dds(FILE *fp, const dake::gl::image &img)
+{
+    dds_header hdr;
+    dds_header_dx10 dx10;
+    bool use_dx10 = false;
+
+    memset(&hdr, 0, sizeof(hdr));
+    memset(&dx10, 0, sizeof(dx10));
+
+    memcpy(hdr.magic, "DDS ", 4);
+    hdr.size   = sizeof(dds_header) - 4;
+    hdr.flags  = DDSD_CAPS | DDSD_HEIGHT | DDSD_WIDTH | DDSD_PIXELFORMAT;
+    hdr.height = img.height();
+    hdr.width  = img.width();
+    hdr.caps   = DDSCAPS_TEXTURE;
+    hdr.pf.size = sizeof(dds_pixel_format);
+
+    if (img.levels() > 1) {
+        hdr.flags |= DDSD_MIPMAPCOUNT;
+        hdr.mip_map_count = img.levels();
+        hdr.caps |= DDSCAPS_COMPLEX | DDSCAPS_MIPMAP;
+    }
+
+    dx10.resource_dimension = DDS_DIMENSION_TEXTURE2D;
+    dx10.array_size = 1;
+
+    if (img.compressed()) {
+        hdr.flags |= DDSD_LINEARSIZE;
+        hdr.pitch_or_linear_size = img.level_byte_size(0);
+        hdr.pf.flags = DDPF_FOURCC;
+
+        for (const auto &f: dds_compressed_formats) {
+            if (f.format == img.format()) {
+                use_dx10 = !f.fourcc;
+                hdr.pf.fourcc = use_dx10 ? fourcc("DX10") : f.fourcc;
+                dx10.dxgi_format = f.dxgi_format;
+                break;
+            }
+        }
+
+        if (img.format() == dake::gl::image::COMPRESSED_S3TC_DXT1_ALPHA) {
+            hdr.pf.flags |= DDPF_ALPHAPIXELS;
+        }
+    } else {
+        size_t cs = dake::gl::texel::value_size(img.format());
+
+        hdr.flags |= DDSD_PITCH;
+        hdr.pitch_or_linear_size = img.width() * img.channels() * cs;
+
+        if (img.format() == dake::gl::image::LINEAR_UINT8 && img.channels() >= 3) {
+            hdr.pf.flags = DDPF_RGB | (img.channels() == 4 ? DDPF_ALPHAPIXELS : 0);
+            hdr.pf.rgb_bit_count = img.channels() * 8;
+            for (int c = 0; c < img.channels(); c++) {
+                hdr.pf.masks[c] = 0xffu << (c * 8);
+            }
+        } else {
+            // Luminance/alpha would not mean the same as red/green, and
+            // there are no masks for anything but 8-bit channels
+            use_dx10 = true;
+            hdr.pf.flags = DDPF_FOURCC;
+            hdr.pf.fourcc = fourcc("DX10");
+
+            for (const auto &f: dds_uncompressed_formats) {
+                if (f.layout.format == img.format() && f.layout.channels == img.channels() &&
+                    dds_layout_is_identity(f.layout))
+                {
+                    dx10.dxgi_format = f.dxgi_format;
+                    break;
+                }
+            }
+
+            if (!dx10.dxgi_format) {
+                throw std::runtime_error("DDS cannot store this format with " +
+                                         std::to_string(img.channels()) + " channels");
+            }
+        }
+    }
+
+    bool ok = fwrite(&hdr, sizeof(hdr), 1, fp) == 1;
+    if (use_dx10) {
+        ok = ok && fwrite(&dx10, sizeof(dx10), 1, fp) == 1;
+    }
+
+    for (int l = 0; ok && l < img.levels(); l++) {
+        const uint8_t *level = static_cast<const uint8_t *>(img.level_data(l));
+
+        if (img.compressed()) {
+            ok = fwrite(level, img.level_byte_size(l), 1, fp) == 1;
+            continue;
+        }
+
+        // Strip the row padding
+        size_t row = img.level_width(l) * img.channels() * dake::gl::texel::value_size(img.format());
+        size_t stride = (row + 3) & ~static_cast<size_t>(3);
+        for (int y = 0; ok && y < img.level_height(l); y++) {
+            ok = fwrite(level + y * stride, row, 1, fp) == 1;
+        }
+    }
+
+    if (!ok) {
+        throw std::runtime_error(strerror(errno));
+    }
+}
+
+
+struct image_format {
+    const char *name;
+
+    bool (*test)(const void *buffer, size_t length);
+    void *(*load)(const void *buffer, size_t length, int *width, int *height, int *channels, int *levels, dake::gl::image::channel_format *fmt);
+    // Optional: decodes directly at a reduced size of at most
+    // max_width x max_height where the format allows
+    void *(*load_reduced)(const void *buffer, size_t length, int max_width, int max_height, int *width, int *height, int *channels, int *levels, dake::gl::image::channel_format *fmt);
+    // Optional: incremental decoding for image_reader
+    const dake::gl::image_row_decoder *rows;
+};
+
+
+static const image_format formats[] = {
+    // Must come first, libjpeg does not take well to being fed DDS files
+    {
+        "dds",
+        test_dds,
+        load_dds,
+        nullptr,
+        nullptr
+    },
+
+    {
+        "hdr",
+        test_hdr,
+        load_hdr,
+        nullptr,
+        nullptr
+    },
+
+#ifndef WITHOUT_LIBPNG
+    {
+        "png",
+        test_png,
+        load_png,
+        nullptr,
+        &png_rows
+    },
+#endif
+
+    {
+        "bmp",
+        test_bmp,
+        load_bmp,
+        nullptr,
+        &bmp_rows
+    },
+
+#ifndef WITHOUT_LIBJPEG
+    {
+        "jpg",
+        test_jpg,
+        load_jpg,
+        load_jpg_reduced,
+        &jpg_rows
+    },
+#endif
+};
+
+
+static bool points_into(const void *ptr, const void *buffer, size_t length)
+{
+    uintptr_t p = reinterpret_cast<uintptr_t>(ptr), b = reinterpret_cast<uintptr_t>(buffer);
+    return p >= b && p < b + length;
+}
+
+
+dake::gl::image::image(const std::string &file):
+    image(file, 0, 0)
+{}
+
+
+dake::gl::image::image(const std::string &file, int max_width, int max_height)
+{
+    size_t lof;
+    void *buffer = dake::cross::map_file(dake::gl::find_resource_filename(file).c_str(), &lof);
+    if (!buffer) {
+        throw std::runtime_error("Could not load image from " + file + ": " + strerror(errno));
+    }
+
+    try {
+        load(buffer, lof, file, max_width, max_height);
+    } catch (...) {
+        dake::cross::unmap_file(buffer, lof);
+        throw;
+    }
+
+    // Keep the file mapped if the data is used in place
+    if (points_into(d, buffer, lof)) {
+        mapping = buffer;
+        mapping_size = lof;
+    } else {
+        dake::cross::unmap_file(buffer, lof);
+    }
+}
+
+
+dake::gl::image::image(const void *buffer, size_t length):
+    image(buffer, length, 0, 0)
+{}
+
+
+dake::gl::image::image(const void *buffer, size_t length, int max_width, int max_height)
+{
+    char *name = new char[2 + sizeof(buffer) * 2 + 1];
+    snprintf(name, 2 + sizeof(buffer) * 2 + 1, "%p", buffer);
+
+    try {
+        load(buffer, length, name, max_width, max_height);
+    } catch (...) {
+        delete[] name;
+        throw;
+    }
+
+    delete[] name;
+
+    // The buffer belongs to the caller
+    if (points_into(d, buffer, length)) {
+        uint8_t *copy = new uint8_t[bsz];
+        memcpy(copy, d, bsz);
+        d = copy;
+    }
+}
+
+
+dake::gl::image::image(const dake::gl::image &copy)
+{
+    w = copy.width();
+    h = copy.height();
+    cc = copy.channels();
+    fmt = copy.format();
+    lvls = copy.levels();
+    bsz = copy.byte_size();
+
+    d = new uint8_t[bsz];
+    memcpy(d, copy.data(), bsz);
+}
+
+
+dake::gl::image::image(dake::gl::image &&other):
+    d(other.d),
+    fmt(other.fmt),
+    w(other.w),
+    h(other.h),
+    cc(other.cc),
+    lvls(other.lvls),
+    bsz(other.bsz),
+    mapping(other.mapping),
+    mapping_size(other.mapping_size)
+{
+    other.d = nullptr;
+    other.mapping = nullptr;
+    other.bsz = 0;
+}
+
+
+dake::gl::image::image(int width, int height, int channels, channel_format format):
+    fmt(format),
+    w(width),
+    h(height),
+    cc(channels)
+{
+    if (compressed()) {
+        throw std::invalid_argument("Cannot create a blank compressed image");
+    }
+
+    bsz = level_size(fmt, w, h, cc);
+    d = new uint8_t[bsz]();
+}
+
+
+dake::gl::image::image(const dake::gl::image &i1, const dake::gl::image &i2)
+{
+    if (i1.channels() + i2.channels() > 4) {
+        throw std::invalid_argument("Images have too many channels");
+    }
+
+    if ((i1.width() != i2.width()) || (i1.height() != i2.height())) {
+        throw std::invalid_argument("Images do not have the same size");
+    }
+
+    if ((i1.format() != LINEAR_UINT8) || (i2.format() != LINEAR_UINT8)) {
+        throw std::invalid_argument("Images are not in linear uint8 format");
+    }
+
+    w = i1.width();
+    h = i1.height();
+    cc = i1.channels() + i2.channels();
+    fmt = LINEAR_UINT8;
+
+    bsz = level_size(fmt, w, h, cc);
+
+    d = new uint8_t[bsz];
+
+    // Only level 0 is merged
+    dake::gl::swizzle::merge(d, bsz / h,
+                             i1.data(), i1.channels(), i1.level_byte_size(0) / h,
+                             i2.data(), i2.channels(), i2.level_byte_size(0) / h,
+                             w, h);
+}
+
+
+size_t dake::gl::image::level_offset(int level) const
+{
+    size_t offset = 0;
+    for (int l = 0; l < level; l++) {
+        offset += level_byte_size(l);
+    }
+
+    return offset;
+}
+
+
+const void *dake::gl::image::level_data(int level) const
+{
+    return static_cast<const uint8_t *>(d) + level_offset(level);
+}
+
+
+size_t dake::gl::image::level_byte_size(int level) const
+{
+    return level_size(fmt, level_width(level), level_height(level), cc);
+}
+
+
+dake::gl::image::image(const dake::gl::image &input, channel_format new_format, int new_channels, compression_quality quality)
+{
+    convert(input, new_format, new_channels, quality);
+}
+
+
+void dake::gl::image::convert(const dake::gl::image &input, channel_format new_format, int new_channels, compression_quality quality)
+{
+    const channel_format_info &ifi = channel_formats[input.format()];
+    const channel_format_info &nfi = channel_formats[new_format];
+    bool same_format = input.format() == new_format;
+
+    if (!new_channels) {
+        new_channels = input.channels();
+    }
+
+    if (ifi.compressed && nfi.compressed && !same_format) {
+        throw std::invalid_argument("Recompression is not supported");
+    }
+
+    // Codecs only work on a single uncompressed format and the type and the
+    // channel count are changed in separate steps, so anything else goes
+    // through an intermediate image
+    bool via = true;
+    channel_format via_format = input.format();
+    int via_channels = input.channels();
+
+    if (nfi.compressed && !same_format && input.format() != nfi.codec_format) {
+        via_format = nfi.codec_format;
+    } else if (ifi.compressed && !nfi.compressed && new_format != ifi.codec_format) {
+        via_format = ifi.codec_format;
+        via_channels = new_channels;
+    } else if (!ifi.compressed && !nfi.compressed && !same_format && new_channels != input.channels()) {
+        via_channels = new_channels;
+    } else {
+        via = false;
+    }
+
+    if (via) {
+        image intermediate(input, via_format, via_channels);
+        convert(intermediate, new_format, new_channels, quality);
+        return;
+    }
+
+    if (!nfi.compressed) {
+        cc = new_channels;
+    } else if (!same_format) {
+        cc = nfi.channels;
+    } else if (new_channels == input.channels()) {
+        cc = new_channels;
+    } else {
+        throw std::invalid_argument("Cannot change channel count of compressed images");
+    }
+
+    fmt = new_format;
+    w = input.width();
+    h = input.height();
+    lvls = input.levels();
+
+    bsz = 0;
+    for (int l = 0; l < lvls; l++) {
+        bsz += level_byte_size(l);
+    }
+
+    d = new uint8_t[bsz];
+
+    if (same_format && cc == input.channels()) {
+        memcpy(d, input.data(), bsz);
+        return;
+    }
+
+    uint8_t *outp_level = static_cast<uint8_t *>(d);
+
+    for (int l = 0; l < lvls; l++) {
+        int lw = level_width(l), lh = level_height(l);
+        const void *inp_level = input.level_data(l);
+
+        if (nfi.compressed) {
+            nfi.compress(new_format, outp_level, inp_level, lw, lh, input.channels(),
+                         input.level_byte_size(l) / lh, quality);
+        } else if (ifi.compressed) {
+            ifi.decompress(input.format(), outp_level, inp_level, lw, lh, cc, level_byte_size(l) / lh);
+        } else if (same_format) {
+            // Keep the first channels, fill up with zeroes
+            int map[4];
+            for (int c = 0; c < cc; c++) {
+                map[c] = c < input.channels() ? c : -1;
+            }
+
+            dake::gl::swizzle::remap(outp_level, cc, level_byte_size(l) / lh,
+                                     inp_level, input.channels(), input.level_byte_size(l) / lh,
+                                     map, lw, lh, nfi.block_bytes);
+        } else {
+            dake::gl::texel::convert(outp_level, new_format, level_byte_size(l) / lh,
+                                     inp_level, input.format(), input.level_byte_size(l) / lh,
+                                     static_cast<size_t>(lw) * cc, lh);
+        }
+
+        outp_level += level_byte_size(l);
+    }
+}
+
+
+dake::gl::image::image(const dake::gl::image &input, const mipmap_options &options)
+{
+    if (input.format() != LINEAR_UINT8) {
+        throw std::invalid_argument("Mipmaps can only be generated from linear uint8 images");
+    }
+
+    if (options.compress_to != LINEAR_UINT8) {
+        mipmap_options uncompressed = options;
+        uncompressed.compress_to = LINEAR_UINT8;
+
+        convert(image(input, uncompressed), options.compress_to, 0, options.quality);
+        return;
+    }
+
+    fmt = LINEAR_UINT8;
+    w = input.width();
+    h = input.height();
+    cc = input.channels();
+
+    lvls = 1;
+    while ((w >> lvls) || (h >> lvls)) {
+        lvls++;
+    }
+
+    bsz = 0;
+    for (int l = 0; l < lvls; l++) {
+        bsz += level_byte_size(l);
+    }
+
+    d = new uint8_t[bsz];
+    memcpy(d, input.level_data(0), level_byte_size(0));
+
+    // Every level is filtered from the previous one in floating point, so
+    // rounding errors do not accumulate
+    resample::plane prev(w, h);
+    resample::unpack(&prev, d, cc, level_byte_size(0) / h, options.srgb);
+
+    bool keep_coverage = cc == 4 && options.alpha_coverage_ref >= 0.f;
+    float coverage = 0.f;
+    if (keep_coverage) {
+        coverage = resample::alpha_coverage(prev, options.alpha_coverage_ref);
+    }
+
+    uint8_t *level = static_cast<uint8_t *>(d);
+    for (int l = 1; l < lvls; l++) {
+        level += level_byte_size(l - 1);
+
+        resample::plane next(level_width(l), level_height(l));
+        resample::scale(&next, prev, options.filter);
+
+        float alpha_scale = 1.f;
+        if (keep_coverage) {
+            // Coverage grows monotonically with the scale
+            float lo = 0.f, hi = 4.f;
+            for (int i = 0; i < 16; i++) {
+                alpha_scale = (lo + hi) / 2.f;
+                if (resample::alpha_coverage(next, options.alpha_coverage_ref, alpha_scale) < coverage) {
+                    lo = alpha_scale;
+                } else {
+                    hi = alpha_scale;
+                }
+            }
+            alpha_scale = hi;
+        }
+
+        resample::pack(level, cc, level_byte_size(l) / level_height(l), next,
+                       options.srgb, alpha_scale);
+
+        prev = std::move(next);
+    }
+}
+
+
+dake::gl::image::image(const dake::gl::image &input, int new_width, int new_height, resample_filter filter, bool srgb)
+{
+    if (input.format() != LINEAR_UINT8) {
+        throw std::invalid_argument("Only linear uint8 images can be scaled");
+    }
+    if (new_width < 1 || new_height < 1) {
+        throw std::invalid_argument("Invalid image size");
+    }
+
+    fmt = LINEAR_UINT8;
+    w = new_width;
+    h = new_height;
+    cc = input.channels();
+    bsz = level_size(fmt, w, h, cc);
+
+    d = new uint8_t[bsz];
+
+    resample::scale(d, w, h, bsz / h,
+                    input.data(), input.width(), input.height(), input.level_byte_size(0) / input.height(),
+                    cc, filter, srgb);
+}
+
+
+dake::gl::image::~image(void)
+{
+    if (mapping) {
+        dake::cross::unmap_file(mapping, mapping_size);
+    } else {
+        // FIXME (should use the correct type)
+        delete[] static_cast<uint8_t *>(d);
+    }
+}
+
+
+void dake::gl::image::load(const void *buffer, size_t length, const std::string &name, int max_width, int max_height)
+{
+    bool limited = max_width > 0 || max_height > 0;
+
+    for (const image_format &f: formats) {
+        if (f.test(buffer, length)) {
+            try {
+                if (limited && f.load_reduced) {
+                    d = f.load_reduced(buffer, length, max_width, max_height, &w, &h, &cc, &lvls, &fmt);
+                } else {
+                    d = f.load(buffer, length, &w, &h, &cc, &lvls, &fmt);
+                }
+            } catch (const std::exception &e) {
+                throw std::runtime_error("Could not load image from " + name + ": " + e.what());
+            }
+
+            bsz = 0;
+            for (int l = 0; l < lvls; l++) {
+                bsz += level_byte_size(l);
+            }
+
+            if (limited) {
+                reduce(max_width, max_height, buffer, length);
+            }
+
+            return;
+        }
+    }
+
+    std::string format_list;
+
+    int format_count = static_cast<int>(sizeof(formats) / sizeof(formats[0]));
+    for (int i = 0; i < format_count; i++) {
+        format_list += formats[i].name;
+
+        if (i < format_count - 1) {
+            format_list += ", ";
         }
     }
 
@@ -677,6 +1779,140 @@ void dake::gl::image::load(const void *buffer, size_t length, const std::string
 }
 
 
+dake::gl::image::image(const std::string &file, const region &area)
+{
+    image_reader reader(file, area.x, area.width);
+
+    if (area.y < 0 || area.height < 1 || area.height > reader.image_height() - area.y) {
+        throw std::invalid_argument("Rows out of bounds");
+    }
+
+    reader.skip(area.y);
+    read(reader, area.height);
+}
+
+
+dake::gl::image::image(const void *buffer, size_t length, const region &area)
+{
+    image_reader reader(buffer, length, area.x, area.width);
+
+    if (area.y < 0 || area.height < 1 || area.height > reader.image_height() - area.y) {
+        throw std::invalid_argument("Rows out of bounds");
+    }
+
+    reader.skip(area.y);
+    read(reader, area.height);
+}
+
+
+dake::gl::image::image(image_reader &reader, int rows)
+{
+    read(reader, rows);
+}
+
+
+void dake::gl::image::read(image_reader &reader, int rows)
+{
+    if (rows > reader.rows_left()) {
+        rows = reader.rows_left();
+    }
+    if (rows < 1) {
+        throw std::invalid_argument("No rows left to read");
+    }
+
+    fmt = reader.format();
+    w = reader.width();
+    h = rows;
+    cc = reader.channels();
+    bsz = level_size(fmt, w, h, cc);
+
+    d = new uint8_t[bsz];
+
+    try {
+        reader.read(d, bsz / h, rows);
+    } catch (...) {
+        delete[] static_cast<uint8_t *>(d);
+        throw;
+    }
+}
+
+
+// d may still point into the buffer the image was loaded from
+void dake::gl::image::reduce(int max_width, int max_height, const void *buffer, size_t length)
+{
+    auto too_large = [=](int lw, int lh) {
+        return (max_width > 0 && lw > max_width) || (max_height > 0 && lh > max_height);
+    };
+
+    bool borrowed = points_into(d, buffer, length);
+
+    int first = 0;
+    while (first < lvls - 1 && too_large(level_width(first), level_height(first))) {
+        first++;
+    }
+
+    if (first) {
+        size_t offset = level_offset(first);
+
+        w = level_width(first);
+        h = level_height(first);
+        lvls -= first;
+        bsz -= offset;
+
+        if (borrowed) {
+            d = static_cast<uint8_t *>(d) + offset;
+        } else {
+            uint8_t *rest = new uint8_t[bsz];
+            memcpy(rest, static_cast<uint8_t *>(d) + offset, bsz);
+            delete[] static_cast<uint8_t *>(d);
+            d = rest;
+        }
+    } else if (lvls == 1 && fmt == LINEAR_UINT8 && too_large(w, h)) {
+        int nw = w, nh = h;
+        if (max_width > 0 && nw > max_width) {
+            nh = maximum(1, static_cast<int>(static_cast<int64_t>(nh) * max_width / nw));
+            nw = max_width;
+        }
+        if (max_height > 0 && nh > max_height) {
+            nw = maximum(1, static_cast<int>(static_cast<int64_t>(nw) * max_height / nh));
+            nh = max_height;
+        }
+
+        size_t scaled_size = level_size(fmt, nw, nh, cc);
+        uint8_t *scaled = new uint8_t[scaled_size];
+        resample::scale(scaled, nw, nh, scaled_size / nh, d, w, h, bsz / h, cc, RESAMPLE_BOX, false);
+
+        if (!borrowed) {
+            delete[] static_cast<uint8_t *>(d);
+        }
+        d = scaled;
+        w = nw;
+        h = nh;
+        bsz = scaled_size;
+    }
+}
+
+
+void dake::gl::image::save(const std::string &file) const
+{
+    FILE *fp = fopen(file.c_str(), "wb");
+    if (!fp) {
+        throw std::runtime_error("Could not save image to " + file + ": " + strerror(errno));
+    }
+
+    try {
+        save_dds(fp, *this);
+    } catch (const std::exception &e) {
+        fclose(fp);
+        throw std::runtime_error("Could not save image to " + file + ": " + e.what());
+    }
+
+    if (fclose(fp)) {
+        throw std::runtime_error("Could not save image to " + file + ": " + strerror(errno));
+    }
+}
+
+
 static const GLenum gl_formats[] = {
     GL_RED,
     GL_RG,
@@ -697,33 +1933,29 @@ GLenum dake::gl::image::gl_format(void) const
 
 GLenum dake::gl::image::gl_type(void) const
 {
-    return gl_types[fmt];
+    return channel_formats[fmt].gl_type;
 }
 
 
-bool dake::gl::image::compressed(void) const
+GLenum dake::gl::image::gl_internal_format(void) const
 {
-    switch (fmt) {
-        case LINEAR_UINT8:
-            return false;
+    if (compressed()) {
+        return gl_type();
+    } else {
+        return channel_formats[fmt].internal_formats[cc - 1];
+    }
+}
 
-        case COMPRESSED_S3TC_DXT1:
-        case COMPRESSED_S3TC_DXT1_ALPHA:
-        case COMPRESSED_S3TC_DXT3:
-        case COMPRESSED_S3TC_DXT5:
-        case COMPRESSED_RGTC_RED:
-        case COMPRESSED_RGTC_RG:
-            return true;
 
-        default:
-            abort();
-    }
+bool dake::gl::image::compressed(void) const
+{
+    return channel_formats[fmt].compressed;
 }
 
 
 void dake::gl::image::swap_channels(int r, int g, int b, int a)
 {
-    if (fmt != LINEAR_UINT8) {
+    if (compressed()) {
         throw std::runtime_error("Cannot swap color channels of compressed "
                                  "images");
     }
@@ -738,21 +1970,144 @@ void dake::gl::image::swap_channels(int r, int g, int b, int a)
         }
     }
 
-    uint8_t *base = static_cast<uint8_t *>(d), *ptr = base;
-    uint8_t src[4] = { 0 };
+    uint8_t *level = static_cast<uint8_t *>(d);
+    for (int l = 0; l < lvls; l++) {
+        size_t stride = level_byte_size(l) / level_height(l);
+        dake::gl::swizzle::remap(level, cc, stride, level, cc, stride, tc,
+                                 level_width(l), level_height(l), channel_formats[fmt].block_bytes);
 
-    for (int y = 0; y < h; y++) {
-        ptr = base + ((ptr - base + 3) & ~3ul);
+        level += level_byte_size(l);
+    }
+}
 
-        for (int x = 0; x < w; x++) {
-            for (int c = 0; c < cc; c++) {
-                src[c] = ptr[tc[c]];
-            }
-            for (int c = 0; c < cc; c++) {
-                ptr[c] = src[c];
-            }
 
-            ptr += cc;
+dake::gl::image_reader::image_reader(const std::string &file):
+    image_reader(file, 0, 0)
+{}
+
+
+dake::gl::image_reader::image_reader(const void *buffer, size_t length):
+    image_reader(buffer, length, 0, 0)
+{}
+
+
+dake::gl::image_reader::image_reader(const std::string &file, int x, int width)
+{
+    mapping = dake::cross::map_file(dake::gl::find_resource_filename(file).c_str(), &mapping_size);
+    if (!mapping) {
+        throw std::runtime_error("Could not load image from " + file + ": " + strerror(errno));
+    }
+
+    try {
+        open(mapping, mapping_size, file, x, width);
+    } catch (...) {
+        dake::cross::unmap_file(mapping, mapping_size);
+        throw;
+    }
+}
+
+
+dake::gl::image_reader::image_reader(const void *buffer, size_t length, int x, int width)
+{
+    char name[2 + sizeof(buffer) * 2 + 1];
+    snprintf(name, sizeof(name), "%p", buffer);
+
+    open(buffer, length, name, x, width);
+}
+
+
+void dake::gl::image_reader::open(const void *buffer, size_t length, const std::string &name, int x, int width)
+{
+    const image_format *format = nullptr;
+    for (const image_format &f: formats) {
+        if (f.test(buffer, length)) {
+            format = &f;
+            break;
+        }
+    }
+
+    if (!format) {
+        throw std::runtime_error("Could not load image from " + name + ": Unsupported format");
+    }
+
+    x0 = x;
+    cols = width;
+
+    if (format->rows) {
+        try {
+            state = format->rows->open(buffer, length, x, &cols, &w, &h, &cc, &fmt);
+        } catch (const std::exception &e) {
+            throw std::runtime_error("Could not load image from " + name + ": " + e.what());
+        }
+
+        decoder = format->rows;
+        return;
+    }
+
+    whole = new image(buffer, length);
+    w = whole->width();
+    h = whole->height();
+    cc = whole->channels();
+    fmt = whole->format();
+
+    try {
+        if (whole->compressed()) {
+            throw std::runtime_error("Could not read " + name + ": Compressed images cannot be read in rows");
+        }
+        check_columns(x, &cols, w);
+    } catch (...) {
+        delete whole;
+        whole = nullptr;
+        throw;
+    }
+}
+
+
+dake::gl::image_reader::~image_reader(void)
+{
+    if (decoder) {
+        decoder->close(state);
+    }
+    delete whole;
+
+    if (mapping) {
+        dake::cross::unmap_file(mapping, mapping_size);
+    }
+}
+
+
+void dake::gl::image_reader::skip(int rows)
+{
+    if (rows < 0 || rows > h - next) {
+        throw std::invalid_argument("Rows out of bounds");
+    }
+
+    if (decoder) {
+        decoder->skip(state, rows);
+    }
+    next += rows;
+}
+
+
+void dake::gl::image_reader::read(void *dst, size_t stride, int rows)
+{
+    if (rows < 0 || rows > h - next) {
+        throw std::invalid_argument("Rows out of bounds");
+    }
+
+    uint8_t *out = static_cast<uint8_t *>(dst);
+
+    if (decoder) {
+        decoder->read(state, out, stride, rows);
+    } else {
+        size_t cs = cc * dake::gl::texel::value_size(fmt);
+        size_t in_stride = whole->level_byte_size(0) / h;
+        const uint8_t *in = static_cast<const uint8_t *>(whole->data()) + next * in_stride + x0 * cs;
+
+        for (int y = 0; y < rows; y++) {
+            memcpy(out + y * stride, in + y * in_stride, cols * cs);
         }
     }
+
+    next += rows;
 }
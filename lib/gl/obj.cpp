@@ -22,7 +22,8 @@ static dake::gl::obj_material default_mat = {
     dake::math::vec4(1.f, 1.f, 1.f, 1.f),
     dake::math::vec4(1.f, 1.f, 1.f, 1.f), 100.f,
     2,
-    nullptr
+    nullptr,
+    ""
 };
 
 
@@ -203,6 +204,7 @@ dake::gl::obj dake::gl::load_obj(const char *filename)
                             fname = obj_dirname + "/" + fname;
                         }
                         materials.back().tex = dake::gl::texture_manager::instance().find_texture(fname);
+                        materials.back().tex_file = fname;
                     }
                 }
             }
@@ -0,0 +1,126 @@
+#include <cstddef>
+#include <cstring>
+#include <stdexcept>
+
+#include <dake/gl/gl.hpp>
+#include <dake/gl/pixel_buffer.hpp>
+
+
+dake::gl::pixel_buffer::pixel_buffer(size_t size, GLenum target, GLenum usage, bool persistent):
+    tgt(target),
+    sz(size)
+{
+    if ((tgt != GL_PIXEL_UNPACK_BUFFER) && (tgt != GL_PIXEL_PACK_BUFFER)) {
+        throw std::invalid_argument("Pixel buffers are either pack or unpack buffers");
+    }
+
+    persistent = persistent && glext.has_extension(BUFFER_STORAGE);
+    GLbitfield access = tgt == GL_PIXEL_UNPACK_BUFFER ? GL_MAP_WRITE_BIT : GL_MAP_READ_BIT;
+    access |= GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+
+    if (glext.has_direct_state_access()) {
+        glCreateBuffers(1, &id);
+        if (persistent) {
+            glNamedBufferStorage(id, sz, nullptr, access);
+            persistent_map = glMapNamedBufferRange(id, 0, sz, access);
+        } else {
+            glNamedBufferData(id, sz, nullptr, usage);
+        }
+    } else {
+        glGenBuffers(1, &id);
+        bind();
+        if (persistent) {
+            glBufferStorage(tgt, sz, nullptr, access);
+            persistent_map = glMapBufferRange(tgt, 0, sz, access);
+        } else {
+            glBufferData(tgt, sz, nullptr, usage);
+        }
+        unbind();
+    }
+
+    if (persistent && !persistent_map) {
+        glDeleteBuffers(1, &id);
+        throw std::runtime_error("Could not map pixel buffer persistently");
+    }
+}
+
+
+dake::gl::pixel_buffer::~pixel_buffer(void)
+{
+    glDeleteBuffers(1, &id);
+}
+
+
+void dake::gl::pixel_buffer::data(const void *ptr, size_t size, size_t offset)
+{
+    if (offset > sz || size > sz - offset) {
+        throw std::out_of_range("Data exceeds the pixel buffer");
+    }
+
+    // Immutable storage cannot be updated with glBufferSubData()
+    if (persistent_map) {
+        memcpy(static_cast<char *>(persistent_map) + offset, ptr, size);
+        return;
+    }
+
+    if (glext.has_direct_state_access()) {
+        glNamedBufferSubData(id, offset, size, ptr);
+    } else {
+        bind();
+        glBufferSubData(tgt, offset, size, ptr);
+        unbind();
+    }
+}
+
+
+void *dake::gl::pixel_buffer::map(GLbitfield access)
+{
+    return map(0, sz, access);
+}
+
+
+void *dake::gl::pixel_buffer::map(size_t offset, size_t length, GLbitfield access)
+{
+    if (persistent_map) {
+        return static_cast<char *>(persistent_map) + offset;
+    }
+
+    if (glext.has_direct_state_access()) {
+        return glMapNamedBufferRange(id, offset, length, access);
+    }
+
+    bind();
+    void *ptr = glMapBufferRange(tgt, offset, length, access);
+    unbind();
+
+    return ptr;
+}
+
+
+void dake::gl::pixel_buffer::unmap(void)
+{
+    if (persistent_map) {
+        return;
+    }
+
+    if (glext.has_direct_state_access()) {
+        glUnmapNamedBuffer(id);
+    } else {
+        bind();
+        glUnmapBuffer(tgt);
+        unbind();
+    }
+}
+
+
+void dake::gl::pixel_buffer::bind(void) const
+{
+    glBindBuffer(tgt, id);
+}
+
+
+// Pixel transfers from and to client memory only work with no buffer bound
+void dake::gl::pixel_buffer::unbind(void) const
+{
+    glBindBuffer(tgt, 0);
+}
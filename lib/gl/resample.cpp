@@ -0,0 +1,534 @@
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <utility>
+#include <vector>
+
+#include <dake/cross.hpp>
+#include <dake/gl/resample.hpp>
+#include <dake/gl/texture.hpp>
+#include <dake/helper/parallel.hpp>
+
+
+using dake::gl::image;
+using dake::gl::resample::plane;
+
+
+// One RGBA pixel
+typedef float pixel_vector __attribute__((vector_size(16)));
+typedef int32_t pixel_int_vector __attribute__((vector_size(16)));
+// Two RGBA pixels, without any alignment requirement
+typedef float pixel_pair __attribute__((vector_size(32), aligned(4)));
+
+
+dake::gl::resample::plane::plane(int width, int height):
+    w(width),
+    h(height)
+{
+    // One more pixel, which is read (and multiplied by 0) when filtering the
+    // end of the last row two pixels at a time
+    size_t size = (static_cast<size_t>(w) * h + 1) * 4 * sizeof(float);
+    px = static_cast<float *>(dake::cross::aligned_alloc(32, (size + 31) & ~static_cast<size_t>(31)));
+    if (!px) {
+        throw std::bad_alloc();
+    }
+
+    for (int c = 0; c < 4; c++) {
+        px[static_cast<size_t>(w) * h * 4 + c] = 0.f;
+    }
+}
+
+
+dake::gl::resample::plane::plane(plane &&orig):
+    px(orig.px),
+    w(orig.w),
+    h(orig.h)
+{
+    orig.px = nullptr;
+}
+
+
+dake::gl::resample::plane::~plane(void)
+{
+    if (px) {
+        dake::cross::aligned_free(px);
+    }
+}
+
+
+plane &dake::gl::resample::plane::operator=(plane &&orig)
+{
+    std::swap(px, orig.px);
+    w = orig.w;
+    h = orig.h;
+
+    return *this;
+}
+
+
+static float srgb_to_linear(float v)
+{
+    return v <= .04045f ? v / 12.92f : powf((v + .055f) / 1.055f, 2.4f);
+}
+
+
+struct srgb_tables {
+    float to_linear[256];
+    // Linear values above thresholds[i] encode to sRGB values above i
+    float thresholds[255];
+
+    srgb_tables(void)
+    {
+        for (int i = 0; i < 256; i++) {
+            to_linear[i] = srgb_to_linear(i / 255.f);
+        }
+        for (int i = 0; i < 255; i++) {
+            thresholds[i] = srgb_to_linear((i + .5f) / 255.f);
+        }
+    }
+};
+
+
+static const srgb_tables &get_srgb_tables(void)
+{
+    static const srgb_tables tables;
+    return tables;
+}
+
+
+static uint8_t encode_srgb(const srgb_tables &t, float v)
+{
+    // Count the thresholds below v
+    int lo = 0, hi = 255;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (v > t.thresholds[mid]) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    return lo;
+}
+
+
+// Value of every byte, per channel
+struct unpack_table {
+    bool linear;
+    float value[4][256];
+
+    unpack_table(bool srgb):
+        linear(!srgb)
+    {
+        const srgb_tables &t = get_srgb_tables();
+
+        for (int c = 0; c < 4; c++) {
+            for (int i = 0; i < 256; i++) {
+                value[c][i] = srgb && c < 3 ? t.to_linear[i] : i * (1.f / 255.f);
+            }
+        }
+    }
+};
+
+
+template<int channels> static void unpack_row(float *o, const uint8_t *s, int w, const unpack_table &lut)
+{
+    int x = 0;
+
+    // Plain RGBA needs no lookups, just a conversion (GCC recognizes this as
+    // a zero extension)
+    if (channels == 4 && lut.linear) {
+        for (; x < w; x++, s += 4, o += 4) {
+            pixel_int_vector iv = { s[0], s[1], s[2], s[3] };
+            *reinterpret_cast<pixel_vector *>(o) = __builtin_convertvector(iv, pixel_vector) * (1.f / 255.f);
+        }
+    }
+
+    for (; x < w; x++, s += channels, o += 4) {
+        pixel_vector px = { 0.f, 0.f, 0.f, 1.f };
+        for (int c = 0; c < channels; c++) {
+            px[c] = lut.value[c][s[c]];
+        }
+        *reinterpret_cast<pixel_vector *>(o) = px;
+    }
+}
+
+
+static void unpack_row(float *o, const uint8_t *s, int w, int channels, const unpack_table &lut)
+{
+    switch (channels) {
+        case 1: unpack_row<1>(o, s, w, lut); break;
+        case 2: unpack_row<2>(o, s, w, lut); break;
+        case 3: unpack_row<3>(o, s, w, lut); break;
+        case 4: unpack_row<4>(o, s, w, lut); break;
+        default: abort();
+    }
+}
+
+
+template<int channels> static void pack_row(uint8_t *o, const float *s, int w, bool srgb, float alpha_scale)
+{
+    const srgb_tables &t = get_srgb_tables();
+    const pixel_vector scale = { 255.f, 255.f, 255.f, 255.f * alpha_scale };
+    const pixel_vector zero = {}, max = { 255.f, 255.f, 255.f, 255.f };
+    int color = channels < 3 ? channels : 3;
+
+    for (int x = 0; x < w; x++, s += 4, o += channels) {
+        pixel_vector v = *reinterpret_cast<const pixel_vector *>(s) * scale + .5f;
+        v = v < zero ? zero : v;
+        v = v > max ? max : v;
+        pixel_int_vector iv = __builtin_convertvector(v, pixel_int_vector);
+
+        for (int c = 0; c < channels; c++) {
+            o[c] = iv[c];
+        }
+        if (srgb) {
+            for (int c = 0; c < color; c++) {
+                o[c] = encode_srgb(t, s[c]);
+            }
+        }
+    }
+}
+
+
+static void pack_row(uint8_t *o, const float *s, int w, int channels, bool srgb, float alpha_scale)
+{
+    switch (channels) {
+        case 1: pack_row<1>(o, s, w, srgb, alpha_scale); break;
+        case 2: pack_row<2>(o, s, w, srgb, alpha_scale); break;
+        case 3: pack_row<3>(o, s, w, srgb, alpha_scale); break;
+        case 4: pack_row<4>(o, s, w, srgb, alpha_scale); break;
+        default: abort();
+    }
+}
+
+
+void dake::gl::resample::unpack(plane *dst, const void *src, int channels, size_t stride, bool srgb)
+{
+    const uint8_t *in = static_cast<const uint8_t *>(src);
+    unpack_table lut(srgb);
+
+    dake::helper::parallel_for(0, dst->height(), [=, &lut](int first, int last) {
+            for (int y = first; y < last; y++) {
+                unpack_row(dst->row(y), in + y * stride, dst->width(), channels, lut);
+            }
+        }, 16);
+}
+
+
+void dake::gl::resample::pack(void *dst, int channels, size_t stride, const plane &src, bool srgb, float alpha_scale)
+{
+    uint8_t *out = static_cast<uint8_t *>(dst);
+
+    dake::helper::parallel_for(0, src.height(), [=, &src](int first, int last) {
+            for (int y = first; y < last; y++) {
+                pack_row(out + y * stride, src.row(y), src.width(), channels, srgb, alpha_scale);
+            }
+        }, 16);
+}
+
+
+static float sinc(float x)
+{
+    if (fabsf(x) < 1e-5f) {
+        return 1.f;
+    }
+
+    x *= static_cast<float>(M_PI);
+    return sinf(x) / x;
+}
+
+
+static float bessel_i0(float x)
+{
+    float sum = 1.f, term = 1.f;
+    for (int k = 1; k < 32 && term > sum * 1e-8f; k++) {
+        term *= (x / (2.f * k)) * (x / (2.f * k));
+        sum += term;
+    }
+
+    return sum;
+}
+
+
+static float filter_radius(image::resample_filter filter)
+{
+    switch (filter) {
+        case image::RESAMPLE_BOX:
+            return .5f;
+
+        case image::RESAMPLE_BILINEAR:
+            return 1.f;
+
+        case image::RESAMPLE_BICUBIC:
+            return 2.f;
+
+        case image::RESAMPLE_KAISER:
+        case image::RESAMPLE_LANCZOS:
+            return 3.f;
+    }
+
+    abort();
+}
+
+
+static float filter_kernel(image::resample_filter filter, float x)
+{
+    float r = filter_radius(filter);
+
+    switch (filter) {
+        case image::RESAMPLE_BOX:
+            return x >= -r && x < r ? 1.f : 0.f;
+
+        case image::RESAMPLE_BILINEAR:
+            return fabsf(x) < r ? 1.f - fabsf(x) : 0.f;
+
+        case image::RESAMPLE_BICUBIC: {
+            // Keys' cubic with a = -0.5
+            float ax = fabsf(x);
+            if (ax < 1.f) {
+                return (1.5f * ax - 2.5f) * ax * ax + 1.f;
+            } else if (ax < 2.f) {
+                return ((-.5f * ax + 2.5f) * ax - 4.f) * ax + 2.f;
+            }
+            return 0.f;
+        }
+
+        case image::RESAMPLE_KAISER: {
+            // Same parameters as NVTT's mipmap filter (alpha = 4)
+            if (fabsf(x) >= r) {
+                return 0.f;
+            }
+            float t = x / r;
+            return sinc(x) * bessel_i0(4.f * sqrtf(1.f - t * t)) / bessel_i0(4.f);
+        }
+
+        case image::RESAMPLE_LANCZOS:
+            return fabsf(x) < r ? sinc(x) * sinc(x / r) : 0.f;
+    }
+
+    abort();
+}
+
+
+// The source pixels contributing to each destination pixel along one axis:
+// taps pixels starting at first[x], with normalized weights.  Pixels beyond
+// the edge are folded onto the edge pixel, so the range is always inside the
+// source.
+struct filter_taps {
+    int taps;
+    std::vector<int> first;
+    std::vector<float> weight;
+};
+
+
+static filter_taps make_taps(int src_size, int dst_size, image::resample_filter filter)
+{
+    float scale = static_cast<float>(src_size) / dst_size;
+    float widen = scale > 1.f ? scale : 1.f;
+    float support = filter_radius(filter) * widen;
+    int window = static_cast<int>(ceilf(2.f * support)) + 1;
+
+    filter_taps ft;
+    ft.taps = window < src_size ? window : src_size;
+    ft.first.resize(dst_size);
+    ft.weight.assign(static_cast<size_t>(dst_size) * ft.taps, 0.f);
+
+    for (int x = 0; x < dst_size; x++) {
+        // Source pixel i covers [i, i + 1)
+        float center = (x + .5f) * scale;
+        int lo = static_cast<int>(floorf(center - support));
+
+        int first = lo < 0 ? 0 : lo;
+        first = first + ft.taps > src_size ? src_size - ft.taps : first;
+        ft.first[x] = first;
+
+        float *weight = &ft.weight[x * ft.taps];
+        float sum = 0.f;
+
+        for (int k = 0; k < window; k++) {
+            int i = lo + k;
+            float v = filter_kernel(filter, (i + .5f - center) / widen);
+
+            i = i < 0 ? 0 : i >= src_size ? src_size - 1 : i;
+            weight[i - first] += v;
+            sum += v;
+        }
+
+        for (int k = 0; k < ft.taps; k++) {
+            weight[k] /= sum ? sum : 1.f;
+        }
+    }
+
+    return ft;
+}
+
+
+static inline pixel_pair load_pair(const float *p)
+{
+    return *reinterpret_cast<const pixel_pair *>(p);
+}
+
+
+// Horizontal weights for filter_row(), two taps per vector: every weight
+// repeated for all four channels of its pixel, an odd count padded with 0
+static std::vector<float> pair_weights(const filter_taps &ft, int dst_size)
+{
+    int pairs = (ft.taps + 1) / 2;
+    std::vector<float> weights(static_cast<size_t>(dst_size) * pairs * 8);
+
+    for (int x = 0; x < dst_size; x++) {
+        for (int k = 0; k < 2 * pairs; k++) {
+            float v = k < ft.taps ? ft.weight[x * ft.taps + k] : 0.f;
+            for (int c = 0; c < 4; c++) {
+                weights[(x * pairs * 2 + k) * 4 + c] = v;
+            }
+        }
+    }
+
+    return weights;
+}
+
+
+// in must be readable for one pixel past the last tap
+static void filter_row(float *out, const float *in, int w, const filter_taps &ft, const float *weights)
+{
+    int pairs = (ft.taps + 1) / 2;
+
+    for (int x = 0; x < w; x++) {
+        const float *p = in + ft.first[x] * 4;
+        const float *wp = weights + x * pairs * 8;
+        pixel_pair acc0 = {}, acc1 = {};
+        int k = 0;
+
+        for (; k + 2 <= pairs; k += 2) {
+            acc0 += load_pair(p + k * 8) * load_pair(wp + k * 8);
+            acc1 += load_pair(p + k * 8 + 8) * load_pair(wp + k * 8 + 8);
+        }
+        if (k < pairs) {
+            acc0 += load_pair(p + k * 8) * load_pair(wp + k * 8);
+        }
+        acc0 += acc1;
+
+        pixel_vector lo, hi;
+        memcpy(&lo, &acc0, sizeof(lo));
+        memcpy(&hi, reinterpret_cast<const float *>(&acc0) + 4, sizeof(hi));
+        *reinterpret_cast<pixel_vector *>(out + x * 4) = lo + hi;
+    }
+}
+
+
+static void filter_column(float *out, const float *const *rows, const float *weight, int taps, int floats)
+{
+    int i = 0;
+
+    for (; i + 8 <= floats; i += 8) {
+        pixel_pair acc = {};
+        for (int k = 0; k < taps; k++) {
+            acc += load_pair(rows[k] + i) * weight[k];
+        }
+        *reinterpret_cast<pixel_pair *>(out + i) = acc;
+    }
+
+    if (i < floats) {
+        pixel_vector acc = {};
+        for (int k = 0; k < taps; k++) {
+            acc += *reinterpret_cast<const pixel_vector *>(rows[k] + i) * weight[k];
+        }
+        *reinterpret_cast<pixel_vector *>(out + i) = acc;
+    }
+}
+
+
+// Separable scaling, horizontal pass first.  fetch(y, scratch) returns source
+// row y, readable for one pixel past its end (scratch has room for
+// src_width + 1 pixels, the last being 0); emit(y, row) takes output row y.
+// Every thread processes a band of output rows and keeps the horizontally
+// filtered source rows it currently needs in a ring, so there is never a
+// whole intermediate image.
+template<typename Fetch, typename Emit>
+static void scale_rows(int src_width, int src_height, int dst_width, int dst_height,
+                       image::resample_filter filter, Fetch fetch, Emit emit)
+{
+    filter_taps horizontal = make_taps(src_width, dst_width, filter);
+    filter_taps vertical = make_taps(src_height, dst_height, filter);
+    std::vector<float> weights = pair_weights(horizontal, dst_width);
+
+    int taps = vertical.taps;
+    size_t row_floats = static_cast<size_t>(dst_width) * 4;
+
+    dake::helper::parallel_for(0, dst_height, [&](int first, int last) {
+            std::vector<float> scratch((static_cast<size_t>(src_width) + 1) * 4, 0.f);
+            std::vector<float> ring(taps * row_floats);
+            std::vector<float> out(row_floats);
+            std::vector<const float *> rows(taps);
+
+            // Next source row to filter horizontally
+            int next = 0;
+
+            for (int y = first; y < last; y++) {
+                int lo = vertical.first[y];
+
+                next = next > lo ? next : lo;
+                for (; next < lo + taps; next++) {
+                    filter_row(&ring[(next % taps) * row_floats], fetch(next, scratch.data()),
+                               dst_width, horizontal, weights.data());
+                }
+
+                for (int k = 0; k < taps; k++) {
+                    rows[k] = &ring[((lo + k) % taps) * row_floats];
+                }
+                filter_column(out.data(), rows.data(), &vertical.weight[y * taps], taps, row_floats);
+
+                emit(y, out.data());
+            }
+        }, 16);
+}
+
+
+void dake::gl::resample::scale(plane *dst, const plane &src, image::resample_filter filter)
+{
+    size_t row_size = static_cast<size_t>(dst->width()) * 4 * sizeof(float);
+
+    scale_rows(src.width(), src.height(), dst->width(), dst->height(), filter,
+               [&src](int y, float *) { return src.row(y); },
+               [dst, row_size](int y, const float *row) { memcpy(dst->row(y), row, row_size); });
+}
+
+
+void dake::gl::resample::scale(void *dst, int dst_width, int dst_height, size_t dst_stride,
+                               const void *src, int src_width, int src_height, size_t src_stride,
+                               int channels, image::resample_filter filter, bool srgb)
+{
+    const uint8_t *in = static_cast<const uint8_t *>(src);
+    uint8_t *out = static_cast<uint8_t *>(dst);
+    unpack_table lut(srgb);
+
+    scale_rows(src_width, src_height, dst_width, dst_height, filter,
+               [=, &lut](int y, float *scratch) {
+                   unpack_row(scratch, in + y * src_stride, src_width, channels, lut);
+                   return static_cast<const float *>(scratch);
+               },
+               [=](int y, const float *row) {
+                   pack_row(out + y * dst_stride, row, dst_width, channels, srgb, 1.f);
+               });
+}
+
+
+float dake::gl::resample::alpha_coverage(const plane &p, float ref, float alpha_scale)
+{
+    long covered = 0;
+
+    for (int y = 0; y < p.height(); y++) {
+        const float *row = p.row(y);
+        for (int x = 0; x < p.width(); x++) {
+            covered += row[x * 4 + 3] * alpha_scale >= ref;
+        }
+    }
+
+    return static_cast<float>(covered) / (static_cast<long>(p.width()) * p.height());
+}
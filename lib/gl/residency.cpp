@@ -0,0 +1,220 @@
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+
+#include <dake/gl/gl.hpp>
+#include <dake/gl/residency.hpp>
+#include <dake/gl/texture.hpp>
+
+
+template<typename T> static void set_resident(void *object, bool state)
+{
+    static_cast<T *>(object)->make_resident(state);
+}
+
+
+dake::gl::residency_manager::residency_manager(size_t budget_bytes, int keep):
+    budget(budget_bytes),
+    keep_frames(keep)
+{}
+
+
+dake::gl::residency_manager::~residency_manager(void)
+{
+    if (buffer) {
+        glDeleteBuffers(1, &buffer);
+    }
+}
+
+
+int dake::gl::residency_manager::add(texture &t, size_t bytes)
+{
+    t.make_bindless(false);
+    return add(&t, t.handle(), set_resident<texture>, bytes);
+}
+
+
+int dake::gl::residency_manager::add(array_texture &t, size_t bytes)
+{
+    t.make_bindless(false);
+    return add(&t, t.handle(), set_resident<array_texture>, bytes);
+}
+
+
+int dake::gl::residency_manager::add(cubemap &t, size_t bytes)
+{
+    t.make_bindless(false);
+    return add(&t, t.handle(), set_resident<cubemap>, bytes);
+}
+
+
+int dake::gl::residency_manager::add(void *object, uint64_t handle, void (*set)(void *object, bool state), size_t bytes)
+{
+    int index;
+    if (free_slots.empty()) {
+        index = slots.size();
+        slots.emplace_back();
+        table.push_back(0);
+    } else {
+        index = free_slots.back();
+        free_slots.pop_back();
+    }
+
+    slot &s = slots[index];
+    s.object = object;
+    s.set_resident = set;
+    s.bytes = bytes;
+    s.last_used = -1;
+
+    // Residency is up to us from now on
+    s.resident = false;
+    s.set_resident(object, false);
+
+    table[index] = handle;
+    mark_dirty(index);
+
+    return index;
+}
+
+
+void dake::gl::residency_manager::remove(int index)
+{
+    if (index < 0 || index >= static_cast<int>(slots.size()) || !slots[index].object) {
+        throw std::invalid_argument("Invalid residency manager index");
+    }
+
+    slot &s = slots[index];
+    if (s.resident) {
+        s.set_resident(s.object, false);
+        stats_.resident--;
+        stats_.resident_bytes -= s.bytes;
+    }
+
+    s.object = nullptr;
+    free_slots.push_back(index);
+    pending.erase(std::remove(pending.begin(), pending.end(), index), pending.end());
+
+    table[index] = 0;
+    mark_dirty(index);
+}
+
+
+void dake::gl::residency_manager::use(int index)
+{
+    slot &s = slots[index];
+
+    if (s.last_used != frame) {
+        s.last_used = frame;
+        if (!s.resident) {
+            pending.push_back(index);
+        }
+    }
+}
+
+
+void dake::gl::residency_manager::commit(void)
+{
+    stats_.made_resident = 0;
+    stats_.made_non_resident = 0;
+
+    size_t needed = 0;
+    for (int index: pending) {
+        needed += slots[index].bytes;
+    }
+
+    // Release first so that the old and the new working set are not
+    // resident at the same time
+    std::vector<int> candidates;
+    for (int i = 0; i < static_cast<int>(slots.size()); i++) {
+        const slot &s = slots[i];
+        if (s.object && s.resident && s.last_used != frame) {
+            candidates.push_back(i);
+        }
+    }
+
+    std::sort(candidates.begin(), candidates.end(),
+              [this](int a, int b) { return slots[a].last_used < slots[b].last_used; });
+
+    for (int index: candidates) {
+        slot &s = slots[index];
+        if (frame - s.last_used < keep_frames && stats_.resident_bytes + needed <= budget) {
+            break;
+        }
+
+        s.set_resident(s.object, false);
+        s.resident = false;
+        stats_.resident--;
+        stats_.resident_bytes -= s.bytes;
+        stats_.made_non_resident++;
+    }
+
+    for (int index: pending) {
+        slot &s = slots[index];
+        if (s.resident) {
+            // Used in several frames without a commit() in between
+            continue;
+        }
+
+        s.set_resident(s.object, true);
+        s.resident = true;
+        stats_.resident++;
+        stats_.resident_bytes += s.bytes;
+        stats_.made_resident++;
+    }
+    pending.clear();
+
+    upload_table();
+}
+
+
+void dake::gl::residency_manager::next_frame(void)
+{
+    frame++;
+}
+
+
+void dake::gl::residency_manager::mark_dirty(int index)
+{
+    if (dirty_first == dirty_last) {
+        dirty_first = index;
+        dirty_last = index + 1;
+    } else {
+        dirty_first = std::min(dirty_first, index);
+        dirty_last = std::max(dirty_last, index + 1);
+    }
+}
+
+
+void dake::gl::residency_manager::upload_table(void)
+{
+    if (dirty_first == dirty_last) {
+        return;
+    }
+
+    if (!buffer) {
+        glGenBuffers(1, &buffer);
+    }
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+
+    size_t size = table.size() * sizeof(uint64_t);
+    if (buffer_capacity < size) {
+        buffer_capacity = std::max(size, 2 * buffer_capacity);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, buffer_capacity, nullptr, GL_DYNAMIC_DRAW);
+
+        dirty_first = 0;
+        dirty_last = table.size();
+    }
+
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, dirty_first * sizeof(uint64_t),
+                    (dirty_last - dirty_first) * sizeof(uint64_t), &table[dirty_first]);
+
+    dirty_first = dirty_last = 0;
+}
+
+
+void dake::gl::residency_manager::bind(GLuint binding)
+{
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, binding, buffer);
+}
@@ -0,0 +1,953 @@
+#include <climits>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+
+#include <dake/gl/s3tc.hpp>
+#include <dake/gl/texture.hpp>
+#include <dake/helper/parallel.hpp>
+
+
+using dake::gl::image;
+
+
+// One lane per pixel of a 4x4 block; GCC splits this into as many SSE or AVX
+// registers as the target has to offer
+typedef int32_t block_vector __attribute__((vector_size(64)));
+
+struct block_pixels {
+    // R, G, B, A
+    block_vector c[4];
+};
+
+// Sixteen bytes, i.e. one row of four RGBA pixels
+typedef uint8_t byte_vector __attribute__((vector_size(16)));
+typedef char shuffle_vector __attribute__((vector_size(16)));
+
+struct color_candidate {
+    unsigned c0, c1;
+    uint32_t indices;
+    int error;
+};
+
+
+static void fetch_block(block_pixels *bp, const uint8_t *src, int w, int h, int cc, size_t stride, int bx, int by)
+{
+    for (int i = 0; i < 16; i++) {
+        int x = bx * 4 + (i & 3), y = by * 4 + (i >> 2);
+        if (x >= w) {
+            x = w - 1;
+        }
+        if (y >= h) {
+            y = h - 1;
+        }
+
+        const uint8_t *p = src + y * stride + x * cc;
+        bp->c[0][i] = p[0];
+        bp->c[1][i] = cc > 1 ? p[1] : 0;
+        bp->c[2][i] = cc > 2 ? p[2] : 0;
+        bp->c[3][i] = cc > 3 ? p[3] : 255;
+    }
+}
+
+
+static void unpack_565(unsigned c, int rgb[3])
+{
+    int r = (c >> 11) & 0x1f, g = (c >> 5) & 0x3f, b = c & 0x1f;
+
+    rgb[0] = (r << 3) | (r >> 2);
+    rgb[1] = (g << 2) | (g >> 4);
+    rgb[2] = (b << 3) | (b >> 2);
+}
+
+
+static unsigned pack_565(const float rgb[3])
+{
+    static const float scale[3] = { 31.f / 255.f, 63.f / 255.f, 31.f / 255.f };
+    static const int max[3] = { 31, 63, 31 };
+    int q[3];
+
+    for (int i = 0; i < 3; i++) {
+        q[i] = static_cast<int>(lrintf(rgb[i] * scale[i]));
+        q[i] = q[i] < 0 ? 0 : q[i] > max[i] ? max[i] : q[i];
+    }
+
+    return (q[0] << 11) | (q[1] << 5) | q[2];
+}
+
+
+// Builds the palette exactly like the reference decoder does
+static void color_palette(unsigned c0, unsigned c1, bool four_color, int pal[4][3])
+{
+    unpack_565(c0, pal[0]);
+    unpack_565(c1, pal[1]);
+
+    for (int i = 0; i < 3; i++) {
+        if (four_color) {
+            pal[2][i] = (2 * pal[0][i] + pal[1][i]) / 3;
+            pal[3][i] = (pal[0][i] + 2 * pal[1][i]) / 3;
+        } else {
+            pal[2][i] = (pal[0][i] + pal[1][i]) / 2;
+            pal[3][i] = 0;
+        }
+    }
+}
+
+
+static void alpha_palette(int a0, int a1, int pal[8])
+{
+    pal[0] = a0;
+    pal[1] = a1;
+
+    if (a0 > a1) {
+        for (int c = 2; c < 8; c++) {
+            pal[c] = (a0 * (8 - c) + a1 * (c - 1)) / 7;
+        }
+    } else {
+        for (int c = 2; c < 6; c++) {
+            pal[c] = (a0 * (6 - c) + a1 * (c - 1)) / 5;
+        }
+        pal[6] = 0;
+        pal[7] = 255;
+    }
+}
+
+
+// Picks the closest of the first entries palette colors for every pixel whose
+// lane in valid is set; all other pixels get index 3.  Returns the total
+// squared error.
+static int select_color_indices(const block_pixels &bp, const block_vector &valid, const int pal[4][3], int entries, uint32_t *indices)
+{
+    block_vector best_err = block_vector{} + INT_MAX;
+    block_vector best_idx = block_vector{};
+
+    for (int e = 0; e < entries; e++) {
+        block_vector dr = bp.c[0] - pal[e][0];
+        block_vector dg = bp.c[1] - pal[e][1];
+        block_vector db = bp.c[2] - pal[e][2];
+        block_vector err = dr * dr + dg * dg + db * db;
+
+        block_vector better = err < best_err;
+        best_err = better ? err : best_err;
+        best_idx = better ? block_vector{} + e : best_idx;
+    }
+
+    best_idx = valid ? best_idx : block_vector{} + 3;
+    best_err = valid ? best_err : block_vector{};
+
+    uint32_t bits = 0;
+    int total = 0;
+    for (int i = 0; i < 16; i++) {
+        bits |= static_cast<uint32_t>(best_idx[i]) << (2 * i);
+        total += best_err[i];
+    }
+
+    *indices = bits;
+    return total;
+}
+
+
+static int select_alpha_indices(const block_vector &v, const int pal[8], uint64_t *indices)
+{
+    block_vector best_err = block_vector{} + INT_MAX;
+    block_vector best_idx = block_vector{};
+
+    for (int e = 0; e < 8; e++) {
+        block_vector d = v - pal[e];
+        block_vector err = d * d;
+
+        block_vector better = err < best_err;
+        best_err = better ? err : best_err;
+        best_idx = better ? block_vector{} + e : best_idx;
+    }
+
+    uint64_t bits = 0;
+    int total = 0;
+    for (int i = 0; i < 16; i++) {
+        bits |= static_cast<uint64_t>(best_idx[i]) << (3 * i);
+        total += best_err[i];
+    }
+
+    *indices = bits;
+    return total;
+}
+
+
+static void bbox_endpoints(const block_pixels &bp, const block_vector &valid, float ep[2][3])
+{
+    float mn[3] = { 255.f, 255.f, 255.f }, mx[3] = { 0.f, 0.f, 0.f };
+
+    for (int i = 0; i < 16; i++) {
+        if (!valid[i]) {
+            continue;
+        }
+        for (int c = 0; c < 3; c++) {
+            float v = bp.c[c][i];
+            mn[c] = v < mn[c] ? v : mn[c];
+            mx[c] = v > mx[c] ? v : mx[c];
+        }
+    }
+
+    float center[3];
+    for (int c = 0; c < 3; c++) {
+        float inset = (mx[c] - mn[c]) / 16.f;
+        mn[c] += inset;
+        mx[c] -= inset;
+        center[c] = (mn[c] + mx[c]) / 2.f;
+    }
+
+    // Pick the box diagonal which follows the pixel distribution
+    float cov_rb = 0.f, cov_gb = 0.f;
+    for (int i = 0; i < 16; i++) {
+        if (valid[i]) {
+            float db = bp.c[2][i] - center[2];
+            cov_rb += (bp.c[0][i] - center[0]) * db;
+            cov_gb += (bp.c[1][i] - center[1]) * db;
+        }
+    }
+
+    for (int c = 0; c < 3; c++) {
+        ep[0][c] = mx[c];
+        ep[1][c] = mn[c];
+    }
+    if (cov_rb < 0.f) {
+        ep[0][0] = mn[0];
+        ep[1][0] = mx[0];
+    }
+    if (cov_gb < 0.f) {
+        ep[0][1] = mn[1];
+        ep[1][1] = mx[1];
+    }
+}
+
+
+static void pca_endpoints(const block_pixels &bp, const block_vector &valid, float ep[2][3])
+{
+    float mean[3] = { 0.f, 0.f, 0.f };
+    float mn[3] = { 255.f, 255.f, 255.f }, mx[3] = { 0.f, 0.f, 0.f };
+    int n = 0;
+
+    for (int i = 0; i < 16; i++) {
+        if (valid[i]) {
+            for (int c = 0; c < 3; c++) {
+                float v = bp.c[c][i];
+                mean[c] += v;
+                mn[c] = v < mn[c] ? v : mn[c];
+                mx[c] = v > mx[c] ? v : mx[c];
+            }
+            n++;
+        }
+    }
+    for (int c = 0; c < 3; c++) {
+        mean[c] /= n;
+    }
+
+    // xx, xy, xz, yy, yz, zz
+    float cov[6] = { 0.f, 0.f, 0.f, 0.f, 0.f, 0.f };
+    for (int i = 0; i < 16; i++) {
+        if (valid[i]) {
+            float d[3] = {
+                bp.c[0][i] - mean[0],
+                bp.c[1][i] - mean[1],
+                bp.c[2][i] - mean[2]
+            };
+            cov[0] += d[0] * d[0];
+            cov[1] += d[0] * d[1];
+            cov[2] += d[0] * d[2];
+            cov[3] += d[1] * d[1];
+            cov[4] += d[1] * d[2];
+            cov[5] += d[2] * d[2];
+        }
+    }
+
+    float axis[3] = { mx[0] - mn[0], mx[1] - mn[1], mx[2] - mn[2] };
+    if (axis[0] + axis[1] + axis[2] == 0.f) {
+        for (int c = 0; c < 3; c++) {
+            ep[0][c] = ep[1][c] = mean[c];
+        }
+        return;
+    }
+
+    // Power iteration for the principal axis
+    for (int iter = 0; iter < 8; iter++) {
+        float v[3] = {
+            cov[0] * axis[0] + cov[1] * axis[1] + cov[2] * axis[2],
+            cov[1] * axis[0] + cov[3] * axis[1] + cov[4] * axis[2],
+            cov[2] * axis[0] + cov[4] * axis[1] + cov[5] * axis[2]
+        };
+
+        float m = fmaxf(fabsf(v[0]), fmaxf(fabsf(v[1]), fabsf(v[2])));
+        if (m < 1e-6f) {
+            break;
+        }
+        for (int c = 0; c < 3; c++) {
+            axis[c] = v[c] / m;
+        }
+    }
+
+    float len2 = axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2];
+    float tmin = HUGE_VALF, tmax = -HUGE_VALF;
+    for (int i = 0; i < 16; i++) {
+        if (valid[i]) {
+            float t = ((bp.c[0][i] - mean[0]) * axis[0] +
+                       (bp.c[1][i] - mean[1]) * axis[1] +
+                       (bp.c[2][i] - mean[2]) * axis[2]) / len2;
+            tmin = t < tmin ? t : tmin;
+            tmax = t > tmax ? t : tmax;
+        }
+    }
+
+    for (int c = 0; c < 3; c++) {
+        ep[0][c] = fminf(fmaxf(mean[c] + axis[c] * tmax, 0.f), 255.f);
+        ep[1][c] = fminf(fmaxf(mean[c] + axis[c] * tmin, 0.f), 255.f);
+    }
+}
+
+
+// Least-squares fit of both endpoints to the pixels, given their current
+// palette indices.  Returns false if the system is degenerate.
+static bool refine_endpoints(const block_pixels &bp, const block_vector &valid, const color_candidate &cand, bool four_color, float ep[2][3])
+{
+    static const float w4[4] = { 0.f, 1.f, 1.f / 3.f, 2.f / 3.f };
+    static const float w3[4] = { 0.f, 1.f, 1.f / 2.f, 0.f };
+
+    float aa = 0.f, ab = 0.f, bb = 0.f;
+    float ap[3] = { 0.f, 0.f, 0.f }, bq[3] = { 0.f, 0.f, 0.f };
+
+    for (int i = 0; i < 16; i++) {
+        int idx = (cand.indices >> (2 * i)) & 3;
+        if (!valid[i] || (!four_color && idx == 3)) {
+            continue;
+        }
+
+        float b = four_color ? w4[idx] : w3[idx];
+        float a = 1.f - b;
+
+        aa += a * a;
+        ab += a * b;
+        bb += b * b;
+        for (int c = 0; c < 3; c++) {
+            ap[c] += a * bp.c[c][i];
+            bq[c] += b * bp.c[c][i];
+        }
+    }
+
+    float det = aa * bb - ab * ab;
+    if (fabsf(det) < 1e-6f) {
+        return false;
+    }
+
+    for (int c = 0; c < 3; c++) {
+        ep[0][c] = fminf(fmaxf((bb * ap[c] - ab * bq[c]) / det, 0.f), 255.f);
+        ep[1][c] = fminf(fmaxf((aa * bq[c] - ab * ap[c]) / det, 0.f), 255.f);
+    }
+
+    return true;
+}
+
+
+static color_candidate try_color_endpoints(const block_pixels &bp, const block_vector &valid, const float ep[2][3], bool three_color, bool always_four_color)
+{
+    color_candidate cand;
+
+    cand.c0 = pack_565(ep[0]);
+    cand.c1 = pack_565(ep[1]);
+
+    if (three_color ? cand.c0 > cand.c1 : cand.c0 < cand.c1) {
+        unsigned tmp = cand.c0;
+        cand.c0 = cand.c1;
+        cand.c1 = tmp;
+    }
+
+    bool four_color = always_four_color || cand.c0 > cand.c1;
+
+    int pal[4][3];
+    color_palette(cand.c0, cand.c1, four_color, pal);
+    cand.error = select_color_indices(bp, valid, pal, four_color ? 4 : 3, &cand.indices);
+
+    return cand;
+}
+
+
+// Encodes the color half of a DXT1/3/5 block, punch_through enables DXT1's
+// transparent palette entry for pixels with alpha < 128
+static void encode_color_block(const block_pixels &bp, bool punch_through, bool always_four_color, image::compression_quality q, uint8_t *out)
+{
+    block_vector valid = block_vector{} - 1;
+    bool three_color = false;
+
+    if (punch_through) {
+        valid = bp.c[3] >= 128;
+        for (int i = 0; i < 16; i++) {
+            three_color |= !valid[i];
+        }
+    }
+
+    color_candidate best;
+    bool any_valid = false;
+    for (int i = 0; i < 16; i++) {
+        any_valid |= valid[i];
+    }
+
+    if (!any_valid) {
+        best.c0 = best.c1 = 0;
+        best.indices = 0xffffffffu;
+    } else {
+        float ep[2][3];
+
+        if (q == image::COMPRESS_FAST) {
+            bbox_endpoints(bp, valid, ep);
+        } else {
+            pca_endpoints(bp, valid, ep);
+        }
+        best = try_color_endpoints(bp, valid, ep, three_color, always_four_color);
+
+        if (q == image::COMPRESS_BEST) {
+            bbox_endpoints(bp, valid, ep);
+            color_candidate cand = try_color_endpoints(bp, valid, ep, three_color, always_four_color);
+            if (cand.error < best.error) {
+                best = cand;
+            }
+
+            for (int iter = 0; iter < 3 && best.error > 0; iter++) {
+                bool four_color = always_four_color || best.c0 > best.c1;
+                if (!refine_endpoints(bp, valid, best, four_color, ep)) {
+                    break;
+                }
+
+                cand = try_color_endpoints(bp, valid, ep, three_color, always_four_color);
+                if (cand.error >= best.error) {
+                    break;
+                }
+                best = cand;
+            }
+        }
+    }
+
+    out[0] = best.c0 & 0xff;
+    out[1] = best.c0 >> 8;
+    out[2] = best.c1 & 0xff;
+    out[3] = best.c1 >> 8;
+    for (int i = 0; i < 4; i++) {
+        out[4 + i] = (best.indices >> (8 * i)) & 0xff;
+    }
+}
+
+
+static int try_alpha_endpoints(const block_vector &v, int a0, int a1, uint8_t *out)
+{
+    int pal[8];
+    uint64_t indices;
+
+    alpha_palette(a0, a1, pal);
+    int error = select_alpha_indices(v, pal, &indices);
+
+    out[0] = a0;
+    out[1] = a1;
+    for (int i = 0; i < 6; i++) {
+        out[2 + i] = (indices >> (8 * i)) & 0xff;
+    }
+
+    return error;
+}
+
+
+// Encodes a DXT5 alpha/RGTC channel block
+static void encode_alpha_block(const block_vector &v, image::compression_quality q, uint8_t *out)
+{
+    int mn = 255, mx = 0;
+    int mn6 = 255, mx6 = 0;
+
+    for (int i = 0; i < 16; i++) {
+        mn = v[i] < mn ? v[i] : mn;
+        mx = v[i] > mx ? v[i] : mx;
+        if (v[i] > 0 && v[i] < 255) {
+            mn6 = v[i] < mn6 ? v[i] : mn6;
+            mx6 = v[i] > mx6 ? v[i] : mx6;
+        }
+    }
+
+    if (mn == mx) {
+        // a0 == a1 selects the six-value mode, whose entry 0 is a0
+        out[0] = out[1] = mx;
+        for (int i = 2; i < 8; i++) {
+            out[i] = 0;
+        }
+        return;
+    }
+
+    int best_error = try_alpha_endpoints(v, mx, mn, out);
+    if (q != image::COMPRESS_BEST || !best_error) {
+        return;
+    }
+
+    uint8_t cand[8];
+
+    // Six-value mode has explicit 0 and 255, which frees up the
+    // interpolated values for the rest of the block
+    if ((mn == 0 || mx == 255) && mn6 <= mx6) {
+        int error = try_alpha_endpoints(v, mn6, mx6, cand);
+        if (error < best_error) {
+            best_error = error;
+            for (int i = 0; i < 8; i++) {
+                out[i] = cand[i];
+            }
+        }
+    }
+
+    // The range spanned by the extremes is not necessarily optimal
+    // because of the decoder's rounding; try shrinking it a bit
+    for (int a0 = mx; a0 >= mx - 3; a0--) {
+        for (int a1 = mn; a1 <= mn + 3; a1++) {
+            if (a0 <= a1 || (a0 == mx && a1 == mn)) {
+                continue;
+            }
+
+            int error = try_alpha_endpoints(v, a0, a1, cand);
+            if (error < best_error) {
+                best_error = error;
+                for (int i = 0; i < 8; i++) {
+                    out[i] = cand[i];
+                }
+            }
+        }
+    }
+}
+
+
+static void encode_explicit_alpha(const block_vector &v, uint8_t *out)
+{
+    for (int i = 0; i < 8; i++) {
+        int lo = (v[2 * i    ] * 15 + 127) / 255;
+        int hi = (v[2 * i + 1] * 15 + 127) / 255;
+        out[i] = lo | (hi << 4);
+    }
+}
+
+
+static void encode_block(image::channel_format fmt, const block_pixels &bp, image::compression_quality q, uint8_t *out)
+{
+    switch (fmt) {
+        case image::COMPRESSED_S3TC_DXT1:
+            encode_color_block(bp, false, false, q, out);
+            break;
+
+        case image::COMPRESSED_S3TC_DXT1_ALPHA:
+            encode_color_block(bp, true, false, q, out);
+            break;
+
+        case image::COMPRESSED_S3TC_DXT3:
+            encode_explicit_alpha(bp.c[3], out);
+            encode_color_block(bp, false, true, q, out + 8);
+            break;
+
+        case image::COMPRESSED_S3TC_DXT5:
+            encode_alpha_block(bp.c[3], q, out);
+            encode_color_block(bp, false, true, q, out + 8);
+            break;
+
+        case image::COMPRESSED_RGTC_RED:
+            encode_alpha_block(bp.c[0], q, out);
+            break;
+
+        case image::COMPRESSED_RGTC_RG:
+            encode_alpha_block(bp.c[0], q, out);
+            encode_alpha_block(bp.c[1], q, out + 8);
+            break;
+
+        default:
+            abort();
+    }
+}
+
+
+size_t dake::gl::s3tc::block_size(image::channel_format fmt)
+{
+    switch (fmt) {
+        case image::COMPRESSED_S3TC_DXT1:
+        case image::COMPRESSED_S3TC_DXT1_ALPHA:
+        case image::COMPRESSED_RGTC_RED:
+            return 8;
+
+        case image::COMPRESSED_S3TC_DXT3:
+        case image::COMPRESSED_S3TC_DXT5:
+        case image::COMPRESSED_RGTC_RG:
+            return 16;
+
+        default:
+            throw std::invalid_argument("Not an S3TC or RGTC format");
+    }
+}
+
+
+void dake::gl::s3tc::compress(image::channel_format fmt, void *dst, const void *src, int width, int height, int channels, size_t stride, image::compression_quality quality)
+{
+    size_t bsz = block_size(fmt);
+    int bw = (width + 3) / 4, bh = (height + 3) / 4;
+
+    const uint8_t *in = static_cast<const uint8_t *>(src);
+    uint8_t *out = static_cast<uint8_t *>(dst);
+
+    dake::helper::parallel_for(0, bh, [=](int first, int last) {
+            block_pixels bp;
+
+            for (int by = first; by < last; by++) {
+                uint8_t *row = out + static_cast<size_t>(by) * bw * bsz;
+
+                for (int bx = 0; bx < bw; bx++) {
+                    fetch_block(&bp, in, width, height, channels, stride, bx, by);
+                    encode_block(fmt, bp, quality, row + bx * bsz);
+                }
+            }
+        }, 8);
+}
+
+
+// The reference decoder does not share the palette code with the compressor
+// and decompress(), so that comparing against it can catch mistakes there.
+// Every texel is interpolated on its own from the weights of its index.
+static void decode_color_reference(const uint8_t *blk, bool always_four_color, bool punch_through, uint8_t rgba[16][4])
+{
+    // Weights of color 0 and color 1 for each index
+    static const int four_color_weights[4][2] = { { 1, 0 }, { 0, 1 }, { 2, 1 }, { 1, 2 } };
+    static const int three_color_weights[4][2] = { { 1, 0 }, { 0, 1 }, { 1, 1 }, { 0, 0 } };
+
+    unsigned c0 = blk[0] | (blk[1] << 8);
+    unsigned c1 = blk[2] | (blk[3] << 8);
+    uint32_t indices = blk[4] | (blk[5] << 8) | (blk[6] << 16) | (static_cast<uint32_t>(blk[7]) << 24);
+
+    bool four_color = always_four_color || c0 > c1;
+    const int (*weights)[2] = four_color ? four_color_weights : three_color_weights;
+
+    // 5:6:5 bits, expanded to 8 bits by replicating the top bits
+    int e0[3] = { static_cast<int>(c0 >> 11), static_cast<int>((c0 >> 5) & 0x3f), static_cast<int>(c0 & 0x1f) };
+    int e1[3] = { static_cast<int>(c1 >> 11), static_cast<int>((c1 >> 5) & 0x3f), static_cast<int>(c1 & 0x1f) };
+    for (int c = 0; c < 3; c++) {
+        int bits = c == 1 ? 6 : 5;
+        e0[c] = (e0[c] << (8 - bits)) | (e0[c] >> (2 * bits - 8));
+        e1[c] = (e1[c] << (8 - bits)) | (e1[c] >> (2 * bits - 8));
+    }
+
+    for (int i = 0; i < 16; i++) {
+        int e = (indices >> (2 * i)) & 3;
+        int w0 = weights[e][0], w1 = weights[e][1];
+
+        for (int c = 0; c < 3; c++) {
+            rgba[i][c] = w0 + w1 ? (w0 * e0[c] + w1 * e1[c]) / (w0 + w1) : 0;
+        }
+        rgba[i][3] = (punch_through && !w0 && !w1) ? 0 : 255;
+    }
+}
+
+
+static void decode_alpha_reference(const uint8_t *blk, uint8_t rgba[16][4], int channel)
+{
+    int a0 = blk[0], a1 = blk[1];
+
+    uint64_t indices = 0;
+    for (int i = 0; i < 6; i++) {
+        indices |= static_cast<uint64_t>(blk[2 + i]) << (8 * i);
+    }
+
+    for (int i = 0; i < 16; i++) {
+        int e = (indices >> (3 * i)) & 7;
+
+        if (e < 2) {
+            rgba[i][channel] = e ? a1 : a0;
+        } else if (a0 > a1) {
+            // Six interpolated values
+            rgba[i][channel] = ((8 - e) * a0 + (e - 1) * a1) / 7;
+        } else if (e < 6) {
+            // Four interpolated values, then 0 and 255
+            rgba[i][channel] = ((6 - e) * a0 + (e - 1) * a1) / 5;
+        } else {
+            rgba[i][channel] = e == 6 ? 0 : 255;
+        }
+    }
+}
+
+
+void dake::gl::s3tc::decode_block_reference(image::channel_format fmt, const void *block, uint8_t rgba[16][4])
+{
+    const uint8_t *blk = static_cast<const uint8_t *>(block);
+
+    switch (fmt) {
+        case image::COMPRESSED_S3TC_DXT1:
+            decode_color_reference(blk, false, false, rgba);
+            break;
+
+        case image::COMPRESSED_S3TC_DXT1_ALPHA:
+            decode_color_reference(blk, false, true, rgba);
+            break;
+
+        case image::COMPRESSED_S3TC_DXT3:
+            decode_color_reference(blk + 8, true, false, rgba);
+            for (int i = 0; i < 16; i++) {
+                rgba[i][3] = ((blk[i / 2] >> (4 * (i & 1))) & 0xf) * 17;
+            }
+            break;
+
+        case image::COMPRESSED_S3TC_DXT5:
+            decode_color_reference(blk + 8, true, false, rgba);
+            decode_alpha_reference(blk, rgba, 3);
+            break;
+
+        case image::COMPRESSED_RGTC_RED:
+            decode_alpha_reference(blk, rgba, 0);
+            for (int i = 0; i < 16; i++) {
+                rgba[i][1] = rgba[i][2] = 0;
+                rgba[i][3] = 255;
+            }
+            break;
+
+        case image::COMPRESSED_RGTC_RG:
+            decode_alpha_reference(blk, rgba, 0);
+            decode_alpha_reference(blk + 8, rgba, 1);
+            for (int i = 0; i < 16; i++) {
+                rgba[i][2] = 0;
+                rgba[i][3] = 255;
+            }
+            break;
+
+        default:
+            throw std::invalid_argument("Not an S3TC or RGTC format");
+    }
+}
+
+
+// pshufb semantics: mask bytes with the MSB set select 0
+static inline byte_vector shuffle_bytes(const byte_vector &v, const byte_vector &mask)
+{
+#ifdef __SSSE3__
+    return (byte_vector)__builtin_ia32_pshufb128((shuffle_vector)v, (shuffle_vector)mask);
+#else
+    byte_vector r;
+    for (int i = 0; i < 16; i++) {
+        r[i] = (mask[i] & 0x80) ? 0 : v[mask[i] & 0xf];
+    }
+    return r;
+#endif
+}
+
+
+struct decode_tables {
+    // Gathers the RGBA palette entries for a row of four 2-bit indices
+    byte_vector color_gather[256];
+    // Moves the 8-bit values of pixel row r (out of all 16 pixels) into
+    // channel c of a row of RGBA pixels
+    byte_vector channel_place[4][4];
+    // Strips RGBA down to the first 1, 2, 3 or 4 channels
+    byte_vector pack[4];
+
+    decode_tables(void)
+    {
+        byte_vector v = {};
+
+        for (int bits = 0; bits < 256; bits++) {
+            for (int j = 0; j < 16; j++) {
+                v[j] = ((bits >> (2 * (j / 4))) & 3) * 4 + j % 4;
+            }
+            color_gather[bits] = v;
+        }
+
+        for (int c = 0; c < 4; c++) {
+            for (int r = 0; r < 4; r++) {
+                for (int j = 0; j < 16; j++) {
+                    v[j] = j % 4 == c ? 4 * r + j / 4 : 0x80;
+                }
+                channel_place[c][r] = v;
+            }
+        }
+
+        for (int cc = 1; cc <= 4; cc++) {
+            for (int j = 0; j < 16; j++) {
+                v[j] = j < 4 * cc ? (j / cc) * 4 + j % cc : 0x80;
+            }
+            pack[cc - 1] = v;
+        }
+    }
+};
+
+
+static const decode_tables &get_decode_tables(void)
+{
+    static const decode_tables tables;
+    return tables;
+}
+
+
+// Decodes a DXT color block into four rows of RGBA pixels.  Unless
+// opaque_alpha is set, alpha is left 0 so an alpha block can be or'ed in.
+static void decode_color_rows(const decode_tables &t, const uint8_t *blk, bool always_four_color, bool punch_through, bool opaque_alpha, byte_vector rows[4])
+{
+    unsigned c0 = blk[0] | (blk[1] << 8);
+    unsigned c1 = blk[2] | (blk[3] << 8);
+    bool four_color = always_four_color || c0 > c1;
+
+    int pal[4][3];
+    color_palette(c0, c1, four_color, pal);
+
+    byte_vector pv;
+    for (int e = 0; e < 4; e++) {
+        pv[4 * e + 0] = pal[e][0];
+        pv[4 * e + 1] = pal[e][1];
+        pv[4 * e + 2] = pal[e][2];
+        pv[4 * e + 3] = opaque_alpha ? 255 : 0;
+    }
+    if (punch_through && !four_color) {
+        pv[15] = 0;
+    }
+
+    for (int r = 0; r < 4; r++) {
+        rows[r] = shuffle_bytes(pv, t.color_gather[blk[4 + r]]);
+    }
+}
+
+
+// Decodes a DXT5 alpha/RGTC block into 16 bytes, one per pixel
+static byte_vector decode_alpha_values(const uint8_t *blk)
+{
+    int pal[8];
+    alpha_palette(blk[0], blk[1], pal);
+
+    byte_vector pv = {};
+    for (int i = 0; i < 8; i++) {
+        pv[i] = pal[i];
+    }
+
+    uint64_t bits = 0;
+    for (int i = 0; i < 6; i++) {
+        bits |= static_cast<uint64_t>(blk[2 + i]) << (8 * i);
+    }
+
+    byte_vector idx;
+#ifdef __BMI2__
+    uint64_t lo = __builtin_ia32_pdep_di(bits & 0xffffff, 0x0707070707070707ull);
+    uint64_t hi = __builtin_ia32_pdep_di(bits >> 24, 0x0707070707070707ull);
+    memcpy(&idx, &lo, 8);
+    memcpy(reinterpret_cast<uint8_t *>(&idx) + 8, &hi, 8);
+#else
+    for (int i = 0; i < 16; i++) {
+        idx[i] = (bits >> (3 * i)) & 7;
+    }
+#endif
+
+    return shuffle_bytes(pv, idx);
+}
+
+
+static byte_vector decode_explicit_alpha_values(const uint8_t *blk)
+{
+    static const byte_vector lo_mask = {
+        0, 0x80, 1, 0x80, 2, 0x80, 3, 0x80, 4, 0x80, 5, 0x80, 6, 0x80, 7, 0x80
+    };
+    static const byte_vector hi_mask = {
+        0x80, 0, 0x80, 1, 0x80, 2, 0x80, 3, 0x80, 4, 0x80, 5, 0x80, 6, 0x80, 7
+    };
+
+    byte_vector b = {};
+    memcpy(&b, blk, 8);
+
+    byte_vector nibbles = shuffle_bytes(b & 0xf, lo_mask) | shuffle_bytes(b >> 4, hi_mask);
+    return nibbles | (nibbles << 4);
+}
+
+
+static void decode_block_rows(const decode_tables &t, image::channel_format fmt, const uint8_t *blk, byte_vector rows[4])
+{
+    static const byte_vector opaque_black = {
+        0, 0, 0, 255, 0, 0, 0, 255, 0, 0, 0, 255, 0, 0, 0, 255
+    };
+
+    byte_vector a, g;
+
+    switch (fmt) {
+        case image::COMPRESSED_S3TC_DXT1:
+            decode_color_rows(t, blk, false, false, true, rows);
+            break;
+
+        case image::COMPRESSED_S3TC_DXT1_ALPHA:
+            decode_color_rows(t, blk, false, true, true, rows);
+            break;
+
+        case image::COMPRESSED_S3TC_DXT3:
+            decode_color_rows(t, blk + 8, true, false, false, rows);
+            a = decode_explicit_alpha_values(blk);
+            for (int r = 0; r < 4; r++) {
+                rows[r] |= shuffle_bytes(a, t.channel_place[3][r]);
+            }
+            break;
+
+        case image::COMPRESSED_S3TC_DXT5:
+            decode_color_rows(t, blk + 8, true, false, false, rows);
+            a = decode_alpha_values(blk);
+            for (int r = 0; r < 4; r++) {
+                rows[r] |= shuffle_bytes(a, t.channel_place[3][r]);
+            }
+            break;
+
+        case image::COMPRESSED_RGTC_RED:
+            a = decode_alpha_values(blk);
+            for (int r = 0; r < 4; r++) {
+                rows[r] = opaque_black | shuffle_bytes(a, t.channel_place[0][r]);
+            }
+            break;
+
+        case image::COMPRESSED_RGTC_RG:
+            a = decode_alpha_values(blk);
+            g = decode_alpha_values(blk + 8);
+            for (int r = 0; r < 4; r++) {
+                rows[r] = opaque_black | shuffle_bytes(a, t.channel_place[0][r])
+                                       | shuffle_bytes(g, t.channel_place[1][r]);
+            }
+            break;
+
+        default:
+            abort();
+    }
+}
+
+
+void dake::gl::s3tc::decompress(image::channel_format fmt, void *dst, const void *src, int width, int height, int channels, size_t stride)
+{
+    if (channels < 1 || channels > 4) {
+        throw std::invalid_argument("Invalid channel count for decompression");
+    }
+
+    size_t bsz = block_size(fmt);
+    int bw = (width + 3) / 4, bh = (height + 3) / 4;
+
+    const uint8_t *in = static_cast<const uint8_t *>(src);
+    uint8_t *out = static_cast<uint8_t *>(dst);
+    const decode_tables &t = get_decode_tables();
+
+    dake::helper::parallel_for(0, bh, [=, &t](int first, int last) {
+            byte_vector rows[4];
+
+            for (int by = first; by < last; by++) {
+                const uint8_t *blk = in + static_cast<size_t>(by) * bw * bsz;
+                int rows_left = height - by * 4;
+
+                for (int bx = 0; bx < bw; bx++, blk += bsz) {
+                    decode_block_rows(t, fmt, blk, rows);
+
+                    int x = bx * 4;
+                    size_t bytes = (width - x < 4 ? width - x : 4) * channels;
+
+                    for (int r = 0; r < 4 && r < rows_left; r++) {
+                        uint8_t *o = out + (by * 4 + r) * stride + x * channels;
+
+                        if (channels == 4) {
+                            memcpy(o, &rows[r], bytes);
+                        } else {
+                            byte_vector packed = shuffle_bytes(rows[r], t.pack[channels - 1]);
+                            memcpy(o, &packed, bytes);
+                        }
+                    }
+                }
+            }
+        }, 8);
+}
@@ -1,7 +1,15 @@
+#include <cctype>
+#include <cerrno>
+#include <cstdint>
 #include <cstdio>
+#include <cstring>
 #include <initializer_list>
+#include <memory>
+#include <sstream>
 #include <stdexcept>
 #include <string>
+#include <utility>
+#include <vector>
 
 #include <dake/math/fmatrix.hpp>
 #include <dake/math/matrix.hpp>
@@ -23,6 +31,10 @@ program *active_program;
 }
 
 
+static std::string binary_cache_dir;
+static dake::gl::program::binary_cache_statistics binary_cache_stats_;
+
+
 dake::gl::shader::shader(GLint tp, GLuint glid):
     id(glid), t(tp), is_copy(true)
 {}
@@ -49,12 +61,13 @@ dake::gl::shader::shader(dake::gl::shader &&sh)
 {
     id = sh.id;
     t = sh.t;
-    compiled = sh.compiled;
+    compiled = std::move(sh.compiled);
     name = std::move(sh.name);
+    code = std::move(sh.code);
 
     sh.t = 0;
     sh.id = 0;
-    sh.compiled = false;
+    sh.compiled = std::make_shared<bool>(false);
     sh.name = "(unnamed)";
 }
 
@@ -93,35 +106,170 @@ void dake::gl::shader::check_valid(void) const
 }
 
 
-void dake::gl::shader::load(const char *file)
+static std::string read_shader_file(const std::string &path)
 {
-    check_valid();
-
-    FILE *fp = fopen(dake::gl::find_resource_filename(file).c_str(), "rb");
+    FILE *fp = fopen(path.c_str(), "rb");
     if (!fp) {
-        throw std::invalid_argument("Could not open the given shader file");
+        throw std::invalid_argument("Could not open shader file " + path);
     }
 
-    name = std::string(file);
-
     fseek(fp, 0, SEEK_END);
     size_t len = ftell(fp);
     rewind(fp);
 
-    char *src = new char[len + 1];
-    if (fread(src, 1, len, fp) < len) {
+    std::string src(len, '\0');
+    if (fread(&src[0], 1, len, fp) < len) {
         const char *err = strerror(errno);
         fclose(fp);
-        delete[] src;
-        throw std::runtime_error("Failed to read shader code from " + name
+        throw std::runtime_error("Failed to read shader code from " + path
                                  + ": " + err);
     }
-    src[len] = 0;
 
     fclose(fp);
 
-    glShaderSource(id, 1, const_cast<const GLchar **>(&src), nullptr);
-    delete[] src;
+    return src;
+}
+
+
+static bool file_exists(const std::string &path)
+{
+    FILE *fp = fopen(path.c_str(), "rb");
+    if (fp) {
+        fclose(fp);
+    }
+    return fp;
+}
+
+
+namespace
+{
+
+struct include_state {
+    std::vector<std::string> stack, once;
+    int source_strings = 0;
+};
+
+}
+
+
+static void include_shader(std::string &out, const std::string &path, include_state &st)
+{
+    for (const std::string &f: st.stack) {
+        if (f == path) {
+            throw std::runtime_error("Recursive #include of " + path);
+        }
+    }
+    for (const std::string &f: st.once) {
+        if (f == path) {
+            return;
+        }
+    }
+
+    std::string text = read_shader_file(path);
+
+    int string_index = st.source_strings++;
+    if (string_index) {
+        out += "#line 1 " + std::to_string(string_index) + "\n";
+    }
+
+    st.stack.push_back(path);
+
+    size_t slash = path.rfind('/');
+    std::string dir = slash == std::string::npos ? "" : path.substr(0, slash + 1);
+
+    std::istringstream in(text);
+    std::string line;
+    for (int line_nr = 1; std::getline(in, line); line_nr++) {
+        size_t start = line.find_first_not_of(" \t");
+        if ((start == std::string::npos) || (line[start] != '#')) {
+            out += line + "\n";
+            continue;
+        }
+
+        std::istringstream directive(line.substr(start + 1));
+        std::string word, arg;
+        directive >> word >> arg;
+
+        if (word == "include") {
+            size_t len = arg.length();
+            if ((len < 3) || !(((arg[0] == '"') && (arg[len - 1] == '"')) || ((arg[0] == '<') && (arg[len - 1] == '>')))) {
+                throw std::runtime_error(path + ":" + std::to_string(line_nr) + ": Invalid #include");
+            }
+
+            std::string name = arg.substr(1, len - 2);
+            if (file_exists(dir + name)) {
+                include_shader(out, dir + name, st);
+            } else {
+                include_shader(out, dake::gl::find_resource_filename(name), st);
+            }
+
+            out += "#line " + std::to_string(line_nr + 1) + " " + std::to_string(string_index) + "\n";
+        } else if ((word == "pragma") && (arg == "once")) {
+            st.once.push_back(path);
+            out += "\n";
+        } else {
+            out += line + "\n";
+        }
+    }
+
+    st.stack.pop_back();
+}
+
+
+std::string dake::gl::preprocess_shader(const std::string &file)
+{
+    std::string out;
+    include_state st;
+
+    include_shader(out, find_resource_filename(file), st);
+
+    return out;
+}
+
+
+std::string dake::gl::inject_defines(const std::string &src, const std::vector<std::string> &defines)
+{
+    if (defines.empty()) {
+        return src;
+    }
+
+    std::string block;
+    for (const std::string &d: defines) {
+        block += "#define " + d + "\n";
+    }
+
+    // #version has to stay in front; it is the first directive, so the
+    // line it is on can be told by its leading whitespace only
+    size_t pos = 0;
+    int line_nr = 1;
+    while (pos < src.length()) {
+        size_t eol = src.find('\n', pos);
+        size_t start = src.find_first_not_of(" \t", pos);
+        bool version = (start < eol) && (start < src.length()) && !src.compare(start, 8, "#version");
+
+        pos = eol == std::string::npos ? src.length() : eol + 1;
+        if (version) {
+            return src.substr(0, pos) + (eol == std::string::npos ? "\n" : "") + block +
+                   "#line " + std::to_string(line_nr + 1) + " 0\n" + src.substr(pos);
+        }
+        line_nr++;
+    }
+
+    return block + "#line 1 0\n" + src;
+}
+
+
+void dake::gl::shader::load(const char *file, const std::vector<std::string> &defines)
+{
+    check_valid();
+
+    std::string src = inject_defines(preprocess_shader(file), defines);
+    name = std::string(file);
+
+    const char *src_ptr = src.c_str();
+    glShaderSource(id, 1, &src_ptr, nullptr);
+    code = std::move(src);
+    *compiled = false;
 }
 
 
@@ -132,6 +280,8 @@ void dake::gl::shader::source(const char *src)
     name = "unknown";
 
     glShaderSource(id, 1, const_cast<const GLchar **>(&src), nullptr);
+    code = src;
+    *compiled = false;
 }
 
 
@@ -155,12 +305,19 @@ bool dake::gl::shader::compile(void)
     check_valid();
 
     glCompileShader(id);
+    check_compiled();
+
+    return true;
+}
+
 
+void dake::gl::shader::check_compiled(void)
+{
     GLint status;
     glGetShaderiv(id, GL_COMPILE_STATUS, &status);
     if (status == GL_TRUE) {
-        compiled = true;
-        return true;
+        *compiled = true;
+        return;
     }
 
     GLint illen;
@@ -179,8 +336,6 @@ bool dake::gl::shader::compile(void)
 
         throw std::runtime_error("Error compiling " + std::string(shader_type_string(t)) + " shader " + name + ": " + msg_str);
     }
-
-    return false;
 }
 
 
@@ -196,6 +351,9 @@ dake::gl::program::program(std::initializer_list<shader> shaders):
     for (const shader &sh: shaders) {
         // Let's just pray to god this works
         shader sh_copy(sh.t, sh.id);
+        sh_copy.compiled = sh.compiled;
+        sh_copy.name = sh.name;
+        sh_copy.code = sh.code;
         *this << sh_copy;
     }
 }
@@ -205,7 +363,19 @@ dake::gl::program::program(program &&prg)
 {
     id = prg.id;
     uniform_locations = std::move(prg.uniform_locations);
+    uniform_slots = std::move(prg.uniform_slots);
+    pending_uniforms = std::move(prg.pending_uniforms);
     name = std::move(prg.name);
+    linked = prg.linked;
+    link_pending = prg.link_pending;
+    stages = std::move(prg.stages);
+    bindings = std::move(prg.bindings);
+    cacheable = prg.cacheable;
+    cache_result = prg.cache_result;
+    binary_key = prg.binary_key;
+    uniform_table = std::move(prg.uniform_table);
+    block_table = std::move(prg.block_table);
+    attrib_table = std::move(prg.attrib_table);
 
     prg.id = 0;
     prg.name = "";
@@ -232,9 +402,12 @@ void dake::gl::program::operator<<(dake::gl::shader &sh)
 {
     check_valid();
 
-    if (!sh.compiled) {
-        sh.compile();
+    // Compiling waits until link(), which may find a cached binary or be
+    // part of a batch
+    if (sh.code.empty()) {
+        cacheable = false;
     }
+    stages.push_back(stage{sh.t, sh.id, sh.name, sh.code, sh.compiled});
 
     if (name.empty()) {
         name = sh.name;
@@ -251,9 +424,12 @@ void dake::gl::program::operator<<(dake::gl::shader &&sh)
     check_valid();
 
     shader sh_moved(sh.t, sh.id);
+    sh_moved.compiled = std::move(sh.compiled);
+    sh_moved.name = sh.name;
+    sh_moved.code = std::move(sh.code);
 
     sh.id = 0;
-    sh.compiled = false;
+    sh.compiled = std::make_shared<bool>(false);
 
     *this << sh_moved;
 }
@@ -263,13 +439,98 @@ bool dake::gl::program::link(void)
 {
     check_valid();
 
+    // Linking again (e.g. after bind_attrib()) compiles whatever has not been
+    // compiled yet, as after loading a cached binary
+    if (!link_pending) {
+        linked = false;
+        submit_compile();
+        if (!linked) {
+            submit_link();
+        }
+    }
+    check_linked();
+
+    return true;
+}
+
+
+// Loads the program from the binary cache or starts compiling its shaders
+void dake::gl::program::submit_compile(void)
+{
+    GLint formats = 0;
+    if (!binary_cache_dir.empty() && cacheable && !stages.empty()) {
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+    }
+
+    cache_result = formats > 0;
+    if (cache_result) {
+        binary_key = cache_key();
+        if (load_binary(binary_key)) {
+            binary_cache_stats_.hits++;
+            linked = true;
+            reflect();
+            return;
+        }
+        binary_cache_stats_.misses++;
+    }
+
+    // Shaders attached to several programs are compiled by the first one
+    for (const stage &st: stages) {
+        if (!*st.compiled) {
+            glCompileShader(st.id);
+            *st.compiled = true;
+        }
+    }
+}
+
+
+void dake::gl::program::submit_link(void)
+{
+    if (cache_result) {
+        glProgramParameteri(id, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    }
+
     glLinkProgram(id);
+    link_pending = true;
+}
+
+
+bool dake::gl::program::link_complete(void) const
+{
+    if (!link_pending || !glext.has_extension(PARALLEL_SHADER_COMPILE)) {
+        return true;
+    }
+
+    GLint done;
+    glGetProgramiv(id, GL_COMPLETION_STATUS_KHR, &done);
+    return done == GL_TRUE;
+}
+
+
+// Waits for linking to finish; on failure, only then are the shaders checked
+void dake::gl::program::check_linked(void)
+{
+    if (!link_pending) {
+        return;
+    }
+    link_pending = false;
 
     GLint status;
     glGetProgramiv(id, GL_LINK_STATUS, &status);
     if (status == GL_TRUE) {
         linked = true;
-        return true;
+        if (cache_result) {
+            save_binary(binary_key);
+        }
+        reflect();
+        return;
+    }
+
+    // Another program may have compiled a shader without checking it
+    for (const stage &st: stages) {
+        shader sh(st.type, st.id);
+        sh.name = st.name;
+        sh.check_compiled();
     }
 
     GLint illen;
@@ -291,6 +552,73 @@ bool dake::gl::program::link(void)
 }
 
 
+static size_t uniform_value_size(GLenum type)
+{
+    switch (type) {
+        case GL_FLOAT:             return sizeof(GLfloat);
+        case GL_FLOAT_VEC2:        return 2 * sizeof(GLfloat);
+        case GL_FLOAT_VEC3:        return 3 * sizeof(GLfloat);
+        case GL_FLOAT_VEC4:        return 4 * sizeof(GLfloat);
+        case GL_FLOAT_MAT2:        return 4 * sizeof(GLfloat);
+        case GL_FLOAT_MAT3:        return 9 * sizeof(GLfloat);
+        case GL_FLOAT_MAT4:        return 16 * sizeof(GLfloat);
+        case GL_INT:               return sizeof(GLint);
+        case GL_UNSIGNED_INT:      return sizeof(GLuint);
+        case GL_UNSIGNED_INT64_ARB: return sizeof(GLuint64);
+    }
+
+    throw std::invalid_argument("Unsupported uniform type");
+}
+
+
+// Sets a uniform of the program prg_id with glProgramUniform*(), or of the
+// program in use with glUniform*() if prg_id is 0
+static void set_uniform(GLuint prg_id, GLint location, GLenum type, const void *value)
+{
+    const GLfloat *f = static_cast<const GLfloat *>(value);
+
+    if (prg_id) {
+        switch (type) {
+            case GL_FLOAT:      glProgramUniform1fv(prg_id, location, 1, f); break;
+            case GL_FLOAT_VEC2: glProgramUniform2fv(prg_id, location, 1, f); break;
+            case GL_FLOAT_VEC3: glProgramUniform3fv(prg_id, location, 1, f); break;
+            case GL_FLOAT_VEC4: glProgramUniform4fv(prg_id, location, 1, f); break;
+            case GL_FLOAT_MAT2: glProgramUniformMatrix2fv(prg_id, location, 1, false, f); break;
+            case GL_FLOAT_MAT3: glProgramUniformMatrix3fv(prg_id, location, 1, false, f); break;
+            case GL_FLOAT_MAT4: glProgramUniformMatrix4fv(prg_id, location, 1, false, f); break;
+            case GL_INT:
+                glProgramUniform1i(prg_id, location, *static_cast<const GLint *>(value));
+                break;
+            case GL_UNSIGNED_INT:
+                glProgramUniform1ui(prg_id, location, *static_cast<const GLuint *>(value));
+                break;
+            case GL_UNSIGNED_INT64_ARB:
+                glProgramUniformHandleui64ARB(prg_id, location, *static_cast<const GLuint64 *>(value));
+                break;
+        }
+    } else {
+        switch (type) {
+            case GL_FLOAT:      glUniform1fv(location, 1, f); break;
+            case GL_FLOAT_VEC2: glUniform2fv(location, 1, f); break;
+            case GL_FLOAT_VEC3: glUniform3fv(location, 1, f); break;
+            case GL_FLOAT_VEC4: glUniform4fv(location, 1, f); break;
+            case GL_FLOAT_MAT2: glUniformMatrix2fv(location, 1, false, f); break;
+            case GL_FLOAT_MAT3: glUniformMatrix3fv(location, 1, false, f); break;
+            case GL_FLOAT_MAT4: glUniformMatrix4fv(location, 1, false, f); break;
+            case GL_INT:
+                glUniform1i(location, *static_cast<const GLint *>(value));
+                break;
+            case GL_UNSIGNED_INT:
+                glUniform1ui(location, *static_cast<const GLuint *>(value));
+                break;
+            case GL_UNSIGNED_INT64_ARB:
+                glUniformHandleui64ARB(location, *static_cast<const GLuint64 *>(value));
+                break;
+        }
+    }
+}
+
+
 void dake::gl::program::use(void)
 {
     check_valid();
@@ -305,6 +633,43 @@ void dake::gl::program::use(void)
 
     glUseProgram(id);
     dake::gl::active_program = this;
+
+    for (const pending_uniform &pu: pending_uniforms) {
+        set_uniform(0, pu.location, pu.type, &pu.value);
+    }
+    pending_uniforms.clear();
+}
+
+
+void dake::gl::program::write_uniform(GLint location, GLenum type, const void *value)
+{
+    if (glext.has_extension(SEPARATE_SHADER_OBJECTS)) {
+        set_uniform(id, location, type, value);
+        return;
+    }
+
+    if (dake::gl::active_program == this) {
+        set_uniform(0, location, type, value);
+        return;
+    }
+
+    // Only the last value written counts; programs have few uniforms, so
+    // searching is cheaper than keeping an index
+    pending_uniform *pu = nullptr;
+    for (pending_uniform &p: pending_uniforms) {
+        if (p.location == location) {
+            pu = &p;
+            break;
+        }
+    }
+    if (!pu) {
+        pending_uniforms.emplace_back();
+        pu = &pending_uniforms.back();
+    }
+
+    pu->location = location;
+    pu->type = type;
+    memcpy(&pu->value, value, uniform_value_size(type));
 }
 
 
@@ -323,6 +688,7 @@ void dake::gl::program::bind_attrib(const char *identifier, int location)
 {
     check_valid();
     glBindAttribLocation(id, location, identifier);
+    bindings += "attrib " + std::string(identifier) + " " + std::to_string(location) + "\n";
 }
 
 
@@ -341,6 +707,480 @@ void dake::gl::program::bind_frag(const char *identifier, int location)
 {
     check_valid();
     glBindFragDataLocation(id, location, identifier);
+    bindings += "frag " + std::string(identifier) + " " + std::to_string(location) + "\n";
+}
+
+
+// Fills the tables once after linking, so that nothing has to be queried
+// per name later on
+void dake::gl::program::reflect(void)
+{
+    GLint count, max_length;
+
+    uniform_table.clear();
+    uniform_locations.clear();
+    glGetProgramiv(id, GL_ACTIVE_UNIFORMS, &count);
+    glGetProgramiv(id, GL_ACTIVE_UNIFORM_MAX_LENGTH, &max_length);
+
+    std::vector<char> name_buf(max_length + 1);
+    std::vector<GLuint> indices(count);
+    std::vector<GLint> blocks(count), offsets(count), array_strides(count), matrix_strides(count);
+    for (int i = 0; i < count; i++) {
+        indices[i] = i;
+    }
+    if (count) {
+        glGetActiveUniformsiv(id, count, indices.data(), GL_UNIFORM_BLOCK_INDEX, blocks.data());
+        glGetActiveUniformsiv(id, count, indices.data(), GL_UNIFORM_OFFSET, offsets.data());
+        glGetActiveUniformsiv(id, count, indices.data(), GL_UNIFORM_ARRAY_STRIDE, array_strides.data());
+        glGetActiveUniformsiv(id, count, indices.data(), GL_UNIFORM_MATRIX_STRIDE, matrix_strides.data());
+    }
+
+    for (int i = 0; i < count; i++) {
+        GLint size;
+        GLenum type;
+        glGetActiveUniform(id, i, name_buf.size(), nullptr, &size, &type, name_buf.data());
+
+        std::string uni_name(name_buf.data());
+        GLint location = blocks[i] < 0 ? glGetUniformLocation(id, uni_name.c_str()) : -1;
+
+        uniform_table.push_back(uniform_info{uni_name, type, size, location, blocks[i], offsets[i], array_strides[i], matrix_strides[i]});
+
+        if (location >= 0) {
+            uniform_locations.emplace(uni_name, location);
+            // Arrays are reported as "name[0]", but can be found by "name"
+            if ((uni_name.length() > 3) && !uni_name.compare(uni_name.length() - 3, 3, "[0]")) {
+                uniform_locations.emplace(uni_name.substr(0, uni_name.length() - 3), location);
+            }
+        }
+    }
+
+    // At most half full, so probe sequences stay short
+    size_t slots = 1;
+    while (slots < 2 * uniform_locations.size()) {
+        slots <<= 1;
+    }
+    uniform_slots.assign(uniform_locations.empty() ? 0 : slots, uniform_slot{0, -1});
+
+    for (const auto &loc: uniform_locations) {
+        uint64_t hash = uniform_name::hash(loc.first.c_str(), loc.first.length());
+        size_t i = hash & (slots - 1);
+        while (uniform_slots[i].hash && (uniform_slots[i].hash != hash)) {
+            i = (i + 1) & (slots - 1);
+        }
+        uniform_slots[i] = uniform_slot{hash, loc.second};
+    }
+
+    block_table.clear();
+    glGetProgramiv(id, GL_ACTIVE_UNIFORM_BLOCKS, &count);
+    glGetProgramiv(id, GL_ACTIVE_UNIFORM_BLOCK_MAX_NAME_LENGTH, &max_length);
+    name_buf.resize(max_length + 1);
+
+    for (int i = 0; i < count; i++) {
+        GLint size, binding;
+        glGetActiveUniformBlockName(id, i, name_buf.size(), nullptr, name_buf.data());
+        glGetActiveUniformBlockiv(id, i, GL_UNIFORM_BLOCK_DATA_SIZE, &size);
+        glGetActiveUniformBlockiv(id, i, GL_UNIFORM_BLOCK_BINDING, &binding);
+
+        block_table.push_back(block_info{name_buf.data(), size, binding});
+    }
+
+    attrib_table.clear();
+    glGetProgramiv(id, GL_ACTIVE_ATTRIBUTES, &count);
+    glGetProgramiv(id, GL_ACTIVE_ATTRIBUTE_MAX_LENGTH, &max_length);
+    name_buf.resize(max_length + 1);
+
+    for (int i = 0; i < count; i++) {
+        GLint size;
+        GLenum type;
+        glGetActiveAttrib(id, i, name_buf.size(), nullptr, &size, &type, name_buf.data());
+
+        attrib_table.push_back(attrib_info{name_buf.data(), type, size, glGetAttribLocation(id, name_buf.data())});
+    }
+}
+
+
+const std::vector<dake::gl::program::uniform_info> &dake::gl::program::active_uniforms(void)
+{
+    check_valid();
+
+    if (!linked) {
+        link();
+    }
+    return uniform_table;
+}
+
+
+const std::vector<dake::gl::program::block_info> &dake::gl::program::active_blocks(void)
+{
+    check_valid();
+
+    if (!linked) {
+        link();
+    }
+    return block_table;
+}
+
+
+const std::vector<dake::gl::program::attrib_info> &dake::gl::program::active_attribs(void)
+{
+    check_valid();
+
+    if (!linked) {
+        link();
+    }
+    return attrib_table;
+}
+
+
+int dake::gl::program::block_index(const std::string &block)
+{
+    const std::vector<block_info> &blocks = active_blocks();
+
+    for (size_t i = 0; i < blocks.size(); i++) {
+        if (blocks[i].name == block) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+
+void dake::gl::program::bind_block(const std::string &block, GLuint binding)
+{
+    int index = block_index(block);
+    if (index < 0) {
+        throw std::invalid_argument("Could not find uniform block " + block);
+    }
+
+    glUniformBlockBinding(id, index, binding);
+    block_table[index].binding = binding;
+}
+
+
+void dake::gl::program::set_binary_cache(const std::string &directory)
+{
+    binary_cache_dir = directory;
+}
+
+
+const dake::gl::program::binary_cache_statistics &dake::gl::program::binary_cache_stats(void)
+{
+    return binary_cache_stats_;
+}
+
+
+static void fnv1a(uint64_t &hash, const void *data, size_t length)
+{
+    const uint8_t *p = static_cast<const uint8_t *>(data);
+
+    for (size_t i = 0; i < length; i++) {
+        hash = (hash ^ p[i]) * 1099511628211ull;
+    }
+}
+
+
+static void fnv1a(uint64_t &hash, const std::string &str)
+{
+    // Including the terminator keeps concatenations apart
+    fnv1a(hash, str.c_str(), str.length() + 1);
+}
+
+
+static bool binary_format_supported(GLenum format)
+{
+    GLint count = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &count);
+
+    std::vector<GLint> formats(count);
+    glGetIntegerv(GL_PROGRAM_BINARY_FORMATS, formats.data());
+
+    for (GLint f: formats) {
+        if (static_cast<GLenum>(f) == format) {
+            return true;
+        }
+    }
+    return false;
+}
+
+
+static std::string binary_cache_file(uint64_t key)
+{
+    char name[32];
+    snprintf(name, sizeof(name), "/%016llx.bin", static_cast<unsigned long long>(key));
+    return binary_cache_dir + name;
+}
+
+
+// Identifies a program binary, together with the format and the key itself
+// stored in the file
+static const char binary_magic[8] = "dakeprg";
+
+
+uint64_t dake::gl::program::cache_key(void) const
+{
+    uint64_t hash = 14695981039346656037ull;
+
+    // Binaries are only valid for the same driver
+    for (GLenum s: {GL_VENDOR, GL_RENDERER, GL_VERSION}) {
+        const GLubyte *str = glGetString(s);
+        fnv1a(hash, str ? reinterpret_cast<const char *>(str) : "");
+    }
+
+    GLint count = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &count);
+    std::vector<GLint> formats(count);
+    glGetIntegerv(GL_PROGRAM_BINARY_FORMATS, formats.data());
+    fnv1a(hash, formats.data(), formats.size() * sizeof(formats[0]));
+
+    for (const stage &st: stages) {
+        fnv1a(hash, &st.type, sizeof(st.type));
+        fnv1a(hash, st.source);
+    }
+    fnv1a(hash, bindings);
+
+    return hash;
+}
+
+
+bool dake::gl::program::load_binary(uint64_t key)
+{
+    FILE *fp = fopen(binary_cache_file(key).c_str(), "rb");
+    if (!fp) {
+        return false;
+    }
+
+    char magic[sizeof(binary_magic)];
+    uint64_t file_key;
+    uint32_t format, length;
+    std::vector<char> binary;
+
+    bool valid = fread(magic, sizeof(magic), 1, fp) && fread(&file_key, sizeof(file_key), 1, fp) &&
+                 fread(&format, sizeof(format), 1, fp) && fread(&length, sizeof(length), 1, fp) &&
+                 !memcmp(magic, binary_magic, sizeof(magic)) && (file_key == key) && length;
+    if (valid) {
+        binary.resize(length);
+        valid = fread(binary.data(), length, 1, fp) == 1;
+    }
+    fclose(fp);
+
+    if (valid && binary_format_supported(format)) {
+        // Fails (leaving the program unlinked) if the driver has changed in
+        // a way the key does not show
+        glProgramBinary(id, format, binary.data(), length);
+
+        GLint status;
+        glGetProgramiv(id, GL_LINK_STATUS, &status);
+        if (status == GL_TRUE) {
+            return true;
+        }
+    }
+
+    binary_cache_stats_.rejected++;
+    return false;
+}
+
+
+// Failing to write the cache is not an error, the program works anyway
+void dake::gl::program::save_binary(uint64_t key)
+{
+    GLint length = 0;
+    glGetProgramiv(id, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0) {
+        return;
+    }
+
+    std::vector<char> binary(length);
+    GLenum format;
+    glGetProgramBinary(id, length, &length, &format, binary.data());
+
+    std::string file = binary_cache_file(key), tmp_file = file + ".tmp";
+    FILE *fp = fopen(tmp_file.c_str(), "wb");
+    if (!fp) {
+        return;
+    }
+
+    uint32_t format32 = format, length32 = length;
+    bool ok = fwrite(binary_magic, sizeof(binary_magic), 1, fp) && fwrite(&key, sizeof(key), 1, fp) &&
+              fwrite(&format32, sizeof(format32), 1, fp) && fwrite(&length32, sizeof(length32), 1, fp) &&
+              fwrite(binary.data(), length, 1, fp);
+    ok = !fclose(fp) && ok;
+
+    // Readers only ever see complete files
+    if (!ok || rename(tmp_file.c_str(), file.c_str())) {
+        remove(tmp_file.c_str());
+    }
+}
+
+
+// Whether name occurs in src as a whole identifier
+static bool mentions(const std::string &src, const std::string &name)
+{
+    auto ident = [](char c) { return isalnum(static_cast<unsigned char>(c)) || (c == '_'); };
+
+    for (size_t pos = src.find(name); pos != std::string::npos; pos = src.find(name, pos + 1)) {
+        size_t end = pos + name.length();
+        if ((!pos || !ident(src[pos - 1])) && ((end == src.length()) || !ident(src[end]))) {
+            return true;
+        }
+    }
+    return false;
+}
+
+
+dake::gl::program_permutations::program_permutations(const std::vector<std::pair<shader::type, std::string>> &files,
+                                                     const std::vector<std::string> &feature_names):
+    features(feature_names)
+{
+    if (features.size() > 32) {
+        throw std::invalid_argument("Programs can have at most 32 features");
+    }
+
+    for (const auto &f: files) {
+        stages.push_back(stage{f.first, f.second, preprocess_shader(f.second), 0});
+
+        for (size_t i = 0; i < features.size(); i++) {
+            if (mentions(stages.back().source, features[i])) {
+                stages.back().used |= UINT32_C(1) << i;
+            }
+        }
+    }
+}
+
+
+dake::gl::program_permutations::~program_permutations(void)
+{
+    for (auto &p: by_source) {
+        delete p.second.prg;
+    }
+}
+
+
+dake::gl::program &dake::gl::program_permutations::operator[](uint32_t mask)
+{
+    auto known = by_mask.find(mask);
+    if (known != by_mask.end()) {
+        return *known->second;
+    }
+
+    if ((features.size() < 32) && (mask >> features.size())) {
+        throw std::out_of_range("Unknown feature bits set");
+    }
+
+    uint64_t hash = 14695981039346656037ull;
+    std::vector<std::string> sources;
+    for (const stage &st: stages) {
+        std::vector<std::string> defines;
+        for (size_t i = 0; i < features.size(); i++) {
+            if (mask & st.used & (UINT32_C(1) << i)) {
+                defines.push_back(features[i]);
+            }
+        }
+
+        sources.push_back(inject_defines(st.source, defines));
+        fnv1a(hash, &st.type, sizeof(st.type));
+        fnv1a(hash, sources.back());
+    }
+
+    // Hashes can collide, so candidates have to be compared in full
+    program *prg = nullptr;
+    auto candidates = by_source.equal_range(hash);
+    for (auto c = candidates.first; c != candidates.second; ++c) {
+        if (c->second.sources == sources) {
+            prg = c->second.prg;
+            break;
+        }
+    }
+
+    if (prg) {
+        stats_.shared++;
+    } else {
+        prg = new program;
+        for (size_t i = 0; i < stages.size(); i++) {
+            shader sh(stages[i].type);
+            sh.source(sources[i].c_str());
+            sh.name = stages[i].file;
+            *prg << sh;
+        }
+
+        by_source.emplace(hash, variant{std::move(sources), prg});
+        stats_.programs++;
+    }
+
+    by_mask.emplace(mask, prg);
+    return *prg;
+}
+
+
+dake::gl::program_batch &dake::gl::program_batch::operator<<(program &prg)
+{
+    prg.check_valid();
+    programs.push_back(&prg);
+    submitted = false;
+
+    return *this;
+}
+
+
+void dake::gl::program_batch::submit(void)
+{
+    if (glext.has_extension(PARALLEL_SHADER_COMPILE)) {
+        // Let the driver choose how many threads to use
+        glMaxShaderCompilerThreadsKHR(0xffffffffu);
+    }
+
+    // All compiles first, so that links do not wait for shaders submitted
+    // after them
+    for (program *prg: programs) {
+        if (!prg->linked && !prg->link_pending) {
+            prg->submit_compile();
+        }
+    }
+    for (program *prg: programs) {
+        if (!prg->linked && !prg->link_pending) {
+            prg->submit_link();
+        }
+    }
+
+    submitted = true;
+}
+
+
+bool dake::gl::program_batch::ready(void)
+{
+    if (!submitted) {
+        submit();
+    }
+
+    for (const program *prg: programs) {
+        if (!prg->link_complete()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+void dake::gl::program_batch::finish(void)
+{
+    if (!submitted) {
+        submit();
+    }
+
+    std::string errors;
+    for (program *prg: programs) {
+        try {
+            prg->check_linked();
+        } catch (std::runtime_error &e) {
+            errors += std::string(errors.empty() ? "" : "\n") + e.what();
+        }
+    }
+
+    programs.clear();
+    submitted = false;
+
+    if (!errors.empty()) {
+        throw std::runtime_error(errors);
+    }
 }
 
 
@@ -351,58 +1191,64 @@ namespace gl
 {
 
 template<> void uniform<math::mat2>::assign(const math::mat2 &value)
-{ glUniformMatrix2fv(id, 1, false, value); }
+{ prg->write_uniform(id, GL_FLOAT_MAT2, value.d); }
 template<> void uniform<math::mat3>::assign(const math::mat3 &value)
-{ glUniformMatrix3fv(id, 1, false, value); }
+{ prg->write_uniform(id, GL_FLOAT_MAT3, value.d); }
 template<> void uniform<math::mat4>::assign(const math::mat4 &value)
-{ glUniformMatrix4fv(id, 1, false, value); }
+{ prg->write_uniform(id, GL_FLOAT_MAT4, value.d); }
 template<> void uniform<math::fmat3>::assign(const math::fmat3 &value)
-{ glUniformMatrix3fv(id, 1, false, (math::mat3)value); }
+{ prg->write_uniform(id, GL_FLOAT_MAT3, static_cast<math::mat3>(value).d); }
 template<> void uniform<math::fmat4>::assign(const math::fmat4 &value)
-{ glUniformMatrix4fv(id, 1, false, value.d); }
+{ prg->write_uniform(id, GL_FLOAT_MAT4, value.d); }
 template<> void uniform<math::vec2>::assign(const math::vec2 &value)
-{ glUniform2fv(id, 1, value); }
+{ prg->write_uniform(id, GL_FLOAT_VEC2, value.d); }
 template<> void uniform<math::vec3>::assign(const math::vec3 &value)
-{ glUniform3fv(id, 1, value); }
+{ prg->write_uniform(id, GL_FLOAT_VEC3, value.d); }
 template<> void uniform<math::vec4>::assign(const math::vec4 &value)
-{ glUniform4fv(id, 1, value); }
+{ prg->write_uniform(id, GL_FLOAT_VEC4, value.d); }
 template<> void uniform<math::fvec2>::assign(const math::fvec2 &value)
-{ glUniform2fv(id, 1, value); }
+{ prg->write_uniform(id, GL_FLOAT_VEC2, value.d); }
 template<> void uniform<math::fvec3>::assign(const math::fvec3 &value)
-{ glUniform3fv(id, 1, value); }
+{ prg->write_uniform(id, GL_FLOAT_VEC3, value.d); }
 template<> void uniform<math::fvec4>::assign(const math::fvec4 &value)
-{ glUniform4fv(id, 1, value); }
+{ prg->write_uniform(id, GL_FLOAT_VEC4, value.d); }
 template<> void uniform<float>::assign(const float &value)
-{ glUniform1f(id, value); }
+{ prg->write_uniform(id, GL_FLOAT, &value); }
 template<> void uniform<uint32_t>::assign(const uint32_t &value)
-{ glUniform1ui(id, value); }
+{ prg->write_uniform(id, GL_UNSIGNED_INT, &value); }
 template<> void uniform<int32_t>::assign(const int32_t &value)
-{ glUniform1i(id, value); }
+{ prg->write_uniform(id, GL_INT, &value); }
 
 template<> void uniform<texture>::assign(const texture &value)
 {
     if (value.bindless()) {
-        glUniformHandleui64ARB(id, value.handle());
+        GLuint64 handle = value.handle();
+        prg->write_uniform(id, GL_UNSIGNED_INT64_ARB, &handle);
     } else {
-        glUniform1i(id, value.tmu());
+        GLint tmu = value.tmu();
+        prg->write_uniform(id, GL_INT, &tmu);
     }
 }
 
 template<> void uniform<array_texture>::assign(const array_texture &value)
 {
     if (value.bindless()) {
-        glUniformHandleui64ARB(id, value.handle());
+        GLuint64 handle = value.handle();
+        prg->write_uniform(id, GL_UNSIGNED_INT64_ARB, &handle);
     } else {
-        glUniform1i(id, value.tmu());
+        GLint tmu = value.tmu();
+        prg->write_uniform(id, GL_INT, &tmu);
     }
 }
 
 template<> void uniform<cubemap>::assign(const cubemap &value)
 {
     if (value.bindless()) {
-        glUniformHandleui64ARB(id, value.handle());
+        GLuint64 handle = value.handle();
+        prg->write_uniform(id, GL_UNSIGNED_INT64_ARB, &handle);
     } else {
-        glUniform1i(id, value.tmu());
+        GLint tmu = value.tmu();
+        prg->write_uniform(id, GL_INT, &tmu);
     }
 }
 
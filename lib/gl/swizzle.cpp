@@ -0,0 +1,264 @@
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+
+#include <dake/gl/swizzle.hpp>
+#include <dake/helper/parallel.hpp>
+
+
+typedef uint8_t byte_vector __attribute__((vector_size(16)));
+typedef char shuffle_vector __attribute__((vector_size(16)));
+
+#ifdef __AVX2__
+// Two independent 16-byte groups
+typedef uint8_t wide_byte_vector __attribute__((vector_size(32)));
+typedef char wide_shuffle_vector __attribute__((vector_size(32)));
+#endif
+
+
+// Up to two sources whose channels are written into dst in the order given
+// by from_source/from_channel
+struct repack_plan {
+    int sources;
+    const uint8_t *src[2];
+    int src_channels[2];
+    size_t src_stride[2];
+
+    uint8_t *dst;
+    int dst_channels;
+    size_t dst_stride;
+
+    // Per byte of a pixel; negative from_source means 0
+    int from_source[16], from_channel[16];
+
+    // Pixels moved per 16-byte group
+    int group;
+    // pshufb masks taking a group of pixels from each source to its place in
+    // the output group
+    byte_vector mask[2];
+};
+
+
+#ifdef __SSSE3__
+static inline byte_vector load_group(const uint8_t *p)
+{
+    byte_vector v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+
+static inline void store_group(uint8_t *p, const byte_vector &v)
+{
+    memcpy(p, &v, sizeof(v));
+}
+
+
+static inline byte_vector shuffle_bytes(const byte_vector &v, const byte_vector &mask)
+{
+    return (byte_vector)__builtin_ia32_pshufb128((shuffle_vector)v, (shuffle_vector)mask);
+}
+#endif
+
+
+#ifdef __AVX2__
+static inline wide_byte_vector load_groups(const uint8_t *p0, const uint8_t *p1)
+{
+    wide_byte_vector v;
+    memcpy(&v, p0, 16);
+    memcpy(reinterpret_cast<uint8_t *>(&v) + 16, p1, 16);
+    return v;
+}
+
+
+// p0 first, so p1 may overlap it
+static inline void store_groups(uint8_t *p0, uint8_t *p1, const wide_byte_vector &v)
+{
+    memcpy(p0, &v, 16);
+    memcpy(p1, reinterpret_cast<const uint8_t *>(&v) + 16, 16);
+}
+
+
+// vpshufb shuffles both 128-bit lanes separately
+static inline wide_byte_vector shuffle_bytes(const wide_byte_vector &v, const wide_byte_vector &mask)
+{
+    return (wide_byte_vector)__builtin_ia32_pshufb256((wide_shuffle_vector)v, (wide_shuffle_vector)mask);
+}
+#endif
+
+
+static void build_masks(repack_plan *p)
+{
+    int widest = p->dst_channels;
+    for (int s = 0; s < p->sources; s++) {
+        widest = p->src_channels[s] > widest ? p->src_channels[s] : widest;
+    }
+    p->group = 16 / widest;
+
+    for (int s = 0; s < p->sources; s++) {
+        for (int i = 0; i < 16; i++) {
+            // With a single source, bytes past the group are passed through
+            // so that storing whole vectors in place leaves the next group
+            // untouched
+            p->mask[s][i] = p->sources == 1 ? i : 0x80;
+        }
+
+        for (int x = 0; x < p->group; x++) {
+            for (int c = 0; c < p->dst_channels; c++) {
+                int i = x * p->dst_channels + c;
+                if (p->from_source[c] == s) {
+                    p->mask[s][i] = x * p->src_channels[s] + p->from_channel[c];
+                } else {
+                    p->mask[s][i] = 0x80;
+                }
+            }
+        }
+    }
+}
+
+
+// Whether the groups starting at x up to (excluding) x + pixels can be loaded
+// and stored without leaving the row
+static inline bool groups_fit(const repack_plan &p, int x, int pixels, int width)
+{
+    int last = x + pixels - p.group;
+
+    if (last * p.dst_channels + 16 > width * p.dst_channels) {
+        return false;
+    }
+    for (int s = 0; s < p.sources; s++) {
+        if (last * p.src_channels[s] + 16 > width * p.src_channels[s]) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+static void repack_row(const repack_plan &p, uint8_t *out, const uint8_t *const *in, int width)
+{
+    int x = 0;
+    int dc = p.dst_channels;
+
+#ifdef __AVX2__
+    wide_byte_vector wide_mask[2];
+    for (int s = 0; s < p.sources; s++) {
+        wide_mask[s] = load_groups(reinterpret_cast<const uint8_t *>(&p.mask[s]),
+                                   reinterpret_cast<const uint8_t *>(&p.mask[s]));
+    }
+
+    for (; groups_fit(p, x, 2 * p.group, width); x += 2 * p.group) {
+        wide_byte_vector v = {};
+        for (int s = 0; s < p.sources; s++) {
+            int sc = p.src_channels[s];
+            v |= shuffle_bytes(load_groups(in[s] + x * sc, in[s] + (x + p.group) * sc), wide_mask[s]);
+        }
+        store_groups(out + x * dc, out + (x + p.group) * dc, v);
+    }
+#endif
+
+#ifdef __SSSE3__
+    for (; groups_fit(p, x, p.group, width); x += p.group) {
+        byte_vector v = {};
+        for (int s = 0; s < p.sources; s++) {
+            v |= shuffle_bytes(load_group(in[s] + x * p.src_channels[s]), p.mask[s]);
+        }
+        store_group(out + x * dc, v);
+    }
+#endif
+
+    for (; x < width; x++) {
+        // Read everything first, dst may be src
+        uint8_t px[16];
+        for (int c = 0; c < dc; c++) {
+            int s = p.from_source[c];
+            px[c] = s < 0 ? 0 : in[s][x * p.src_channels[s] + p.from_channel[c]];
+        }
+        memcpy(out + x * dc, px, dc);
+    }
+}
+
+
+static void repack(const repack_plan &p, int width, int height)
+{
+    dake::helper::parallel_for(0, height, [&p, width](int first, int last) {
+            for (int y = first; y < last; y++) {
+                const uint8_t *in[2];
+                for (int s = 0; s < p.sources; s++) {
+                    in[s] = p.src[s] + y * p.src_stride[s];
+                }
+
+                repack_row(p, p.dst + y * p.dst_stride, in, width);
+            }
+        }, 64);
+}
+
+
+void dake::gl::swizzle::remap(void *dst, int dst_channels, size_t dst_stride,
+                              const void *src, int src_channels, size_t src_stride,
+                              const int *map, int width, int height, int channel_size)
+{
+    if (dst_channels < 1 || dst_channels > 4 || src_channels < 1 || src_channels > 4) {
+        throw std::invalid_argument("Invalid channel count");
+    }
+    if (channel_size != 1 && channel_size != 2 && channel_size != 4) {
+        throw std::invalid_argument("Invalid channel size");
+    }
+
+    repack_plan p;
+    p.sources = 1;
+    p.src[0] = static_cast<const uint8_t *>(src);
+    p.src_channels[0] = src_channels * channel_size;
+    p.src_stride[0] = src_stride;
+    p.dst = static_cast<uint8_t *>(dst);
+    p.dst_channels = dst_channels * channel_size;
+    p.dst_stride = dst_stride;
+
+    // Wider channels are moved as runs of bytes
+    for (int c = 0; c < dst_channels; c++) {
+        if (map[c] >= src_channels) {
+            throw std::invalid_argument("Invalid source channel");
+        }
+
+        for (int b = 0; b < channel_size; b++) {
+            p.from_source[c * channel_size + b] = map[c] < 0 ? -1 : 0;
+            p.from_channel[c * channel_size + b] = map[c] * channel_size + b;
+        }
+    }
+
+    build_masks(&p);
+    repack(p, width, height);
+}
+
+
+void dake::gl::swizzle::merge(void *dst, size_t dst_stride,
+                              const void *src1, int channels1, size_t stride1,
+                              const void *src2, int channels2, size_t stride2,
+                              int width, int height)
+{
+    if (channels1 < 1 || channels2 < 1 || channels1 + channels2 > 4) {
+        throw std::invalid_argument("Invalid channel count");
+    }
+
+    repack_plan p;
+    p.sources = 2;
+    p.src[0] = static_cast<const uint8_t *>(src1);
+    p.src[1] = static_cast<const uint8_t *>(src2);
+    p.src_channels[0] = channels1;
+    p.src_channels[1] = channels2;
+    p.src_stride[0] = stride1;
+    p.src_stride[1] = stride2;
+    p.dst = static_cast<uint8_t *>(dst);
+    p.dst_channels = channels1 + channels2;
+    p.dst_stride = dst_stride;
+
+    for (int c = 0; c < p.dst_channels; c++) {
+        p.from_source[c] = c < channels1 ? 0 : 1;
+        p.from_channel[c] = c < channels1 ? c : c - channels1;
+    }
+
+    build_masks(&p);
+    repack(p, width, height);
+}
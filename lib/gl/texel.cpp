@@ -0,0 +1,246 @@
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+
+#include <dake/gl/texel.hpp>
+#include <dake/gl/texture.hpp>
+#include <dake/helper/parallel.hpp>
+
+
+using dake::gl::image;
+
+
+// Eight channel values
+typedef float value_vector __attribute__((vector_size(32)));
+typedef int32_t value_int_vector __attribute__((vector_size(32)));
+#ifdef __F16C__
+typedef short half_vector __attribute__((vector_size(16)));
+#endif
+
+
+uint16_t dake::gl::texel::float_to_half(float f)
+{
+    uint32_t bits;
+    memcpy(&bits, &f, sizeof(bits));
+
+    uint32_t sign = (bits >> 16) & 0x8000;
+    uint32_t abs = bits & 0x7fffffff;
+
+    if (abs > 0x7f800000) {
+        // Keep NaNs NaN
+        return sign | 0x7e00;
+    } else if (abs >= 0x477ff000) {
+        // 65520 and up round to infinity
+        return sign | 0x7c00;
+    } else if (abs < 0x38800000) {
+        // Denormal: multiples of 2^-24
+        float a;
+        memcpy(&a, &abs, sizeof(a));
+        return sign | static_cast<uint16_t>(lrintf(a * 16777216.f));
+    }
+
+    uint32_t h = (abs >> 13) - (112 << 10);
+    uint32_t rest = abs & 0x1fff;
+    if (rest > 0x1000 || (rest == 0x1000 && (h & 1))) {
+        h++;
+    }
+
+    return sign | h;
+}
+
+
+float dake::gl::texel::half_to_float(uint16_t h)
+{
+    int exp = (h >> 10) & 0x1f, mant = h & 0x3ff;
+    float v;
+
+    if (!exp) {
+        v = ldexpf(mant, -24);
+    } else if (exp == 31) {
+        v = mant ? NAN : INFINITY;
+    } else {
+        v = ldexpf(mant + 1024, exp - 25);
+    }
+
+    return (h & 0x8000) ? -v : v;
+}
+
+
+size_t dake::gl::texel::value_size(image::channel_format fmt)
+{
+    switch (fmt) {
+        case image::LINEAR_UINT8:  return 1;
+        case image::LINEAR_UINT16: return 2;
+        case image::LINEAR_HALF:   return 2;
+        case image::LINEAR_FLOAT:  return 4;
+        default:
+            throw std::invalid_argument("Not an uncompressed format");
+    }
+}
+
+
+template<typename T> static void load_unorm(float *out, const T *in, size_t count, float scale)
+{
+    size_t i = 0;
+
+    // GCC turns this initialization into a zero extension
+    for (; i + 8 <= count; i += 8) {
+        value_int_vector iv = { in[i], in[i + 1], in[i + 2], in[i + 3], in[i + 4], in[i + 5], in[i + 6], in[i + 7] };
+        value_vector v = __builtin_convertvector(iv, value_vector) * scale;
+        memcpy(out + i, &v, sizeof(v));
+    }
+
+    for (; i < count; i++) {
+        out[i] = in[i] * scale;
+    }
+}
+
+
+template<typename T> static void store_unorm(T *out, const float *in, size_t count, float max)
+{
+    const value_vector zero = {};
+    size_t i = 0;
+
+    for (; i + 8 <= count; i += 8) {
+        value_vector v;
+        memcpy(&v, in + i, sizeof(v));
+
+        // Also maps NaN to 0
+        v = v > zero ? v : zero;
+        v = v * max + .5f;
+        v = v < max ? v : max;
+
+        value_int_vector iv = __builtin_convertvector(v, value_int_vector);
+        for (int j = 0; j < 8; j++) {
+            out[i + j] = iv[j];
+        }
+    }
+
+    for (; i < count; i++) {
+        float v = in[i] > 0.f ? in[i] * max + .5f : 0.f;
+        out[i] = static_cast<T>(v < max ? v : max);
+    }
+}
+
+
+static void load_half(float *out, const uint16_t *in, size_t count)
+{
+    size_t i = 0;
+
+#ifdef __F16C__
+    for (; i + 8 <= count; i += 8) {
+        half_vector h;
+        memcpy(&h, in + i, sizeof(h));
+        value_vector v = __builtin_ia32_vcvtph2ps256(h);
+        memcpy(out + i, &v, sizeof(v));
+    }
+#endif
+
+    for (; i < count; i++) {
+        out[i] = dake::gl::texel::half_to_float(in[i]);
+    }
+}
+
+
+static void store_half(uint16_t *out, const float *in, size_t count)
+{
+    size_t i = 0;
+
+#ifdef __F16C__
+    for (; i + 8 <= count; i += 8) {
+        value_vector v;
+        memcpy(&v, in + i, sizeof(v));
+        // Round to nearest even
+        half_vector h = __builtin_ia32_vcvtps2ph256(v, 0);
+        memcpy(out + i, &h, sizeof(h));
+    }
+#endif
+
+    for (; i < count; i++) {
+        out[i] = dake::gl::texel::float_to_half(in[i]);
+    }
+}
+
+
+static void load_values(float *out, const void *in, image::channel_format fmt, size_t count)
+{
+    switch (fmt) {
+        case image::LINEAR_UINT8:
+            load_unorm(out, static_cast<const uint8_t *>(in), count, 1.f / 255.f);
+            break;
+
+        case image::LINEAR_UINT16:
+            load_unorm(out, static_cast<const uint16_t *>(in), count, 1.f / 65535.f);
+            break;
+
+        case image::LINEAR_HALF:
+            load_half(out, static_cast<const uint16_t *>(in), count);
+            break;
+
+        case image::LINEAR_FLOAT:
+            memcpy(out, in, count * sizeof(float));
+            break;
+
+        default:
+            abort();
+    }
+}
+
+
+static void store_values(void *out, image::channel_format fmt, const float *in, size_t count)
+{
+    switch (fmt) {
+        case image::LINEAR_UINT8:
+            store_unorm(static_cast<uint8_t *>(out), in, count, 255.f);
+            break;
+
+        case image::LINEAR_UINT16:
+            store_unorm(static_cast<uint16_t *>(out), in, count, 65535.f);
+            break;
+
+        case image::LINEAR_HALF:
+            store_half(static_cast<uint16_t *>(out), in, count);
+            break;
+
+        case image::LINEAR_FLOAT:
+            memcpy(out, in, count * sizeof(float));
+            break;
+
+        default:
+            abort();
+    }
+}
+
+
+void dake::gl::texel::convert(void *dst, image::channel_format dst_format, size_t dst_stride,
+                              const void *src, image::channel_format src_format, size_t src_stride,
+                              size_t row_values, int rows)
+{
+    size_t src_size = value_size(src_format), dst_size = value_size(dst_format);
+    const uint8_t *in = static_cast<const uint8_t *>(src);
+    uint8_t *out = static_cast<uint8_t *>(dst);
+
+    dake::helper::parallel_for(0, rows, [=](int first, int last) {
+            // Going through float in chunks that stay in L1
+            float values[1024];
+
+            for (int y = first; y < last; y++) {
+                const uint8_t *ir = in + y * src_stride;
+                uint8_t *outr = out + y * dst_stride;
+
+                if (src_format == dst_format) {
+                    memcpy(outr, ir, row_values * src_size);
+                    continue;
+                }
+
+                for (size_t i = 0; i < row_values; i += 1024) {
+                    size_t count = row_values - i < 1024 ? row_values - i : 1024;
+                    load_values(values, ir + i * src_size, src_format, count);
+                    store_values(outr + i * dst_size, dst_format, values, count);
+                }
+            }
+        }, 16);
+}
@@ -8,9 +8,12 @@
 #include <string>
 #include <vector>
 
+#include <dake/cross.hpp>
 #include <dake/gl/find_resource.hpp>
 #include <dake/gl/gl.hpp>
+#include <dake/gl/pixel_buffer.hpp>
 #include <dake/gl/texture.hpp>
+#include <dake/gl/upload_pool.hpp>
 
 
 namespace dake
@@ -30,28 +33,165 @@ static int active_tmu;
 }
 
 
+// With direct state access, textures are edited by name; otherwise, they
+// have to be bound first
+template<typename T> static void set_parameter(const T *tex, GLenum target, GLenum pname, GLint value)
+{
+    if (dake::gl::glext.has_direct_state_access()) {
+        glTextureParameteri(tex->glid(), pname, value);
+    } else {
+        tex->bind();
+        glTexParameteri(target, pname, value);
+    }
+}
+
+
+template<typename T> static void set_parameter(const T *tex, GLenum target, GLenum pname, const GLfloat *value)
+{
+    if (dake::gl::glext.has_direct_state_access()) {
+        glTextureParameterfv(tex->glid(), pname, value);
+    } else {
+        tex->bind();
+        glTexParameterfv(target, pname, value);
+    }
+}
+
+
+template<typename T> static void get_parameter(const T *tex, GLenum target, GLenum pname, GLint *value)
+{
+    if (dake::gl::glext.has_direct_state_access()) {
+        glGetTextureParameteriv(tex->glid(), pname, value);
+    } else {
+        tex->bind();
+        glGetTexParameteriv(target, pname, value);
+    }
+}
+
+
+template<typename T> static void get_parameter(const T *tex, GLenum target, GLenum pname, GLfloat *value)
+{
+    if (dake::gl::glext.has_direct_state_access()) {
+        glGetTextureParameterfv(tex->glid(), pname, value);
+    } else {
+        tex->bind();
+        glGetTexParameterfv(target, pname, value);
+    }
+}
+
+
+static GLuint create_texture(GLenum target)
+{
+    GLuint id;
+
+    if (dake::gl::glext.has_direct_state_access()) {
+        glCreateTextures(target, 1, &id);
+    } else {
+        glGenTextures(1, &id);
+    }
+
+    return id;
+}
+
+
 void dake::gl::texture::raw_init(void)
 {
-    glGenTextures(1, &tex_id);
+    tex_id = create_texture(target);
 
-    bind();
     wrap(GL_CLAMP_TO_EDGE);
     filter(GL_LINEAR);
 }
 
 
+void dake::gl::texture::upload(const image &img, upload_pool *pool)
+{
+    if (pool || glext.has_extension(TEXTURE_STORAGE)) {
+        allocate(img);
+        for (int l = 0; l < img.levels(); l++) {
+            if (pool) {
+                pool->upload(*this, l, 0, 0, img, l);
+            } else {
+                upload_level(l, 0, 0, img, l);
+            }
+        }
+    } else {
+        upload_mutable(img);
+    }
+
+    // Only a mip chain of the image limits the levels; otherwise, mipmaps
+    // may still be generated later
+    if (img.levels() > 1) {
+        set_parameter(this, target, GL_TEXTURE_MAX_LEVEL, img.levels() - 1);
+    }
+}
+
+
+// Allocates all levels of img without filling them; immutable storage
+// always gets the full chain, so that mipmaps can still be generated
+void dake::gl::texture::allocate(const image &img)
+{
+    if (glext.has_extension(TEXTURE_STORAGE)) {
+        storage(img.compressed() ? img.gl_format() : img.gl_internal_format(), img.width(), img.height(), 0);
+        return;
+    }
+
+    bind();
+
+    for (int l = 0; l < img.levels(); l++) {
+        if (img.compressed()) {
+            glCompressedTexImage2D(target, l, img.gl_format(), img.level_width(l), img.level_height(l), 0,
+                                   img.level_byte_size(l), nullptr);
+        } else {
+            glTexImage2D(target, l, img.gl_internal_format(), img.level_width(l), img.level_height(l), 0,
+                         img.gl_format(), img.gl_type(), nullptr);
+        }
+    }
+}
+
+
+void dake::gl::texture::upload_mutable(const image &img)
+{
+    // (Re)specifying levels always needs the texture bound
+    bind();
+
+    for (int l = 0; l < img.levels(); l++) {
+        if (img.compressed()) {
+            glCompressedTexImage2D(target, l, img.gl_format(), img.level_width(l), img.level_height(l), 0,
+                                   img.level_byte_size(l), img.level_data(l));
+        } else {
+            glTexImage2D(target, l, img.gl_internal_format(), img.level_width(l), img.level_height(l), 0,
+                         img.gl_format(), img.gl_type(), img.level_data(l));
+        }
+    }
+}
+
+
+void dake::gl::texture::upload_level(int level, int x, int y, const image &img, int img_level)
+{
+    upload_region(level, x, y, img.level_width(img_level), img.level_height(img_level), img,
+                  img.level_byte_size(img_level), img.level_data(img_level));
+}
+
+
+void dake::gl::texture::upload_region(int level, int x, int y, int w, int h, const image &img, size_t bytes, const void *data)
+{
+    if (!img.compressed()) {
+        sub_image(level, x, y, w, h, img.gl_format(), img.gl_type(), data);
+    } else if (glext.has_direct_state_access()) {
+        glCompressedTextureSubImage2D(tex_id, level, x, y, w, h, img.gl_format(), bytes, data);
+    } else {
+        bind(true);
+        glCompressedTexSubImage2D(target, level, x, y, w, h, img.gl_format(), bytes, data);
+    }
+}
+
+
 dake::gl::texture::texture(const std::string &name):
     tmu_index(0),
     fname(name)
 {
     raw_init();
 
-    dake::gl::image img(name);
-    if (img.compressed()) {
-        glCompressedTexImage2D(target, 0, img.gl_format(), img.width(), img.height(), 0, img.byte_size(), img.data());
-    } else {
-        glTexImage2D(target, 0, img.gl_format(), img.width(), img.height(), 0, img.gl_format(), img.gl_type(), img.data());
-    }
+    upload(dake::gl::image(name));
 }
 
 
@@ -61,12 +201,7 @@ dake::gl::texture::texture(const char *name):
 {
     raw_init();
 
-    dake::gl::image img(name);
-    if (img.compressed()) {
-        glCompressedTexImage2D(target, 0, img.gl_format(), img.width(), img.height(), 0, img.byte_size(), img.data());
-    } else {
-        glTexImage2D(target, 0, img.gl_format(), img.width(), img.height(), 0, img.gl_format(), img.gl_type(), img.data());
-    }
+    upload(dake::gl::image(name));
 }
 
 
@@ -75,11 +210,41 @@ dake::gl::texture::texture(const image &img):
     fname("[anon]")
 {
     raw_init();
+    upload(img);
+}
 
-    if (img.compressed()) {
-        glCompressedTexImage2D(target, 0, img.gl_format(), img.width(), img.height(), 0, img.byte_size(), img.data());
-    } else {
-        glTexImage2D(target, 0, img.gl_format(), img.width(), img.height(), 0, img.gl_format(), img.gl_type(), img.data());
+
+dake::gl::texture::texture(const image &img, upload_pool &pool):
+    tmu_index(0),
+    fname("[anon]")
+{
+    raw_init();
+    upload(img, &pool);
+}
+
+
+dake::gl::texture::texture(image_reader &reader, int band_rows):
+    tmu_index(0),
+    fname("[anon]")
+{
+    raw_init();
+
+    int total = reader.rows_left(), y = 0;
+    while (reader.rows_left()) {
+        image band(reader, band_rows);
+
+        if (!y) {
+            if (glext.has_extension(TEXTURE_STORAGE)) {
+                storage(band.gl_internal_format(), band.width(), total, 0);
+            } else {
+                bind();
+                glTexImage2D(target, 0, band.gl_internal_format(), band.width(), total, 0,
+                             band.gl_format(), band.gl_type(), nullptr);
+            }
+        }
+        sub_image(0, 0, y, band);
+
+        y += band.height();
     }
 }
 
@@ -101,10 +266,14 @@ dake::gl::texture::texture(const texture &orig, GLenum fmt):
     if (!glext.has_extension(TEXTURE_VIEW)) {
         throw std::runtime_error("No texture view support");
     }
+    if (!orig.immutable) {
+        throw std::runtime_error("Only textures with immutable storage can be viewed");
+    }
 
     glGenTextures(1, &tex_id);
 
     glTextureView(tex_id, target, orig.tex_id, fmt, 0, 1, 0, 1);
+    immutable = true;
 }
 
 
@@ -115,6 +284,14 @@ dake::gl::texture::~texture(void)
     }
 
     glDeleteTextures(1, &tex_id);
+
+    // GL unbinds deleted textures; another object at this address must not
+    // be mistaken for being bound
+    for (auto &b: tmu_bindings) {
+        if (b == this) {
+            b = nullptr;
+        }
+    }
 }
 
 
@@ -201,11 +378,47 @@ void dake::gl::texture::make_resident(bool state)
 }
 
 
+// Immutable storage cannot be respecified, so the texture object is replaced
+// by a new one with the same sampling parameters (existing views keep the
+// old storage)
+void dake::gl::texture::replace_immutable(void)
+{
+    static const GLenum pnames[] = {
+        GL_TEXTURE_MIN_FILTER, GL_TEXTURE_MAG_FILTER, GL_TEXTURE_WRAP_S, GL_TEXTURE_WRAP_T
+    };
+    GLint params[4];
+    GLfloat border[4];
+
+    for (int i = 0; i < 4; i++) {
+        get_parameter(this, target, pnames[i], &params[i]);
+    }
+    get_parameter(this, target, GL_TEXTURE_BORDER_COLOR, border);
+
+    glDeleteTextures(1, &tex_id);
+    for (auto &b: tmu_bindings) {
+        if (b == this) {
+            b = nullptr;
+        }
+    }
+
+    tex_id = create_texture(target);
+    immutable = false;
+
+    for (int i = 0; i < 4; i++) {
+        set_parameter(this, target, pnames[i], params[i]);
+    }
+    set_parameter(this, target, GL_TEXTURE_BORDER_COLOR, border);
+}
+
+
 void dake::gl::texture::format(GLenum fmt, int w, int h, GLenum read_format, GLenum read_data_format, int spp)
 {
     if (bl) {
         throw std::runtime_error("Cannot change format of a bindless texture");
     }
+    if (immutable) {
+        replace_immutable();
+    }
 
     bind();
 
@@ -219,6 +432,68 @@ void dake::gl::texture::format(GLenum fmt, int w, int h, GLenum read_format, GLe
 }
 
 
+void dake::gl::texture::storage(GLenum fmt, int w, int h, int levels)
+{
+    if (bl) {
+        throw std::runtime_error("Cannot change format of a bindless texture");
+    }
+    if (multisampled) {
+        throw std::invalid_argument("Multisampled textures can only be set up with format()");
+    }
+
+    if (!levels) {
+        levels = 1;
+        while ((w >> levels) || (h >> levels)) {
+            levels++;
+        }
+    }
+
+    if (immutable) {
+        replace_immutable();
+    }
+
+    if (glext.has_direct_state_access()) {
+        glTextureStorage2D(tex_id, levels, fmt, w, h);
+    } else {
+        bind();
+        glTexStorage2D(target, levels, fmt, w, h);
+    }
+
+    immutable = true;
+}
+
+
+void dake::gl::texture::sub_image(int level, int x, int y, const image &img)
+{
+    upload_level(level, x, y, img, 0);
+}
+
+
+void dake::gl::texture::sub_image(int level, int x, int y, int w, int h, GLenum read_format, GLenum read_data_format, const void *data)
+{
+    if (glext.has_direct_state_access()) {
+        glTextureSubImage2D(tex_id, level, x, y, w, h, read_format, read_data_format, data);
+    } else {
+        // Updating contents is fine for bindless textures, too
+        bind(true);
+        glTexSubImage2D(target, level, x, y, w, h, read_format, read_data_format, data);
+    }
+}
+
+
+void dake::gl::texture::sub_image(int level, int x, int y, int w, int h, GLenum read_format, GLenum read_data_format, const pixel_buffer &buffer, size_t offset)
+{
+    if (buffer.target() != GL_PIXEL_UNPACK_BUFFER) {
+        throw std::invalid_argument("Textures can only be updated from unpack buffers");
+    }
+
+    // With a buffer bound, data is an offset into it
+    buffer.bind();
+    sub_image(level, x, y, w, h, read_format, read_data_format, reinterpret_cast<const void *>(offset));
+    buffer.unbind();
+}
+
+
 void dake::gl::texture::filter(GLenum f)
 {
     filter(f, f);
@@ -231,9 +506,8 @@ void dake::gl::texture::filter(GLenum min_filter, GLenum mag_filter)
         throw std::runtime_error("Cannot change filtering of a bindless texture");
     }
 
-    bind();
-    glTexParameteri(target, GL_TEXTURE_MIN_FILTER, min_filter);
-    glTexParameteri(target, GL_TEXTURE_MAG_FILTER, mag_filter);
+    set_parameter(this, target, GL_TEXTURE_MIN_FILTER, min_filter);
+    set_parameter(this, target, GL_TEXTURE_MAG_FILTER, mag_filter);
 }
 
 
@@ -249,9 +523,8 @@ void dake::gl::texture::wrap(GLenum s_wrap, GLenum t_wrap)
         throw std::runtime_error("Cannot change wrap mode of a bindless texture");
     }
 
-    bind();
-    glTexParameteri(target, GL_TEXTURE_WRAP_S, s_wrap);
-    glTexParameteri(target, GL_TEXTURE_WRAP_T, t_wrap);
+    set_parameter(this, target, GL_TEXTURE_WRAP_S, s_wrap);
+    set_parameter(this, target, GL_TEXTURE_WRAP_T, t_wrap);
 }
 
 
@@ -261,17 +534,15 @@ void dake::gl::texture::set_border_color(const dake::math::vec4 &color)
         throw std::runtime_error("Cannot change border color of a bindless texture");
     }
 
-    bind();
-    glTexParameterfv(target, GL_TEXTURE_BORDER_COLOR, color);
+    set_parameter(this, target, GL_TEXTURE_BORDER_COLOR, color);
 }
 
 
 dake::gl::array_texture::array_texture(void):
     tmu_index(0)
 {
-    glGenTextures(1, &tex_id);
+    tex_id = create_texture(GL_TEXTURE_2D_ARRAY);
 
-    bind();
     wrap(GL_CLAMP_TO_EDGE);
     filter(GL_LINEAR);
 }
@@ -284,6 +555,14 @@ dake::gl::array_texture::~array_texture(void)
     }
 
     glDeleteTextures(1, &tex_id);
+
+    // GL unbinds deleted textures; another object at this address must not
+    // be mistaken for being bound
+    for (auto &b: tmu_array_bindings) {
+        if (b == this) {
+            b = nullptr;
+        }
+    }
 }
 
 
@@ -397,9 +676,8 @@ void dake::gl::array_texture::filter(GLenum min_filter, GLenum mag_filter)
         throw std::runtime_error("Cannot change filtering of a bindless array texture");
     }
 
-    bind();
-    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, min_filter);
-    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, mag_filter);
+    set_parameter(this, GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, min_filter);
+    set_parameter(this, GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, mag_filter);
 }
 
 
@@ -415,9 +693,8 @@ void dake::gl::array_texture::wrap(GLenum s_wrap, GLenum t_wrap)
         throw std::runtime_error("Cannot change wrap mode of a bindless array texture");
     }
 
-    bind();
-    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, s_wrap);
-    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, t_wrap);
+    set_parameter(this, GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, s_wrap);
+    set_parameter(this, GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, t_wrap);
 }
 
 
@@ -427,8 +704,7 @@ void dake::gl::array_texture::set_border_color(const dake::math::vec4 &color)
         throw std::runtime_error("Cannot change border color of a bindless array texture");
     }
 
-    bind();
-    glTexParameterfv(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BORDER_COLOR, color);
+    set_parameter(this, GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BORDER_COLOR, color);
 }
 
 
@@ -438,9 +714,18 @@ void dake::gl::array_texture::load_layer(int layer, const dake::gl::image &img)
         throw std::invalid_argument("Array texture layer out of bounds");
     }
 
+    if (glext.has_direct_state_access()) {
+        if (img.compressed()) {
+            glCompressedTextureSubImage3D(tex_id, 0, 0, 0, layer, img.width(), img.height(), 1, img.gl_format(), img.level_byte_size(0), img.data());
+        } else {
+            glTextureSubImage3D(tex_id, 0, 0, 0, layer, img.width(), img.height(), 1, img.gl_format(), img.gl_type(), img.data());
+        }
+        return;
+    }
+
     bind(true);
     if (img.compressed()) {
-        glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, layer, img.width(), img.height(), 1, img.gl_format(), img.byte_size(), img.data());
+        glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, layer, img.width(), img.height(), 1, img.gl_format(), img.level_byte_size(0), img.data());
     } else {
         glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, layer, img.width(), img.height(), 1, img.gl_format(), img.gl_type(), img.data());
     }
@@ -453,17 +738,46 @@ void dake::gl::array_texture::load_layer(int layer, const void *data, GLenum f,
         throw std::invalid_argument("Array texture layer out of bounds");
     }
 
-    bind(true);
-    glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, layer, width, height, 1, f, df, data);
+    if (glext.has_direct_state_access()) {
+        glTextureSubImage3D(tex_id, 0, 0, 0, layer, width, height, 1, f, df, data);
+    } else {
+        bind(true);
+        glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, layer, width, height, 1, f, df, data);
+    }
+}
+
+
+void dake::gl::array_texture::load_layer(int layer, image_reader &reader, int band_rows)
+{
+    if ((layer < 0) || (layer >= layers)) {
+        throw std::invalid_argument("Array texture layer out of bounds");
+    }
+    if ((reader.width() != width) || (reader.rows_left() != height)) {
+        throw std::invalid_argument("Image size does not match the array texture");
+    }
+
+    bool dsa = glext.has_direct_state_access();
+    if (!dsa) {
+        bind(true);
+    }
+
+    for (int y = 0; reader.rows_left(); ) {
+        image band(reader, band_rows);
+        if (dsa) {
+            glTextureSubImage3D(tex_id, 0, 0, y, layer, band.width(), band.height(), 1, band.gl_format(), band.gl_type(), band.data());
+        } else {
+            glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, y, layer, band.width(), band.height(), 1, band.gl_format(), band.gl_type(), band.data());
+        }
+        y += band.height();
+    }
 }
 
 
 dake::gl::cubemap::cubemap(void):
     tmu_index(0)
 {
-    glGenTextures(1, &tex_id);
+    tex_id = create_texture(GL_TEXTURE_CUBE_MAP);
 
-    bind();
     wrap(GL_CLAMP_TO_EDGE);
     filter(GL_LINEAR);
 }
@@ -476,6 +790,14 @@ dake::gl::cubemap::~cubemap(void)
     }
 
     glDeleteTextures(1, &tex_id);
+
+    // GL unbinds deleted textures; another object at this address must not
+    // be mistaken for being bound
+    for (auto &b: tmu_cubemap_bindings) {
+        if (b == this) {
+            b = nullptr;
+        }
+    }
 }
 
 
@@ -593,9 +915,8 @@ void dake::gl::cubemap::filter(GLenum min_filter, GLenum mag_filter)
         throw std::runtime_error("Cannot change filtering of a bindless cube map");
     }
 
-    bind();
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, min_filter);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, mag_filter);
+    set_parameter(this, GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, min_filter);
+    set_parameter(this, GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, mag_filter);
 }
 
 
@@ -611,9 +932,8 @@ void dake::gl::cubemap::wrap(GLenum s_wrap, GLenum t_wrap)
         throw std::runtime_error("Cannot change wrap mode of a bindless cube map");
     }
 
-    bind();
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, s_wrap);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, t_wrap);
+    set_parameter(this, GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, s_wrap);
+    set_parameter(this, GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, t_wrap);
 }
 
 
@@ -623,16 +943,26 @@ void dake::gl::cubemap::set_border_color(const dake::math::vec4 &color)
         throw std::runtime_error("Cannot change border color of a bindless cube map");
     }
 
-    bind();
-    glTexParameterfv(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_BORDER_COLOR, color);
+    set_parameter(this, GL_TEXTURE_CUBE_MAP, GL_TEXTURE_BORDER_COLOR, color);
 }
 
 
 void dake::gl::cubemap::load_layer(layer l, const dake::gl::image &img)
 {
+    if (glext.has_direct_state_access()) {
+        // Faces are layers in the order of the layer enum values
+        int face = l - GL_TEXTURE_CUBE_MAP_POSITIVE_X;
+        if (img.compressed()) {
+            glCompressedTextureSubImage3D(tex_id, 0, 0, 0, face, img.width(), img.height(), 1, img.gl_format(), img.level_byte_size(0), img.data());
+        } else {
+            glTextureSubImage3D(tex_id, 0, 0, 0, face, img.width(), img.height(), 1, img.gl_format(), img.gl_type(), img.data());
+        }
+        return;
+    }
+
     bind(true);
     if (img.compressed()) {
-        glCompressedTexSubImage2D(l, 0, 0, 0, img.width(), img.height(), img.gl_format(), img.byte_size(), img.data());
+        glCompressedTexSubImage2D(l, 0, 0, 0, img.width(), img.height(), img.gl_format(), img.level_byte_size(0), img.data());
     } else {
         glTexSubImage2D(l, 0, 0, 0, img.width(), img.height(), img.gl_format(), img.gl_type(), img.data());
     }
@@ -641,28 +971,246 @@ void dake::gl::cubemap::load_layer(layer l, const dake::gl::image &img)
 
 void dake::gl::cubemap::load_layer(layer l, const void *data, GLenum f, GLenum df)
 {
-    bind(true);
-    glTexSubImage2D(l, 0, 0, 0, width, height, f, df, data);
+    if (glext.has_direct_state_access()) {
+        glTextureSubImage3D(tex_id, 0, 0, 0, l - GL_TEXTURE_CUBE_MAP_POSITIVE_X, width, height, 1, f, df, data);
+    } else {
+        bind(true);
+        glTexSubImage2D(l, 0, 0, 0, width, height, f, df, data);
+    }
+}
+
+
+// FNV-1a
+static uint64_t content_hash(const void *buffer, size_t length)
+{
+    const uint8_t *p = static_cast<const uint8_t *>(buffer);
+    uint64_t hash = 14695981039346656037ull;
+
+    for (size_t i = 0; i < length; i++) {
+        hash = (hash ^ p[i]) * 1099511628211ull;
+    }
+
+    return hash;
+}
+
+
+// Hashes can collide, so candidates have to be compared in full
+static bool same_contents(const std::string &file, const void *buffer, size_t length)
+{
+    size_t other_length;
+    void *other = dake::cross::map_file(file.c_str(), &other_length);
+    if (!other) {
+        return false;
+    }
+
+    bool same = (other_length == length) && !memcmp(other, buffer, length);
+    dake::cross::unmap_file(other, other_length);
+
+    return same;
 }
 
 
 dake::gl::texture_manager::~texture_manager(void)
 {
-    for (texture *t: textures) {
-        delete t;
+    for (resource *res: lru) {
+        delete res->tex;
+        delete res;
+    }
+}
+
+
+dake::gl::texture_manager::handle dake::gl::texture_manager::find_texture(const std::string &name)
+{
+    auto i = by_name.find(name);
+
+    if (i == by_name.end()) {
+        i = by_name.emplace(name, entry()).first;
+        i->second.name = name;
+    } else if (i->second.res) {
+        stats_.hits++;
     }
+
+    return handle(this, &i->second);
 }
 
 
-const dake::gl::texture *dake::gl::texture_manager::find_texture(const std::string &name)
+void dake::gl::texture_manager::load(entry *e)
 {
-    for (texture *t: textures) {
-        if (name == t->get_fname()) {
-            return t;
+    size_t length;
+    std::string file = find_resource_filename(e->name);
+    void *buffer = dake::cross::map_file(file.c_str(), &length);
+    if (!buffer) {
+        throw std::runtime_error("Could not load image from " + e->name + ": " + strerror(errno));
+    }
+
+    uint64_t hash = content_hash(buffer, length);
+
+    resource *res = nullptr;
+    auto range = by_content.equal_range(hash);
+    for (auto i = range.first; i != range.second; ++i) {
+        if ((i->second->length == length) && same_contents(i->second->file, buffer, length)) {
+            res = i->second;
+            break;
         }
     }
 
-    texture *nt = new dake::gl::texture(name);
-    textures.push_back(nt);
-    return nt;
+    dake::cross::unmap_file(buffer, length);
+
+    if (res) {
+        stats_.content_hits++;
+        touch(res);
+    } else {
+        image img(e->name);
+
+        res = new resource;
+        res->tex = new texture(img);
+        res->tex->fname = e->name;
+        res->file = file;
+        res->hash = hash;
+        res->length = length;
+        res->bytes = img.byte_size();
+
+        by_content.emplace(hash, res);
+        lru.push_front(res);
+        res->lru_position = lru.begin();
+
+        stats_.misses++;
+        stats_.textures++;
+        stats_.bytes += res->bytes;
+    }
+
+    res->names.push_back(e);
+    e->res = res;
+    if (e->refs) {
+        res->refs++;
+    }
+
+    evict();
+}
+
+
+void dake::gl::texture_manager::touch(resource *res)
+{
+    lru.splice(lru.begin(), lru, res->lru_position);
+}
+
+
+void dake::gl::texture_manager::reference(entry *e)
+{
+    if (!e->refs++ && e->res) {
+        e->res->refs++;
+    }
+}
+
+
+void dake::gl::texture_manager::release(entry *e)
+{
+    if (--e->refs) {
+        return;
+    }
+
+    if (!e->res) {
+        by_name.erase(by_name.find(e->name));
+    } else if (!--e->res->refs) {
+        evict();
+    }
+}
+
+
+void dake::gl::texture_manager::evict(void)
+{
+    auto i = lru.end();
+
+    while (stats_.bytes > budget && i != lru.begin()) {
+        resource *res = *--i;
+        if (res->refs) {
+            continue;
+        }
+
+        // Without references to the resource, none of its names has any
+        for (entry *e: res->names) {
+            by_name.erase(by_name.find(e->name));
+        }
+
+        auto range = by_content.equal_range(res->hash);
+        for (auto j = range.first; j != range.second; ++j) {
+            if (j->second == res) {
+                by_content.erase(j);
+                break;
+            }
+        }
+
+        stats_.evictions++;
+        stats_.textures--;
+        stats_.bytes -= res->bytes;
+
+        delete res->tex;
+        delete res;
+        i = lru.erase(i);
+    }
+}
+
+
+void dake::gl::texture_manager::set_budget(size_t bytes)
+{
+    budget = bytes;
+    evict();
+}
+
+
+dake::gl::texture_manager::handle::handle(texture_manager *manager, entry *ent):
+    tm(manager),
+    e(ent)
+{
+    tm->reference(e);
+}
+
+
+dake::gl::texture_manager::handle::handle(const handle &other):
+    tm(other.tm),
+    e(other.e)
+{
+    if (e) {
+        tm->reference(e);
+    }
+}
+
+
+dake::gl::texture_manager::handle::~handle(void)
+{
+    if (e) {
+        tm->release(e);
+    }
+}
+
+
+dake::gl::texture_manager::handle &dake::gl::texture_manager::handle::operator=(const handle &other)
+{
+    if (other.e) {
+        other.tm->reference(other.e);
+    }
+    if (e) {
+        tm->release(e);
+    }
+
+    tm = other.tm;
+    e = other.e;
+
+    return *this;
+}
+
+
+const dake::gl::texture *dake::gl::texture_manager::handle::get(void) const
+{
+    if (!e) {
+        return nullptr;
+    }
+
+    if (e->res) {
+        tm->touch(e->res);
+    } else {
+        tm->load(e);
+    }
+
+    return e->res->tex;
 }
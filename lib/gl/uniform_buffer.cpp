@@ -0,0 +1,198 @@
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#include <dake/gl/gl.hpp>
+#include <dake/gl/shader.hpp>
+#include <dake/gl/uniform_buffer.hpp>
+
+
+// Bytes of one column of a block member of the given type (of the whole
+// member for scalars and vectors), and its number of columns; 0 for unknown
+// types
+static size_t column_size(GLenum type, size_t *columns)
+{
+    *columns = 1;
+
+    switch (type) {
+        case GL_FLOAT:
+        case GL_INT:
+        case GL_UNSIGNED_INT:
+        case GL_BOOL:
+            return 4;
+        case GL_FLOAT_VEC2:
+        case GL_INT_VEC2:
+        case GL_UNSIGNED_INT_VEC2:
+        case GL_BOOL_VEC2:
+        case GL_DOUBLE:
+            return 8;
+        case GL_FLOAT_VEC3:
+        case GL_INT_VEC3:
+        case GL_UNSIGNED_INT_VEC3:
+        case GL_BOOL_VEC3:
+            return 12;
+        case GL_FLOAT_VEC4:
+        case GL_INT_VEC4:
+        case GL_UNSIGNED_INT_VEC4:
+        case GL_BOOL_VEC4:
+        case GL_DOUBLE_VEC2:
+            return 16;
+        case GL_DOUBLE_VEC3:
+            return 24;
+        case GL_DOUBLE_VEC4:
+            return 32;
+
+        // MATCxR: C columns of R rows
+        case GL_FLOAT_MAT2:    *columns = 2; return 8;
+        case GL_FLOAT_MAT2x3:  *columns = 2; return 12;
+        case GL_FLOAT_MAT2x4:  *columns = 2; return 16;
+        case GL_FLOAT_MAT3x2:  *columns = 3; return 8;
+        case GL_FLOAT_MAT3:    *columns = 3; return 12;
+        case GL_FLOAT_MAT3x4:  *columns = 3; return 16;
+        case GL_FLOAT_MAT4x2:  *columns = 4; return 8;
+        case GL_FLOAT_MAT4x3:  *columns = 4; return 12;
+        case GL_FLOAT_MAT4:    *columns = 4; return 16;
+        case GL_DOUBLE_MAT2:   *columns = 2; return 16;
+        case GL_DOUBLE_MAT2x3: *columns = 2; return 24;
+        case GL_DOUBLE_MAT2x4: *columns = 2; return 32;
+        case GL_DOUBLE_MAT3x2: *columns = 3; return 16;
+        case GL_DOUBLE_MAT3:   *columns = 3; return 24;
+        case GL_DOUBLE_MAT3x4: *columns = 3; return 32;
+        case GL_DOUBLE_MAT4x2: *columns = 4; return 16;
+        case GL_DOUBLE_MAT4x3: *columns = 4; return 24;
+        case GL_DOUBLE_MAT4:   *columns = 4; return 32;
+    }
+
+    return 0;
+}
+
+
+dake::gl::uniform_buffer::uniform_buffer(program &prg, const std::string &block)
+{
+    int index = prg.block_index(block);
+    if (index < 0) {
+        throw std::invalid_argument("Could not find uniform block " + block);
+    }
+
+    shadow.resize(prg.active_blocks()[index].size);
+
+    std::string prefix = block + ".";
+    for (const program::uniform_info &u: prg.active_uniforms()) {
+        if (u.block != index) {
+            continue;
+        }
+
+        member m = { static_cast<size_t>(u.offset), static_cast<size_t>(u.array_stride), static_cast<size_t>(u.matrix_stride), 0, 0 };
+
+        size_t columns;
+        m.column_size = column_size(u.type, &columns);
+        m.size = m.column_size ? (columns - 1) * m.matrix_stride + m.column_size : 0;
+
+        // Members are found under their full name, without the "[0]" of
+        // arrays and without the prefix of blocks with an instance name
+        std::string name = u.name;
+        if ((name.length() > 3) && !name.compare(name.length() - 3, 3, "[0]")) {
+            name.erase(name.length() - 3);
+            members.emplace(u.name, m);
+        }
+        members.emplace(name, m);
+        if (!name.compare(0, prefix.length(), prefix)) {
+            members.emplace(name.substr(prefix.length()), m);
+        }
+    }
+
+    create();
+}
+
+
+dake::gl::uniform_buffer::uniform_buffer(size_t size):
+    shadow(size)
+{
+    create();
+}
+
+
+void dake::gl::uniform_buffer::create(void)
+{
+    if (glext.has_direct_state_access()) {
+        glCreateBuffers(1, &id);
+        glNamedBufferData(id, shadow.size(), shadow.data(), GL_DYNAMIC_DRAW);
+    } else {
+        glGenBuffers(1, &id);
+        glBindBuffer(GL_UNIFORM_BUFFER, id);
+        glBufferData(GL_UNIFORM_BUFFER, shadow.size(), shadow.data(), GL_DYNAMIC_DRAW);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    }
+}
+
+
+dake::gl::uniform_buffer::~uniform_buffer(void)
+{
+    glDeleteBuffers(1, &id);
+}
+
+
+const dake::gl::uniform_buffer::member &dake::gl::uniform_buffer::find(const std::string &name) const
+{
+    auto it = members.find(name);
+    if (it == members.end()) {
+        throw std::invalid_argument("Could not find uniform block member " + name);
+    }
+    return it->second;
+}
+
+
+void dake::gl::uniform_buffer::write(size_t offset, const void *ptr, size_t length)
+{
+    if (offset > shadow.size() || length > shadow.size() - offset) {
+        throw std::out_of_range("Data exceeds the uniform buffer");
+    }
+
+    memcpy(shadow.data() + offset, ptr, length);
+    mark_dirty(offset, length);
+}
+
+
+void dake::gl::uniform_buffer::mark_dirty(size_t offset, size_t length)
+{
+    if (!length) {
+        return;
+    }
+
+    if (dirty_first >= dirty_last) {
+        dirty_first = offset;
+        dirty_last = offset + length;
+    } else {
+        dirty_first = std::min(dirty_first, offset);
+        dirty_last = std::max(dirty_last, offset + length);
+    }
+}
+
+
+void dake::gl::uniform_buffer::flush(void)
+{
+    if (dirty_first >= dirty_last) {
+        return;
+    }
+
+    dirty_last = std::min(dirty_last, shadow.size());
+
+    if (glext.has_direct_state_access()) {
+        glNamedBufferSubData(id, dirty_first, dirty_last - dirty_first, shadow.data() + dirty_first);
+    } else {
+        glBindBuffer(GL_UNIFORM_BUFFER, id);
+        glBufferSubData(GL_UNIFORM_BUFFER, dirty_first, dirty_last - dirty_first, shadow.data() + dirty_first);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    }
+
+    dirty_first = dirty_last = 0;
+}
+
+
+void dake::gl::uniform_buffer::bind(GLuint binding, GLenum target)
+{
+    flush();
+    glBindBufferBase(target, binding, id);
+}
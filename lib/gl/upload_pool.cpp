@@ -0,0 +1,164 @@
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+#include <dake/gl/gl.hpp>
+#include <dake/gl/pixel_buffer.hpp>
+#include <dake/gl/texture.hpp>
+#include <dake/gl/upload_pool.hpp>
+
+
+dake::gl::upload_pool::upload_pool(size_t size, int buffers):
+    slots(buffers),
+    buffer_size(size)
+{
+    if (buffers < 1) {
+        throw std::invalid_argument("An upload pool needs at least one buffer");
+    }
+
+    for (slot &s: slots) {
+        s.buffer = new pixel_buffer(buffer_size, GL_PIXEL_UNPACK_BUFFER, GL_STREAM_DRAW, true);
+    }
+}
+
+
+dake::gl::upload_pool::~upload_pool(void)
+{
+    for (slot &s: slots) {
+        if (s.fence) {
+            glDeleteSync(s.fence);
+        }
+        delete s.buffer;
+    }
+}
+
+
+void dake::gl::upload_pool::wait(slot &s)
+{
+    if (!s.fence) {
+        return;
+    }
+
+    if (glClientWaitSync(s.fence, 0, 0) == GL_TIMEOUT_EXPIRED) {
+        stats_.waits++;
+        while (glClientWaitSync(s.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000) == GL_TIMEOUT_EXPIRED);
+    }
+
+    glDeleteSync(s.fence);
+    s.fence = nullptr;
+}
+
+
+dake::gl::upload_pool::staging dake::gl::upload_pool::acquire(size_t bytes)
+{
+    if (bytes > buffer_size) {
+        throw std::invalid_argument("Staging memory requested exceeds the buffer size");
+    }
+
+    // Going round the ring, the first free buffer is the one that has been
+    // submitted the longest time ago, so its fence is most likely signaled
+    for (size_t i = 0; i < slots.size(); i++) {
+        int index = (next + i) % slots.size();
+        slot &sl = slots[index];
+        if (sl.acquired) {
+            continue;
+        }
+
+        wait(sl);
+
+        // Unsynchronized is fine, the fence has been waited for
+        staging s;
+        s.ptr = sl.buffer->map(0, bytes, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+        if (!s.ptr) {
+            throw std::runtime_error("Could not map staging buffer");
+        }
+        s.slot = index;
+        s.sz = bytes;
+
+        sl.acquired = true;
+        next = (index + 1) % slots.size();
+
+        return s;
+    }
+
+    throw std::runtime_error("All staging buffers are in use");
+}
+
+
+// Checks s and unmaps its buffer, so the GL can read from it
+dake::gl::pixel_buffer &dake::gl::upload_pool::begin(staging &s)
+{
+    if (s.slot < 0 || s.slot >= static_cast<int>(slots.size()) || !slots[s.slot].acquired) {
+        throw std::invalid_argument("Invalid staging memory");
+    }
+
+    pixel_buffer &buffer = *slots[s.slot].buffer;
+    buffer.unmap();
+    return buffer;
+}
+
+
+// Fences the commands reading from the buffer of s and gives it back
+void dake::gl::upload_pool::submit(staging &s)
+{
+    slot &sl = slots[s.slot];
+
+    sl.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    sl.acquired = false;
+
+    stats_.uploads++;
+    stats_.bytes += s.sz;
+
+    s = staging();
+}
+
+
+void dake::gl::upload_pool::upload(staging &s, texture &tex, int level, int x, int y, int w, int h,
+                                   GLenum read_format, GLenum read_data_format, size_t offset)
+{
+    pixel_buffer &buffer = begin(s);
+    tex.sub_image(level, x, y, w, h, read_format, read_data_format, buffer, offset);
+    submit(s);
+}
+
+
+void dake::gl::upload_pool::upload(texture &tex, int level, int x, int y, const image &img, int img_level)
+{
+    int w = img.level_width(img_level), h = img.level_height(img_level);
+    const char *src = static_cast<const char *>(img.level_data(img_level));
+
+    // Compressed levels can only be split between rows of blocks
+    int row_height = img.compressed() ? 4 : 1;
+    int rows = (h + row_height - 1) / row_height;
+    size_t row_bytes = img.level_byte_size(img_level) / rows;
+
+    int band_rows = std::min(buffer_size / row_bytes, static_cast<size_t>(rows));
+    if (!band_rows) {
+        throw std::invalid_argument("Image rows do not fit into a staging buffer");
+    }
+
+    for (int r = 0; r < rows; r += band_rows) {
+        int n = std::min(band_rows, rows - r);
+        int band_y = r * row_height;
+
+        staging s = acquire(n * row_bytes);
+        memcpy(s.data(), src + r * row_bytes, s.size());
+
+        pixel_buffer &buffer = begin(s);
+        buffer.bind();
+        tex.upload_region(level, x, y + band_y, w, std::min(n * row_height, h - band_y), img, s.size(), nullptr);
+        buffer.unbind();
+
+        submit(s);
+    }
+}
+
+
+void dake::gl::upload_pool::release(staging &s)
+{
+    begin(s);
+    slots[s.slot].acquired = false;
+    s = staging();
+}
@@ -103,6 +103,48 @@ void dake::gl::vertex_array::draw(GLenum type, int start_index)
 }
 
 
+void dake::gl::vertex_array::draw_instanced(GLenum type, int instances, GLuint base_instance, int start_index)
+{
+    bind();
+
+    if (index_buffer) {
+        index_buffer->bind();
+        const void *offset = reinterpret_cast<const void *>(index_buffer->offset);
+        if (base_instance) {
+            glDrawElementsInstancedBaseInstance(type, n, index_buffer->t, offset, instances, base_instance);
+        } else {
+            glDrawElementsInstanced(type, n, index_buffer->t, offset, instances);
+        }
+    } else {
+        dake::gl::elements_array::unbind();
+        if (base_instance) {
+            glDrawArraysInstancedBaseInstance(type, start_index, n, instances, base_instance);
+        } else {
+            glDrawArraysInstanced(type, start_index, n, instances);
+        }
+    }
+}
+
+
+dake::gl::vertex_attrib *dake::gl::vertex_array::instance_transforms(GLuint first_id)
+{
+    dake::gl::vertex_attrib *first = attrib(first_id);
+
+    for (GLuint i = 0; i < 4; i++) {
+        dake::gl::vertex_attrib *col = i ? attrib(first_id + i) : first;
+        if (i) {
+            col->reuse_buffer(first);
+        }
+
+        col->format(4);
+        col->load(16 * sizeof(float), i * 4 * sizeof(float));
+        col->divisor(1);
+    }
+
+    return first;
+}
+
+
 dake::gl::elements_array *dake::gl::vertex_array::indices(void)
 {
     if (!index_buffer) {
@@ -2,6 +2,7 @@
 #include <cstdint>
 #include <stdexcept>
 
+#include <dake/gl/gl.hpp>
 #include <dake/gl/vertex_array.hpp>
 #include <dake/gl/vertex_attrib.hpp>
 
@@ -23,12 +24,20 @@ dake::gl::vertex_attrib::vertex_attrib(vertex_array *vxa, GLuint a_id):
     attrib(a_id),
     va(vxa)
 {
-    glGenBuffers(1, &buffer);
+    if (glext.has_direct_state_access()) {
+        glCreateBuffers(1, &buffer);
+    } else {
+        glGenBuffers(1, &buffer);
+    }
 }
 
 
 dake::gl::vertex_attrib::~vertex_attrib(void)
 {
+    if (curr_vattr == this) {
+        curr_vattr = nullptr;
+    }
+
     if (!buffer_reused) {
         glDeleteBuffers(1, &buffer);
     }
@@ -114,8 +123,12 @@ void dake::gl::vertex_attrib::data(const void *ptr, size_t size, GLenum usage, b
         size = va->n * bpv;
     }
 
-    bind();
-    glBufferData(GL_ARRAY_BUFFER, size, ptr, usage);
+    if (glext.has_direct_state_access()) {
+        glNamedBufferData(buffer, size, ptr, usage);
+    } else {
+        bind();
+        glBufferData(GL_ARRAY_BUFFER, size, ptr, usage);
+    }
 
     if (autoload) {
         load();
@@ -123,8 +136,36 @@ void dake::gl::vertex_attrib::data(const void *ptr, size_t size, GLenum usage, b
 }
 
 
+void dake::gl::vertex_attrib::stream(const void *ptr, size_t size)
+{
+    if (size > stream_capacity) {
+        stream_capacity = size;
+    }
+
+    if (glext.has_direct_state_access()) {
+        glNamedBufferData(buffer, stream_capacity, nullptr, GL_STREAM_DRAW);
+        glNamedBufferSubData(buffer, 0, size, ptr);
+    } else {
+        bind();
+        glBufferData(GL_ARRAY_BUFFER, stream_capacity, nullptr, GL_STREAM_DRAW);
+        glBufferSubData(GL_ARRAY_BUFFER, 0, size, ptr);
+    }
+}
+
+
+void dake::gl::vertex_attrib::divisor(GLuint instances)
+{
+    va->bind();
+    glVertexAttribDivisor(attrib, instances);
+}
+
+
 void *dake::gl::vertex_attrib::map(bool readable)
 {
+    if (glext.has_direct_state_access()) {
+        return glMapNamedBuffer(buffer, readable ? GL_READ_WRITE : GL_WRITE_ONLY);
+    }
+
     bind();
     return glMapBuffer(GL_ARRAY_BUFFER, readable ? GL_READ_WRITE : GL_WRITE_ONLY);
 }
@@ -133,6 +174,10 @@ void *dake::gl::vertex_attrib::map(bool readable)
 void dake::gl::vertex_attrib::unmap(void)
 {
     // checks are for noobs
-    bind();
-    glUnmapBuffer(GL_ARRAY_BUFFER);
+    if (glext.has_direct_state_access()) {
+        glUnmapNamedBuffer(buffer);
+    } else {
+        bind();
+        glUnmapBuffer(GL_ARRAY_BUFFER);
+    }
 }